@@ -0,0 +1,226 @@
+package EpubGen;
+
+# Deterministic generation of synthetic EPUB files, for the benchmarks.
+#  Everything is derived from a seeded pseudo-random generator and a
+#  fixed timestamp, so a given scenario always produces the same bytes.
+
+use strict;
+use warnings;
+use utf8;
+use Encode qw(encode_utf8);
+use IO::Compress::Zip qw(:zip_method $ZipError);
+
+our @EXPORT_OK = qw(new_rng rand_int sentence_pool paragraph
+  write_epub latin_words nonlatin_words entities);
+
+use Exporter 'import';
+
+# Fixed modification time for every ZIP member (2010-01-01)
+my $ZIP_TIME = 1262304000;
+
+# xorshift32 -- we can't rely on Perl's rand() giving the same sequence
+#  on every platform
+sub new_rng($)
+  {
+  my $seed = $_[0] || 1;
+  my $x = $seed & 0xffffffff;
+  return sub
+    {
+    $x ^= ($x << 13) & 0xffffffff;
+    $x ^= $x >> 17;
+    $x ^= ($x << 5) & 0xffffffff;
+    return $x;
+    };
+  }
+
+sub rand_int($$)
+  {
+  my ($rng, $n) = @_;
+  return $rng->() % $n;
+  }
+
+my @latin = qw(the of and to in a was he that it his her you as had with
+  for she not at but be my on have him is said me which by so this all
+  from they no were if would or when what there been one could very an
+  who them do we any more then now into their some your will upon out
+  over before after again little about long great other time never like
+  house door window river morning evening letter garden carriage horse
+  sister brother mother father friend stranger captain doctor lady
+  gentleman country village town street hill forest water fire light
+  dark cold warm quiet sudden strange certain whole young old small
+  large white black heart hand face eyes voice word thought moment
+  answered replied looked turned walked stood waited remembered
+  whispered believed understood Elizabeth Darcy Holmes Watson London
+  Paris Thornfield Pemberley November Tuesday);
+
+my %nonlatin =
+  (
+  cyrillic => [qw(и в не на я быть он с что а по это она этот к но они мы
+    как из у который то за свой что весь год от так о для ты же все
+    тот мочь вы человек такой его сказать только или ещё бы себя один
+    как уже до время если сам когда другой вот говорить наш мой знать
+    стать при чтобы дело жизнь кто первый очень два день её новый рука
+    даже во со раз где там под можно ну какой после их работа без
+    самый потом надо хотеть ли слово идти большой должен место иметь)],
+  greek => [qw(και το να του η της με που την από για τα είναι των στο
+    ο θα σε τον στην δεν οι τους στη ότι μια ένα αυτό έχει στα όπως
+    πιο μας στις αλλά ή καλά μου αν τι όταν μόνο σας εγώ εκεί πολύ
+    ήταν κάτι ποτέ τώρα μέρα νύχτα θάλασσα ουρανός σπίτι δρόμος
+    πόλη χώρα φίλος μητέρα πατέρας παιδί γυναίκα άνθρωπος)],
+  cjk => [qw(我 的 你 是 了 不 在 他 有 这 个 上 们 来 到 时 大 地 为 子
+    中 说 生 国 年 着 就 那 和 要 她 出 也 得 里 后 自 以 会 家 可 下 而
+    过 天 去 能 对 小 多 然 于 心 学 么 之 都 好 看 起 发 当 没 成 只 如
+    事 把 还 用 第 样 道 想 作 种 开 美 总 从 无 情 己 面 最 女 但 现 前
+    些 所 同 日 手 又 行 意 动 方 期 它 头 经 长 儿 回 位 分 爱 老 因)],
+  );
+
+my @entities = split (' ', "&amp; &lt; &gt; &quot; &apos; &nbsp; &mdash;
+  &ndash; &eacute; &egrave; &agrave; &ccedil; &uuml; &ouml; &hellip;
+  &lsquo; &rsquo; &ldquo; &rdquo; &#x2014; &#x00e9; &#x201c; &#x201d;
+  &#169;");
+
+sub latin_words() { return \@latin; }
+sub nonlatin_words($) { return $nonlatin{$_[0]}; }
+sub entities() { return \@entities; }
+
+# A pool of sentences built from the given words. Paragraphs are made by
+#  picking sentences from the pool, which is much faster than picking
+#  words when generating a hundred megabytes of text. $sep is the word
+#  separator (empty for CJK)
+sub sentence_pool($$$$)
+  {
+  my ($rng, $words, $n, $sep) = @_;
+  my @pool;
+  for (my $i = 0; $i < $n; $i++)
+    {
+    my $len = 4 + rand_int ($rng, 16);
+    my @w;
+    for (my $j = 0; $j < $len; $j++)
+      {
+      push @w, $words->[rand_int ($rng, scalar @$words)];
+      }
+    my $s = join ($sep, @w);
+    $s = ucfirst ($s) . ($sep eq "" ? "。" : ".");
+    push @pool, $s;
+    }
+  return \@pool;
+  }
+
+# A paragraph of approximately $size characters of text
+sub paragraph($$$$)
+  {
+  my ($rng, $pool, $size, $sep) = @_;
+  my $p = "";
+  while (length ($p) < $size)
+    {
+    $p .= $sep if length ($p);
+    $p .= $pool->[rand_int ($rng, scalar @$pool)];
+    }
+  return $p;
+  }
+
+sub xhtml($$)
+  {
+  my ($title, $body) = @_;
+  return "<?xml version='1.0' encoding='utf-8'?>\n"
+    . "<html xmlns='http://www.w3.org/1999/xhtml'>\n"
+    . "<head><title>$title</title></head>\n"
+    . "<body>\n$body</body>\n</html>\n";
+  }
+
+# Write an EPUB. $chapters is a list of [ title, body ], where body is
+#  the (character, not byte) string that goes inside <body>. %opts can
+#  give extra_manifest, a string of <item> elements added before the
+#  chapters, package_attrs, extra attributes for the <package> element,
+#  and metadata, extra content for <metadata>. These are how the
+#  complexity benchmark makes pathological OPF files. dirs adds an
+#  entry for each directory, as zip -r does, and stream set to 0 or 1
+#  says whether the sizes of the entries go in the local headers or
+#  after the data, in descriptors, as in a zip written to a pipe
+sub write_epub($$$;%)
+  {
+  my ($file, $title, $chapters, %opts) = @_;
+  my @stream = defined $opts{stream} ? (Stream => $opts{stream}) : ();
+
+  my $z = IO::Compress::Zip->new ($file, Name => "mimetype",
+    Method => ZIP_CM_STORE, Time => $ZIP_TIME, Minimal => 1,
+    @stream)
+    or die "Can't write $file: $ZipError\n";
+  $z->print ("application/epub+zip");
+
+  my %dirs;
+  my $member = sub
+    {
+    my ($name, $content) = @_;
+    my $dir = "";
+    foreach my $part (split (m{/}, $name))
+      {
+      last if $dir . $part eq $name;
+      $dir .= "$part/";
+      next if !$opts{dirs} || $dirs{$dir}++;
+      $z->newStream (Name => $dir, Method => ZIP_CM_STORE,
+        Time => $ZIP_TIME, Minimal => 1, @stream)
+        or die "Can't write $file: $ZipError\n";
+      }
+    $z->newStream (Name => $name, Method => ZIP_CM_DEFLATE,
+      Time => $ZIP_TIME, Minimal => 1, @stream)
+      or die "Can't write $file: $ZipError\n";
+    $z->print (encode_utf8 ($content));
+    };
+
+  $member->("META-INF/container.xml",
+    "<?xml version='1.0'?>\n"
+    . "<container version='1.0' "
+    . "xmlns='urn:oasis:names:tc:opendocument:xmlns:container'>"
+    . "<rootfiles><rootfile full-path='OEBPS/content.opf' "
+    . "media-type='application/oebps-package+xml'/></rootfiles>"
+    . "</container>\n");
+
+  my $manifest = $opts{extra_manifest} || "";
+  my $package_attrs = $opts{package_attrs} || "";
+  my $metadata = $opts{metadata} || "";
+  my $spine = "";
+  my $navmap = "";
+  my $n = 0;
+  foreach my $c (@$chapters)
+    {
+    my $href = sprintf ("text/ch%05d.xhtml", $n);
+    $manifest .= "<item id='ch$n' href='$href' "
+      . "media-type='application/xhtml+xml'/>\n";
+    $spine .= "<itemref idref='ch$n'/>\n";
+    $navmap .= "<navPoint id='np$n' playOrder='" . ($n + 1) . "'>"
+      . "<navLabel><text>$c->[0]</text></navLabel>"
+      . "<content src='$href'/></navPoint>\n";
+    $n++;
+    }
+
+  $member->("OEBPS/content.opf",
+    "<?xml version='1.0'?>\n"
+    . "<package xmlns='http://www.idpf.org/2007/opf' version='2.0'"
+    . "$package_attrs>\n"
+    . "<metadata xmlns:dc='http://purl.org/dc/elements/1.1/'>"
+    . "<dc:title>$title</dc:title>$metadata</metadata>\n"
+    . "<manifest>\n$manifest"
+    . "<item id='ncx' href='toc.ncx' "
+    . "media-type='application/x-dtbncx+xml'/>\n"
+    . "</manifest>\n<spine toc='ncx'>\n$spine</spine>\n</package>\n");
+
+  $member->("OEBPS/toc.ncx",
+    "<?xml version='1.0'?>\n"
+    . "<ncx xmlns='http://www.daisy.org/z3986/2005/ncx/' version='2005-1'>"
+    . "<docTitle><text>$title</text></docTitle>\n"
+    . "<navMap>\n$navmap</navMap></ncx>\n");
+
+  $n = 0;
+  foreach my $c (@$chapters)
+    {
+    $member->(sprintf ("OEBPS/text/ch%05d.xhtml", $n),
+      xhtml ($c->[0], $c->[1]));
+    $n++;
+    }
+
+  $z->close () or die "Can't write $file: $ZipError\n";
+  }
+
+1;
+
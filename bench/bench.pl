@@ -0,0 +1,169 @@
+#!/usr/bin/perl -w
+# Throughput benchmark: run epub2txt over each scenario of the synthetic
+#  corpus, and report MB/s, paragraphs/s and peak memory
+#
+# Usage: bench.pl [options] [path/to/epub2txt]
+#   --scale N        corpus size factor (default 1)
+#   --dir DIR        corpus directory (default bench/corpus)
+#   --runs N         runs per scenario; the fastest is reported (default 3,
+#                      but a scenario is not repeated after 30 seconds)
+#   --timeout SECS   give up on a scenario run after this long 
+#                      (default 600)
+#   --args "..."     extra epub2txt options, e.g. "-w 72"
+#   --output FILE    results, one JSON object per scenario
+#                      (default bench/results.jsonl)
+#   --baseline FILE  earlier results file to compare MB/s against
+#   --only NAME      run just this scenario (may be repeated)
+#
+# MB/s is bytes extracted from the EPUBs (the documents that are
+#  converted, not media) per second of wall time, for the whole
+#  process. Peak RSS is epub2txt's own, as reported by --stats-json
+
+use strict;
+use FindBin;
+use Getopt::Long;
+use POSIX qw(:sys_wait_h);
+use Time::HiRes qw(time);
+use JSON::PP;
+
+my $scale = 1;
+my $dir = "$FindBin::Bin/corpus";
+my $runs = 3;
+my $timeout = 600;
+my $args = "";
+my $output = "$FindBin::Bin/results.jsonl";
+my $baseline;
+my @only;
+GetOptions ("scale=f" => \$scale, "dir=s" => \$dir, "runs=i" => \$runs,
+  "timeout=i" => \$timeout, "args=s" => \$args, "output=s" => \$output,
+  "baseline=s" => \$baseline, "only=s" => \@only)
+  or die "Usage: $0 [options] [epub2txt]\n";
+my $prog = shift @ARGV || "$FindBin::Bin/../epub2txt";
+-x $prog or die "$prog is not executable\n";
+
+system ($^X, "$FindBin::Bin/mkcorpus.pl", "--scale", $scale,
+  "--dir", $dir) == 0 or die "Can't generate corpus\n";
+
+my $json = JSON::PP->new->canonical;
+
+# Run epub2txt once over the files, with output discarded. Returns the
+#  wall time and the 'total' stats object, or undef on timeout
+sub run_once($)
+  {
+  my ($files) = @_;
+  my $err = "$dir/.stderr";
+  my $start = time ();
+  my $pid = fork ();
+  die "Can't fork: $!\n" unless defined $pid;
+  if ($pid == 0)
+    {
+    open (STDOUT, ">", "/dev/null");
+    open (STDERR, ">", $err);
+    exec ($prog, split (' ', $args), "--stats-json", @$files);
+    exit 127;
+    }
+  my $deadline = $start + $timeout;
+  while (waitpid ($pid, WNOHANG) == 0)
+    {
+    if (time () > $deadline)
+      {
+      kill ('KILL', $pid);
+      waitpid ($pid, 0);
+      return undef;
+      }
+    select (undef, undef, undef, 0.01);
+    }
+  my $status = $?;
+  my $wall = time () - $start;
+  die "$prog failed with status $status\n" if $status;
+  my $total;
+  open (my $f, "<", $err) or die "Can't read $err: $!\n";
+  while (<$f>)
+    {
+    next unless /^\{/;
+    my $o = $json->decode ($_);
+    $total = $o if $o->{type} eq "total";
+    }
+  close $f;
+  unlink $err;
+  die "No statistics from $prog -- is it too old for --stats-json?\n"
+    unless $total;
+  return ($wall, $total);
+  }
+
+my %base;
+if ($baseline)
+  {
+  open (my $f, "<", $baseline) or die "Can't read $baseline: $!\n";
+  while (<$f>)
+    {
+    my $o = $json->decode ($_);
+    $base{$o->{scenario}} = $o;
+    }
+  close $f;
+  }
+
+opendir (my $d, $dir) or die "Can't read $dir: $!\n";
+my @scenarios = sort grep { !/^\./ && -d "$dir/$_" } readdir ($d);
+closedir $d;
+@scenarios = grep { my $s = $_; grep { $_ eq $s } @only } @scenarios
+  if @only;
+
+open (my $out, ">", $output) or die "Can't write $output: $!\n";
+printf "%-10s %6s %10s %9s %10s %12s %10s%s\n", "scenario", "books",
+  "MB", "wall (s)", "MB/s", "paras/s", "RSS (kB)",
+  $baseline ? "   vs base" : "";
+
+foreach my $s (@scenarios)
+  {
+  my @files = sort glob ("$dir/$s/*.epub");
+  my ($best, $stats);
+  my $timed_out = 0;
+  my $elapsed = 0;
+  for (my $i = 0; $i < $runs && $elapsed < 30; $i++)
+    {
+    my ($wall, $total) = run_once (\@files);
+    if (!defined $wall)
+      {
+      $timed_out = 1;
+      last;
+      }
+    ($best, $stats) = ($wall, $total) if !defined $best || $wall < $best;
+    $elapsed += $wall;
+    }
+
+  my %r = (scenario => $s, books => scalar @files, args => $args,
+    scale => $scale + 0);
+  if ($timed_out)
+    {
+    $r{timeout} = JSON::PP::true;
+    $r{wall} = $timeout;
+    printf "%-10s %6d %10s %9s\n", $s, scalar @files, "", "timeout";
+    }
+  else
+    {
+    my $mb = $stats->{uncompressed_bytes} / 1e6;
+    $r{compressed_bytes} = $stats->{compressed_bytes};
+    $r{uncompressed_bytes} = $stats->{uncompressed_bytes};
+    $r{paragraphs} = $stats->{paragraphs};
+    $r{output_bytes} = $stats->{output_bytes};
+    $r{wall} = $best;
+    $r{mb_per_sec} = $best > 0 ? $mb / $best : 0;
+    $r{paras_per_sec} = $best > 0 ? $stats->{paragraphs} / $best : 0;
+    $r{peak_rss_kb} = $stats->{peak_rss_kb};
+    $r{child_peak_rss_kb} = $stats->{child_peak_rss_kb};
+    my $cmp = "";
+    if (my $b = $base{$s})
+      {
+      $cmp = $b->{timeout} ? "  (base timed out)"
+        : sprintf ("   %6.2fx", $r{mb_per_sec} / $b->{mb_per_sec});
+      }
+    printf "%-10s %6d %10.1f %9.3f %10.2f %12.0f %10d%s\n", $s,
+      scalar @files, $mb, $best, $r{mb_per_sec}, $r{paras_per_sec},
+      $r{peak_rss_kb}, $cmp;
+    }
+  print $out $json->encode (\%r), "\n";
+  }
+close $out;
+print "Results written to $output\n";
+
@@ -0,0 +1,211 @@
+#!/usr/bin/perl -w
+# Complexity benchmark: time each conversion stage on adversarial inputs
+#  of size n, 2n, 4n and 8n, and fail if the time grows faster than
+#  (nearly) linearly
+#
+# Usage: complexity.pl [options] [path/to/epub2txt]
+#   --scale N       multiply every base size by N (default 1)
+#   --max-exp X     largest acceptable growth exponent (default 1.3)
+#   --timeout SECS  a run that takes longer than this fails (default 60)
+#   --only NAME     run just this case (may be repeated)
+#
+# The exponent is log2 of the time ratio between successive sizes,
+#  taken over the whole range from n to 8n: 1.0 is linear, 2.0 quadratic.
+#  The time measured is that of the stages the case exercises, as
+#  reported by --stats-json, so unzip and process startup are excluded.
+#  Each size is run three times and the fastest is used. Exit status is
+#  1 if any case fails
+
+use strict;
+use utf8;
+use FindBin;
+use lib $FindBin::Bin;
+use Getopt::Long;
+use File::Temp qw(tempdir);
+use POSIX qw(:sys_wait_h);
+use Time::HiRes qw(time);
+use JSON::PP;
+use EpubGen qw(new_rng sentence_pool paragraph write_epub latin_words);
+
+my $scale = 1;
+my $max_exp = 1.3;
+my $timeout = 60;
+my @only;
+GetOptions ("scale=f" => \$scale, "max-exp=f" => \$max_exp,
+  "timeout=i" => \$timeout, "only=s" => \@only)
+  or die "Usage: $0 [options] [epub2txt]\n";
+my $prog = shift @ARGV || "$FindBin::Bin/../epub2txt";
+-x $prog or die "$prog is not executable\n";
+
+my $tmp = tempdir ("epub2txt-complexity-XXXXXX", TMPDIR => 1, CLEANUP => 1);
+my $rng = new_rng (7000);
+my $pool = sentence_pool ($rng, latin_words(), 1000, " ");
+
+# Each case has a base size, the stages whose time is measured, and a
+#  function that writes an EPUB of size n
+my @cases =
+  (
+  # One paragraph of n characters, which is scanned, wrapped and output
+  [ "longpara", 100000, [qw(scan wrap output)], sub
+    {
+    my ($file, $n) = @_;
+    write_epub ($file, "Long paragraph",
+      [["Long", "<p>" . paragraph ($rng, $pool, $n, " ") . "</p>\n"]]);
+    } ],
+
+  # n short paragraphs
+  [ "manyparas", 20000, [qw(scan wrap output)], sub
+    {
+    my ($file, $n) = @_;
+    write_epub ($file, "Many paragraphs",
+      [["Many", join ("", map { "<p>Para $_.</p>\n" } 1..$n)]]);
+    } ],
+
+  # Elements nested n deep
+  [ "nesting", 20000, [qw(scan wrap output)], sub
+    {
+    my ($file, $n) = @_;
+    write_epub ($file, "Nesting",
+      [["Deep", ("<span>" x $n) . "deep" . ("</span>" x $n) . "\n"]]);
+    } ],
+
+  # A single tag of n characters
+  [ "longtag", 100000, [qw(scan wrap output)], sub
+    {
+    my ($file, $n) = @_;
+    write_epub ($file, "Long tag",
+      [["Tag", "<p><span title='" . ("x" x $n) . "'>text</span></p>\n"]]);
+    } ],
+
+  # An entity with a name of n characters
+  [ "longentity", 100000, [qw(scan wrap output)], sub
+    {
+    my ($file, $n) = @_;
+    write_epub ($file, "Long entity",
+      [["Entity", "<p>a &" . ("x" x $n) . "; b</p>\n"]]);
+    } ],
+
+  # n spine items, each with its manifest entry
+  [ "manifest", 2000, [qw(opf)], sub
+    {
+    my ($file, $n) = @_;
+    write_epub ($file, "Manifest",
+      [map { ["C$_", "<p>$_</p>\n"] } 1..$n]);
+    } ],
+
+  # An OPF package element with n attributes
+  [ "attributes", 20000, [qw(opf)], sub
+    {
+    my ($file, $n) = @_;
+    write_epub ($file, "Attributes", [["A", "<p>a</p>\n"]],
+      package_attrs => join ("", map { " a$_='$_'" } 1..$n));
+    } ],
+
+  # OPF metadata nested n deep
+  [ "opfnesting", 5000, [qw(opf)], sub
+    {
+    my ($file, $n) = @_;
+    write_epub ($file, "OPF nesting", [["A", "<p>a</p>\n"]],
+      metadata => ("<meta>" x $n) . ("</meta>" x $n));
+    } ],
+  );
+
+my $json = JSON::PP->new;
+
+# Run epub2txt once, and return the time spent in the given stages, or
+#  undef on timeout
+sub run_once($$)
+  {
+  my ($file, $stages) = @_;
+  my $err = "$tmp/stderr";
+  my $pid = fork ();
+  die "Can't fork: $!\n" unless defined $pid;
+  if ($pid == 0)
+    {
+    open (STDOUT, ">", "/dev/null");
+    open (STDERR, ">", $err);
+    exec ($prog, "--stats-json", $file);
+    exit 127;
+    }
+  my $deadline = time () + $timeout;
+  while (waitpid ($pid, WNOHANG) == 0)
+    {
+    if (time () > $deadline)
+      {
+      kill ('KILL', $pid);
+      waitpid ($pid, 0);
+      return undef;
+      }
+    select (undef, undef, undef, 0.005);
+    }
+  die "$prog failed with status $?\n" if $?;
+  my $t;
+  open (my $f, "<", $err) or die "Can't read $err: $!\n";
+  while (<$f>)
+    {
+    next unless /^\{/;
+    my $o = $json->decode ($_);
+    next unless $o->{type} eq "total";
+    $t = 0;
+    $t += $o->{stages}->{$_}->{wall} foreach @$stages;
+    }
+  close $f;
+  die "No statistics from $prog\n" unless defined $t;
+  return $t;
+  }
+
+my $failed = 0;
+printf "%-12s %9s %10s %10s %10s %10s %6s\n", "case", "n", "t(n)",
+  "t(2n)", "t(4n)", "t(8n)", "exp";
+foreach my $c (@cases)
+  {
+  my ($name, $base, $stages, $gen) = @$c;
+  next if @only && !grep { $_ eq $name } @only;
+  my $n = int ($base * $scale) || 1;
+  my @t;
+  my $timed_out = 0;
+  foreach my $m (1, 2, 4, 8)
+    {
+    my $file = "$tmp/$name-$m.epub";
+    $gen->($file, $n * $m);
+    my $best;
+    for (my $i = 0; $i < 3; $i++)
+      {
+      my $t = run_once ($file, $stages);
+      if (!defined $t)
+        {
+        $timed_out = 1;
+        last;
+        }
+      $best = $t if !defined $best || $t < $best;
+      }
+    unlink $file;
+    last if $timed_out;
+    push @t, $best;
+    }
+
+  my $status;
+  my $exp;
+  if ($timed_out)
+    {
+    $status = "FAIL (timeout)";
+    }
+  else
+    {
+    # Very short times are dominated by noise; treat them as a
+    #  millisecond, which errs on the side of passing
+    my ($t1, $t8) = ($t[0], $t[3]);
+    $t1 = 0.001 if $t1 < 0.001;
+    $t8 = 0.001 if $t8 < 0.001;
+    $exp = log ($t8 / $t1) / log (2) / 3;
+    $status = $exp > $max_exp ? "FAIL" : "ok";
+    }
+  $failed = 1 if $status ne "ok";
+  printf "%-12s %9d", $name, $n;
+  printf " %10.4f", $_ foreach @t;
+  printf " %10s", "-" foreach (scalar @t + 1)..4;
+  printf " %6s %s\n", defined $exp ? sprintf ("%.2f", $exp) : "-", $status;
+  }
+
+exit $failed;
+
@@ -0,0 +1,282 @@
+/*========================================================================
+  epub2txt
+  inflate_microbench.c
+  Compares epub2txt's DEFLATE decoder with zlib's, the reference
+  implementation, on data compressed by zlib at several levels. Reports
+  the output throughput of each in MB/s, and checks that the two
+  produce the same bytes. Files named on the command line are used as
+  well as the built-in samples
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+#include "klib_log.h"
+#include "klib_error.h"
+#include "klib_getopt.h"
+#include "klib_getoptspec.h"
+#include "epub2txt_inflate.h"
+
+/*========================================================================
+  Timing
+=========================================================================*/
+static double microbench_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+/*========================================================================
+  Test data
+  Sample text is made from a small vocabulary with markup, like the
+  XHTML of an EPUB; the other samples are the extremes of highly
+  repetitive and incompressible data
+=========================================================================*/
+static unsigned int rng = 1;
+
+static unsigned int next_random (void)
+  {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+  }
+
+static BYTE *make_xhtml (int size)
+  {
+  static const char *words[] = {"the", "of", "and", "to", "in", "a", "was",
+    "he", "that", "it", "his", "her", "you", "as", "had", "with", "for",
+    "she", "not", "at", "but", "be", "my", "on", "have", "him", "is",
+    "said", "house", "door", "window", "morning", "evening", "letter",
+    "garden", "carriage", "remembered", "whispered", "Elizabeth",
+    "Darcy", "Pemberley", "November", "&mdash;", "&rsquo;s"};
+  int nwords = sizeof (words) / sizeof (words[0]);
+  BYTE *s = malloc (size + 64);
+  int len = 0;
+  while (len < size)
+    {
+    const char *w = words[next_random () % nwords];
+    if (next_random () % 80 == 0)
+      len += sprintf ((char *)s + len, ".</p>\n<p class=\"text\">");
+    len += sprintf ((char *)s + len, "%s ", w);
+    }
+  return s;
+  }
+
+static BYTE *make_repetitive (int size)
+  {
+  BYTE *s = malloc (size);
+  int i;
+  for (i = 0; i < size; i++)
+    s[i] = "<p></p>\n"[i % 8];
+  return s;
+  }
+
+static BYTE *make_random (int size)
+  {
+  BYTE *s = malloc (size);
+  int i;
+  for (i = 0; i < size; i++)
+    s[i] = (BYTE)next_random ();
+  return s;
+  }
+
+static BYTE *read_file (const char *name, int *size)
+  {
+  FILE *f = fopen (name, "rb");
+  if (!f) return NULL;
+  fseek (f, 0, SEEK_END);
+  *size = (int)ftell (f);
+  fseek (f, 0, SEEK_SET);
+  BYTE *s = malloc (*size + 1);
+  *size = fread (s, 1, *size, f);
+  fclose (f);
+  return s;
+  }
+
+/*========================================================================
+  Decoding
+  Both decoders write into the same output buffer
+=========================================================================*/
+static BYTE *output;
+static int output_len;
+
+static BOOL collect (void *ctx, const BYTE *data, int len)
+  {
+  memcpy (output + output_len, data, len);
+  output_len += len;
+  return TRUE;
+  }
+
+static int run_epub2txt (epub2txt_Inflate *s, BYTE *comp, int comp_len)
+  {
+  FILE *f = fmemopen (comp, comp_len, "rb");
+  output_len = 0;
+  int ret = epub2txt_inflate (s, f, comp_len, collect, NULL);
+  fclose (f);
+  return ret;
+  }
+
+static int run_zlib (BYTE *comp, int comp_len, int size)
+  {
+  z_stream z;
+  memset (&z, 0, sizeof (z));
+  inflateInit2 (&z, -15);
+  z.next_in = comp;
+  z.avail_in = comp_len;
+  z.next_out = output;
+  z.avail_out = size;
+  int ret = inflate (&z, Z_FINISH);
+  output_len = size - z.avail_out;
+  inflateEnd (&z);
+  return ret == Z_STREAM_END ? INFLATE_OK : INFLATE_BAD_DATA;
+  }
+
+/*========================================================================
+  bench_one
+  Compresses the data at the given level, then times each decoder,
+  repeating until min_time has passed
+=========================================================================*/
+static void bench_one (const char *name, BYTE *data, int size, int level,
+    double min_time, BOOL json, epub2txt_Inflate *s)
+  {
+  z_stream z;
+  memset (&z, 0, sizeof (z));
+  deflateInit2 (&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+  int cap = deflateBound (&z, size);
+  BYTE *comp = malloc (cap);
+  z.next_in = data;
+  z.avail_in = size;
+  z.next_out = comp;
+  z.avail_out = cap;
+  deflate (&z, Z_FINISH);
+  int comp_len = cap - z.avail_out;
+  deflateEnd (&z);
+
+  output = malloc (size + 1);
+  double mbs[2];
+  int d;
+  for (d = 0; d < 2; d++)
+    {
+    long iters = 0;
+    double start = microbench_now (), elapsed;
+    do
+      {
+      int ret = d == 0 ? run_epub2txt (s, comp, comp_len)
+        : run_zlib (comp, comp_len, size);
+      if (ret != INFLATE_OK || output_len != size
+          || memcmp (output, data, size) != 0)
+        {
+        fprintf (stderr, "%s: %s decoded level %d data wrongly\n", name,
+          d == 0 ? "epub2txt" : "zlib", level);
+        exit (1);
+        }
+      iters++;
+      elapsed = microbench_now () - start;
+      } while (elapsed < min_time);
+    mbs[d] = (double)size * iters / elapsed / 1e6;
+    }
+
+  if (json)
+    printf ("{\"name\":\"%s\",\"level\":%d,\"size\":%d,\"compressed\":%d,"
+      "\"epub2txt_mb_per_sec\":%.2f,\"zlib_mb_per_sec\":%.2f}\n", name,
+      level, size, comp_len, mbs[0], mbs[1]);
+  else
+    printf ("%-16s %5d %10d %10d %12.1f %12.1f %8.2f\n", name, level,
+      size, comp_len, mbs[0], mbs[1], mbs[0] / mbs[1]);
+  fflush (stdout);
+  free (output);
+  free (comp);
+  }
+
+/*========================================================================
+  main
+=========================================================================*/
+int main (int argc, char **argv)
+  {
+  klib_GetOpt *getopt = klib_getopt_new ();
+  klib_getopt_add_spec (getopt, "help", "help", 'h', KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "json", "json", 'j', KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "size", "size", 's', KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "time", "time", 't', KLIB_GETOPT_COMPARG);
+
+  klib_Error *error = NULL;
+  klib_getopt_parse (getopt, argc, (const char **)argv, &error);
+  if (error)
+    {
+    fprintf (stderr, "%s: %s\n", argv[0], klib_error_cstr (error));
+    klib_error_free (error);
+    klib_getopt_free (getopt);
+    return 1;
+    }
+
+  if (klib_getopt_arg_set (getopt, "help"))
+    {
+    printf ("Usage: %s [options] [files...]\n", argv[0]);
+    printf ("  -h,--help            Show this message\n");
+    printf ("  -j,--json            One JSON object per result\n");
+    printf ("  -s,--size {bytes}    Size of the samples (default 1000000)\n");
+    printf ("  -t,--time {ms}       Minimum time per result (default 200)\n");
+    klib_getopt_free (getopt);
+    return 0;
+    }
+
+  BOOL json = klib_getopt_arg_set (getopt, "json");
+  const char *s_time = klib_getopt_get_arg (getopt, "time");
+  double min_time = (s_time ? atof (s_time) : 200) / 1000;
+  const char *s_size = klib_getopt_get_arg (getopt, "size");
+  int size = s_size ? atoi (s_size) : 1000000;
+  if (size < 1) size = 1;
+
+  epub2txt_Inflate *s = malloc (sizeof (epub2txt_Inflate));
+  static const int levels[] = {1, 6, 9};
+  int i, l;
+
+  if (!json)
+    printf ("%-16s %5s %10s %10s %12s %12s %8s\n", "sample", "level",
+      "size", "compressed", "epub2txt MB/s", "zlib MB/s", "ratio");
+
+  struct
+    {
+    const char *name;
+    BYTE *(*make) (int size);
+    } samples[] =
+    {
+    {"xhtml", make_xhtml},
+    {"repetitive", make_repetitive},
+    {"random", make_random},
+    };
+  for (i = 0; i < 3; i++)
+    {
+    BYTE *data = samples[i].make (size);
+    for (l = 0; l < 3; l++)
+      bench_one (samples[i].name, data, size, levels[l], min_time, json, s);
+    free (data);
+    }
+
+  int nfiles = klib_getopt_argc (getopt);
+  for (i = 0; i < nfiles; i++)
+    {
+    const char *name = klib_getopt_argv (getopt, i);
+    int fsize;
+    BYTE *data = read_file (name, &fsize);
+    if (!data)
+      {
+      fprintf (stderr, "%s: can't read %s\n", argv[0], name);
+      continue;
+      }
+    for (l = 0; l < 3; l++)
+      bench_one (name, data, fsize, levels[l], min_time, json, s);
+    free (data);
+    }
+
+  free (s);
+  klib_getopt_free (getopt);
+  return 0;
+  }
+
@@ -0,0 +1,601 @@
+/*========================================================================
+  epub2txt
+  klib_microbench.c
+  Microbenchmarks for the klib string, wstring, buffer and list
+  primitives. Reports the time and the number of heap allocations per
+  operation, for a range of sizes
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <time.h>
+#include "klib_log.h"
+#include "klib_error.h"
+#include "klib_getopt.h"
+#include "klib_getoptspec.h"
+#include "klib_string.h"
+#include "klib_wstring.h"
+#include "klib_buffer.h"
+#include "klib_list.h"
+
+/*========================================================================
+  Allocation counting
+  With glibc, a program may supply its own malloc family, which is then
+  used by the C library and by klib alike. We count calls and pass them
+  on to the glibc implementation. On other platforms allocations are
+  not counted, and are reported as -1
+=========================================================================*/
+static long long allocs = 0;
+
+#ifdef __GLIBC__
+#define MICROBENCH_COUNT_ALLOCS 1
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t count, size_t size);
+extern void *__libc_realloc (void *p, size_t size);
+extern void __libc_free (void *p);
+
+void *malloc (size_t size)
+  {
+  allocs++;
+  return __libc_malloc (size);
+  }
+
+void *calloc (size_t count, size_t size)
+  {
+  allocs++;
+  return __libc_calloc (count, size);
+  }
+
+void *realloc (void *p, size_t size)
+  {
+  allocs++;
+  return __libc_realloc (p, size);
+  }
+
+void free (void *p)
+  {
+  __libc_free (p);
+  }
+#endif
+
+/*========================================================================
+  Timing
+  Each benchmark does its setup, then calls microbench_start(), runs
+  'iters' operations, and calls microbench_stop()
+=========================================================================*/
+static double t_start, t_elapsed;
+static long long allocs_start, allocs_elapsed;
+
+static double microbench_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+
+static void microbench_start (void)
+  {
+  allocs_start = allocs;
+  t_start = microbench_now ();
+  }
+
+static void microbench_stop (void)
+  {
+  t_elapsed = microbench_now () - t_start;
+  allocs_elapsed = allocs - allocs_start;
+  }
+
+// Prevents the compiler discarding results that are otherwise unused
+static volatile long long sink;
+
+/*========================================================================
+  Test data
+=========================================================================*/
+static char *make_text (int size)
+  {
+  char *s = malloc (size + 1);
+  int i;
+  for (i = 0; i < size; i++)
+    s[i] = (i % 64 == 63) ? ' ' : 'a' + (i * 7) % 26;
+  s[size] = 0;
+  return s;
+  }
+
+static wchar_t *make_wtext (int size)
+  {
+  wchar_t *s = malloc ((size + 1) * sizeof (wchar_t));
+  int i;
+  for (i = 0; i < size; i++)
+    s[i] = (i % 64 == 63) ? L' ' : 0x430 + (i * 7) % 32; // Cyrillic
+  s[size] = 0;
+  return s;
+  }
+
+/*========================================================================
+  klib_String
+=========================================================================*/
+static void bench_string_new_free (int size, long iters)
+  {
+  char *text = make_text (size);
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    klib_string_free (klib_string_new (text));
+  microbench_stop ();
+  free (text);
+  }
+
+static void bench_string_set (int size, long iters)
+  {
+  char *text = make_text (size);
+  klib_String *s = klib_string_new_empty ();
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    klib_string_set (s, text);
+  microbench_stop ();
+  klib_string_free (s);
+  free (text);
+  }
+
+// One operation is one byte appended to a string, which is emptied
+//  whenever it reaches 'size' bytes
+static void bench_string_append_byte (int size, long iters)
+  {
+  klib_String *s = klib_string_new_empty ();
+  long i;
+  int len = 0;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    {
+    if (len == size)
+      {
+      klib_string_set (s, "");
+      len = 0;
+      }
+    klib_string_append_byte (s, 'x');
+    len++;
+    }
+  microbench_stop ();
+  klib_string_free (s);
+  }
+
+static void bench_string_append_16 (int size, long iters)
+  {
+  klib_String *s = klib_string_new_empty ();
+  long i;
+  int len = 0;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    {
+    if (len + 16 > size)
+      {
+      klib_string_set (s, "");
+      len = 0;
+      }
+    klib_string_append (s, "0123456789abcdef");
+    len += 16;
+    }
+  microbench_stop ();
+  klib_string_free (s);
+  }
+
+static void bench_string_substring (int size, long iters)
+  {
+  char *text = make_text (size);
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    klib_string_free (klib_string_new_substring (text, size / 4, size / 2));
+  microbench_stop ();
+  free (text);
+  }
+
+// Worst case: the pattern is only found at the end
+static void bench_string_index_of (int size, long iters)
+  {
+  char *text = make_text (size);
+  text[size - 1] = '!';
+  klib_String *s = klib_string_new (text);
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    sink += klib_string_index_of (s, "!");
+  microbench_stop ();
+  klib_string_free (s);
+  free (text);
+  }
+
+// The pattern (a space) occurs every 64 bytes
+static void bench_string_search_replace (int size, long iters)
+  {
+  char *text = make_text (size);
+  klib_String *s = klib_string_new (text);
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    klib_string_free (klib_string_new_search_replace (s, " ", "_"));
+  microbench_stop ();
+  klib_string_free (s);
+  free (text);
+  }
+
+/*========================================================================
+  klib_WString
+=========================================================================*/
+static void bench_wstring_set (int size, long iters)
+  {
+  wchar_t *text = make_wtext (size);
+  klib_WString *s = klib_wstring_new_empty ();
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    klib_wstring_set (s, text);
+  microbench_stop ();
+  klib_wstring_free (s);
+  free (text);
+  }
+
+static void bench_wstring_append_char (int size, long iters)
+  {
+  klib_WString *s = klib_wstring_new_empty ();
+  long i;
+  int len = 0;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    {
+    if (len == size)
+      {
+      klib_wstring_set (s, L"");
+      len = 0;
+      }
+    klib_wstring_append_char (s, 0x430);
+    len++;
+    }
+  microbench_stop ();
+  klib_wstring_free (s);
+  }
+
+static void bench_wstring_index_of (int size, long iters)
+  {
+  wchar_t *text = make_wtext (size);
+  text[size - 1] = L'!';
+  klib_WString *s = klib_wstring_new (text);
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    sink += klib_wstring_index_of (s, L"!");
+  microbench_stop ();
+  klib_wstring_free (s);
+  free (text);
+  }
+
+static void bench_wstring_search_replace (int size, long iters)
+  {
+  wchar_t *text = make_wtext (size);
+  klib_WString *s = klib_wstring_new (text);
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    klib_wstring_free (klib_wstring_new_search_replace (s, L" ", L"_"));
+  microbench_stop ();
+  klib_wstring_free (s);
+  free (text);
+  }
+
+static void bench_wstring_from_utf8 (int size, long iters)
+  {
+  wchar_t *wtext = make_wtext (size / 2);
+  klib_WString *w = klib_wstring_new (wtext);
+  klib_String *utf8 = klib_string_new_from_wstring (w);
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    klib_wstring_free (klib_wstring_new_from_utf8
+      ((const unsigned char *)klib_string_cstr (utf8)));
+  microbench_stop ();
+  klib_string_free (utf8);
+  klib_wstring_free (w);
+  free (wtext);
+  }
+
+/*========================================================================
+  klib_Buffer
+=========================================================================*/
+static void bench_buffer_set (int size, long iters)
+  {
+  char *text = make_text (size);
+  klib_Buffer *b = klib_buffer_new_empty ();
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    klib_buffer_set (b, size, text);
+  microbench_stop ();
+  klib_buffer_free (b);
+  free (text);
+  }
+
+static void bench_buffer_append_byte (int size, long iters)
+  {
+  klib_Buffer *b = klib_buffer_new_empty ();
+  long i;
+  int len = 0;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    {
+    if (len == size)
+      {
+      klib_buffer_set (b, 0, "");
+      len = 0;
+      }
+    klib_buffer_append_byte (b, 'x');
+    len++;
+    }
+  microbench_stop ();
+  klib_buffer_free (b);
+  }
+
+static void bench_buffer_append_16 (int size, long iters)
+  {
+  klib_Buffer *b = klib_buffer_new_empty ();
+  long i;
+  int len = 0;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    {
+    if (len + 16 > size)
+      {
+      klib_buffer_set (b, 0, "");
+      len = 0;
+      }
+    klib_buffer_append (b, 16, (BYTE *)"0123456789abcdef");
+    len += 16;
+    }
+  microbench_stop ();
+  klib_buffer_free (b);
+  }
+
+/*========================================================================
+  klib_List
+=========================================================================*/
+static klib_List *make_list (int size)
+  {
+  klib_List *list = klib_list_new ();
+  int i;
+  for (i = 0; i < size; i++)
+    {
+    // Descending order, so that sorting has work to do
+    klib_String *s = klib_string_new_printf ("%08d", size - i);
+    klib_list_append (list, (klib_Object *)s);
+    klib_string_free (s);
+    }
+  return list;
+  }
+
+// One operation is one append, to a list that is cleared whenever it
+//  reaches 'size' entries
+static void bench_list_append (int size, long iters)
+  {
+  klib_List *list = klib_list_new ();
+  klib_String *s = klib_string_new ("x");
+  long i;
+  int len = 0;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    {
+    if (len == size)
+      {
+      klib_list_clear (list);
+      len = 0;
+      }
+    klib_list_append (list, (klib_Object *)s);
+    len++;
+    }
+  microbench_stop ();
+  klib_list_free (list);
+  klib_string_free (s);
+  }
+
+static void bench_list_get_sequential (int size, long iters)
+  {
+  klib_List *list = make_list (size);
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    sink += (long long)klib_list_get (list, i % size) != 0;
+  microbench_stop ();
+  klib_list_free (list);
+  }
+
+static void bench_list_get_random (int size, long iters)
+  {
+  klib_List *list = make_list (size);
+  unsigned int x = 12345;
+  long i;
+  microbench_start ();
+  for (i = 0; i < iters; i++)
+    {
+    x = x * 1103515245 + 12345;
+    sink += (long long)klib_list_get (list, (x >> 8) % size) != 0;
+    }
+  microbench_stop ();
+  klib_list_free (list);
+  }
+
+static int compare_strings (const klib_Object *o1, const klib_Object *o2)
+  {
+  return strcmp (klib_string_cstr ((const klib_String *)o1),
+    klib_string_cstr ((const klib_String *)o2));
+  }
+
+// One operation is sorting a whole list. The setup (creating the list)
+//  is not timed, so each list is made and sorted separately
+static void bench_list_sort (int size, long iters)
+  {
+  double elapsed = 0;
+  long long n_allocs = 0;
+  long i;
+  for (i = 0; i < iters; i++)
+    {
+    klib_List *list = make_list (size);
+    microbench_start ();
+    klib_list_sort (list, compare_strings);
+    microbench_stop ();
+    elapsed += t_elapsed;
+    n_allocs += allocs_elapsed;
+    klib_list_free (list);
+    }
+  t_elapsed = elapsed;
+  allocs_elapsed = n_allocs;
+  }
+
+/*========================================================================
+  Benchmark table
+=========================================================================*/
+typedef void (*microbench_fn) (int size, long iters);
+
+typedef struct _Microbench
+  {
+  const char *name;
+  microbench_fn fn;
+  // Sizes above this are skipped, for operations that are too slow;
+  //  zero means no limit
+  int max_size;
+  } Microbench;
+
+static const Microbench benchmarks[] =
+  {
+  {"string_new_free", bench_string_new_free, 0},
+  {"string_set", bench_string_set, 0},
+  {"string_append_byte", bench_string_append_byte, 0},
+  {"string_append_16", bench_string_append_16, 0},
+  {"string_substring", bench_string_substring, 0},
+  {"string_index_of", bench_string_index_of, 0},
+  {"string_search_replace", bench_string_search_replace, 0},
+  {"wstring_set", bench_wstring_set, 0},
+  {"wstring_append_char", bench_wstring_append_char, 0},
+  {"wstring_index_of", bench_wstring_index_of, 0},
+  {"wstring_search_replace", bench_wstring_search_replace, 0},
+  {"wstring_from_utf8", bench_wstring_from_utf8, 0},
+  {"buffer_set", bench_buffer_set, 0},
+  {"buffer_append_byte", bench_buffer_append_byte, 0},
+  {"buffer_append_16", bench_buffer_append_16, 0},
+  {"list_append", bench_list_append, 0},
+  {"list_get_sequential", bench_list_get_sequential, 0},
+  {"list_get_random", bench_list_get_random, 0},
+  {"list_sort", bench_list_sort, 0},
+  {NULL, NULL, 0}
+  };
+
+/*========================================================================
+  run_one
+  Doubles the iteration count until a run takes at least min_time
+=========================================================================*/
+static void run_one (const Microbench *b, int size, double min_time,
+    BOOL json)
+  {
+  long iters = 1;
+  for (;;)
+    {
+    b->fn (size, iters);
+    if (t_elapsed >= min_time || iters >= (1L << 40)) break;
+    // Aim a little over min_time, but no more than 10x per step
+    double factor = t_elapsed > 0 ? 1.2 * min_time / t_elapsed : 10;
+    if (factor > 10) factor = 10;
+    if (factor < 2) factor = 2;
+    iters = (long)(iters * factor);
+    }
+  double ns = t_elapsed * 1e9 / iters;
+#ifdef MICROBENCH_COUNT_ALLOCS
+  double a = (double)allocs_elapsed / iters;
+#else
+  double a = -1;
+#endif
+  if (json)
+    printf ("{\"name\":\"%s\",\"size\":%d,\"iterations\":%ld,"
+      "\"ns_per_op\":%.3f,\"allocs_per_op\":%.3f}\n", b->name, size,
+      iters, ns, a);
+  else
+    printf ("%-24s %8d %12ld %14.1f %12.3f\n", b->name, size, iters, ns, a);
+  fflush (stdout);
+  }
+
+/*========================================================================
+  main
+=========================================================================*/
+int main (int argc, char **argv)
+  {
+  klib_GetOpt *getopt = klib_getopt_new ();
+  klib_getopt_add_spec (getopt, "help", "help", 'h', KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "json", "json", 'j', KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "sizes", "sizes", 's', KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "time", "time", 't', KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "filter", "filter", 'f',
+    KLIB_GETOPT_COMPARG);
+
+  klib_Error *error = NULL;
+  klib_getopt_parse (getopt, argc, (const char **)argv, &error);
+  if (error)
+    {
+    fprintf (stderr, "%s: %s\n", argv[0], klib_error_cstr (error));
+    klib_error_free (error);
+    klib_getopt_free (getopt);
+    return 1;
+    }
+
+  if (klib_getopt_arg_set (getopt, "help"))
+    {
+    printf ("Usage: %s [options]\n", argv[0]);
+    printf ("  -f,--filter {text}   Run benchmarks whose names contain text\n");
+    printf ("  -h,--help            Show this message\n");
+    printf ("  -j,--json            One JSON object per result\n");
+    printf ("  -s,--sizes {n,...}   Sizes (default 16,256,4096,65536)\n");
+    printf ("  -t,--time {ms}       Minimum time per result (default 100)\n");
+    klib_getopt_free (getopt);
+    return 0;
+    }
+
+  BOOL json = klib_getopt_arg_set (getopt, "json");
+  const char *filter = klib_getopt_get_arg (getopt, "filter");
+  const char *s_time = klib_getopt_get_arg (getopt, "time");
+  double min_time = (s_time ? atof (s_time) : 100) / 1000;
+  const char *s_sizes = klib_getopt_get_arg (getopt, "sizes");
+  if (!s_sizes) s_sizes = "16,256,4096,65536";
+
+  int sizes[32];
+  int nsizes = 0;
+  char *sizes_copy = strdup (s_sizes);
+  char *tok;
+  for (tok = strtok (sizes_copy, ","); tok && nsizes < 32;
+      tok = strtok (NULL, ","))
+    {
+    int n = atoi (tok);
+    if (n > 0) sizes[nsizes++] = n;
+    }
+  free (sizes_copy);
+
+  if (!json)
+    printf ("%-24s %8s %12s %14s %12s\n", "benchmark", "size",
+      "iterations", "ns/op", "allocs/op");
+
+  const Microbench *b;
+  for (b = benchmarks; b->name; b++)
+    {
+    if (filter && !strstr (b->name, filter)) continue;
+    int i;
+    for (i = 0; i < nsizes; i++)
+      {
+      if (b->max_size && sizes[i] > b->max_size) continue;
+      run_one (b, sizes[i], min_time, json);
+      }
+    }
+
+  klib_getopt_free (getopt);
+  return 0;
+  }
+
@@ -0,0 +1,159 @@
+#!/usr/bin/perl -w
+# Generate the synthetic EPUB corpus used by bench.pl
+#
+# Usage: mkcorpus.pl [--scale N] [--dir DIR]
+#
+# Each scenario is written to its own subdirectory of DIR (default
+#  bench/corpus). Sizes are multiplied by the scale factor, except the
+#  number of spine items in the 'spine10k' scenario. The corpus is
+#  only regenerated when the scale or this script's version changes
+
+use strict;
+use utf8;
+use FindBin;
+use lib $FindBin::Bin;
+use File::Path qw(make_path remove_tree);
+use Getopt::Long;
+use EpubGen qw(new_rng rand_int sentence_pool paragraph write_epub
+  latin_words nonlatin_words entities);
+
+# Increment when the generated files change
+my $VERSION = 1;
+
+my $scale = 1;
+my $dir = "$FindBin::Bin/corpus";
+GetOptions ("scale=f" => \$scale, "dir=s" => \$dir)
+  or die "Usage: $0 [--scale N] [--dir DIR]\n";
+
+# Scaled size in characters, never less than 1 kB
+sub sz($)
+  {
+  my $n = int ($_[0] * $scale);
+  return $n < 1000 ? 1000 : $n;
+  }
+
+# Chapters of <p> paragraphs, totalling about $size characters
+sub chapters($$$$$)
+  {
+  my ($rng, $pool, $size, $nchapters, $sep) = @_;
+  my @ret;
+  my $per = $size / $nchapters;
+  for (my $i = 0; $i < $nchapters; $i++)
+    {
+    my $body = "<h1>Chapter " . ($i + 1) . "</h1>\n";
+    my $len = 0;
+    while ($len < $per)
+      {
+      my $p = paragraph ($rng, $pool, 200 + rand_int ($rng, 800), $sep);
+      $body .= "<p>$p</p>\n";
+      $len += length ($p);
+      }
+    push @ret, ["Chapter " . ($i + 1), $body];
+    }
+  return \@ret;
+  }
+
+my %scenarios =
+  (
+  # A shelf of ordinary novels, about 500 kB each
+  novels => sub
+    {
+    my ($d) = @_;
+    for (my $b = 0; $b < 10; $b++)
+      {
+      my $rng = new_rng (1000 + $b);
+      my $pool = sentence_pool ($rng, latin_words(), 2000, " ");
+      write_epub ("$d/novel$b.epub", "Novel $b",
+        chapters ($rng, $pool, sz (500000), 30, " "));
+      }
+    },
+
+  # One very large book
+  omnibus => sub
+    {
+    my ($d) = @_;
+    my $rng = new_rng (2000);
+    my $pool = sentence_pool ($rng, latin_words(), 5000, " ");
+    write_epub ("$d/omnibus.epub", "Omnibus",
+      chapters ($rng, $pool, sz (100000000), 500, " "));
+    },
+
+  # Ten thousand tiny spine items
+  spine10k => sub
+    {
+    my ($d) = @_;
+    my $rng = new_rng (3000);
+    my $pool = sentence_pool ($rng, latin_words(), 1000, " ");
+    write_epub ("$d/spine10k.epub", "Spine",
+      chapters ($rng, $pool, 10000 * 1000, 10000, " "));
+    },
+
+  # Chapters that are a single <div> with no paragraph breaks at all,
+  #  so each chapter is one enormous paragraph
+  giantdiv => sub
+    {
+    my ($d) = @_;
+    my $rng = new_rng (4000);
+    my $pool = sentence_pool ($rng, latin_words(), 1000, " ");
+    my @ch;
+    for (my $i = 0; $i < 4; $i++)
+      {
+      my $text = paragraph ($rng, $pool, sz (256000), " ");
+      # Break the source into lines, as a real file would be
+      $text =~ s/(.{70,}?) /$1\n/g;
+      push @ch, ["Part " . ($i + 1), "<div>$text</div>\n"];
+      }
+    write_epub ("$d/giantdiv.epub", "Giant div", \@ch);
+    },
+
+  # Text with an entity every few words
+  entities => sub
+    {
+    my ($d) = @_;
+    my $rng = new_rng (5000);
+    my @words = @{latin_words()};
+    push @words, (@{entities()}) x 10;
+    my $pool = sentence_pool ($rng, \@words, 2000, " ");
+    for (my $b = 0; $b < 2; $b++)
+      {
+      write_epub ("$d/entities$b.epub", "Entities $b",
+        chapters ($rng, $pool, sz (2000000), 20, " "));
+      }
+    },
+
+  # Multi-byte UTF-8 text
+  nonlatin => sub
+    {
+    my ($d) = @_;
+    my $seed = 6000;
+    foreach my $script (qw(cyrillic greek cjk))
+      {
+      my $rng = new_rng ($seed++);
+      my $sep = $script eq "cjk" ? "" : " ";
+      my $pool = sentence_pool ($rng, nonlatin_words ($script), 2000, $sep);
+      write_epub ("$d/$script.epub", ucfirst ($script),
+        chapters ($rng, $pool, sz (1000000), 20, $sep));
+      }
+    },
+  );
+
+my $stamp = "$dir/.stamp";
+my $want = "version=$VERSION scale=$scale\n";
+if (open (my $f, "<", $stamp))
+  {
+  my $have = <$f>;
+  close $f;
+  exit 0 if defined $have && $have eq $want;
+  }
+
+remove_tree ($dir);
+foreach my $name (sort keys %scenarios)
+  {
+  print STDERR "Generating $name\n";
+  make_path ("$dir/$name");
+  $scenarios{$name}->("$dir/$name");
+  }
+open (my $f, ">", $stamp) or die "Can't write $stamp: $!\n";
+print $f $want;
+close $f;
+
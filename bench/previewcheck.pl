@@ -0,0 +1,91 @@
+#!/usr/bin/perl -w
+# Preview check: convert books with --preview sizes around the size of
+#  the whole text, up to and including exactly that size, and fail if
+#  the text is not the longest prefix of the whole text that fits and
+#  does not end part of the way through a character
+#
+# Usage: previewcheck.pl [path/to/epub2txt]
+#
+# The books have two identical spine items, so that the second is
+#  written out whole from the text kept for the first, and are in
+#  Latin, Greek and Chinese script, so that the cut falls within
+#  characters of one, two and three bytes. Anything epub2txt reports
+#  on stderr also fails the case. Exit status is 1 if any case fails
+
+use strict;
+use utf8;
+use FindBin;
+use lib $FindBin::Bin;
+use File::Temp qw(tempdir);
+use EpubGen qw(new_rng sentence_pool paragraph write_epub latin_words
+  nonlatin_words);
+
+my $prog = shift @ARGV || "$FindBin::Bin/../epub2txt";
+-x $prog or die "$prog is not executable\n";
+
+my $tmp = tempdir ("epub2txt-previewcheck-XXXXXX", TMPDIR => 1,
+  CLEANUP => 1);
+
+my $failed = 0;
+
+# Run epub2txt, and return its output as bytes
+sub run($)
+  {
+  my ($args) = @_;
+  local $/;
+  open (my $f, "-|", "$prog $args 2>$tmp/stderr")
+    or die "Can't run $prog: $!\n";
+  binmode ($f);
+  my $out = <$f>;
+  close ($f);
+  open ($f, "<", "$tmp/stderr") or die "Can't read $tmp/stderr: $!\n";
+  my $err = <$f>;
+  close ($f);
+  if (defined $err && $err ne "")
+    {
+    print "$args:\n";
+    print "  $_\n" foreach (split (/\n/, $err));
+    $failed = 1;
+    }
+  return defined $out ? $out : "";
+  }
+
+# The text that --preview $size should give, from the whole text
+sub expected($$)
+  {
+  my ($text, $size) = @_;
+  return $text if $size >= length ($text);
+  my $len = $size;
+  $len-- while ($len > 0
+    && (ord (substr ($text, $len, 1)) & 0xC0) == 0x80);
+  return substr ($text, 0, $len);
+  }
+
+foreach my $script ("latin", "greek", "cjk")
+  {
+  my $rng = new_rng (40);
+  my ($words, $sep) = $script eq "latin" ? (latin_words (), " ")
+    : (nonlatin_words ($script), $script eq "cjk" ? "" : " ");
+  my $pool = sentence_pool ($rng, $words, 50, $sep);
+  my $body = "";
+  $body .= "<p>" . paragraph ($rng, $pool, 300, $sep) . "</p>\n"
+    foreach (1 .. 6);
+  my $file = "$tmp/$script.epub";
+  write_epub ($file, "Preview check", [ [ "Chapter", $body ],
+    [ "Chapter", $body ] ]);
+  my $text = run ($file);
+  my $n = length ($text);
+  my $ok = $n > 0;
+  foreach my $size ($n - 4 .. $n + 1, int ($n / 2) - 1 .. int ($n / 2) + 1)
+    {
+    my $got = run ("--preview $size $file");
+    next if $got eq expected ($text, $size);
+    print "$script: --preview $size gives " . length ($got)
+      . " bytes, not " . length (expected ($text, $size)) . "\n";
+    $ok = 0;
+    }
+  printf "%-24s %s\n", "$script ($n bytes)", $ok ? "ok" : "FAILED";
+  $failed = 1 unless $ok;
+  }
+exit $failed;
+
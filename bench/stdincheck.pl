@@ -0,0 +1,67 @@
+#!/usr/bin/perl -w
+# Stdin check: convert EPUBs laid out as the zip tool and others write
+#  them both from a file and from stdin, where they are read as a
+#  stream, and fail if the text differs or anything is reported
+#
+# Usage: stdincheck.pl [path/to/epub2txt]
+#
+# The cases are EPUBs with and without an entry for each directory (as
+#  zip -r writes), with their sizes in the local headers or in data
+#  descriptors. Exit status is 1 if any case fails
+
+use strict;
+use utf8;
+use FindBin;
+use lib $FindBin::Bin;
+use File::Temp qw(tempdir);
+use EpubGen qw(new_rng sentence_pool paragraph write_epub latin_words);
+
+my $prog = shift @ARGV || "$FindBin::Bin/../epub2txt";
+-x $prog or die "$prog is not executable\n";
+
+my $tmp = tempdir ("epub2txt-stdincheck-XXXXXX", TMPDIR => 1, CLEANUP => 1);
+
+my $rng = new_rng (45);
+my $pool = sentence_pool ($rng, latin_words (), 200, " ");
+my @chapters;
+foreach my $i (1 .. 5)
+  {
+  my $body = "";
+  $body .= "<p>" . paragraph ($rng, $pool, 400, " ") . "</p>\n"
+    foreach (1 .. 20);
+  push (@chapters, [ "Chapter $i", $body ]);
+  }
+
+# Run epub2txt with stdin from $in, if set. Returns stdout and stderr
+sub run($$)
+  {
+  my ($args, $in) = @_;
+  my $cmd = "$prog $args" . ($in ? " < $in" : "") . " 2> $tmp/stderr";
+  my $out = `$cmd`;
+  local $/;
+  open (my $f, "<", "$tmp/stderr") or die "Can't read $tmp/stderr: $!\n";
+  my $err = <$f>;
+  close ($f);
+  return ($out, $err);
+  }
+
+my $failed = 0;
+foreach my $dirs (0, 1)
+  {
+  foreach my $stream (0, 1)
+    {
+    my $name = ($dirs ? "dirs" : "nodirs") . "-"
+      . ($stream ? "descriptors" : "headers");
+    my $file = "$tmp/$name.epub";
+    write_epub ($file, "Stdin check", \@chapters, dirs => $dirs,
+      stream => $stream);
+    my ($want) = run ($file, undef);
+    my ($got, $err) = run ("-", $file);
+    my $ok = length ($want) > 0 && $got eq $want && $err eq "";
+    printf "%-24s %s\n", $name, $ok ? "ok" : "FAILED";
+    print "  $_\n" foreach (split (/\n/, $err));
+    $failed = 1 unless $ok;
+    }
+  }
+exit $failed;
+
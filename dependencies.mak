@@ -1,3 +1,13 @@
-main.o: main.c epub2txt.h
-epub2txt.o: epub2txt.c epub2txt.h
-
+main.o: main.c epub2txt.h epub2txt_stats.h epub2txt_jobs.h epub2txt_cache.h epub2txt_sync.h klib_memstat.h
+epub2txt.o: epub2txt.c epub2txt.h epub2txt_stats.h epub2txt_jobs.h epub2txt_cache.h epub2txt_sync.h epub2txt_dedup.h epub2txt_hash.h epub2txt_vfs.h epub2txt_tar.h epub2txt_zip.h epub2txt_inflate.h klib_memstat.h
+epub2txt_stats.o: epub2txt_stats.c epub2txt_stats.h klib_memstat.h
+epub2txt_jobs.o: epub2txt_jobs.c epub2txt.h epub2txt_jobs.h epub2txt_stats.h klib_memstat.h
+epub2txt_cache.o: epub2txt_cache.c epub2txt_cache.h epub2txt_hash.h epub2txt_zip.h epub2txt_inflate.h
+epub2txt_sync.o: epub2txt_sync.c epub2txt_sync.h epub2txt.h epub2txt_stats.h epub2txt_jobs.h epub2txt_hash.h epub2txt_zip.h epub2txt_inflate.h klib_memstat.h
+epub2txt_dedup.o: epub2txt_dedup.c epub2txt_dedup.h
+epub2txt_hash.o: epub2txt_hash.c epub2txt_hash.h
+epub2txt_vfs.o: epub2txt_vfs.c epub2txt_vfs.h epub2txt_tar.h epub2txt_zip.h epub2txt_inflate.h
+epub2txt_tar.o: epub2txt_tar.c epub2txt_tar.h
+epub2txt_zip.o: epub2txt_zip.c epub2txt_zip.h epub2txt_inflate.h epub2txt_crc32.h
+epub2txt_inflate.o: epub2txt_inflate.c epub2txt_inflate.h
+epub2txt_crc32.o: epub2txt_crc32.c epub2txt_crc32.h
@@ -1,15 +1,17 @@
-klib_path.o: klib_path.c klib_path.h klib_object.h klib_defs.h klib_string.h
-klib_list.o: klib_list.c klib_list.h klib_object.h klib_defs.h
-klib_string.o: klib_string.c klib_string.h klib_object.h klib_defs.h klib_wstring.h klib_buffer.h klib_error.h
-klib_wstring.o: klib_wstring.c klib_string.h klib_object.h klib_defs.h klib_string.h klib_buffer.h klib_error.h klib_convertutf.h
-klib_object.o: klib_object.c klib_object.h klib_defs.h
-klib_buffer.o: klib_buffer.c klib_buffer.h klib_object.h klib_object.h klib_defs.h
+klib_path.o: klib_path.c klib_path.h klib_object.h klib_defs.h klib_string.h klib_memstat.h
+klib_list.o: klib_list.c klib_list.h klib_object.h klib_defs.h klib_memstat.h
+klib_string.o: klib_string.c klib_string.h klib_object.h klib_defs.h klib_wstring.h klib_buffer.h klib_error.h klib_memstat.h
+klib_wstring.o: klib_wstring.c klib_string.h klib_object.h klib_defs.h klib_string.h klib_buffer.h klib_error.h klib_convertutf.h klib_memstat.h
+klib_memstat.o: klib_memstat.c klib_memstat.h klib_defs.h
+klib_object.o: klib_object.c klib_object.h klib_defs.h klib_memstat.h
+klib_buffer.o: klib_buffer.c klib_buffer.h klib_object.h klib_object.h klib_defs.h klib_memstat.h
 klib_convertutf.o: klib_convertutf.c klib_convertutf.h
-klib_getopt.o: klib_getopt.c klib_getopt.h klib_getoptspec.h klib_log.h klib_error.h
-klib_getoptspec.o: klib_getoptspec.c klib_getoptspec.h klib_string.h klib_error.h klib_log.h
-klib_log.o: klib_log.h klib_log.c
+klib_getopt.o: klib_getopt.c klib_getopt.h klib_getoptspec.h klib_log.h klib_error.h klib_memstat.h
+klib_getoptspec.o: klib_getoptspec.c klib_getoptspec.h klib_string.h klib_error.h klib_log.h klib_memstat.h
+klib_log.o: klib_log.h klib_log.c klib_profile.h
+klib_profile.o: klib_profile.c klib_profile.h klib_defs.h
 klib_propsfile.o: klib_propsfile.c klib_propsfile.h 
-sxmlc.o: sxmlc.h sxmlc.c
+sxmlc.o: sxmlc.h sxmlc.c sxmlutils.h klib_memstat.h
 sxmlsearch.o: sxmlcsearch.h sxmlsearch.c
-sxmlutils.o: sxmlutils.h sxmlutils.c
-klib_xml.o: klib_xml.c sxmlc.h sxmlsearch.c sxmlutils.h
+sxmlutils.o: sxmlutils.h sxmlutils.c klib_memstat.h
+klib_xml.o: klib_xml.c sxmlc.h sxmlsearch.c sxmlutils.h klib_memstat.h
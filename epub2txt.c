@@ -11,6 +11,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "klib_log.h"
 #include "klib_error.h"
 #include "klib_path.h"
@@ -19,7 +23,17 @@
 #include "klib_getoptspec.h" 
 #include "klib_xml.h" 
 #include "klib_wstring.h" 
+#include "klib_buffer.h" 
+#include "klib_convertutf.h" 
 #include "epub2txt.h" 
+#include "epub2txt_stats.h" 
+#include "epub2txt_zip.h" 
+#include "epub2txt_vfs.h" 
+#include "epub2txt_jobs.h" 
+#include "epub2txt_cache.h" 
+#include "epub2txt_dedup.h" 
+#include "epub2txt_hash.h" 
+#include "epub2txt_sync.h" 
 
 /*========================================================================
   globals 
@@ -34,84 +48,2312 @@ int start_para = 0;
 
 int para_mark = 0;
 
+// Output is collected here and written in large blocks, rather than
+//  with a printf() call for every word
+#define OUTPUT_BUFF_SIZE 65536
+static char output_buff[OUTPUT_BUFF_SIZE];
+static int output_len = 0;
+
+// With --cache, the entry that the output of the book is also written 
+//  to, unless the book was found in the cache
+static epub2txt_CacheEntry *cache_entry = NULL;
+
+// Set while the output of a spine document is being collected, so that
+//  it can be written again for a document with the same contents: 
+//  where its output starts in output_buff, or -1. It is collected from
+//  there whenever the buffer is flushed
+static int dedup_from = -1;
+
+// Paragraphs written so far, all told
+static int written_paras = 0;
+
+// Spine items to convert, set by --spine, or NULL for all
+const char *spine_range = NULL;
+
+// Set by --chapter: convert only the chapters whose table of contents
+//  entries contain this text
+const char *chapter_label = NULL;
+
+// Set by --preview: the most bytes of text to write for each book, or
+//  zero for no limit. Once they have been written, conversion of the 
+//  book stops
+long long preview_bytes = 0;
+static long long preview_written = 0;
+static BOOL preview_done = FALSE;
+
+// Set by --count: instead of writing the text, count it
+BOOL count_mode = FALSE;
+
+// Set by --verify: check the CRC of each entry that is extracted
+BOOL verify_mode = FALSE;
+
+// Set when an entry of any book fails --verify
+BOOL verify_failed = FALSE;
+
+// Set by --output: the directory to write the text of each book into,
+//  rather than stdout
+const char *output_dir = NULL;
+
+/*========================================================================
+  epub2txt_Counts
+  What --count reports, for a spine item or a book. Characters are
+  Unicode characters, and words are separated by whitespace, including
+  the Unicode spaces and no-break spaces, which is how GNU wc counts 
+  them in a UTF-8 locale
+=========================================================================*/
+typedef struct _epub2txt_Counts
+  {
+  long long paras;
+  long long words;
+  long long chars;
+  } epub2txt_Counts;
+
+static epub2txt_Counts item_counts;
+// Whether the text counted so far ends in the middle of a word
+static BOOL count_inword = FALSE;
+
+// Documents are read and scanned in blocks of this size
+#define SCAN_CHUNK_SIZE 65536
+
+// Memory budget in bytes, set by --max-memory, or zero for none. It 
+//  covers the memory that depends on the input -- the fixed buffers 
+//  above, and whatever grows with the EPUB -- but not the program 
+//  itself or unzip
+long long max_memory = 0;
+
+// The part of the budget that is in use
+static long long budget_used = 0;
+
+/*========================================================================
+  epub2txt_budget_take
+  Claims n bytes of the memory budget, returning FALSE if that would
+  exceed it
+=========================================================================*/
+static BOOL epub2txt_budget_take (long long n)
+  {
+  if (max_memory != 0 && budget_used + n > max_memory) return FALSE;
+  budget_used += n;
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_budget_give
+=========================================================================*/
+static void epub2txt_budget_give (long long n)
+  {
+  budget_used -= n;
+  }
+
+/*========================================================================
+  epub2txt_budget_error
+=========================================================================*/
+static klib_Error *epub2txt_budget_error (const char *file, 
+    const char *what)
+  {
+  return klib_error_new (ENOMEM, 
+    "%s: %s would exceed the memory budget of %lld bytes", 
+    file, what, max_memory);
+  }
+
+/*========================================================================
+  epub2txt_Bytes
+  A growable byte buffer whose memory is claimed from the budget. If
+  the budget won't allow it to grow, bytes are dropped and overflow
+  is set; the caller must check it and give up
+=========================================================================*/
+typedef struct _epub2txt_Bytes
+  {
+  char *data;
+  int len;
+  int capacity;
+  BOOL overflow;
+  } epub2txt_Bytes;
+
+/*========================================================================
+  epub2txt_bytes_append
+=========================================================================*/
+static void epub2txt_bytes_append (epub2txt_Bytes *b, const char *s, 
+    int n)
+  {
+  if (b->len + n > b->capacity)
+    {
+    int capacity = b->capacity ? b->capacity : 256;
+    while (b->len + n > capacity) capacity *= 2;
+    if (!epub2txt_budget_take (capacity - b->capacity))
+      {
+      b->overflow = TRUE;
+      return;
+      }
+    b->data = realloc (b->data, capacity);
+    b->capacity = capacity;
+    }
+  memcpy (b->data + b->len, s, n);
+  b->len += n;
+  }
+
+/*========================================================================
+  epub2txt_bytes_free
+=========================================================================*/
+static void epub2txt_bytes_free (epub2txt_Bytes *b)
+  {
+  free (b->data);
+  epub2txt_budget_give (b->capacity);
+  b->data = NULL;
+  b->len = 0;
+  b->capacity = 0;
+  }
+
+/*========================================================================
+  epub2txt_bytes_sink
+  Collects an entry's data in an epub2txt_Bytes. A buffer that would
+  grow past what an int can count overflows, like one that would
+  exceed the budget
+=========================================================================*/
+static BOOL epub2txt_bytes_sink (void *ctx, const BYTE *data, int len)
+  {
+  epub2txt_Bytes *b = ctx;
+  if (len > INT_MAX / 2 - b->len)
+    b->overflow = TRUE;
+  else
+    epub2txt_bytes_append (b, (const char *)data, len);
+  return !b->overflow;
+  }
+
+/*========================================================================
+  epub2txt_Entry
+  An entry held whole in memory, for the XML parser or, if it is an 
+  EPUB in a bundle, to be opened as an archive: where it was, if it 
+  could be mapped, or else a copy of it
+=========================================================================*/
+typedef struct _epub2txt_Entry
+  {
+  const BYTE *data;
+  long long size;
+  BOOL mapped;
+  epub2txt_Bytes copy;
+  } epub2txt_Entry;
+
+/*========================================================================
+  epub2txt_entry_get
+  Gets the whole of the named entry. Returns FALSE, and sets error, if
+  the entry is missing, or would exceed the memory budget. The entry
+  must be given back with epub2txt_entry_close, whether this succeeded
+  or not
+=========================================================================*/
+static BOOL epub2txt_entry_get (epub2txt_Vfs *vfs, const char *name,
+    epub2txt_Entry *entry, klib_Error **error)
+  {
+  KLIB_IN
+  memset (entry, 0, sizeof (*entry));
+  epub2txt_stats_enter (STAGE_UNZIP);
+  klib_log_debug ("Extracting %s", name);
+  entry->data = epub2txt_vfs_map (vfs, name, &entry->size, error);
+  entry->mapped = entry->data != NULL;
+  if (!entry->data && *error == NULL)
+    {
+    BOOL got = epub2txt_vfs_read (vfs, name, epub2txt_bytes_sink, 
+      &entry->copy, error);
+    if (entry->copy.overflow)
+      *error = epub2txt_budget_error (name, "Reading");
+    else if (!got && *error == NULL)
+      *error = klib_error_new (ENOENT, "%s: %s", name, strerror (ENOENT));
+    entry->data = (const BYTE *)entry->copy.data;
+    entry->size = entry->copy.len;
+    }
+  epub2txt_stats_leave ();
+  KLIB_OUT
+  return *error == NULL;
+  }
+
+/*========================================================================
+  epub2txt_entry_open
+  Gets the whole of the named entry, and opens it as a file for the
+  XML parser. Returns NULL, and sets error, if the entry can't be got,
+  or is empty, which is no use to the parser. As for 
+  epub2txt_entry_get, the entry must be given back
+=========================================================================*/
+static FILE *epub2txt_entry_open (epub2txt_Vfs *vfs, const char *name,
+    epub2txt_Entry *entry, klib_Error **error)
+  {
+  KLIB_IN
+  FILE *f = NULL;
+  if (epub2txt_entry_get (vfs, name, entry, error))
+    {
+    if (entry->size > 0) 
+      f = fmemopen ((void *)entry->data, entry->size, "rb");
+    if (!f)
+      *error = klib_error_new (KLIB_ERR_PARSE_XML, 
+        klib_error_strerror (KLIB_ERR_PARSE_XML), name);
+    }
+  KLIB_OUT
+  return f;
+  }
+
+/*========================================================================
+  epub2txt_entry_close
+=========================================================================*/
+static void epub2txt_entry_close (epub2txt_Vfs *vfs, epub2txt_Entry *entry,
+    FILE *f)
+  {
+  if (f) fclose (f);
+  if (entry->mapped) 
+    epub2txt_vfs_unmap (vfs, entry->data, entry->size);
+  epub2txt_bytes_free (&entry->copy);
+  }
+
+/*========================================================================
+  epub2txt_read_xml
+  Parses the named entry into a DOM
+=========================================================================*/
+static klib_Xml *epub2txt_read_xml (epub2txt_Vfs *vfs, const char *name,
+    klib_Error **error)
+  {
+  epub2txt_Entry entry;
+  klib_Xml *x = NULL;
+  FILE *f = epub2txt_entry_open (vfs, name, &entry, error);
+  if (f) x = klib_xml_read_stream (f, name, error);
+  epub2txt_entry_close (vfs, &entry, f);
+  return x;
+  }
+
+/*========================================================================
+  epub2txt_ascii_space
+=========================================================================*/
+static const unsigned char epub2txt_ascii_space[128] = 
+  {
+  [' '] = 1, ['\n'] = 1, ['\t'] = 1, ['\r'] = 1, ['\v'] = 1, ['\f'] = 1
+  };
+
+/*========================================================================
+  epub2txt_is_space
+  Whether the n-byte, non-ASCII character at s is whitespace
+=========================================================================*/
+static inline BOOL epub2txt_is_space (const unsigned char *s, int n)
+  {
+  switch (s[0])
+    {
+    case 0xC2: // U+00A0
+      return s[1] == 0xA0;
+    case 0xE1: // U+1680
+      return s[1] == 0x9A && s[2] == 0x80;
+    case 0xE2: // U+2000-200A, 2028, 2029, 202F, 205F, 2060
+      if (s[1] == 0x80) 
+        return s[2] <= 0x8A || s[2] == 0xA8 || s[2] == 0xA9 || s[2] == 0xAF;
+      return s[1] == 0x81 && (s[2] == 0x9F || s[2] == 0xA0);
+    case 0xE3: // U+3000
+      return s[1] == 0x80 && s[2] == 0x80;
+    }
+  return FALSE;
+  }
+
+/*========================================================================
+  epub2txt_count_output
+  Counts the characters and words in the text, and returns the number
+  of bytes counted; a character that is incomplete at the end is left
+  to be counted with the text that follows
+=========================================================================*/
+static int epub2txt_count_output (const char *_s, int len)
+  {
+  const unsigned char *s = (const unsigned char *)_s;
+  int i = 0;
+  long long chars = 0, words = 0;
+  BOOL inword = count_inword;
+  while (i < len)
+    {
+    unsigned char c = s[i];
+    if (c < 0x80)
+      {
+      BOOL space = epub2txt_ascii_space[c];
+      words += !space && !inword;
+      inword = !space;
+      chars++;
+      i++;
+      continue;
+      }
+    int n = c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+    if (i + n > len) break;
+    if ((c & 0xC0) != 0x80)
+      {
+      chars++;
+      if (epub2txt_is_space (s + i, n))
+        inword = FALSE;
+      else
+        {
+        if (!inword) words++;
+        inword = TRUE;
+        }
+      }
+    i += n;
+    }
+  item_counts.chars += chars;
+  item_counts.words += words;
+  count_inword = inword;
+  return i;
+  }
+
+/*========================================================================
+  epub2txt_flush_output
+=========================================================================*/
+void epub2txt_flush_output (void)
+  {
+  KLIB_IN
+  if (output_len > 0)
+    {
+    epub2txt_stats_enter (STAGE_OUTPUT);
+    if (dedup_from >= 0)
+      epub2txt_dedup_record (output_buff + dedup_from, 
+        output_len - dedup_from);
+    if (count_mode)
+      {
+      int n = epub2txt_count_output (output_buff, output_len);
+      memmove (output_buff, output_buff + n, output_len - n);
+      output_len -= n;
+      }
+    else
+      {
+      fwrite (output_buff, 1, output_len, stdout);
+      fflush (stdout);
+      if (cache_entry) 
+        epub2txt_cache_write (cache_entry, output_buff, output_len);
+      output_len = 0;
+      }
+    if (dedup_from >= 0) dedup_from = output_len;
+    epub2txt_stats_leave ();
+    }
+  KLIB_OUT
+  }
+
+/*========================================================================
+  epub2txt_write
+=========================================================================*/
+static void epub2txt_write (const char *s, int len)
+  {
+  if (preview_bytes != 0)
+    {
+    if (preview_done) return;
+    if (len >= preview_bytes - preview_written)
+      {
+      // Stop short of a character that would be cut in two; the byte
+      //  after the cut is only looked at if it is in the chunk
+      if (len > preview_bytes - preview_written)
+        {
+        len = preview_bytes - preview_written;
+        while (len > 0 && (s[len] & 0xC0) == 0x80) len--;
+        }
+      preview_done = TRUE;
+      }
+    preview_written += len;
+    }
+  if (stats_enabled) book_stats.output_bytes += len;
+  while (len > 0)
+    {
+    int n = OUTPUT_BUFF_SIZE - output_len;
+    if (n > len) n = len;
+    memcpy (output_buff + output_len, s, n);
+    output_len += n;
+    s += n;
+    len -= n;
+    if (output_len == OUTPUT_BUFF_SIZE)
+      epub2txt_flush_output ();
+    }
+  }
+
+/*========================================================================
+  epub2txt_write_para_mark
+=========================================================================*/
+static void epub2txt_write_para_mark (int para)
+  {
+  char mark[64];
+  int n = snprintf (mark, sizeof (mark), "\n\n*** PARA %d\n\n", para);
+  epub2txt_write (mark, n);
+  }
+
+/*========================================================================
+  epub2txt_count_words
+  Used to collect statistics, when we don't split the text into words
+  for any other reason, and by --count. The only whitespace in the 
+  output is spaces and line breaks, so this agrees with wc
+=========================================================================*/
+static int epub2txt_count_words (const char *s, int len, BOOL *inword)
+  {
+  int words = 0;
+  for (; len > 0; s++, len--)
+    {
+    BOOL white = (*s == ' ' || *s == '\n' || *s == '\t');
+    if (!white && !*inword) words++;
+    *inword = !white;
+    }
+  return words;
+  }
+
+/*========================================================================
+  epub2txt_ManifestId
+  One id attribute of a manifest item. The manifest is indexed by
+  sorting these, so that looking up spine items is O(n log n) rather 
+  than O(n^2)
+=========================================================================*/
+typedef struct _epub2txt_ManifestId
+  {
+  const char *id;
+  // Index of the item among the manifest's children
+  int item;
+  int order;
+  } epub2txt_ManifestId;
+
+/*========================================================================
+  epub2txt_compare_manifest_id
+  Ties are broken by document order, so that duplicate ids are found
+  in the same order as a linear scan of the manifest would find them
+=========================================================================*/
+static int epub2txt_compare_manifest_id (const void *a, const void *b)
+  {
+  const epub2txt_ManifestId *ia = a;
+  const epub2txt_ManifestId *ib = b;
+  int ret = strcmp (ia->id, ib->id);
+  if (ret == 0) ret = ia->order - ib->order;
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_index_manifest
+  Returns a sorted array of all the id attributes in the manifest, which
+  the caller must free
+=========================================================================*/
+static epub2txt_ManifestId *epub2txt_index_manifest (XMLNode *manifest,
+    int *count)
+  {
+  int m, n = 0, total = 0;
+  for (m = 0; m < manifest->n_children; m++)
+    total += manifest->children[m]->n_attributes;
+  epub2txt_ManifestId *ids = malloc ((total + 1) * sizeof (*ids));
+  for (m = 0; m < manifest->n_children; m++)
+    {
+    XMLNode *r3 = manifest->children[m]; // item
+    int a;
+    for (a = 0; a < r3->n_attributes; a++)
+      {
+      if (strcmp (r3->attributes[a].name, "id") == 0)
+        {
+        ids[n].id = r3->attributes[a].value;
+        ids[n].item = m;
+        ids[n].order = n;
+        n++;
+        }
+      }
+    }
+  qsort (ids, n, sizeof (*ids), epub2txt_compare_manifest_id);
+  *count = n;
+  return ids;
+  }
+
+/*========================================================================
+  epub2txt_find_manifest_id
+  Returns the index of the first entry with the specified id, or count
+  if there is none
+=========================================================================*/
+static int epub2txt_find_manifest_id (const epub2txt_ManifestId *ids, 
+    int count, const char *id)
+  {
+  int lo = 0, hi = count;
+  while (lo < hi)
+    {
+    int mid = lo + (hi - lo) / 2;
+    if (strcmp (ids[mid].id, id) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  return lo;
+  }
+
+/*========================================================================
+  epub2txt_OpfScan
+  What the SAX parser collects from the OPF file, when it is parsed 
+  within a memory budget. Strings are kept in one pool, and referred
+  to by their offsets in it, so that they don't move when it grows
+=========================================================================*/
+typedef struct _epub2txt_OpfScan
+  {
+  int depth;
+  BOOL seen_root;
+  BOOL in_root;
+  BOOL in_manifest;
+  BOOL in_spine;
+  BOOL got_manifest;
+  epub2txt_Bytes pool;
+  // Offset of each id in the pool, and the item it belongs to
+  epub2txt_Bytes ids;
+  // Index in hrefs of the first href of each manifest item
+  epub2txt_Bytes items;
+  // Offsets of href attributes of the manifest, in document order
+  epub2txt_Bytes hrefs;
+  // Offsets of idref attributes of the spine, in document order
+  epub2txt_Bytes idrefs;
+  } epub2txt_OpfScan;
+
+/*========================================================================
+  epub2txt_opf_append_int
+  Appends an int to a table of the OPF scan
+=========================================================================*/
+static void epub2txt_opf_append_int (epub2txt_Bytes *b, int n)
+  {
+  epub2txt_bytes_append (b, (const char *)&n, sizeof (n));
+  }
+
+/*========================================================================
+  epub2txt_opf_append_string
+  Copies s into the string pool of the OPF scan, and appends its offset
+  in the pool to the table b
+=========================================================================*/
+static void epub2txt_opf_append_string (epub2txt_OpfScan *opf, 
+    epub2txt_Bytes *b, const char *s)
+  {
+  epub2txt_opf_append_int (b, opf->pool.len);
+  epub2txt_bytes_append (&opf->pool, s, strlen (s) + 1);
+  }
+
+/*========================================================================
+  epub2txt_opf_overflow
+  Returns TRUE if any of the tables of the OPF scan overflowed
+=========================================================================*/
+static BOOL epub2txt_opf_overflow (const epub2txt_OpfScan *opf)
+  {
+  return opf->pool.overflow || opf->ids.overflow || opf->items.overflow
+    || opf->hrefs.overflow || opf->idrefs.overflow;
+  }
+
+/*========================================================================
+  epub2txt_opf_start_node
+  Tracks the same elements that epub2txt_get_items looks at in the 
+  DOM: the children of the root element, and their children
+=========================================================================*/
+static int epub2txt_opf_start_node (const XMLNode *node, SAX_Data *sd)
+  {
+  epub2txt_OpfScan *opf = sd->user;
+  int depth = opf->depth++;
+  if (depth == 0)
+    {
+    if (node->tag_type == TAG_FATHER && !opf->seen_root)
+      {
+      opf->seen_root = TRUE;
+      opf->in_root = TRUE;
+      }
+    }
+  else if (!opf->in_root)
+    ;
+  else if (depth == 1)
+    {
+    // Add workaround for bug #4 
+    opf->in_manifest = strcmp (node->tag, "manifest") == 0 
+      || strstr (node->tag, ":manifest");
+    opf->in_spine = strcmp (node->tag, "spine") == 0 
+      || strstr (node->tag, ":spine");
+    if (opf->in_manifest)
+      {
+      // It is the last manifest that counts
+      opf->got_manifest = TRUE;
+      opf->ids.len = 0;
+      opf->items.len = 0;
+      opf->hrefs.len = 0;
+      }
+    }
+  else if (depth == 2)
+    {
+    int a;
+    if (opf->in_manifest)
+      {
+      int item = opf->items.len / sizeof (int);
+      epub2txt_opf_append_int (&opf->items, opf->hrefs.len / sizeof (int));
+      for (a = 0; a < node->n_attributes; a++)
+        {
+        if (strcmp (node->attributes[a].name, "id") == 0)
+          {
+          epub2txt_opf_append_string (opf, &opf->ids, 
+            node->attributes[a].value);
+          epub2txt_opf_append_int (&opf->ids, item);
+          }
+        else if (strcmp (node->attributes[a].name, "href") == 0)
+          epub2txt_opf_append_string (opf, &opf->hrefs, 
+            node->attributes[a].value);
+        }
+      }
+    if (opf->in_spine)
+      {
+      for (a = 0; a < node->n_attributes; a++)
+        {
+        if (strcmp (node->attributes[a].name, "idref") == 0)
+          epub2txt_opf_append_string (opf, &opf->idrefs, 
+            node->attributes[a].value);
+        }
+      }
+    }
+  return !epub2txt_opf_overflow (opf);
+  }
+
+/*========================================================================
+  epub2txt_opf_end_node
+  Leaves an element opened in epub2txt_opf_start_node
+=========================================================================*/
+static int epub2txt_opf_end_node (const XMLNode *node, SAX_Data *sd)
+  {
+  (void)node;
+  epub2txt_OpfScan *opf = sd->user;
+  if (opf->depth > 0) opf->depth--;
+  if (opf->depth == 0) opf->in_root = FALSE;
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_get_items_sax
+  epub2txt_get_items for use within a memory budget: rather than 
+  building the DOM of the whole OPF file, which may have a great deal 
+  of metadata we don't need, only the manifest ids and hrefs and the 
+  spine idrefs are kept. Unlike the DOM parser, this does not check 
+  that end tags match
+=========================================================================*/
+static klib_List *epub2txt_get_items_sax (epub2txt_Vfs *vfs, 
+    const char *opf_file, klib_Error **error)
+  {
+  KLIB_IN
+  klib_List *ret = NULL;
+  epub2txt_Entry entry;
+  FILE *f = epub2txt_entry_open (vfs, opf_file, &entry, error);
+  if (!f)
+    {
+    epub2txt_entry_close (vfs, &entry, f);
+    KLIB_OUT
+    return NULL;
+    }
+  epub2txt_OpfScan opf;
+  memset (&opf, 0, sizeof (opf));
+  SAX_Callbacks sax;
+  SAX_Callbacks_init (&sax);
+  sax.start_node = epub2txt_opf_start_node;
+  sax.end_node = epub2txt_opf_end_node;
+  BOOL parsed = XMLDoc_parse_fp_SAX (f, opf_file, &sax, &opf);
+  // The sentinel, so that the hrefs of item i are items[i]..items[i+1]
+  epub2txt_opf_append_int (&opf.items, opf.hrefs.len / sizeof (int));
+  int nids = opf.ids.len / (2 * sizeof (int));
+  long long ids_size = (nids + 1) * sizeof (epub2txt_ManifestId);
+  BOOL took = !epub2txt_opf_overflow (&opf) 
+    && epub2txt_budget_take (ids_size);
+  if (!took)
+    *error = epub2txt_budget_error (opf_file, "The OPF manifest");
+  else if (!parsed)
+    *error = klib_error_new (KLIB_ERR_PARSE_XML, 
+      klib_error_strerror (KLIB_ERR_PARSE_XML), opf_file);
+  else if (!opf.got_manifest)
+    *error = klib_error_new (ENOENT, "File %s has no manifest", opf_file);
+  else
+    {
+    const int *idv = (const int *)opf.ids.data;
+    const int *items = (const int *)opf.items.data;
+    const int *hrefs = (const int *)opf.hrefs.data;
+    const int *idrefs = (const int *)opf.idrefs.data;
+    int i, nidrefs = opf.idrefs.len / sizeof (int);
+    epub2txt_ManifestId *ids = malloc (ids_size);
+    for (i = 0; i < nids; i++)
+      {
+      ids[i].id = opf.pool.data + idv[2 * i];
+      ids[i].item = idv[2 * i + 1];
+      ids[i].order = i;
+      }
+    qsort (ids, nids, sizeof (*ids), epub2txt_compare_manifest_id);
+
+    ret = klib_list_new ();
+    for (i = 0; i < nidrefs; i++)
+      {
+      const char *value = opf.pool.data + idrefs[i];
+      // Every manifest item with a matching id, in document order
+      int m = epub2txt_find_manifest_id (ids, nids, value);
+      for (; m < nids && strcmp (ids[m].id, value) == 0; m++)
+        {
+        int h;
+        for (h = items[ids[m].item]; h < items[ids[m].item + 1]; h++)
+          {
+          klib_String *ss = klib_string_new (opf.pool.data + hrefs[h]);
+          klib_list_append (ret, (klib_Object *)ss);
+          klib_string_free (ss);
+          }
+        }
+      }
+    free (ids);
+    }
+  if (took) epub2txt_budget_give (ids_size);
+  epub2txt_bytes_free (&opf.pool);
+  epub2txt_bytes_free (&opf.ids);
+  epub2txt_bytes_free (&opf.items);
+  epub2txt_bytes_free (&opf.hrefs);
+  epub2txt_bytes_free (&opf.idrefs);
+  epub2txt_entry_close (vfs, &entry, f);
+  KLIB_OUT
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_get_items
+=========================================================================*/
+klib_List *epub2txt_get_items (epub2txt_Vfs *vfs, const char *opf, 
+    klib_Error **error)
+  {
+  KLIB_IN
+  if (max_memory != 0)
+    {
+    klib_List *ret = epub2txt_get_items_sax (vfs, opf, error);
+    KLIB_OUT
+    return ret;
+    }
+  klib_Xml *x = epub2txt_read_xml (vfs, opf, error);
+  if (*error == NULL)
+    {
+    klib_log_debug ("Opened file %s", opf);
+    BOOL got_manifest = FALSE;
+    XMLNode *manifest = NULL;
+
+    XMLNode *root = klib_xml_get_root (x); // package
+    int i, l = root->n_children;
+    for (i = 0; i < l; i++)
+      {
+      XMLNode *r1 = root->children[i];
+      // Add workaround for bug #4 
+      if (strcmp (r1->tag, "manifest") == 0 || strstr (r1->tag, ":manifest"))
+        {
+        manifest = r1;
+        got_manifest = TRUE;
+        }
+      }
+
+    if (!got_manifest)
+      {
+      *error = klib_error_new (ENOENT, "File %s has no manifest", opf);
+      klib_xml_free (x);
+      KLIB_OUT
+      return NULL; 
+      }
+ 
+    klib_List *ret = klib_list_new ();
+    int nids = 0;
+    epub2txt_ManifestId *ids = epub2txt_index_manifest (manifest, &nids);
+
+    for (i = 0; i < l; i++)
+      {
+      XMLNode *r1 = root->children[i];
+      // Add workaround for bug #4
+      if (strcmp (r1->tag, "spine") == 0 || strstr (r1->tag, ":spine"))
+        {
+        int j, l2 = r1->n_children;
+        for (j = 0; j < l2; j++)
+          {
+          XMLNode *r2 = r1->children[j]; // itemref
+          int k, nattrs = r2->n_attributes;
+          for (k = 0; k < nattrs; k++)
+            {
+            char *name = r2->attributes[k].name;
+            if (strcmp (name, "idref") == 0)
+              {
+              char *value= r2->attributes[k].value;
+              // Every manifest item with a matching id, in document order
+              int m = epub2txt_find_manifest_id (ids, nids, value);
+              for (; m < nids && strcmp (ids[m].id, value) == 0; m++)
+                {
+                XMLNode *r3 = manifest->children[ids[m].item];
+                int p, nattrs = r3->n_attributes;
+                for (p = 0; p < nattrs; p++)
+                  {
+                  char *name2 = r3->attributes[p].name;
+                  char *val2 = r3->attributes[p].value;
+                  if (strcmp (name2, "href") == 0)
+                    {
+                    klib_String *ss = klib_string_new (val2);
+                    klib_list_append (ret, (klib_Object *)ss);
+                    klib_string_free (ss);
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+
+    free (ids);
+    klib_xml_free (x);
+    KLIB_OUT
+    return ret;
+    }
+  else
+    {
+    KLIB_OUT
+    return NULL;
+    }
+  }
+
+/*========================================================================
+  epub2txt_translate_entity
+  out must have space for at least five bytes
+  // TODO -- ascii mode subsitutions
+=========================================================================*/
+void epub2txt_translate_entity (const char *in, char *out)
+  {
+  KLIB_IN
+  out[0] = 0;
+  if (strcasecmp (in, "amp") == 0) 
+    strcpy (out, "&");
+  else if (strcasecmp (in, "nbsp") == 0) 
+    strcpy (out, " ");
+  else if (strcasecmp (in, "lt") == 0) 
+    strcpy (out, "<");
+  else if (strcasecmp (in, "gt") == 0) 
+    strcpy (out, ">");
+  else if (strcasecmp (in, "cent") == 0) 
+    strcpy (out, "¢");
+  else if (strcasecmp (in, "pound") == 0) 
+    strcpy (out, "£");
+  else if (strcasecmp (in, "yen") == 0) 
+    strcpy (out, "£");
+  else if (strcasecmp (in, "euro") == 0) 
+    strcpy (out, "€");
+  else if (strcasecmp (in, "sect") == 0) 
+    strcpy (out, "§");
+  else if (strcasecmp (in, "copy") == 0) 
+    strcpy (out, "©");
+  else if (strcasecmp (in, "reg") == 0) 
+    strcpy (out, "®");
+  else if (strcasecmp (in, "trade") == 0) 
+    strcpy (out, "™");
+  else if (strcasecmp (in, "quot") == 0) 
+    strcpy (out, "\"");
+  else if (in[0] == '#')
+    {
+    char *s = strdup (in);
+    s[0] = '0';
+    int v = 0;
+    if (sscanf (s, "%x", &v) == 1)
+      {
+      klib_String *ss = klib_string_new_empty ();
+      klib_string_append_wchar (ss, (wchar_t)v);
+      strcpy (out, klib_string_cstr (ss));
+      klib_string_free (ss);
+      } 
+    free (s);
+    }
+  else
+    strcpy (out, "?");
+  KLIB_OUT
+  }
+
+
+/*========================================================================
+  epub2txt_transliterate
+  The ASCII replacement for character c, or NULL if it needs none
+=========================================================================*/
+const char *epub2txt_transliterate (wchar_t c)
+  {
+  switch (c)
+    {
+    case 0x00B4: return "\'";
+    case 0x0304: return "-";
+    case 0x2010: return "-";
+    case 0x2013: return "-";
+    case 0x2014: return "-";
+    case 0x2018: return "'";
+    case 0x2019: return "\'";
+    case 0x201C: return "\"";
+    case 0x201D: return "\"";
+    case 0xC2A0: return "(c)"; // copyright
+    case 0x00A9: return "(c)"; // ditto
+    case 0xC2A9: return " "; // nbsp
+    case 0x00A0: return " "; // nbsp
+    case 0x2026: return ",,,"; // elipsis
+    case 0x2022: return "."; // dot
+    case 0x00B5: return "u"; // mu
+    case 0x00C0: return "A"; // accented A
+    case 0x00C1: return "A"; // accented A
+    case 0x00C2: return "A"; // accented A
+    case 0x00C3: return "A"; // accented A
+    case 0x00C4: return "A"; // accented A
+    case 0x00C5: return "A"; // accented A
+    case 0x00C6: return "AE"; // accented A
+    case 0x00C7: return "C"; // cedilla
+    case 0x00C8: return "E"; // accented E
+    case 0x00C9: return "E"; // accented E
+    case 0x00CA: return "E"; // accented E
+    case 0x00CB: return "E"; // accented E
+    case 0x00CC: return "I"; // accented I
+    case 0x00CD: return "I"; // accented I
+    case 0x00CE: return "I"; // accented I
+    case 0x00CF: return "I"; // accented I
+    case 0x00D0: return "D"; // accented D
+    case 0x00D1: return "N"; // accented N
+    case 0x00D2: return "O"; // accented O
+    case 0x00D3: return "O"; // accented O
+    case 0x00D4: return "O"; // accented O
+    case 0x00D5: return "O"; // accented O
+    case 0x00D6: return "O"; // accented O
+    case 0x00D7: return "x"; // Multiply
+    case 0x00D8: return "O"; // accented O
+    case 0x00D9: return "U"; // accented U
+    case 0x00DA: return "U"; // accented U
+    case 0x00DB: return "U"; // accented U
+    case 0x00DC: return "U"; // accented U
+    case 0x00DD: return "Y"; // accented Y
+    case 0x00DE: return "Y"; // thorn
+    case 0x00DF: return "sz"; // esszet
+    case 0x00E0: return "a"; // accepted a
+    case 0x00E1: return "a"; // accepted a
+    case 0x00E2: return "a"; // accepted a
+    case 0x00E3: return "a"; // accepted a
+    case 0x00E4: return "a"; // accepted a
+    case 0x00E5: return "a"; // accepted a
+    case 0x00E6: return "ae"; // ae
+    case 0x00E7: return "c"; // cedilla
+    case 0x00E8: return "e"; //a ceepnted e
+    case 0x00E9: return "e"; //a ceepnted e
+    case 0x00EA: return "e"; //a ceepnted e
+    case 0x00EB: return "e"; //a ceepnted e
+    case 0x00EC: return "i"; //a ceepnted i
+    case 0x00ED: return "i"; //a ceepnted i
+    case 0x00EE: return "i"; //a ceepnted i
+    case 0x00EF: return "i"; //a ceepnted i
+    case 0x00F0: return "o"; //a ceepnted o
+    case 0x00F1: return "n"; //a ceepnted n
+    case 0x00F2: return "o"; //a ceepnted o
+    case 0x00F3: return "o"; //a ceepnted o
+    case 0x00F4: return "o"; //a ceepnted o
+    case 0x00F5: return "o"; //a ceepnted o
+    case 0x00F6: return "o"; //a ceepnted o
+    case 0x00F7: return "/"; // divide
+    case 0x00F8: return "o"; //a ceepnted o
+    case 0x00F9: return "u"; //a ceepnted u
+    case 0x00FA: return "u"; //a ceepnted u
+    case 0x00FB: return "u"; //a ceepnted u
+    case 0x00FC: return "u"; //a ceepnted u
+    case 0x00FD: return "y"; //a ceepnted y
+    case 0x00FE: return "y"; //a thorn
+    case 0x00FF: return "y"; //a ceepnted y
+    case 0x0100: return "A"; //a ceepnted A
+    case 0x0101: return "a"; //a ceepnted a
+    case 0x0102: return "A"; //a ceepnted A
+    case 0x0103: return "a"; //a ceepnted a
+    case 0x0104: return "A"; //a ceepnted A
+    case 0x0105: return "a"; //a ceepnted a
+    case 0x0106: return "C"; //a ceepnted C
+    case 0x0107: return "c"; //a ceepnted c
+    case 0x0108: return "C"; //a ceepnted C
+    case 0x0109: return "c"; //a ceepnted c
+    case 0x010A: return "C"; //a ceepnted C
+    case 0x010B: return "c"; //a ceepnted c
+    case 0x010C: return "C"; //a ceepnted C
+    case 0x010D: return "c"; //a ceepnted c
+    case 0x010E: return "D"; //a ceepnted D
+    case 0x010F: return "d"; //a ceepnted d
+    case 0x0110: return "D"; //a ceepnted D
+    case 0x0111: return "d"; //a ceepnted d
+    case 0x0112: return "E"; //a ceepnted E
+    case 0x0113: return "e"; //a ceepnted e
+    case 0x0114: return "E"; //a ceepnted E
+    case 0x0115: return "e"; //a ceepnted e
+    case 0x0116: return "E"; //a ceepnted E
+    case 0x0117: return "e"; //a ceepnted e
+    case 0x0118: return "E"; //a ceepnted E
+    case 0x0119: return "e"; //a ceepnted e
+    case 0x011A: return "E"; //a ceepnted E
+    case 0x011B: return "e"; //a ceepnted e
+    case 0x011C: return "G"; //a ceepnted G
+    case 0x011D: return "g"; //a ceepnted g
+    case 0x011E: return "G"; //a ceepnted G
+    case 0x011F: return "g"; //a ceepnted g
+    case 0x0120: return "G"; //a ceepnted G
+    case 0x0121: return "g"; //a ceepnted g
+    case 0x0122: return "G"; //a ceepnted G
+    case 0x0123: return "g"; //a ceepnted g
+    case 0x0124: return "H"; //a ceepnted H
+    case 0x0125: return "h"; //a ceepnted h
+    case 0x0126: return "H"; //a ceepnted H
+    case 0x0127: return "h"; //a ceepnted h
+    case 0x0128: return "I"; //a ceepnted I
+    case 0x0129: return "i"; //a ceepnted i
+    case 0x012A: return "I"; //a ceepnted I
+    case 0x012B: return "i"; //a ceepnted i
+    case 0x012C: return "I"; //a ceepnted I
+    case 0x012D: return "i"; //a ceepnted i
+    case 0x012E: return "I"; //a ceepnted I
+    case 0x012F: return "i"; //a ceepnted i
+    case 0x0130: return "I"; //a ceepnted I
+    case 0x0131: return "i"; //a ceepnted i
+    case 0x0132: return "IJ";
+    case 0x0133: return "ij";
+    case 0x0134: return "J"; //a ceepnted J
+    case 0x0135: return "j"; //a ceepnted j
+    case 0x0136: return "K"; //a ceepnted K
+    case 0x0138: return "K"; //a ceepnted K
+    case 0x0139: return "L"; //a ceepnted L
+    case 0x013A: return "l"; //a ceepnted l
+    case 0x013B: return "L"; //a ceepnted L
+    case 0x013C: return "l"; //a ceepnted l
+    case 0x013D: return "L"; //a ceepnted L
+    case 0x013E: return "l"; //a ceepnted l
+    case 0x013F: return "L"; //a ceepnted L
+    case 0x0140: return "l"; //a ceepnted l
+    case 0x0141: return "L"; //a ceepnted L
+    case 0x0142: return "l"; //a ceepnted l
+    case 0x0143: return "N"; //a ceepnted N
+    case 0x0144: return "n"; //a ceepnted N
+    case 0x0145: return "N"; //a ceepnted N
+    case 0x0146: return "n"; //a ceepnted N
+    case 0x0147: return "N"; //a ceepnted N
+    case 0x0148: return "n"; //a ceepnted N
+    case 0x0149: return "N"; //a ceepnted N
+    case 0x014A: return "n"; //a ceepnted N
+    case 0x014B: return "n"; //a ceepnted n
+    case 0x014C: return "O"; //a ceepnted O
+    case 0x014D: return "o"; //a ceepnted o
+    case 0x014E: return "O"; //a ceepnted O
+    case 0x014F: return "o"; //a ceepnted o
+    case 0x0150: return "O"; //a ceepnted O
+    case 0x0151: return "o"; //a ceepnted o
+    case 0x0152: return "OE";
+    case 0x0153: return "oe";
+    case 0x0154: return "R"; // accepted R
+    case 0x0155: return "r"; // accepted r
+    case 0x0156: return "R"; // accepted R
+    case 0x0157: return "r"; // accepted r
+    case 0x0158: return "R"; // accepted R
+    case 0x0159: return "r"; // accepted r
+    case 0x015A: return "S"; // accepted S
+    case 0x015B: return "s"; // accepted s
+    case 0x015C: return "S"; // accepted S
+    case 0x015D: return "s"; // accepted s
+    case 0x015E: return "S"; // accepted S
+    case 0x015F: return "s"; // accepted s
+    case 0x0160: return "S"; // accepted S
+    case 0x0161: return "s"; // accepted s
+    case 0x0162: return "T"; // accepted T
+    case 0x0163: return "t"; // accepted t
+    case 0x0164: return "T"; // accepted T
+    case 0x0165: return "t"; // accepted t
+    case 0x0166: return "T"; // accepted T
+    case 0x0167: return "t"; // accepted t
+    case 0x0168: return "U"; // accepted U
+    case 0x0169: return "u"; // accepted u
+    case 0x016A: return "U"; // accepted U
+    case 0x016B: return "u"; // accepted u
+    case 0x016C: return "U"; // accepted U
+    case 0x016D: return "u"; // accepted u
+    case 0x016E: return "U"; // accepted U
+    case 0x016F: return "u"; // accepted u
+    case 0x0170: return "U"; // accepted U
+    case 0x0171: return "u"; // accepted u
+    case 0x0172: return "U"; // accepted U
+    case 0x0173: return "u"; // accepted u
+    case 0x0174: return "W"; // accepted W
+    case 0x0175: return "w"; // accepted w
+    case 0x0176: return "Y"; // accepted Y
+    case 0x0177: return "y"; // accepted y
+    case 0x0178: return "Y"; // accepted Y
+    case 0x00: return "";
+    }
+  if (c > 127) return "?";
+  return NULL;
+  }
+
+
+/*========================================================================
+  Converter variants
+  The scanner and the paragraph layout are each compiled in several 
+  variants, for the combinations of options that affect their inner
+  loops, so that those loops test no options at all. The variant 
+  flags are compile-time constants passed to always-inlined functions,
+  and the compiler drops the code for any option that is not set.
+  epub2txt_select_variant() picks the variants before conversion starts
+=========================================================================*/
+#define EPUB2TXT_INLINE static inline __attribute__((always_inline))
+
+// Scanner variant flags
+#define SCAN_ASCII 0x01
+// Fast-forward to the --start paragraph: only paragraph boundaries are
+//  found, and no text is built
+#define SCAN_SKIP 0x02
+
+struct _epub2txt_Scan;
+struct _epub2txt_Para;
+
+typedef struct _epub2txt_Variant
+  {
+  // Scans a document, len bytes of valid UTF-8
+  void (*scan) (struct _epub2txt_Scan *scan, const char *text, int len);
+  // Lays out the next n bytes of a paragraph that is being output
+  void (*layout) (struct _epub2txt_Para *para, const char *s, int n);
+  // Finishes laying out the paragraph
+  void (*layout_end) (struct _epub2txt_Para *para);
+  int width;
+  } epub2txt_Variant;
+
+/*========================================================================
+  epub2txt_Para
+  The paragraph that the scanner is assembling. Text is laid out as 
+  it arrives, so a paragraph is never held in full, however long it
+  is. What is held back is the whitespace at its start, until
+  something that isn't white shows that the paragraph is to be output 
+  at all; after that, only the part of the current word that might 
+  yet be moved to the next line, which is less than the line width.
+  Whitespace here is space, newline and the non-breaking space, which 
+  is C2 A0 in UTF-8; pending_c2 is set when the last byte appended was 
+  a C2 that might be the start of one
+=========================================================================*/
+typedef struct _epub2txt_Para
+  {
+  const epub2txt_Variant *variant;
+  // Bytes held back
+  epub2txt_Bytes held;
+  // Set when anything at all has been appended
+  BOOL used;
+  BOOL nonwhite;
+  BOOL pending_c2;
+  // Set when the paragraph is found not to be white. Its mark has 
+  //  then been written, or skip set if it comes before --start
+  BOOL started;
+  BOOL skip;
+  // Layout state. placed is set when the line that the current word
+  //  starts on is known, and held_c2 when a C2 byte between words 
+  //  might be the start of a non-breaking space
+  BOOL inword;
+  BOOL placed;
+  BOOL held_c2;
+  int col;
+  int wordlen;
+  int words;
+  } epub2txt_Para;
+
+/*========================================================================
+  epub2txt_para_track_white
+=========================================================================*/
+static inline void epub2txt_para_track_white (epub2txt_Para *para, 
+    const char *s, int n)
+  {
+  int i;
+  for (i = 0; i < n && !para->nonwhite; i++)
+    {
+    unsigned char b = (unsigned char)s[i];
+    if (para->pending_c2)
+      {
+      para->pending_c2 = FALSE;
+      if (b != 0xA0) para->nonwhite = TRUE;
+      }
+    else if (b == 0xC2)
+      para->pending_c2 = TRUE;
+    else if (b != ' ' && b != '\n')
+      para->nonwhite = TRUE;
+    }
+  }
+
+/*========================================================================
+  epub2txt_para_is_white
+  Note that an empty paragraph is considered to be whitespace
+=========================================================================*/
+static inline BOOL epub2txt_para_is_white (const epub2txt_Para *para)
+  {
+  return !para->nonwhite && !para->pending_c2;
+  }
+
+/*========================================================================
+  epub2txt_para_start
+  Called when the paragraph turns out not to be white. It will be
+  numbered output_para + 1 when it is flushed
+=========================================================================*/
+static void epub2txt_para_start (epub2txt_Para *para)
+  {
+  int number = output_para + 1;
+  para->started = TRUE;
+  para->skip = (start_para != 0 && number < start_para);
+  if (para->skip)
+    {
+    para->held.len = 0;
+    return;
+    }
+  if (para_mark != 0)
+    if (number % para_mark == 0)
+      {
+      epub2txt_write_para_mark (number);
+      }
+  // Lay out the whitespace held so far. The layout may hold bytes of
+  //  its own, so it gets an empty buffer
+  epub2txt_Bytes held = para->held;
+  memset (&para->held, 0, sizeof (para->held));
+  para->variant->layout (para, held.data, held.len);
+  para->held.overflow |= held.overflow;
+  epub2txt_bytes_free (&held);
+  }
+
+/*========================================================================
+  epub2txt_para_append
+=========================================================================*/
+static inline void epub2txt_para_append (epub2txt_Para *para, 
+    const char *s, int n)
+  {
+  para->used = TRUE;
+  if (!para->started)
+    {
+    epub2txt_bytes_append (&para->held, s, n);
+    epub2txt_para_track_white (para, s, n);
+    if (para->nonwhite) epub2txt_para_start (para);
+    }
+  else if (!para->skip)
+    para->variant->layout (para, s, n);
+  }
+
+/*========================================================================
+  epub2txt_para_append_char
+  Appends c in UTF-8, encoded the same way as klib_string_append_wchar
+=========================================================================*/
+static inline void epub2txt_para_append_char (epub2txt_Para *para, 
+    wchar_t c)
+  {
+  char b[4];
+  int n;
+  if (c < 0x80)
+    {
+    b[0] = (char)c;
+    n = 1;
+    }
+  else if (c < 0x0800)
+    {
+    b[0] = (char)((c >> 6) | 0xC0);
+    b[1] = (char)((c & 0x3F) | 0x80);
+    n = 2;
+    }
+  else if (c < 0x10000)
+    {
+    b[0] = (char)((c >> 12) | 0xE0);
+    b[1] = (char)((c >> 6 & 0x3F) | 0x80);
+    b[2] = (char)((c & 0x3F) | 0x80);
+    n = 3;
+    }
+  else
+    {
+    b[0] = (char)((c >> 18) | 0xF0);
+    b[1] = (char)(((c >> 12) & 0x3F) | 0x80);
+    b[2] = (char)(((c >> 6) & 0x3F) | 0x80);
+    b[3] = (char)((c & 0x3F) | 0x80);
+    n = 4;
+    }
+  epub2txt_para_append (para, b, n);
+  }
+
+/*========================================================================
+  epub2txt_para_clear
+  Readies the paragraph for the next one, keeping its buffer
+=========================================================================*/
+static void epub2txt_para_clear (epub2txt_Para *para)
+  {
+  const epub2txt_Variant *variant = para->variant;
+  epub2txt_Bytes held = para->held;
+  memset (para, 0, sizeof (*para));
+  para->variant = variant;
+  para->held = held;
+  para->held.len = 0;
+  }
+
+
+/*========================================================================
+  epub2txt_layout_word_bytes
+  Adds n bytes to the current word. When wrapping, they are held back
+  until the word is long enough to go on the next line -- which is 
+  then known without seeing the rest of it -- or it ends
+=========================================================================*/
+EPUB2TXT_INLINE void epub2txt_layout_word_bytes (epub2txt_Para *para, 
+    const char *s, int n, const BOOL wrap)
+  {
+  para->wordlen += n;
+  if (!wrap || para->placed)
+    epub2txt_write (s, n);
+  else if (para->col + para->wordlen >= para->variant->width)
+    {
+    epub2txt_write ("\n", 1);
+    para->col = 0;
+    para->placed = TRUE;
+    epub2txt_write (para->held.data, para->held.len);
+    para->held.len = 0;
+    epub2txt_write (s, n);
+    }
+  else
+    epub2txt_bytes_append (&para->held, s, n);
+  }
+
+/*========================================================================
+  epub2txt_layout_words
+  Words are runs of anything but spaces. Spaces and non-breaking
+  spaces before a word are absorbed; a word is written, followed by a
+  single space, when the space after it is reached. When wrapping, a
+  newline is written before any word that would reach the line width
+=========================================================================*/
+EPUB2TXT_INLINE void epub2txt_layout_words (epub2txt_Para *para, 
+    const char *s, int l, const BOOL wrap)
+  {
+  int i = 0;
+  while (i < l)
+    {
+    if (!para->inword)
+      {
+      unsigned char c = (unsigned char)s[i];
+      if (para->held_c2)
+        {
+        para->held_c2 = FALSE;
+        if (c == 0xA0) 
+          {
+          i++;
+          continue;
+          }
+        para->inword = TRUE;
+        epub2txt_layout_word_bytes (para, "\xC2", 1, wrap);
+        continue;
+        }
+      if (c == ' ')
+        {
+        i++;
+        continue;
+        }
+      if (c == 0xC2)
+        {
+        para->held_c2 = TRUE;
+        i++;
+        continue;
+        }
+      para->inword = TRUE;
+      }
+
+    const char *space = memchr (s + i, ' ', l - i);
+    int n = space ? space - (s + i) : l - i;
+    if (n > 0) epub2txt_layout_word_bytes (para, s + i, n, wrap);
+    i += n;
+    if (space)
+      {
+      epub2txt_write (para->held.data, para->held.len);
+      epub2txt_write (" ", 1);
+      para->held.len = 0;
+      para->words++;
+      para->col += para->wordlen + 1;
+      para->wordlen = 0;
+      para->inword = FALSE;
+      para->placed = FALSE;
+      i++;
+      }
+    }
+  }
+
+/*========================================================================
+  epub2txt_layout_words_end
+=========================================================================*/
+EPUB2TXT_INLINE void epub2txt_layout_words_end (epub2txt_Para *para, 
+    const BOOL wrap)
+  {
+  if (para->held_c2)
+    {
+    para->inword = TRUE;
+    epub2txt_layout_word_bytes (para, "\xC2", 1, wrap);
+    }
+  if (wrap && !para->placed 
+      && para->col + para->wordlen >= para->variant->width)
+    {
+    epub2txt_write ("\n", 1);
+    }
+  epub2txt_write (para->held.data, para->held.len);
+  para->held.len = 0;
+  if (para->wordlen > 0) para->words++;
+  }
+
+/*========================================================================
+  epub2txt_layout_trim
+  Lays out text of the paragraph as words, with runs of spaces
+  collapsed, but without wrapping lines
+=========================================================================*/
+static void epub2txt_layout_trim (epub2txt_Para *para, const char *s, 
+    int n)
+  {
+  epub2txt_layout_words (para, s, n, FALSE);
+  }
+
+/*========================================================================
+  epub2txt_layout_trim_end
+  Ends a paragraph laid out by epub2txt_layout_trim
+=========================================================================*/
+static void epub2txt_layout_trim_end (epub2txt_Para *para)
+  {
+  epub2txt_layout_words_end (para, FALSE);
+  }
+
+/*========================================================================
+  epub2txt_layout_wrap
+  Lays out text of the paragraph as words, wrapped to the line width
+=========================================================================*/
+static void epub2txt_layout_wrap (epub2txt_Para *para, const char *s, 
+    int n)
+  {
+  epub2txt_layout_words (para, s, n, TRUE);
+  }
+
+/*========================================================================
+  epub2txt_layout_wrap_end
+  Ends a paragraph laid out by epub2txt_layout_wrap
+=========================================================================*/
+static void epub2txt_layout_wrap_end (epub2txt_Para *para)
+  {
+  epub2txt_layout_words_end (para, TRUE);
+  }
+
+/*========================================================================
+  epub2txt_layout_verbatim
+  Writes text of the paragraph as it is. While it is quicker just to
+  dump the para to stdout in unlimited-line-length mode, doing this
+  doesn't get us the benefit of trimming whitespace, etc
+=========================================================================*/
+static void epub2txt_layout_verbatim (epub2txt_Para *para, const char *s, 
+    int n)
+  {
+  epub2txt_write (s, n);
+  if (stats_enabled) 
+    para->words += epub2txt_count_words (s, n, &para->inword);
+  }
+
+/*========================================================================
+  epub2txt_layout_verbatim_end
+  Ends a paragraph written by epub2txt_layout_verbatim
+=========================================================================*/
+static void epub2txt_layout_verbatim_end (epub2txt_Para *para)
+  {
+  epub2txt_write ("\n", 1);
+  }
+
+
+/*========================================================================
+  epub2txt_flush_para
+  Ends the paragraph, and readies it for the next. Most of the work of
+  laying out a paragraph is done as it is scanned, and is counted as
+  scanning by --stats
+=========================================================================*/
+void epub2txt_flush_para (epub2txt_Para *para)
+  {
+  KLIB_IN
+  // A C2 byte at the very end isn't a non-breaking space
+  if (!para->started && para->pending_c2) 
+    epub2txt_para_start (para);
+  output_para++;
+  if (para->started && !para->skip)
+    {
+    epub2txt_stats_enter (STAGE_WRAP);
+    para->variant->layout_end (para);
+    written_paras++;
+    if (stats_enabled) 
+      {
+      book_stats.paragraphs++;
+      book_stats.words += para->words;
+      }
+    if (count_mode) item_counts.paras++;
+    epub2txt_stats_leave ();
+    }
+  epub2txt_para_clear (para);
+  KLIB_OUT
+  }
+
+
+/*========================================================================
+  epub2txt_line_break
+=========================================================================*/
+void epub2txt_line_break (void)
+  {
+  KLIB_IN
+  if (start_para == 0 || output_para >= start_para)
+    epub2txt_write ("\n", 1);
+  KLIB_OUT
+  }
+
+
+/*========================================================================
+  epub2txt_para_break
+=========================================================================*/
+void epub2txt_para_break (void)
+  {
+  KLIB_IN
+  if (start_para == 0 || output_para >= start_para)
+    epub2txt_write ("\n\n", 2);
+  KLIB_OUT
+  }
+
+
+/*========================================================================
+  epub2txt_Scan
+  State of the scanner. It is kept here, rather than in the scanner's
+  locals, so that a document can be scanned a block at a time; the
+  normalization filters share it too
+=========================================================================*/
+typedef enum {MODE_ANY=0, MODE_INTAG = 1, MODE_ENTITY = 2} epub2txt_Mode;
+
+typedef struct _epub2txt_Scan
+  {
+  epub2txt_Para para;
+  BOOL inbody;
+  // Whether the previous character of the document, tags and all,
+  //  was a space
+  BOOL last_space;
+  epub2txt_Mode mode;
+  // Only the part of a tag up to the first space matters, and only
+  //  if it is short enough to be one we recognize; taglen is
+  //  sizeof (tag) once it is not
+  char tag[16];
+  int taglen;
+  BOOL tag_named;
+  epub2txt_Bytes entity;
+  } epub2txt_Scan;
+
+/*========================================================================
+  Normalization filters
+  Every character of the document goes through a chain of filters, 
+  all inlined into the scanner's loop, so normalization is done in
+  the same single pass that finds the markup. A filter may change
+  the character, or consume it, and returns FALSE if it is to go no
+  further. Input filters see every character, before markup is
+  recognized; text filters see only characters of body text, which
+  are added to the paragraph if they get to the end of the chain.
+  To add a normalization step, write its filter and add it to one of
+  these lists. A filter that can never change ordinary text -- 
+  anything but markup, whitespace and, in ASCII mode, non-ASCII 
+  characters -- is one the scanner can skip when copying such text
+=========================================================================*/
+#define EPUB2TXT_INPUT_FILTERS(F) \
+  F (epub2txt_filter_dos_eol) \
+  F (epub2txt_filter_tab) 
+
+#define EPUB2TXT_TEXT_FILTERS(F) \
+  F (epub2txt_filter_collapse_space) \
+  F (epub2txt_filter_ascii) 
+
+#define EPUB2TXT_APPLY_FILTER(f) if (!f (scan, c, variant)) return FALSE;
+
+/*========================================================================
+  epub2txt_filter_dos_eol
+  Input filter: drops the carriage return of a DOS line ending
+=========================================================================*/
+EPUB2TXT_INLINE BOOL epub2txt_filter_dos_eol (epub2txt_Scan *scan, 
+    wchar_t *c, const int variant)
+  {
+  return *c != 13;
+  }
+
+/*========================================================================
+  epub2txt_filter_tab
+  Input filter: a tab is a space
+=========================================================================*/
+EPUB2TXT_INLINE BOOL epub2txt_filter_tab (epub2txt_Scan *scan, 
+    wchar_t *c, const int variant)
+  {
+  if (*c == 9) *c = ' ';
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_filter_collapse_space
+  Text filter: a line break in the source is a space, and a space after
+  a space is dropped. Note that a space that follows a line break is not
+=========================================================================*/
+EPUB2TXT_INLINE BOOL epub2txt_filter_collapse_space (epub2txt_Scan *scan, 
+    wchar_t *c, const int variant)
+  {
+  if (*c == ' ' || *c == '\n')
+    {
+    if (scan->last_space) return FALSE;
+    *c = ' ';
+    }
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_filter_ascii
+  Text filter: in ASCII mode, replaces a non-ASCII character with its
+  transliteration, if it has one
+=========================================================================*/
+EPUB2TXT_INLINE BOOL epub2txt_filter_ascii (epub2txt_Scan *scan, 
+    wchar_t *c, const int variant)
+  {
+  if (!(variant & SCAN_ASCII) || (*c < 128 && *c != 0)) return TRUE;
+  const char *s = epub2txt_transliterate (*c);
+  if (s == NULL) return TRUE;
+  epub2txt_para_append (&scan->para, s, strlen (s));
+  return FALSE;
+  }
+
+/*========================================================================
+  epub2txt_input_char
+  Applies the input filters, returning FALSE if c is dropped
+=========================================================================*/
+EPUB2TXT_INLINE BOOL epub2txt_input_char (epub2txt_Scan *scan, 
+    wchar_t *c, const int variant)
+  {
+  EPUB2TXT_INPUT_FILTERS (EPUB2TXT_APPLY_FILTER)
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_text_char
+  Applies the text filters to c, and adds what is left to the paragraph
+=========================================================================*/
+EPUB2TXT_INLINE BOOL epub2txt_text_char (epub2txt_Scan *scan, 
+    wchar_t ch, const int variant)
+  {
+  wchar_t *c = &ch;
+  EPUB2TXT_TEXT_FILTERS (EPUB2TXT_APPLY_FILTER)
+  epub2txt_para_append_char (&scan->para, *c);
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_decode_utf8
+  s must be a complete and legal multi-byte sequence
+=========================================================================*/
+EPUB2TXT_INLINE wchar_t epub2txt_decode_utf8 (const unsigned char *s, 
+    int *n)
+  {
+  if (s[0] < 0xE0)
+    {
+    *n = 2;
+    return ((s[0] & 0x1F) << 6) | (s[1] & 0x3F);
+    }
+  if (s[0] < 0xF0)
+    {
+    *n = 3;
+    return ((s[0] & 0x0F) << 12) | ((s[1] & 0x3F) << 6) | (s[2] & 0x3F);
+    }
+  *n = 4;
+  return ((s[0] & 0x07) << 18) | ((s[1] & 0x3F) << 12) 
+    | ((s[2] & 0x3F) << 6) | (s[3] & 0x3F);
+  }
+
+/*========================================================================
+  epub2txt_classify_tag
+  name is the tag up to the first space
+=========================================================================*/
+typedef enum {TAG_OTHER = 0, TAG_BODY, TAG_END_BODY, TAG_END_BLOCK, 
+  TAG_PARA, TAG_LINE} epub2txt_Tag;
+
+static epub2txt_Tag epub2txt_classify_tag (const char *name)
+  {
+  if (strcasecmp (name, "body") == 0) 
+    return TAG_BODY;
+  if (strcasecmp (name, "/body") == 0) 
+    return TAG_END_BODY;
+  if (strcasecmp (name, "/blockquote") == 0
+      || strcasecmp (name, "/h1") == 0
+      || strcasecmp (name, "/h2") == 0 
+      || strcasecmp (name, "/h3") == 0
+      || strcasecmp (name, "/h4") == 0
+      || strcasecmp (name, "/div") == 0) 
+    return TAG_END_BLOCK;
+  if (strcasecmp (name, "p/") == 0 || strcasecmp (name, "/p") == 0)
+    return TAG_PARA;
+  if (strcasecmp (name, "br/") == 0 || strcasecmp (name, "br") == 0
+      || strcasecmp (name, "b/") == 0 || strcasecmp (name, "b") == 0)
+    return TAG_LINE;
+  return TAG_OTHER;
+  }
+
+/*========================================================================
+  epub2txt_end_para
+  Outputs the paragraph so far and, if it was not empty, the break
+  that ends it
+=========================================================================*/
+static void epub2txt_end_para (epub2txt_Scan *scan, BOOL line_only)
+  {
+  BOOL white = epub2txt_para_is_white (&scan->para);
+  epub2txt_flush_para (&scan->para); 
+  if (!white)
+    {
+    if (line_only)
+      epub2txt_line_break ();
+    else
+      epub2txt_para_break ();
+    }
+  }
+
+/*========================================================================
+  epub2txt_special
+  Bytes that end a run of ordinary body text
+=========================================================================*/
+static const unsigned char epub2txt_special[256] = 
+  {
+  ['<'] = 1, ['&'] = 1, [' '] = 1, ['\n'] = 1, ['\t'] = 1, ['\r'] = 1
+  };
+
+/*========================================================================
+  epub2txt_markup
+  Bytes that start markup
+=========================================================================*/
+static const unsigned char epub2txt_markup[256] = 
+  {
+  ['<'] = 1, ['&'] = 1
+  };
+
+/*========================================================================
+  epub2txt_skip_run
+  Accounts for a run of characters that the fast-forward scanner has
+  passed over, none of which is markup. If they are body text, the 
+  paragraph is used if any of them would have been added to it: any
+  but a carriage return, or a space after a space. The last character
+  but a carriage return decides last_space, as it would in the full 
+  scanner, where a tab has become a space
+=========================================================================*/
+EPUB2TXT_INLINE void epub2txt_skip_run (epub2txt_Scan *scan, 
+    const unsigned char *s, int n, BOOL text)
+  {
+  int j;
+  for (j = 0; text && j < n && !scan->para.used; j++)
+    {
+    if (s[j] == '\r') continue;
+    BOOL space = (s[j] == ' ' || s[j] == '\t' || s[j] == '\n');
+    if (!space || !scan->last_space) scan->para.used = TRUE;
+    scan->last_space = (s[j] == ' ' || s[j] == '\t');
+    }
+  for (j = n - 1; j >= 0 && s[j] == '\r'; j--)
+    ;
+  if (j >= 0) scan->last_space = (s[j] == ' ' || s[j] == '\t');
+  }
+
+/*========================================================================
+  epub2txt_skip_para
+  What epub2txt_end_para comes to for a paragraph before the --start 
+  paragraph: it is only counted
+=========================================================================*/
+EPUB2TXT_INLINE void epub2txt_skip_para (epub2txt_Scan *scan)
+  {
+  output_para++;
+  scan->para.used = FALSE;
+  }
+
+/*========================================================================
+  epub2txt_scan_text
+  The scanner proper, specialized by the variant flags. Runs of body 
+  text that no filter would change are copied into the paragraph in
+  one go; everything else is handled a character at a time. With
+  SCAN_SKIP, the text is not built at all, and the paragraph only
+  records whether anything would have been added to it; the scan stops
+  just after the paragraph before the --start paragraph ends. Returns
+  the number of bytes scanned
+=========================================================================*/
+EPUB2TXT_INLINE int epub2txt_scan_text (epub2txt_Scan *scan, 
+    const char *_text, int len, const int variant)
+  {
+  const unsigned char *text = (const unsigned char *)_text;
+  epub2txt_Mode mode = scan->mode;
+  char *tag = scan->tag;
+  int taglen = scan->taglen;
+  BOOL tag_named = scan->tag_named;
+  epub2txt_Bytes *entity = &scan->entity;
+  int i = 0;
+
+  while (i < len)
+    {
+    if (variant & SCAN_SKIP)
+      {
+      // Only the character that ends the run need be looked at
+      //  individually: in text, the start of markup; in an entity or a
+      //  tag whose name we have, the end of it
+      int start = i;
+      const unsigned char *p;
+      if (mode == MODE_ANY)
+        {
+        while (i < len && !epub2txt_markup[text[i]]) i++;
+        }
+      else if (mode == MODE_ENTITY || tag_named 
+          || taglen == sizeof (scan->tag))
+        {
+        p = memchr (text + i, mode == MODE_ENTITY ? ';' : '>', len - i);
+        i = p ? p - text : len;
+        }
+      if (i > start)
+        {
+        epub2txt_skip_run (scan, text + start, i - start, 
+          mode == MODE_ANY && scan->inbody);
+        if (i == len) break;
+        }
+      }
+    else if (mode == MODE_ANY && scan->inbody)
+      {
+      int start = i;
+      while (i < len && !epub2txt_special[text[i]]
+          && !((variant & SCAN_ASCII) && text[i] >= 0x80))
+        i++;
+      if (i > start)
+        {
+        epub2txt_para_append (&scan->para, _text + start, i - start);
+        scan->last_space = FALSE;
+        if (i == len) break;
+        }
+      }
+
+    wchar_t c = text[i];
+    int n = 1;
+    // When skipping, a multi-byte character can be taken a byte at a 
+    //  time: all that matters is that it is not markup or a space
+    if (c >= 0x80 && !(variant & SCAN_SKIP)) 
+      c = epub2txt_decode_utf8 (text + i, &n);
+    i += n;
+    if (!epub2txt_input_char (scan, &c, variant))
+      continue;
+
+    if (mode == MODE_ANY)
+      {
+      if (c == '<')
+        {
+        mode = MODE_INTAG;
+        taglen = 0;
+        tag_named = FALSE;
+        }
+      else if (c == '&')
+        mode = MODE_ENTITY;
+      else if (scan->inbody)
+        epub2txt_text_char (scan, c, variant);
+      }
+    else if (mode == MODE_ENTITY && c == ';')
+      {
+      if (scan->inbody && (variant & SCAN_SKIP))
+        scan->para.used = TRUE;
+      else if (scan->inbody)
+        {
+        char trans[20];
+        epub2txt_bytes_append (entity, "", 1);
+        epub2txt_translate_entity (entity->overflow ? "" : entity->data, 
+          trans);
+        epub2txt_para_append (&scan->para, trans, strlen (trans));
+        }
+      entity->len = 0;
+      mode = MODE_ANY;
+      }
+    else if (mode == MODE_ENTITY)
+      {
+      if (variant & SCAN_SKIP)
+        ;
+      else if (n == 1)
+        {
+        char b = (char)c;
+        epub2txt_bytes_append (entity, &b, 1);
+        }
+      else
+        epub2txt_bytes_append (entity, _text + i - n, n);
+      }
+    else if (c == '>')
+      {
+      tag[taglen < (int)sizeof (scan->tag) ? taglen : 0] = 0;
+      epub2txt_Tag t = epub2txt_classify_tag (tag);
+      if (t == TAG_BODY)
+        scan->inbody = TRUE;
+      else if (t == TAG_END_BODY || t == TAG_END_BLOCK
+          || (scan->inbody && (t == TAG_PARA || t == TAG_LINE)))
+        {
+        if (variant & SCAN_SKIP)
+          epub2txt_skip_para (scan);
+        else
+          epub2txt_end_para (scan, t == TAG_LINE);
+        if (t == TAG_END_BODY) scan->inbody = FALSE;
+        }
+      mode = MODE_ANY;
+      if ((variant & SCAN_SKIP) && output_para + 1 >= start_para)
+        {
+        scan->last_space = FALSE;
+        break;
+        }
+      }
+    else if (!tag_named)
+      {
+      if (c == ' ')
+        tag_named = TRUE;
+      else if (c < 128 && taglen < (int)sizeof (scan->tag) - 1)
+        tag[taglen++] = (char)c;
+      else
+        taglen = sizeof (scan->tag);
+      }
+    scan->last_space = (c == ' ');
+    }
+
+  scan->mode = mode;
+  scan->taglen = taglen;
+  scan->tag_named = tag_named;
+  return i;
+  }
+
+/*========================================================================
+  epub2txt_scan_utf8
+  Paragraphs before the --start paragraph are skipped by the fast-
+  forward scanner, which hands over to the full one where that 
+  paragraph begins
+=========================================================================*/
+static void epub2txt_scan_utf8 (epub2txt_Scan *scan, const char *text, 
+    int len)
+  {
+  int i = 0;
+  if (output_para + 1 < start_para)
+    i = epub2txt_scan_text (scan, text, len, SCAN_SKIP);
+  epub2txt_scan_text (scan, text + i, len - i, 0);
+  }
+
+/*========================================================================
+  epub2txt_scan_ascii
+  As epub2txt_scan_utf8, but with non-ASCII characters transliterated
+=========================================================================*/
+static void epub2txt_scan_ascii (epub2txt_Scan *scan, const char *text, 
+    int len)
+  {
+  int i = 0;
+  if (output_para + 1 < start_para)
+    i = epub2txt_scan_text (scan, text, len, SCAN_SKIP | SCAN_ASCII);
+  epub2txt_scan_text (scan, text + i, len - i, SCAN_ASCII);
+  }
+
+/*========================================================================
+  epub2txt_select_variant
+=========================================================================*/
+void epub2txt_select_variant (epub2txt_Variant *variant, BOOL ascii, 
+    int width, BOOL notrim)
+  {
+  variant->scan = ascii ? epub2txt_scan_ascii : epub2txt_scan_utf8;
+  if (width != 0)
+    {
+    variant->layout = epub2txt_layout_wrap;
+    variant->layout_end = epub2txt_layout_wrap_end;
+    }
+  else if (notrim)
+    {
+    variant->layout = epub2txt_layout_verbatim;
+    variant->layout_end = epub2txt_layout_verbatim_end;
+    }
+  else
+    {
+    variant->layout = epub2txt_layout_trim;
+    variant->layout_end = epub2txt_layout_trim_end;
+    }
+  variant->width = width;
+  }
+
+
+/*========================================================================
+  epub2txt_scan_window
+  Scans as much of len bytes of a document as is legal UTF-8, up to
+  any NUL, and returns how many bytes that was. The rest is carried 
+  over to the next window, as it may be a character split between 
+  them. done is set if nothing more is to be scanned: this window is
+  the last, or it has more than a split character left over, or a 
+  paragraph has outgrown the memory budget
+=========================================================================*/
+static int epub2txt_scan_window (epub2txt_Scan *scan, const char *text, 
+    int len, BOOL at_end, BOOL *done, const char *name, klib_Error **error)
+  {
+  const char *nul = memchr (text, 0, len);
+  if (nul) 
+    {
+    len = nul - text;
+    *done = TRUE;
+    }
+  int legal = LegalUTF8PrefixLength ((const UTF8 *)text, 
+    (const UTF8 *)text + len);
+  scan->para.variant->scan (scan, text, legal);
+  if (len - legal >= 4 || at_end) *done = TRUE;
+  if (scan->para.held.overflow || scan->entity.overflow)
+    {
+    *error = epub2txt_budget_error (name, "A paragraph or entity");
+    *done = TRUE;
+    }
+  return legal;
+  }
+
 /*========================================================================
-  epub2txt_get_items
+  epub2txt_HtmlReader
+  A document that can't be scanned where it is, which is collected a
+  window at a time as it is read
 =========================================================================*/
-klib_List *epub2txt_get_items (const char *opf, klib_Error **error)
+typedef struct _epub2txt_HtmlReader
   {
-  KLIB_OUT
-  klib_Xml *x = klib_xml_read_file (opf, error);
-  if (*error == NULL)
+  epub2txt_Scan *scan;
+  const char *name;
+  char chunk[SCAN_CHUNK_SIZE];
+  int fill;
+  long long size;
+  BOOL done;
+  klib_Error *error;
+  } epub2txt_HtmlReader;
+
+/*========================================================================
+  epub2txt_html_sink
+  Scans each window of a document as it fills. The last byte read is
+  always held back, as it is not scanned if it turns out to be the 
+  last of the document
+=========================================================================*/
+static BOOL epub2txt_html_sink (void *ctx, const BYTE *data, int len)
+  {
+  epub2txt_HtmlReader *r = ctx;
+  r->size += len;
+  while (len > 0 && !r->done && !preview_done)
     {
-    klib_log_debug ("Opened file %s", opf);
-    BOOL got_manifest = FALSE;
-    XMLNode *manifest = NULL;
+    int n = len < SCAN_CHUNK_SIZE - r->fill ? len : SCAN_CHUNK_SIZE - r->fill;
+    memcpy (r->chunk + r->fill, data, n);
+    r->fill += n;
+    data += n;
+    len -= n;
+    if (r->fill == SCAN_CHUNK_SIZE)
+      {
+      epub2txt_stats_enter (STAGE_SCAN);
+      int used = epub2txt_scan_window (r->scan, r->chunk, r->fill - 1, 
+        FALSE, &r->done, r->name, &r->error);
+      epub2txt_stats_leave ();
+      r->fill -= used;
+      memmove (r->chunk, r->chunk + used, r->fill);
+      }
+    }
+  return !r->done && !preview_done;
+  }
 
-    XMLNode *root = klib_xml_get_root (x); // package
-    int i, l = root->n_children;
-    for (i = 0; i < l; i++)
+/*========================================================================
+  epub2txt_dedup_usable
+  Whether the output of the next spine document depends on nothing but
+  its contents, so that it can be reused for a document with the same 
+  contents: it does not if paragraphs are numbered, or some of them
+  are to be skipped. Within a memory budget, nothing is kept from one
+  book for the next
+=========================================================================*/
+static BOOL epub2txt_dedup_usable (void)
+  {
+  return max_memory == 0 && para_mark == 0 
+    && (start_para == 0 || output_para >= start_para);
+  }
+
+/*========================================================================
+  epub2txt_dedup_sink
+  Collects a small document, to be hashed. It overflows if the document
+  turns out not to be small after all
+=========================================================================*/
+static BOOL epub2txt_dedup_sink (void *ctx, const BYTE *data, int len)
+  {
+  epub2txt_Bytes *b = ctx;
+  if (len > DEDUP_ITEM_MAX - b->len)
+    {
+    b->overflow = TRUE;
+    return FALSE;
+    }
+  return epub2txt_bytes_sink (ctx, data, len);
+  }
+
+/*========================================================================
+  epub2txt_dedup_replay
+  Writes the output of a document that was scanned before, in place of
+  scanning one with the same contents, and counts it as that did
+=========================================================================*/
+static void epub2txt_dedup_replay (const epub2txt_DedupItem *item)
+  {
+  epub2txt_stats_enter (STAGE_SCAN);
+  epub2txt_write (item->text, item->len);
+  output_para += item->flushes;
+  written_paras += item->paras;
+  if (count_mode) item_counts.paras += item->paras;
+  if (stats_enabled)
+    {
+    book_stats.paragraphs += item->paras;
+    book_stats.words += item->words;
+    book_stats.repeated_items++;
+    book_stats.repeated_bytes += item->size;
+    }
+  epub2txt_stats_leave ();
+  }
+
+/*========================================================================
+  epub2txt_parse_html
+  The document is scanned as UTF-8, up to the first byte that is not 
+  part of a legal UTF-8 sequence. The last byte of the file is ignored,
+  as it always has been. The document is scanned in windows, so
+  only a partial paragraph need be held in memory; a UTF-8 sequence
+  that is split between windows is carried over to the next. If the
+  document is already in memory, the windows are of it, where it is;
+  otherwise it is read into them as it is decompressed.
+
+  A small document is hashed before it is scanned, and if one with the
+  same contents has been scanned before, its output is written again
+  instead. A small document that has to be decompressed is read whole
+  for that
+=========================================================================*/
+void epub2txt_parse_html (epub2txt_Vfs *vfs, const char *name, 
+    const epub2txt_Variant *variant, klib_Error **error)
+  {
+  KLIB_IN
+  klib_log_info ("Parsing %s", name);
+  epub2txt_Scan scan;
+  memset (&scan, 0, sizeof (scan));
+  scan.para.variant = variant;
+  epub2txt_stats_enter (STAGE_UNZIP);
+  long long size = 0;
+  const BYTE *data = epub2txt_vfs_map (vfs, name, &size, error);
+  BOOL got = data != NULL;
+  BOOL mapped = got;
+  BOOL dedup = epub2txt_dedup_usable ();
+  epub2txt_Bytes copy;
+  memset (&copy, 0, sizeof (copy));
+  BOOL read_whole = FALSE;
+  if (!got && *error == NULL && dedup)
+    {
+    long long entry_size = epub2txt_vfs_size (vfs, name);
+    if (entry_size >= 0 && entry_size <= DEDUP_ITEM_MAX)
       {
-      XMLNode *r1 = root->children[i];
-      // Add workaround for bug #4 
-      if (strcmp (r1->tag, "manifest") == 0 || strstr (r1->tag, ":manifest"))
+      got = epub2txt_vfs_read (vfs, name, epub2txt_dedup_sink, &copy, 
+        error);
+      if (copy.overflow)
         {
-        manifest = r1;
-        got_manifest = TRUE;
+        // The archive was wrong about the size; the document is read
+        //  again as it would have been
+        got = FALSE;
+        epub2txt_bytes_free (&copy);
+        }
+      else
+        {
+        read_whole = TRUE;
+        data = (const BYTE *)copy.data;
+        size = copy.len;
         }
       }
-
-    if (!got_manifest)
+    }
+  uint64_t hash = 0;
+  const epub2txt_DedupItem *item = NULL;
+  // What scanning does to the counters is kept along with the output
+  int flushes_before = output_para, paras_before = written_paras;
+  long long words_before = book_stats.words;
+  dedup = dedup && got && data && size <= DEDUP_ITEM_MAX;
+  if (dedup)
+    {
+    hash = epub2txt_hash64 (data, size, 0);
+    item = epub2txt_dedup_find (hash, size);
+    }
+  if (item)
+    epub2txt_dedup_replay (item);
+  else if (got)
+    {
+    epub2txt_stats_enter (STAGE_SCAN);
+    if (dedup) 
       {
-      *error = klib_error_new (ENOENT, "File %s has no manifest", opf);
-      KLIB_OUT
-      return NULL; 
+      epub2txt_dedup_record_begin ();
+      dedup_from = output_len;
       }
- 
-    klib_List *ret = klib_list_new ();
+    long long pos = 0;
+    BOOL done = FALSE;
+    while (!done && pos < size - 1 && !preview_done)
+      {
+      int len = size - 1 - pos < SCAN_CHUNK_SIZE 
+        ? (int)(size - 1 - pos) : SCAN_CHUNK_SIZE;
+      pos += epub2txt_scan_window (&scan, (const char *)data + pos, len, 
+        pos + len == size - 1, &done, name, error);
+      }
+    epub2txt_stats_leave ();
+    }
+  else if (*error == NULL && !read_whole)
+    {
+    epub2txt_HtmlReader r;
+    r.scan = &scan;
+    r.name = name;
+    r.fill = 0;
+    r.size = 0;
+    r.done = FALSE;
+    r.error = NULL;
+    got = epub2txt_vfs_read (vfs, name, epub2txt_html_sink, &r, error);
+    if (got && !r.done && !preview_done && r.fill > 1)
+      {
+      epub2txt_stats_enter (STAGE_SCAN);
+      epub2txt_scan_window (&scan, r.chunk, r.fill - 1, TRUE, &r.done, 
+        name, &r.error);
+      epub2txt_stats_leave ();
+      }
+    size = r.size;
+    if (r.error && *error == NULL)
+      *error = r.error;
+    else if (r.error)
+      klib_error_free (r.error);
+    }
+  if (mapped) epub2txt_vfs_unmap (vfs, data, size);
+  epub2txt_stats_leave ();
+  if (got)
+    {
+    if (stats_enabled)
+      {
+      if (!item) book_stats.scanned_bytes += size;
+      book_stats.spine_items++;
+      }
+    epub2txt_stats_enter (STAGE_SCAN);
+    if (*error == NULL && scan.para.used)
+      epub2txt_flush_para (&scan.para); 
+    epub2txt_stats_leave ();
+    } 
+  else if (*error == NULL)
+    *error = klib_error_new (ENOENT, "Can't read file %s\n", name);
+  if (dedup_from >= 0)
+    {
+    epub2txt_dedup_record (output_buff + dedup_from, 
+      output_len - dedup_from);
+    dedup_from = -1;
+    epub2txt_dedup_record_end (hash, size, output_para - flushes_before, 
+      written_paras - paras_before, book_stats.words - words_before, 
+      *error == NULL && !preview_done);
+    }
+  epub2txt_bytes_free (&copy);
+  epub2txt_bytes_free (&scan.para.held);
+  epub2txt_bytes_free (&scan.entity);
+  KLIB_OUT
+  }
 
+
+/*========================================================================
+  epub2txt_get_root_file
+  container.xml is parsed into a DOM even within a memory budget, as 
+  it is normally tiny. The DOM takes several times the size of the 
+  file, so it is refused if XML_DOM_FACTOR times that would exceed 
+  the budget
+=========================================================================*/
+#define XML_DOM_FACTOR 8
+klib_String *epub2txt_get_root_file (epub2txt_Vfs *vfs, 
+    const char *container, klib_Error **error)
+  {
+  KLIB_IN
+  klib_String *ret = NULL;
+  long long dom_size = 0;
+  klib_Xml *x = NULL;
+  epub2txt_Entry entry;
+  FILE *f = epub2txt_entry_open (vfs, container, &entry, error);
+  if (f && max_memory != 0)
+    {
+    dom_size = XML_DOM_FACTOR * entry.size;
+    if (!epub2txt_budget_take (dom_size))
+      {
+      dom_size = 0;
+      *error = epub2txt_budget_error (container, "Parsing");
+      }
+    }
+  if (f && *error == NULL) x = klib_xml_read_stream (f, container, error);
+  epub2txt_entry_close (vfs, &entry, f);
+  if (*error == NULL)
+    {
+    XMLNode *root = klib_xml_get_root (x); // container 
+    int i, l = root->n_children;
     for (i = 0; i < l; i++)
       {
       XMLNode *r1 = root->children[i];
-      // Add workaround for bug #4
-      if (strcmp (r1->tag, "spine") == 0 || strstr (r1->tag, ":spine"))
+      if (strcmp (r1->tag, "rootfiles") == 0)
         {
-        int j, l2 = r1->n_children;
-        for (j = 0; j < l2; j++)
+        XMLNode *rootfiles = r1;
+        int i, l = rootfiles->n_children;
+        for (i = 0; i < l; i++)
           {
-          XMLNode *r2 = r1->children[j]; // itemref
-          int k, nattrs = r2->n_attributes;
-          for (k = 0; k < nattrs; k++)
+          XMLNode *r1 = rootfiles->children[i];
+          if (strcmp (r1->tag, "rootfile") == 0)
             {
-            char *name = r2->attributes[k].name;
-            if (strcmp (name, "idref") == 0)
+            int k, nattrs = r1->n_attributes;
+            for (k = 0; k < nattrs; k++)
               {
-              char *value= r2->attributes[k].value;
-              int m;
-              for (m = 0; m < manifest->n_children; m++)
+              char *name = r1->attributes[k].name;
+              char *value = r1->attributes[k].value;
+              if (strcmp (name, "full-path") == 0)
                 {
-                XMLNode *r3 = manifest->children[m]; // item
-                int n, nattrs = r3->n_attributes;
-                for (n = 0; n < nattrs; n++)
-                  {
-                  char *name2 = r3->attributes[n].name;
-                  char *val2 = r3->attributes[n].value;
-                  if (strcmp (name2, "id") == 0 && 
-                      strcmp (val2, value) == 0)
-                    {
-                    int p;
-                    for (p = 0; p < nattrs; p++)
-                      {
-                      char *name2 = r3->attributes[p].name;
-                      char *val2 = r3->attributes[p].value;
-                      if (strcmp (name2, "href") == 0)
-                        {
-                        klib_String *ss = klib_string_new (val2);
-                        klib_list_append (ret, (klib_Object *)ss);
-                        klib_string_free (ss);
-                        }
-                      }
-                    }
-                  }
+                if (ret) klib_string_free (ret);
+                ret = klib_string_new (value);
                 }
               }
             }
@@ -120,829 +2362,874 @@ klib_List *epub2txt_get_items (const char *opf, klib_Error **error)
       }
 
     klib_xml_free (x);
-    KLIB_OUT
-    return ret;
     }
-  else
+
+  if (ret == NULL && *error == NULL)
+    *error = klib_error_new  
+      (ENOENT, "container.xml does not specify a root file\n");
+  epub2txt_budget_give (dom_size);
+  KLIB_OUT
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_select_range
+  Parses a --spine range, a comma-separated list of spine positions
+  (counting from 1) and ranges of them, such as "1,3-5,8-". A range
+  with no start begins at 1, and one with no end goes on to the end of
+  the spine. The positions in the range are marked in selected, which
+  has n elements; selected may be NULL just to check the syntax.
+  Returns FALSE if the range is not valid or, when selected is given,
+  if part of it starts beyond the end of the spine
+=========================================================================*/
+BOOL epub2txt_select_range (const char *range, int n, BOOL *selected)
+  {
+  const char *p = range;
+  do
     {
-    KLIB_OUT
-    return NULL;
+    char *end;
+    long first = 1, last = -1;
+    if (*p != '-')
+      {
+      first = strtol (p, &end, 10);
+      if (end == p || first < 1) return FALSE;
+      p = end;
+      last = first;
+      }
+    if (*p == '-')
+      {
+      p++;
+      last = -1;
+      if (isdigit ((unsigned char)*p))
+        {
+        last = strtol (p, &end, 10);
+        if (last < first) return FALSE;
+        p = end;
+        }
+      }
+    if (*p != 0 && *p != ',') return FALSE;
+    if (selected)
+      {
+      long i;
+      if (first > n) return FALSE;
+      for (i = first; i <= n && (last < 0 || i <= last); i++)
+        selected[i - 1] = TRUE;
+      }
+    } while (*p++ == ',');
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_entry_name
+  The name of the archive entry that href refers to, from a document
+  in the directory base: the fragment is removed, and "." and ".." are
+  resolved
+=========================================================================*/
+static klib_String *epub2txt_entry_name (const char *base, const char *href)
+  {
+  klib_String *ret = klib_string_new_empty ();
+  klib_String *path = klib_string_new_printf ("%s%s%s", base, 
+    *base ? "/" : "", href);
+  char *s = strdup (klib_string_cstr (path));
+  char *hash = strchr (s, '#');
+  if (hash) *hash = 0;
+  char *save = NULL;
+  char *seg;
+  for (seg = strtok_r (s, "/", &save); seg; seg = strtok_r (NULL, "/", &save))
+    {
+    if (strcmp (seg, ".") == 0) 
+      continue;
+    if (strcmp (seg, "..") == 0)
+      {
+      const char *r = klib_string_cstr (ret);
+      const char *slash = strrchr (r, '/');
+      int keep = slash ? slash - r : 0;
+      klib_string_remove (ret, keep, klib_string_length (ret) - keep);
+      continue;
+      }
+    if (klib_string_length (ret) > 0) klib_string_append (ret, "/");
+    klib_string_append (ret, seg);
     }
+  free (s);
+  klib_string_free (path);
+  return ret;
   }
 
 /*========================================================================
-  epub2txt_translate_entity
-  out must have space for at least five bytes
-  // TODO -- ascii mode subsitutions
+  epub2txt_dir_name
+  The directory part of an archive entry name, or "" if it has none
 =========================================================================*/
-void epub2txt_translate_entity (const char *in, char *out)
+static klib_String *epub2txt_dir_name (const char *entry)
+  {
+  const char *slash = strrchr (entry, '/');
+  return klib_string_new_substring (entry, 0, slash ? slash - entry : 0);
+  }
+
+/*========================================================================
+  epub2txt_get_toc_href
+  Finds the table of contents in the OPF manifest: the NCX file if
+  there is one, or else the EPUB 3 navigation document. Returns its
+  href, relative to the OPF file
+=========================================================================*/
+static klib_String *epub2txt_get_toc_href (epub2txt_Vfs *vfs, 
+    const char *opf, klib_Error **error)
   {
   KLIB_IN
-  if (strcasecmp (in, "amp") == 0) 
-    strcpy (out, "&");
-  else if (strcasecmp (in, "nbsp") == 0) 
-    strcpy (out, " ");
-  else if (strcasecmp (in, "lt") == 0) 
-    strcpy (out, "<");
-  else if (strcasecmp (in, "gt") == 0) 
-    strcpy (out, ">");
-  else if (strcasecmp (in, "cent") == 0) 
-    strcpy (out, "¢");
-  else if (strcasecmp (in, "pound") == 0) 
-    strcpy (out, "£");
-  else if (strcasecmp (in, "yen") == 0) 
-    strcpy (out, "£");
-  else if (strcasecmp (in, "euro") == 0) 
-    strcpy (out, "€");
-  else if (strcasecmp (in, "sect") == 0) 
-    strcpy (out, "§");
-  else if (strcasecmp (in, "copy") == 0) 
-    strcpy (out, "©");
-  else if (strcasecmp (in, "reg") == 0) 
-    strcpy (out, "®");
-  else if (strcasecmp (in, "trade") == 0) 
-    strcpy (out, "™");
-  else if (strcasecmp (in, "quot") == 0) 
-    strcpy (out, "\"");
-  else if (in[0] == '#')
+  klib_String *ncx = NULL, *nav = NULL;
+  klib_Xml *x = epub2txt_read_xml (vfs, opf, error);
+  if (*error == NULL)
     {
-    char *s = strdup (in);
-    s[0] = '0';
-    int v = 0;
-    if (sscanf (s, "%x", &v) == 1)
+    XMLNode *root = klib_xml_get_root (x); // package
+    int i;
+    for (i = 0; i < root->n_children; i++)
       {
-      klib_String *ss = klib_string_new_empty ();
-      klib_string_append_wchar (ss, (wchar_t)v);
-      strcpy (out, klib_string_cstr (ss));
-      klib_string_free (ss);
-      } 
-    free (s);
+      XMLNode *r1 = root->children[i];
+      // Add workaround for bug #4 
+      if (strcmp (r1->tag, "manifest") != 0 && !strstr (r1->tag, ":manifest"))
+        continue;
+      int j;
+      for (j = 0; j < r1->n_children; j++)
+        {
+        XMLNode *r2 = r1->children[j]; // item
+        const char *href = NULL;
+        BOOL is_ncx = FALSE, is_nav = FALSE;
+        int k;
+        for (k = 0; k < r2->n_attributes; k++)
+          {
+          const char *name = r2->attributes[k].name;
+          const char *value = r2->attributes[k].value;
+          if (strcmp (name, "href") == 0)
+            href = value;
+          else if (strcmp (name, "media-type") == 0)
+            is_ncx = strcmp (value, "application/x-dtbncx+xml") == 0;
+          else if (strcmp (name, "properties") == 0)
+            {
+            // properties is a list of words
+            const char *p = value;
+            while ((p = strstr (p, "nav")) != NULL)
+              {
+              if ((p == value || p[-1] == ' ') && (p[3] == 0 || p[3] == ' '))
+                is_nav = TRUE;
+              p += 3;
+              }
+            }
+          }
+        if (href && is_ncx && !ncx) ncx = klib_string_new (href);
+        if (href && is_nav && !nav) nav = klib_string_new (href);
+        }
+      }
+    klib_xml_free (x);
     }
-  else
-    strcpy (out, "?");
+  if (ncx && nav) 
+    {
+    klib_string_free (nav);
+    nav = NULL;
+    }
+  if (*error == NULL && !ncx && !nav)
+    *error = klib_error_new (ENOENT, "File %s has no table of contents", opf);
   KLIB_OUT
+  return ncx ? ncx : nav;
+  }
+
+/*========================================================================
+  epub2txt_TocEntry
+  An entry in the table of contents
+=========================================================================*/
+typedef struct _epub2txt_TocEntry
+  {
+  klib_String *label;
+  // The archive entry it refers to
+  klib_String *entry;
+  // How deeply it is nested in the table of contents
+  int depth;
+  } epub2txt_TocEntry;
+
+/*========================================================================
+  epub2txt_node_text
+  Appends all the text in an element, including that of its children
+=========================================================================*/
+static void epub2txt_node_text (const XMLNode *node, klib_String *text)
+  {
+  int i;
+  if (node->text) klib_string_append (text, node->text);
+  for (i = 0; i < node->n_children; i++)
+    epub2txt_node_text (node->children[i], text);
+  }
+
+/*========================================================================
+  epub2txt_tag_is
+  Returns TRUE if the element's name, ignoring any namespace prefix and
+  case, is name
+=========================================================================*/
+static BOOL epub2txt_tag_is (const XMLNode *node, const char *name)
+  {
+  const char *colon = strrchr (node->tag, ':');
+  return strcasecmp (colon ? colon + 1 : node->tag, name) == 0;
+  }
+
+/*========================================================================
+  epub2txt_attribute
+  The value of the element's attribute name, or NULL if it has none
+=========================================================================*/
+static const char *epub2txt_attribute (const XMLNode *node, 
+    const char *name)
+  {
+  int i;
+  for (i = 0; i < node->n_attributes; i++)
+    if (strcmp (node->attributes[i].name, name) == 0) 
+      return node->attributes[i].value;
+  return NULL;
+  }
+
+/*========================================================================
+  epub2txt_read_toc_node
+  Collects the entries of an NCX file (navPoint elements) or of a
+  navigation document (links inside nav elements), in document order.
+  Depth counts enclosing navPoint or ol elements
+=========================================================================*/
+static void epub2txt_read_toc_node (const XMLNode *node, const char *base,
+    BOOL in_nav, int depth, epub2txt_TocEntry **entries, int *n)
+  {
+  int i;
+  const char *src = NULL;
+  klib_String *label = NULL;
+  if (epub2txt_tag_is (node, "navPoint"))
+    {
+    label = klib_string_new_empty ();
+    for (i = 0; i < node->n_children; i++)
+      {
+      const XMLNode *child = node->children[i];
+      if (epub2txt_tag_is (child, "navLabel"))
+        epub2txt_node_text (child, label);
+      else if (epub2txt_tag_is (child, "content") && !src)
+        src = epub2txt_attribute (child, "src");
+      }
+    depth++;
+    }
+  else if (in_nav && epub2txt_tag_is (node, "a"))
+    {
+    label = klib_string_new_empty ();
+    epub2txt_node_text (node, label);
+    src = epub2txt_attribute (node, "href");
+    }
+  else if (epub2txt_tag_is (node, "nav"))
+    in_nav = TRUE;
+  else if (epub2txt_tag_is (node, "ol"))
+    depth++;
+
+  if (label && src)
+    {
+    *entries = realloc (*entries, (*n + 1) * sizeof (**entries));
+    (*entries)[*n].label = label;
+    (*entries)[*n].entry = epub2txt_entry_name (base, src);
+    (*entries)[*n].depth = depth;
+    (*n)++;
+    }
+  else if (label)
+    klib_string_free (label);
+
+  for (i = 0; i < node->n_children; i++)
+    epub2txt_read_toc_node (node->children[i], base, in_nav, depth, 
+      entries, n);
+  }
+
+/*========================================================================
+  epub2txt_label_matches
+  Whether a table of contents label is text -- ignoring case and 
+  surrounding whitespace -- or, if exact is FALSE, contains it
+=========================================================================*/
+static BOOL epub2txt_label_matches (const char *label, const char *text, 
+    BOOL exact)
+  {
+  int n = strlen (text);
+  while (isspace ((unsigned char)*label)) label++;
+  if (exact)
+    {
+    if (strncasecmp (label, text, n) != 0) return FALSE;
+    for (label += n; *label; label++)
+      if (!isspace ((unsigned char)*label)) return FALSE;
+    return TRUE;
+    }
+  for (; *label; label++)
+    if (strncasecmp (label, text, n) == 0) return TRUE;
+  return n == 0;
   }
 
-
 /*========================================================================
-  epub2txt_transform_char
+  epub2txt_select_chapters
+  Marks the spine items of the chapters whose table of contents label
+  is chapter_label or, if there are none, contains it. A chapter runs
+  from the spine item of its entry to the item of the next entry at the
+  same or a higher level of the table of contents. spine holds the
+  archive entry names of the spine items
 =========================================================================*/
-klib_String *epub2txt_transform_char (wchar_t c, BOOL ascii)
+static void epub2txt_select_chapters (epub2txt_Vfs *vfs, 
+    const char *toc_entry, klib_String **spine, int nspine, 
+    BOOL *selected, klib_Error **error)
   {
   KLIB_IN
-  // if (c > 127) printf ("XXXX c=%04X\n", c);
-  if (ascii)
-    {
-    if (c == 0x00B4) return klib_string_new ("\'");
-    if (c == 0x0304) return klib_string_new ("-");
-    if (c == 0x2010) return klib_string_new ("-");
-    if (c == 0x2013) return klib_string_new ("-");
-    if (c == 0x2014) return klib_string_new ("-");
-    if (c == 0x2018) return klib_string_new ("'");
-    if (c == 0x2019) return klib_string_new ("\'");
-    if (c == 0x201C) return klib_string_new ("\"");
-    if (c == 0x201D) return klib_string_new ("\"");
-    if (c == 0xC2A0) return klib_string_new ("(c)"); // copyright 
-    if (c == 0x00A9) return klib_string_new ("(c)"); // ditto
-    if (c == 0xC2A9) return klib_string_new (" "); // nbsp
-    if (c == 0x00A0) return klib_string_new (" "); // nbsp
-    if (c == 0x2026) return klib_string_new (",,,"); // elipsis 
-    if (c == 0x2022) return klib_string_new ("."); // dot
-    if (c == 0x00B5) return klib_string_new ("u"); // mu
-    if (c == 0x00C0) return klib_string_new ("A"); // accented A 
-    if (c == 0x00C1) return klib_string_new ("A"); // accented A 
-    if (c == 0x00C2) return klib_string_new ("A"); // accented A 
-    if (c == 0x00C3) return klib_string_new ("A"); // accented A 
-    if (c == 0x00C4) return klib_string_new ("A"); // accented A 
-    if (c == 0x00C5) return klib_string_new ("A"); // accented A 
-    if (c == 0x00C6) return klib_string_new ("AE"); // accented A 
-    if (c == 0x00C7) return klib_string_new ("C"); // cedilla 
-    if (c == 0x00C8) return klib_string_new ("E"); // accented E
-    if (c == 0x00C9) return klib_string_new ("E"); // accented E
-    if (c == 0x00CA) return klib_string_new ("E"); // accented E
-    if (c == 0x00CB) return klib_string_new ("E"); // accented E
-    if (c == 0x00CC) return klib_string_new ("I"); // accented I
-    if (c == 0x00CD) return klib_string_new ("I"); // accented I
-    if (c == 0x00CE) return klib_string_new ("I"); // accented I
-    if (c == 0x00CF) return klib_string_new ("I"); // accented I
-    if (c == 0x00D0) return klib_string_new ("D"); // accented D
-    if (c == 0x00D1) return klib_string_new ("N"); // accented N
-    if (c == 0x00D2) return klib_string_new ("O"); // accented O
-    if (c == 0x00D3) return klib_string_new ("O"); // accented O
-    if (c == 0x00D4) return klib_string_new ("O"); // accented O
-    if (c == 0x00D5) return klib_string_new ("O"); // accented O
-    if (c == 0x00D6) return klib_string_new ("O"); // accented O
-    if (c == 0x00D7) return klib_string_new ("x"); // Multiply 
-    if (c == 0x00D8) return klib_string_new ("O"); // accented O
-    if (c == 0x00D9) return klib_string_new ("U"); // accented U
-    if (c == 0x00DA) return klib_string_new ("U"); // accented U
-    if (c == 0x00DB) return klib_string_new ("U"); // accented U
-    if (c == 0x00DC) return klib_string_new ("U"); // accented U
-    if (c == 0x00DD) return klib_string_new ("Y"); // accented Y
-    if (c == 0x00DE) return klib_string_new ("Y"); // thorn 
-    if (c == 0x00DF) return klib_string_new ("sz"); // esszet 
-    if (c == 0x00E0) return klib_string_new ("a"); // accepted a 
-    if (c == 0x00E1) return klib_string_new ("a"); // accepted a 
-    if (c == 0x00E2) return klib_string_new ("a"); // accepted a 
-    if (c == 0x00E3) return klib_string_new ("a"); // accepted a 
-    if (c == 0x00E4) return klib_string_new ("a"); // accepted a 
-    if (c == 0x00E5) return klib_string_new ("a"); // accepted a 
-    if (c == 0x00E6) return klib_string_new ("ae"); // ae
-    if (c == 0x00E7) return klib_string_new ("c"); // cedilla
-    if (c == 0x00E8) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x00E9) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x00EA) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x00EB) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x00EC) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x00ED) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x00EE) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x00EF) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x00F0) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x00F1) return klib_string_new ("n"); //a ceepnted n 
-    if (c == 0x00F2) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x00F3) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x00F4) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x00F5) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x00F6) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x00F7) return klib_string_new ("/"); // divide
-    if (c == 0x00F8) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x00F9) return klib_string_new ("u"); //a ceepnted u 
-    if (c == 0x00FA) return klib_string_new ("u"); //a ceepnted u 
-    if (c == 0x00FB) return klib_string_new ("u"); //a ceepnted u 
-    if (c == 0x00FC) return klib_string_new ("u"); //a ceepnted u 
-    if (c == 0x00FD) return klib_string_new ("y"); //a ceepnted y 
-    if (c == 0x00FE) return klib_string_new ("y"); //a thorn 
-    if (c == 0x00FF) return klib_string_new ("y"); //a ceepnted y 
-    if (c == 0x0100) return klib_string_new ("A"); //a ceepnted A 
-    if (c == 0x0101) return klib_string_new ("a"); //a ceepnted a 
-    if (c == 0x0102) return klib_string_new ("A"); //a ceepnted A 
-    if (c == 0x0103) return klib_string_new ("a"); //a ceepnted a 
-    if (c == 0x0104) return klib_string_new ("A"); //a ceepnted A 
-    if (c == 0x0105) return klib_string_new ("a"); //a ceepnted a 
-    if (c == 0x0106) return klib_string_new ("C"); //a ceepnted C 
-    if (c == 0x0107) return klib_string_new ("c"); //a ceepnted c 
-    if (c == 0x0108) return klib_string_new ("C"); //a ceepnted C 
-    if (c == 0x0109) return klib_string_new ("c"); //a ceepnted c 
-    if (c == 0x010A) return klib_string_new ("C"); //a ceepnted C 
-    if (c == 0x010B) return klib_string_new ("c"); //a ceepnted c 
-    if (c == 0x010C) return klib_string_new ("C"); //a ceepnted C 
-    if (c == 0x010D) return klib_string_new ("c"); //a ceepnted c 
-    if (c == 0x010E) return klib_string_new ("D"); //a ceepnted D 
-    if (c == 0x010F) return klib_string_new ("d"); //a ceepnted d 
-    if (c == 0x0110) return klib_string_new ("D"); //a ceepnted D 
-    if (c == 0x0111) return klib_string_new ("d"); //a ceepnted d 
-    if (c == 0x0112) return klib_string_new ("E"); //a ceepnted E 
-    if (c == 0x0113) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x0114) return klib_string_new ("E"); //a ceepnted E 
-    if (c == 0x0115) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x0116) return klib_string_new ("E"); //a ceepnted E 
-    if (c == 0x0117) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x0118) return klib_string_new ("E"); //a ceepnted E 
-    if (c == 0x0119) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x011A) return klib_string_new ("E"); //a ceepnted E 
-    if (c == 0x011B) return klib_string_new ("e"); //a ceepnted e 
-    if (c == 0x011C) return klib_string_new ("G"); //a ceepnted G 
-    if (c == 0x011D) return klib_string_new ("g"); //a ceepnted g 
-    if (c == 0x011E) return klib_string_new ("G"); //a ceepnted G 
-    if (c == 0x011F) return klib_string_new ("g"); //a ceepnted g 
-    if (c == 0x0120) return klib_string_new ("G"); //a ceepnted G 
-    if (c == 0x0121) return klib_string_new ("g"); //a ceepnted g 
-    if (c == 0x0122) return klib_string_new ("G"); //a ceepnted G 
-    if (c == 0x0123) return klib_string_new ("g"); //a ceepnted g 
-    if (c == 0x0124) return klib_string_new ("H"); //a ceepnted H 
-    if (c == 0x0125) return klib_string_new ("h"); //a ceepnted h 
-    if (c == 0x0126) return klib_string_new ("H"); //a ceepnted H 
-    if (c == 0x0127) return klib_string_new ("h"); //a ceepnted h 
-    if (c == 0x0128) return klib_string_new ("I"); //a ceepnted I 
-    if (c == 0x0129) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x012A) return klib_string_new ("I"); //a ceepnted I 
-    if (c == 0x012B) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x012C) return klib_string_new ("I"); //a ceepnted I 
-    if (c == 0x012D) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x012E) return klib_string_new ("I"); //a ceepnted I 
-    if (c == 0x012F) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x0130) return klib_string_new ("I"); //a ceepnted I 
-    if (c == 0x0131) return klib_string_new ("i"); //a ceepnted i 
-    if (c == 0x0132) return klib_string_new ("IJ"); 
-    if (c == 0x0133) return klib_string_new ("ij"); 
-    if (c == 0x0134) return klib_string_new ("J"); //a ceepnted J 
-    if (c == 0x0135) return klib_string_new ("j"); //a ceepnted j 
-    if (c == 0x0136) return klib_string_new ("K"); //a ceepnted K 
-    if (c == 0x0138) return klib_string_new ("K"); //a ceepnted K 
-    if (c == 0x0138) return klib_string_new ("k"); //a ceepnted k 
-    if (c == 0x0139) return klib_string_new ("L"); //a ceepnted L 
-    if (c == 0x013A) return klib_string_new ("l"); //a ceepnted l 
-    if (c == 0x013B) return klib_string_new ("L"); //a ceepnted L 
-    if (c == 0x013C) return klib_string_new ("l"); //a ceepnted l 
-    if (c == 0x013D) return klib_string_new ("L"); //a ceepnted L 
-    if (c == 0x013E) return klib_string_new ("l"); //a ceepnted l 
-    if (c == 0x013F) return klib_string_new ("L"); //a ceepnted L 
-    if (c == 0x0140) return klib_string_new ("l"); //a ceepnted l 
-    if (c == 0x0141) return klib_string_new ("L"); //a ceepnted L 
-    if (c == 0x0142) return klib_string_new ("l"); //a ceepnted l 
-    if (c == 0x0143) return klib_string_new ("N"); //a ceepnted N 
-    if (c == 0x0144) return klib_string_new ("n"); //a ceepnted N 
-    if (c == 0x0145) return klib_string_new ("N"); //a ceepnted N 
-    if (c == 0x0146) return klib_string_new ("n"); //a ceepnted N 
-    if (c == 0x0147) return klib_string_new ("N"); //a ceepnted N 
-    if (c == 0x0148) return klib_string_new ("n"); //a ceepnted N 
-    if (c == 0x0149) return klib_string_new ("N"); //a ceepnted N 
-    if (c == 0x014A) return klib_string_new ("n"); //a ceepnted N 
-    if (c == 0x014B) return klib_string_new ("n"); //a ceepnted n 
-    if (c == 0x014C) return klib_string_new ("O"); //a ceepnted O 
-    if (c == 0x014D) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x014E) return klib_string_new ("O"); //a ceepnted O 
-    if (c == 0x014F) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x0150) return klib_string_new ("O"); //a ceepnted O 
-    if (c == 0x0151) return klib_string_new ("o"); //a ceepnted o 
-    if (c == 0x0152) return klib_string_new ("OE"); 
-    if (c == 0x0153) return klib_string_new ("oe"); 
-    if (c == 0x0154) return klib_string_new ("R"); // accepted R
-    if (c == 0x0155) return klib_string_new ("r"); // accepted r
-    if (c == 0x0156) return klib_string_new ("R"); // accepted R
-    if (c == 0x0157) return klib_string_new ("r"); // accepted r
-    if (c == 0x0158) return klib_string_new ("R"); // accepted R
-    if (c == 0x0159) return klib_string_new ("r"); // accepted r
-    if (c == 0x015A) return klib_string_new ("S"); // accepted S
-    if (c == 0x015B) return klib_string_new ("s"); // accepted s
-    if (c == 0x015C) return klib_string_new ("S"); // accepted S
-    if (c == 0x015D) return klib_string_new ("s"); // accepted s
-    if (c == 0x015E) return klib_string_new ("S"); // accepted S
-    if (c == 0x015F) return klib_string_new ("s"); // accepted s
-    if (c == 0x0160) return klib_string_new ("S"); // accepted S
-    if (c == 0x0161) return klib_string_new ("s"); // accepted s
-    if (c == 0x0162) return klib_string_new ("T"); // accepted T
-    if (c == 0x0163) return klib_string_new ("t"); // accepted t
-    if (c == 0x0164) return klib_string_new ("T"); // accepted T
-    if (c == 0x0165) return klib_string_new ("t"); // accepted t
-    if (c == 0x0166) return klib_string_new ("T"); // accepted T
-    if (c == 0x0167) return klib_string_new ("t"); // accepted t
-    if (c == 0x0168) return klib_string_new ("U"); // accepted U
-    if (c == 0x0169) return klib_string_new ("u"); // accepted u
-    if (c == 0x016A) return klib_string_new ("U"); // accepted U
-    if (c == 0x016B) return klib_string_new ("u"); // accepted u
-    if (c == 0x016C) return klib_string_new ("U"); // accepted U
-    if (c == 0x016D) return klib_string_new ("u"); // accepted u
-    if (c == 0x016E) return klib_string_new ("U"); // accepted U
-    if (c == 0x016F) return klib_string_new ("u"); // accepted u
-    if (c == 0x0170) return klib_string_new ("U"); // accepted U
-    if (c == 0x0171) return klib_string_new ("u"); // accepted u
-    if (c == 0x0172) return klib_string_new ("U"); // accepted U
-    if (c == 0x0173) return klib_string_new ("u"); // accepted u
-    if (c == 0x0174) return klib_string_new ("W"); // accepted W
-    if (c == 0x0175) return klib_string_new ("w"); // accepted w
-    if (c == 0x0176) return klib_string_new ("Y"); // accepted Y
-    if (c == 0x0177) return klib_string_new ("y"); // accepted y
-    if (c == 0x0178) return klib_string_new ("Y"); // accepted Y
-    if (c == 0x00) return klib_string_new (""); // 
-    if (c > 127) return klib_string_new ("?");
-    }
-     
-  klib_String *ret = klib_string_new_empty();
-  klib_string_append_wchar (ret, c);
+  klib_Xml *x = epub2txt_read_xml (vfs, toc_entry, error);
+  if (*error == NULL)
+    {
+    klib_String *base = epub2txt_dir_name (toc_entry);
+    epub2txt_TocEntry *entries = NULL;
+    int i, j, n = 0;
+    XMLNode *root = klib_xml_get_root (x);
+    if (root)
+      epub2txt_read_toc_node (root, klib_string_cstr (base), FALSE, 0, 
+        &entries, &n);
+    int *item = malloc ((n + 1) * sizeof (int));
+    for (i = 0; i < n; i++)
+      {
+      item[i] = -1;
+      for (j = 0; j < nspine && item[i] < 0; j++)
+        if (strcmp (klib_string_cstr (spine[j]), 
+            klib_string_cstr (entries[i].entry)) == 0)
+          item[i] = j;
+      }
+    BOOL exact = FALSE;
+    for (i = 0; i < n && !exact; i++)
+      exact = epub2txt_label_matches (klib_string_cstr (entries[i].label), 
+        chapter_label, TRUE);
+    for (i = 0; i < n; i++)
+      {
+      if (item[i] < 0 || !epub2txt_label_matches 
+          (klib_string_cstr (entries[i].label), chapter_label, exact))
+        continue;
+      int end = nspine;
+      for (j = i + 1; j < n; j++)
+        if (entries[j].depth <= entries[i].depth && item[j] > item[i])
+          {
+          end = item[j];
+          break;
+          }
+      for (j = item[i]; j < end; j++)
+        selected[j] = TRUE;
+      }
+    for (i = 0; i < n; i++)
+      {
+      klib_string_free (entries[i].label);
+      klib_string_free (entries[i].entry);
+      }
+    free (entries);
+    free (item);
+    klib_string_free (base);
+    klib_xml_free (x);
+    }
   KLIB_OUT
-  return ret; 
   }
 
-
 /*========================================================================
-  epub2txt_all_white
-  Note that an empty string is considered to be whitespace
-  Note also that we struggle here with unicode non-breaking spaces,
-  since some of these are multibyte, and we get the data in this
-  function byte-by-byte
+  epub2txt_select_spine
+  Marks the spine items that were asked for with --spine and --chapter:
+  those in both, if both were given, or all of them if neither was. 
+  entries are the archive entry names of the spine items. It is an
+  error for part of the --spine range to start past the end of the spine
 =========================================================================*/
-BOOL epub2txt_all_white (const char *s)
+static void epub2txt_select_spine (epub2txt_Vfs *vfs, const char *opf, 
+    const char *opf_base, klib_String **entries, int n, BOOL *selected, 
+    klib_Error **error)
   {
   KLIB_IN
-  int i, l = strlen (s);
-  for (i = 0; i < l; i++)
+  int i;
+  for (i = 0; i < n; i++) selected[i] = (spine_range == NULL);
+  if (spine_range && !epub2txt_select_range (spine_range, n, selected))
+    *error = klib_error_new (EINVAL, 
+      "%s: spine range '%s' is beyond the %d spine items", 
+      vfs->name, spine_range, n);
+  if (chapter_label && *error == NULL)
     {
-    BOOL iswhite = FALSE;
-    char c = s[i];
-    if (c == ' ') iswhite = TRUE;
-    if (c == '\n') iswhite = TRUE;
-    if (c == (char)0xC2) // nbsp 
+    epub2txt_stats_enter (STAGE_OPF);
+    klib_String *href = epub2txt_get_toc_href (vfs, opf, error);
+    epub2txt_stats_leave ();
+    if (*error == NULL)
       {
-      if (i < l - 1)
+      klib_String *toc_entry = epub2txt_entry_name (opf_base, 
+        klib_string_cstr (href));
+      BOOL *chapters = calloc (n + 1, sizeof (BOOL));
+      epub2txt_stats_enter (STAGE_OPF);
+      epub2txt_select_chapters (vfs, klib_string_cstr (toc_entry), entries, 
+        n, chapters, error);
+      epub2txt_stats_leave ();
+      BOOL any = FALSE;
+      for (i = 0; i < n; i++)
         {
-        if ((unsigned char)s[i + 1] == (unsigned char)0xA0) 
-          {
-          iswhite = TRUE;
-          i++;
-          }
+        selected[i] = selected[i] && chapters[i];
+        any |= chapters[i];
         }
-      }
-    if (!iswhite) 
-      {
-      KLIB_OUT
-      return FALSE;
+      if (*error == NULL && !any)
+        *error = klib_error_new (ENOENT, "%s: no chapter matches '%s'",
+          vfs->name, chapter_label);
+      free (chapters);
+      klib_string_free (toc_entry);
+      klib_string_free (href);
       }
     }
-      KLIB_OUT
-  return TRUE;
+  KLIB_OUT
   }
 
+/*========================================================================
+  epub2txt_report_counts
+  Writes a line of the --count report: paragraphs, words, characters,
+  the EPUB file and, unless this is the total for the book, the spine
+  item, separated by tabs
+=========================================================================*/
+static void epub2txt_report_counts (const epub2txt_Counts *counts, 
+    const char *file, const char *item)
+  {
+  printf ("%lld\t%lld\t%lld\t%s%s%s\n", counts->paras, counts->words,
+    counts->chars, file, item ? "\t" : "", item ? item : "");
+  }
 
 /*========================================================================
-  epub2txt_flush_para
+  epub2txt_convert
+  Converts the EPUB in vfs. file is its name, for messages and --count
 =========================================================================*/
-void epub2txt_flush_para (const klib_String *para, int width, BOOL notrim)
+static void epub2txt_convert (epub2txt_Vfs *vfs, const char *file, 
+    BOOL ascii, int width, BOOL notrim, klib_Error **error)
   {
   KLIB_IN
-  output_para++;
-  if (start_para != 0 && output_para < start_para) return;
-
-  // While it is quicker just to dump the para to stdout in
-  //  unlimited-line-length mode, doing this doesn't get us the
-  //  benefit of trimming whitespace, etc
-  if (width == 0 && notrim)
+  epub2txt_stats_enter (STAGE_UNZIP);
+  if (vfs->zip) vfs->zip->verify = verify_mode;
+  long long vfs_memory = epub2txt_vfs_memory (vfs);
+  if (epub2txt_budget_take (vfs_memory))
+    epub2txt_vfs_load (vfs, error);
+  else
     {
-    if (!epub2txt_all_white (klib_string_cstr (para)))
-      {
-      if (para_mark != 0)
-        if (output_para % para_mark == 0)
-          {
-          printf ("\n\n*** PARA %d\n\n", output_para);
-          }
-      puts (klib_string_cstr (para));
-      }
+    vfs_memory = 0;
+    *error = epub2txt_budget_error (file, "The archive directory");
     }
-   else
+  epub2txt_stats_leave ();
+    
+  // Only the entries that are read are extracted: container.xml, the
+  //  OPF, the table of contents if --chapter needs it, and the 
+  //  selected spine items, each as it is converted. Images, fonts 
+  //  and other media are never decompressed
+  klib_String *rootfile = NULL;
+  if (*error == NULL)
+    {
+    epub2txt_stats_enter (STAGE_OPF);
+    rootfile = epub2txt_get_root_file (vfs, "META-INF/container.xml", 
+      error);
+    epub2txt_stats_leave ();
+    }
+  if (*error == NULL)
     {
-    if (!epub2txt_all_white (klib_string_cstr (para)))
+    klib_log_debug ("rootfile is %s", klib_string_cstr (rootfile));
+    klib_String *opf_entry = epub2txt_entry_name ("", 
+      klib_string_cstr (rootfile));
+    klib_String *opf_base = epub2txt_dir_name (klib_string_cstr (opf_entry));
+    const char *opf = klib_string_cstr (opf_entry);
+    klib_List *list = NULL;
+    epub2txt_stats_enter (STAGE_OPF);
+    list = epub2txt_get_items (vfs, opf, error);
+    epub2txt_stats_leave ();
+    if (*error == NULL)
       {
-      if (para_mark != 0)
-        if (output_para % para_mark == 0) 
-          {
-          printf ("\n\n*** PARA %d\n\n", output_para);
-          }
-
-      typedef enum {MODE_START = 0, MODE_WORD = 1, MODE_SPACE = 2} Mode;
-      Mode mode = MODE_START;
-      char *s = strdup (klib_string_cstr (para));
-      int i, l = strlen (s), col = 0;
-      klib_String *word = klib_string_new_empty ();
+      klib_log_debug ("EPUB spine has %d items", klib_list_length (list));
+      int i, l = klib_list_length (list);
+      klib_String **entries = malloc ((l + 1) * sizeof (klib_String *));
+      for (i = 0; i < l; i++)
+        entries[i] = epub2txt_entry_name (klib_string_cstr (opf_base), 
+          klib_string_cstr ((klib_String *)klib_list_get (list, i)));
+      BOOL *selected = malloc ((l + 1) * sizeof (BOOL));
+      epub2txt_select_spine (vfs, opf, klib_string_cstr (opf_base), 
+        entries, l, selected, error);
       for (i = 0; i < l; i++)
+        if (selected[i]) 
+          epub2txt_vfs_want (vfs, klib_string_cstr (entries[i]));
+      epub2txt_Variant variant;
+      epub2txt_select_variant (&variant, ascii, width, notrim);
+      epub2txt_Counts book_counts;
+      memset (&book_counts, 0, sizeof (book_counts));
+      count_inword = FALSE;
+      for (i = 0; i < l && *error == NULL && !preview_done; i++)
         {
-        char c = s[i];
-
-        if (mode == MODE_START && (c == ' ' 
-             || (((unsigned char) c == (unsigned char)0xC2) 
-                   && i < l - 1 && (unsigned char)s[i + 1] == (unsigned char)0xA0)))
-          {
-/*
-          if (i < l - 1)
-            {
-            if ((unsigned char)s[i + 1] == (unsigned char)0xA0) 
-              {
-              i++;
-              }
-            }
-*/
-          // Absorb leading spaces
-          i += (c != ' ');
-          }	
-        
-/*
-        if ((mode == MODE_START && (c == ' ' 
-             || (unsigned char) c == (unsigned char)0xC2))
-          &&
-           (i < l - 1)
-          &&
-             ((unsigned char)s[i + 1] == (unsigned char)0xA0)) 
-          {
-          i++;
-          }
-          // Absorb leading spaces
-*/
-        else if (mode == MODE_START)
-          {
-          klib_string_append_byte (word, c);
-          mode = MODE_WORD;
-          }
-        else if (mode == MODE_SPACE && (c == ' '
-            || ((unsigned char) c == (unsigned char)0xC2 && i < l - 1 
-                   && (unsigned char)s[i + 1] == (unsigned char)0xA0)))
-          {
-          i+=c!=' ';
-          }
-/*
-        else if (mode == MODE_SPACE && (c == ' '
-             || (unsigned char) c == (unsigned char)0xC2))
-          {
-            if ((unsigned char)s[i + 1] == (unsigned char)0xA0) 
-              {
-              i++;
-              }
-          }
-*/
-        else if (mode == MODE_SPACE)
-          {
-          mode = MODE_WORD;
-          klib_string_append_byte (word, c);
-          }
-        else if (mode == MODE_WORD && c == ' ')
-          {
-          int wordlen = klib_string_length (word);
-          if (col + wordlen >= width && width != 0)
-            {
-            printf ("\n");
-            col = 0;
-            }
-          printf ("%s", klib_string_cstr (word));
-          printf (" ");
-          col += wordlen + 1;
-          klib_string_set (word, "");
-          mode = MODE_SPACE;
-          }
-        else if (mode == MODE_WORD)
-          {
-          klib_string_append_byte (word, c);
-          }
-        else
+        if (!selected[i]) continue;
+        int corrupt = epub2txt_vfs_corrupt_entries (vfs);
+        klib_object_census_poll (stderr);
+        klib_String *item = (klib_String *)klib_list_get (list, i);
+        memset (&item_counts, 0, sizeof (item_counts));
+        epub2txt_parse_html (vfs, klib_string_cstr (entries[i]), &variant, 
+          error);
+        if (epub2txt_vfs_corrupt_entries (vfs) > corrupt)
+          klib_log_warning ("%s: spine item %d (%s) is damaged; its text "
+            "may be incomplete or wrong", file, i + 1, 
+            klib_string_cstr (item));
+        if (count_mode)
           {
-          fprintf (stderr, "Internal error: bad mode/char combination in"
-             " epub2txt_flush_para: mode=%d char=%d\n", mode, c);
-          exit (-1);
+          epub2txt_flush_output ();
+          epub2txt_report_counts (&item_counts, file, 
+            klib_string_cstr (item));
+          book_counts.paras += item_counts.paras;
+          book_counts.words += item_counts.words;
+          book_counts.chars += item_counts.chars;
           }
         }
-      int wordlen = klib_string_length (word);
-      if (col + wordlen >= width && width != 0)
+      if (count_mode)
         {
-        printf ("\n");
+        epub2txt_report_counts (&book_counts, file, NULL);
+        // Nothing that is left is a complete character
+        output_len = 0;
         }
-      printf ("%s", klib_string_cstr (word)); 
-      klib_string_free (word);
-      free (s);
+      for (i = 0; i < l; i++)
+        klib_string_free (entries[i]);
+      free (entries);
+      free (selected);
       }
+    if (list) klib_list_free (list);
+    klib_string_free (opf_entry);
+    klib_string_free (opf_base);
+    }
+  if (stats_enabled)
+    {
+    epub2txt_stats_enter (STAGE_UNZIP);
+    book_stats.compressed_bytes = epub2txt_vfs_source_bytes (vfs);
+    book_stats.uncompressed_bytes = epub2txt_vfs_extracted_bytes (vfs);
+    book_stats.corrupt_entries = epub2txt_vfs_corrupt_entries (vfs);
+    epub2txt_stats_leave ();
     }
+  if (rootfile) klib_string_free (rootfile);
+  epub2txt_budget_give (vfs_memory);
   KLIB_OUT
   }
 
-
 /*========================================================================
-  epub2txt_line_break
+  epub2txt_output_path
+  The file in output_dir that the text of a book is written to: its 
+  name, without the extension, with ".txt". A book in a bundle goes in
+  a directory named after the bundle, and a book synced from the tree
+  sync_source (--sync) goes where it is in that tree. The caller frees
+  it
 =========================================================================*/
-void epub2txt_line_break (void)
+klib_String *epub2txt_output_path (const char *file, const char *member)
   {
   KLIB_IN
-  if (start_para != 0 && output_para < start_para) return;
-  printf ("\n");
+  char *base = strdup (strcmp (file, "-") == 0 ? "stdin" : file);
+  int len = strlen (base);
+  while (len > 1 && base[len - 1] == '/') base[--len] = 0;
+  const char *slash = strrchr (base, '/');
+  int root_len = sync_source ? strlen (sync_source) : 0;
+  klib_String *name;
+  if (sync_source && !member && strncmp (base, sync_source, root_len) == 0
+      && base[root_len] == '/')
+    name = klib_string_new (base + root_len + 1);
+  else
+    name = klib_string_new (slash ? slash + 1 : base);
+  if (member)
+    {
+    const char *dot = strrchr (klib_string_cstr (name), '.');
+    if (dot) klib_string_remove (name, dot - klib_string_cstr (name),
+      strlen (dot));
+    klib_string_append (name, "/");
+    klib_string_append (name, member);
+    }
+  const char *n = klib_string_cstr (name);
+  const char *dot = strrchr (n, '.');
+  if (dot && dot > n && !strchr (dot, '/')) 
+    klib_string_remove (name, dot - n, strlen (dot));
+  klib_String *path = klib_string_new_printf ("%s/%s.txt", output_dir,
+    klib_string_cstr (name));
+  klib_string_free (name);
+  free (base);
   KLIB_OUT
+  return path;
   }
 
-
 /*========================================================================
-  epub2txt_para_break
+  epub2txt_output_open
+  Sends stdout to the file path. Returns the descriptor that stdout 
+  was, for epub2txt_output_close, or -1 if there is nothing to put back
 =========================================================================*/
-void epub2txt_para_break (void)
+static int epub2txt_output_open (const char *path, klib_Error **error)
   {
   KLIB_IN
-  if (start_para != 0 && output_para < start_para) return;
-  printf ("\n\n");
+  epub2txt_zip_make_dirs (path);
+  int saved = -1;
+  int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    *error = klib_error_new (errno, "Can't write %s: %s", path, 
+      strerror (errno));
+  else
+    {
+    fflush (stdout);
+    saved = dup (STDOUT_FILENO);
+    dup2 (fd, STDOUT_FILENO);
+    close (fd);
+    }
   KLIB_OUT
+  return saved;
   }
 
+/*========================================================================
+  epub2txt_output_close
+  Puts back the stdout that epub2txt_output_open replaced
+=========================================================================*/
+static void epub2txt_output_close (int saved)
+  {
+  if (saved < 0) return;
+  fflush (stdout);
+  dup2 (saved, STDOUT_FILENO);
+  close (saved);
+  }
 
 /*========================================================================
-  epub2txt_parse_html
+  epub2txt_options
+  Describes everything that affects the text, in a form that does not
+  depend on how it was written on the command line: --notrim has no 
+  effect with a width, and starting from paragraph 1 is starting from
+  the beginning. --verify is included, so that a book that was 
+  converted without it is checked when it is asked for. The caller
+  frees it
 =========================================================================*/
-void epub2txt_parse_html (const char *filename, BOOL ascii, 
-    int width, BOOL notrim, klib_Error **error)
+klib_String *epub2txt_options (BOOL ascii, int width, BOOL notrim)
   {
-  KLIB_IN
-  typedef enum {MODE_ANY=0, MODE_INTAG = 1, MODE_ENTITY = 2} Mode;
+  return klib_string_new_printf 
+    ("epub2txt " VERSION " a%d w%d n%d s%d p%d v%d P%lld C%s S%s", 
+    ascii != 0, width, width == 0 && notrim, start_para > 1 ? start_para : 0,
+    para_mark, verify_mode != 0, preview_bytes, 
+    chapter_label ? chapter_label : "", spine_range ? spine_range : "");
+  }
 
-  klib_log_info ("Parsing %s", filename);
-  klib_WString *s = klib_wstring_read_file (filename, KLIB_ENCODING_UTF8, 
-      error); 
-  if (*error == NULL)
+/*========================================================================
+  epub2txt_cache_lookup
+  Returns the --cache key of a book, hashing the size bytes at data 
+  or, if data is NULL, the file. Books on stdin and unpacked into
+  directories are not cached, and neither is the --count report, which
+  has the name of the file in it; for those, the key is NULL
+=========================================================================*/
+static char *epub2txt_cache_lookup (const char *file, const BYTE *data, 
+    long long size, BOOL ascii, int width, BOOL notrim)
+  {
+  KLIB_IN
+  if (!cache_dir || count_mode || (!data && strcmp (file, "-") == 0))
     {
-    const wchar_t *text = klib_wstring_cstr (s);
-    int i, l = wcslen (text);
-    Mode mode = MODE_ANY;
-    klib_WString *tag = klib_wstring_new_empty();
-    klib_WString *entity = klib_wstring_new_empty();
-    BOOL inbody = FALSE;
-    BOOL can_newline = FALSE;
-    wchar_t last_c = 0;
-    klib_String *para = klib_string_new_empty ();
-
-    for (i = 0; i < l; i++)
+    KLIB_OUT
+    return NULL;
+    }
+  klib_String *options = epub2txt_options (ascii, width, notrim);
+  char *key = NULL;
+  epub2txt_stats_enter (STAGE_UNZIP);
+  if (data)
+    key = epub2txt_cache_key (data, size, klib_string_cstr (options));
+  else
+    {
+    int fd = open (file, O_RDONLY);
+    struct stat sb;
+    if (fd >= 0 && fstat (fd, &sb) == 0 && S_ISREG (sb.st_mode))
       {
-      wchar_t c = text[i];
-      if (c == 13) // DOS EOL
-        continue;
-
-      if (c == 9) // Tab
-          c = ' ';
-
-      //printf ("c=%c %04x\n", (char)c, c);
-      if (mode == MODE_ANY && c == '<')
-        {
-        mode = MODE_INTAG;
-        }
-      else if (mode == MODE_ANY && c == '\n')
-        {
-        if (inbody)
-          {
-          if (last_c != ' ')
-            {
-            klib_string_append (para, " ");
-            }
-          }
-        }
-      else if (mode == MODE_ANY && c == '&')
+      void *image = sb.st_size > 0 
+        ? mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+      if (image != MAP_FAILED)
         {
-        mode = MODE_ENTITY;
+        if (image) madvise (image, sb.st_size, MADV_SEQUENTIAL);
+        key = epub2txt_cache_key (image, sb.st_size, 
+          klib_string_cstr (options));
+        if (image) munmap (image, sb.st_size);
         }
-      else if (mode == MODE_ANY)
+      }
+    if (fd >= 0) close (fd);
+    }
+  epub2txt_stats_leave ();
+  klib_string_free (options);
+  KLIB_OUT
+  return key;
+  }
+
+/*========================================================================
+  epub2txt_do_book
+  Converts a book: the file, or, if bundle is set, its entry member, 
+  which is read into memory -- or used where it is, if it is stored
+  -- rather than extracted. With --jobs, the book is converted in a 
+  process of its own, which reports any error itself; otherwise, 
+  errors are left for the caller
+=========================================================================*/
+static void epub2txt_do_book (const char *file, epub2txt_Vfs *bundle,
+    const char *member, BOOL ascii, int width, BOOL notrim, 
+    klib_Error **error)
+  {
+  KLIB_IN
+  if (!epub2txt_jobs_start ())
+    {
+    KLIB_OUT
+    return;
+    }
+  epub2txt_stats_begin_book (file);
+  output_para = 0;
+  preview_written = 0;
+  preview_done = FALSE;
+  int saved_stdout = -1;
+  klib_String *output_path = NULL;
+  if (output_dir) 
+    {
+    output_path = epub2txt_output_path (bundle ? bundle->name : file, 
+      member);
+    saved_stdout = epub2txt_output_open (klib_string_cstr (output_path), 
+      error);
+    }
+  if (*error == NULL 
+      && !epub2txt_budget_take (OUTPUT_BUFF_SIZE + SCAN_CHUNK_SIZE))
+    *error = epub2txt_budget_error (file, "The output and scan buffers");
+  else if (*error == NULL)
+    {
+    // An EPUB on stdin is spooled into a temporary directory, which is
+    //  created along with the first entry extracted into it
+    klib_String *spool = klib_string_new_printf ("%s/epub2txt%d", 
+      getenv ("TMP") ? getenv ("TMP") : "/tmp", getpid ()); 
+    epub2txt_Entry entry;
+    memset (&entry, 0, sizeof (entry));
+    epub2txt_Vfs *vfs = NULL;
+    char *key = NULL;
+    BOOL cached = FALSE;
+    if (!bundle || epub2txt_entry_get (bundle, member, &entry, error))
+      {
+      key = epub2txt_cache_lookup (file, entry.data, entry.size, ascii, 
+        width, notrim);
+      long long size = 0;
+      if (key)
         {
-        if (inbody)
-          {
-          if (c == ' ' && last_c == ' ')
-            {
-            }
-          else
-            {
-            klib_String *s = epub2txt_transform_char (c, ascii);
-            klib_string_append (para, klib_string_cstr (s));
-            klib_string_free (s);
-            }
-          }
+        epub2txt_stats_enter (STAGE_OUTPUT);
+        cached = epub2txt_cache_serve (key, &size);
+        epub2txt_stats_leave ();
         }
-      else if (mode == MODE_ENTITY && c == ';')
+      if (cached)
         {
-        if (inbody)
+        klib_log_info ("%s: found in the cache", file);
+        if (stats_enabled)
           {
-          klib_String *s_entity = klib_string_new_from_wstring (entity);
-          char *ss_entity = strdup (klib_string_cstr (s_entity));
-          klib_string_free (s_entity);
-          char trans[20];
-          epub2txt_translate_entity (ss_entity, trans);
-          klib_string_append (para, trans);
-          free (ss_entity);
+          book_stats.output_bytes = size;
+          book_stats.cache_hits = 1;
           }
-        klib_wstring_set (entity, L"");
-        mode = MODE_ANY;
         }
-      else if (mode == MODE_ENTITY)
+      else if (bundle)
+        vfs = epub2txt_vfs_open_memory (entry.data, entry.size, file, 
+          error);
+      else
         {
-        klib_wstring_append_char (entity, c);
+        epub2txt_stats_enter (STAGE_UNZIP);
+        vfs = epub2txt_vfs_open (file, klib_string_cstr (spool), error);
+        epub2txt_stats_leave ();
         }
-      else if (mode == MODE_INTAG && c == '>')
-        {
-        klib_String *s_tag = klib_string_new_from_wstring (tag);
-        char *ss_tag = strdup (klib_string_cstr (s_tag));
-        klib_string_free (s_tag);
-        char *p = strchr (ss_tag, ' ');
-        if (p) *p = 0;
-        if (strcasecmp (ss_tag, "body") == 0) 
-          {
-          inbody = TRUE;
-          }
-        else if (strcasecmp (ss_tag, "/body") == 0) 
-          {
-          if (epub2txt_all_white(klib_string_cstr(para)))
-            can_newline = FALSE; 
-          else
-            can_newline = TRUE; 
-          epub2txt_flush_para (para, width, notrim); 
-          klib_string_set (para, "");
-          if (can_newline)
-            {
-            epub2txt_para_break();
-            can_newline = FALSE;
-            }
-          inbody = FALSE;
-          }
-        else if (strcasecmp (ss_tag, "/blockquote") == 0
-            || strcasecmp (ss_tag, "/h1") == 0
-            || strcasecmp (ss_tag, "/h2") == 0 
-            || strcasecmp (ss_tag, "/h3") == 0
-            || strcasecmp (ss_tag, "/h4") == 0
-            || strcasecmp (ss_tag, "/div") == 0) 
-          {
-          if (epub2txt_all_white(klib_string_cstr (para)))
-            can_newline = FALSE; 
-          else
-            can_newline = TRUE; 
-          epub2txt_flush_para (para, width, notrim); 
-          klib_string_set (para, "");
-          if (can_newline)
-            {
-            epub2txt_para_break();
-            can_newline = FALSE;
-            }
-          }
-        else if ((strcasecmp (ss_tag, "p/") == 0) 
-            || (strcasecmp (ss_tag, "/p") == 0))
-          {
-          if (inbody)
-            {
-            if (epub2txt_all_white(klib_string_cstr(para)))
-              can_newline = FALSE; 
-            else
-              {
-              can_newline = TRUE; 
-              }
-            epub2txt_flush_para (para, width, notrim); 
-            klib_string_set (para, "");
-            if (can_newline)
-              {
-              epub2txt_para_break();
-              can_newline = FALSE;
-              }
-            }
-          }
-        else if ((strcasecmp (ss_tag, "br/") == 0) 
-            || (strcasecmp (ss_tag, "br") == 0))
-          {
-          if (inbody)
-            {
-            if (epub2txt_all_white(klib_string_cstr(para)))
-              can_newline = FALSE; 
-            else
-              can_newline = TRUE; 
-            epub2txt_flush_para (para, width, notrim); 
-            klib_string_set (para, "");
-            if (can_newline)
-              {
-              epub2txt_line_break();
-              can_newline = FALSE;
-              }
-            }
-          }
-        else if ((strcasecmp (ss_tag, "b/") == 0) 
-            || (strcasecmp (ss_tag, "b") == 0))
-          {
-          if (inbody)
-            {
-            if (epub2txt_all_white(klib_string_cstr(para)))
-              can_newline = FALSE; 
-            else
-              can_newline = TRUE; 
-            epub2txt_flush_para (para, width, notrim); 
-            klib_string_set (para, "");
-            if (can_newline)
-              {
-              epub2txt_line_break();
-              can_newline = FALSE;
-              }
-            }
-          }
-        free (ss_tag);
-        klib_wstring_set (tag, L"");
-        mode = MODE_ANY;
-        }
-      else if (mode == MODE_INTAG)
-       {
-       klib_wstring_append_char (tag, c);
-       }
-      else
-        klib_log_error ("Unexpected character %d in mode %d", c, mode);
-      last_c = c;
-      }
-   
-    if (klib_string_length (para) > 0)
-     epub2txt_flush_para (para, width, notrim); 
-    klib_string_free (para);
-    klib_wstring_free (tag);
-    klib_wstring_free (s);
-    klib_wstring_free (entity);
-    } 
-  else
-    *error = klib_error_new (ENOENT, "Can't read file %s\n", filename);
-  KLIB_IN
+      }
+    if (vfs) 
+      {
+      if (key) cache_entry = epub2txt_cache_begin (key);
+      epub2txt_convert (vfs, file, ascii, width, notrim, error);
+      }
+    epub2txt_flush_output ();
+    if (verify_mode && vfs && epub2txt_vfs_corrupt_entries (vfs) > 0)
+      verify_failed = TRUE;
+    // A book with damaged entries is not cached, so that they are 
+    //  reported again the next time
+    epub2txt_cache_end (cache_entry, *error == NULL && vfs
+      && epub2txt_vfs_corrupt_entries (vfs) == 0);
+    cache_entry = NULL;
+    free (key);
+    epub2txt_vfs_close (vfs);
+    epub2txt_entry_close (bundle, &entry, NULL);
+    klib_string_free (spool);
+    epub2txt_budget_give (OUTPUT_BUFF_SIZE + SCAN_CHUNK_SIZE);
+    }
+  epub2txt_output_close (saved_stdout);
+  // A book that can't be converted is not left half-written in a 
+  //  --sync mirror, which would take it to be up to date; it is tried
+  //  again the next time
+  if (sync_source && output_path && *error)
+    unlink (klib_string_cstr (output_path));
+  klib_string_free (output_path);
+  epub2txt_stats_end_book ();
+  epub2txt_jobs_finish (error);
+  KLIB_OUT
   }
 
+/*========================================================================
+  epub2txt_is_bundle
+  Whether a file is a bundle of EPUBs, rather than an EPUB: a ZIP or
+  tar archive, which is told by its name
+=========================================================================*/
+static BOOL epub2txt_is_bundle (const char *file)
+  {
+  const char *dot = strrchr (file, '.');
+  return dot && !strchr (dot, '/') 
+    && (strcasecmp (dot, ".zip") == 0 || strcasecmp (dot, ".tar") == 0);
+  }
 
 /*========================================================================
-  epub2txt_get_root_file
+  epub2txt_do_bundle
+  Converts each of the EPUBs in a bundle, in order of their names. An
+  error in one book is reported, and the next one converted
 =========================================================================*/
-klib_String *epub2txt_get_root_file (const char *container, klib_Error **error)
+static void epub2txt_do_bundle (const char *file, BOOL ascii, int width, 
+    BOOL notrim, klib_Error **error)
   {
   KLIB_IN
-  klib_String *ret = NULL;
-  klib_Xml *x = klib_xml_read_file (container, error);
-  if (*error == NULL)
+  long long vfs_memory = 0;
+  epub2txt_Vfs *bundle = epub2txt_vfs_open_mapped (file, error);
+  if (bundle)
     {
-    XMLNode *root = klib_xml_get_root (x); // container 
-    int i, l = root->n_children;
-    for (i = 0; i < l; i++)
+    vfs_memory = epub2txt_vfs_memory (bundle);
+    if (epub2txt_budget_take (vfs_memory))
+      epub2txt_vfs_load (bundle, error);
+    else
       {
-      XMLNode *r1 = root->children[i];
-      if (strcmp (r1->tag, "rootfiles") == 0)
-        {
-        XMLNode *rootfiles = r1;
-        int i, l = rootfiles->n_children;
-        for (i = 0; i < l; i++)
-          {
-          XMLNode *r1 = rootfiles->children[i];
-          if (strcmp (r1->tag, "rootfile") == 0)
-            {
-            int k, nattrs = r1->n_attributes;
-            for (k = 0; k < nattrs; k++)
-              {
-              char *name = r1->attributes[k].name;
-              char *value = r1->attributes[k].value;
-              if (strcmp (name, "full-path") == 0)
-                {
-                ret = klib_string_new (value);
-                }
-              }
-            }
-          }
-        }
+      vfs_memory = 0;
+      *error = epub2txt_budget_error (file, "The bundle directory");
       }
-
-    klib_xml_free (x);
     }
-
-  if (ret == NULL)
-    *error = klib_error_new  
-      (ENOENT, "container.xml does not specify a root file\n");
+  long long i, n = *error == NULL ? epub2txt_vfs_count (bundle) : 0;
+  int books = 0;
+  const char *last = NULL;
+  for (i = 0; i < n; i++)
+    {
+    const char *member = epub2txt_vfs_entry (bundle, i);
+    const char *dot = strrchr (member, '.');
+    if (!dot || strcasecmp (dot, ".epub") != 0) continue;
+    // A name that is in the bundle more than once is only converted
+    //  once, as it can only be found once
+    if (last && strcmp (last, member) == 0) continue;
+    last = member;
+    if (epub2txt_zip_name_outside (member))
+      {
+      klib_log_warning ("%s: %s: not converted, as it is outside the "
+        "bundle", file, member);
+      continue;
+      }
+    klib_String *name = klib_string_new_printf ("%s/%s", file, member);
+    klib_Error *book_error = NULL;
+    epub2txt_do_book (klib_string_cstr (name), bundle, member, ascii, 
+      width, notrim, &book_error);
+    if (book_error)
+      {
+      klib_log_error ("%s", klib_error_cstr (book_error));
+      klib_error_free (book_error);
+      }
+    klib_string_free (name);
+    klib_object_census_poll (stderr);
+    books++;
+    }
+  if (*error == NULL && books == 0)
+    *error = klib_error_new (ENOENT, "%s: no EPUBs in the bundle", file);
+  epub2txt_vfs_close (bundle);
+  epub2txt_budget_give (vfs_memory);
   KLIB_OUT
-  return ret;
   }
 
 /*========================================================================
   epub2txt_do_file 
+  Converts an EPUB, or each of the EPUBs in a bundle
 =========================================================================*/
 void epub2txt_do_file (const char *file, BOOL ascii, int width, BOOL notrim, 
     klib_Error **error)
   {
   KLIB_IN
-  if (access (file, R_OK) == 0)
-    {
-    output_para = 0;
-    char tempdir[512];
-    char tempbase[256];
-    char cmd[1024];
-
-
-    //This tmpdir offset is no longer necessary in KBOX3+
-    //const char *kbox = getenv ("KBOX");
-    //if (kbox)
-    //  sprintf (tempbase, "%s/tmp", kbox);
-    //else
-      {
-      if (getenv ("TMP"))
-        strcpy (tempbase, getenv("TMP"));
-      else
-        strcpy (tempbase, "/tmp");
-      }
-
-    //sprintf (tempdir, "/tmp/epub2txt"); 
-    sprintf (tempdir, "%s/epub2txt%d", tempbase, getpid()); 
-
-    sprintf (cmd, "mkdir -p \"%s\"", tempdir);
-    system (cmd);
-   
-
-    sprintf (cmd, "unzip -o -qq \"%s\" -d \"%s\"", file, tempdir);
-    klib_log_debug ("Running unzip command; %s", cmd);
-    system (cmd);
-    klib_log_debug ("Unzip finished");
-    sprintf (cmd, "chmod -R 744 \"%s\"", tempdir);
-    klib_log_debug ("Fix permissions: %s", cmd);
-    system (cmd);
-    klib_log_debug ("Permissions fixed");
-    
-    char opf[768];
-    sprintf (opf, "%s/META-INF/container.xml", tempdir);
-    klib_String *rootfile = epub2txt_get_root_file (opf, error);
-    if (*error == NULL)
-      {
-      klib_log_debug ("rootfile is %s", klib_string_cstr (rootfile));
-      sprintf (opf, "%s/%s", tempdir, klib_string_cstr (rootfile));
-      char *content_dir = strdup (opf);
-      char *p = strrchr (content_dir, '/');
-      *p = 0; 
-      klib_List *list = epub2txt_get_items (opf, error);
-      if (*error == NULL)
-        {
-        klib_log_debug ("EPUB spine has %d items", klib_list_length (list));
-        int i, l = klib_list_length (list);
-        for (i = 0; i < l; i++)
-          {
-          klib_String *item = (klib_String *)klib_list_get (list, i);
-          sprintf (opf, "%s/%s", content_dir, klib_string_cstr (item));
-          epub2txt_parse_html (opf, ascii, width, notrim, error);
-          }
-        }
-      free (content_dir);
-      }
-      
-    if (rootfile) klib_string_free (rootfile);
-    sprintf (cmd, "rm -rf \"%s\"", tempdir);
-    //system (cmd); XXX
-    }
-  else
-    {
+  // "-" is an EPUB arriving on stdin, which is read as a stream; file
+  //  may also be a directory that an EPUB has been unpacked into
+  BOOL from_stdin = strcmp (file, "-") == 0;
+  if (!from_stdin && access (file, R_OK) != 0)
     *error = klib_error_new (ENOENT, "File not found: %s", file);
-    }
+  else if (!from_stdin && epub2txt_is_bundle (file))
+    epub2txt_do_bundle (file, ascii, width, notrim, error);
+  else
+    epub2txt_do_book (file, NULL, NULL, ascii, width, notrim, error);
   KLIB_OUT 
   }
-
@@ -10,6 +10,44 @@ extern int para_mark;
 // Global variable to indicate which paragraph to start output at 
 extern int start_para;
 
+// Global variable for the spine items to convert (--spine), or NULL
+//  for all of them
+extern const char *spine_range;
+
+// Global variable for the text of the table of contents labels of
+//  the chapters to convert (--chapter), or NULL for all of them
+extern const char *chapter_label;
+
+// Global variable for the most bytes of text to write for each book 
+//  (--preview), or zero for no limit
+extern long long preview_bytes;
+
+// Global variable set to count the words, characters and paragraphs
+//  of the text rather than output it
+extern BOOL count_mode;
+
+// Global variable set to check each entry extracted from the EPUB
+//  against the CRC in its directory (--verify)
+extern BOOL verify_mode;
+
+// Global variable set when an entry of any book, converted by this
+//  process or by a --jobs child, fails --verify
+extern BOOL verify_failed;
+
+// Global variable for the directory that the text of each book is
+//  written into (--output), or NULL for stdout
+extern const char *output_dir;
+
+// Global variable for the memory budget in bytes set by --max-memory, 
+//  or zero for none
+extern long long max_memory;
+
+BOOL epub2txt_select_range (const char *range, int n, BOOL *selected);
+
+klib_String *epub2txt_options (BOOL ascii, int width, BOOL notrim);
+
+klib_String *epub2txt_output_path (const char *file, const char *member);
+
 void epub2txt_do_file (const char *file, BOOL ascii, int width, 
   BOOL notrim, klib_Error **error);
 
@@ -0,0 +1,301 @@
+/*========================================================================
+  epub2txt
+  epub2txt_cache.c
+  The --cache of converted books. The text of a book is kept in a file
+  whose name is a hash of the EPUB's bytes and of the options that
+  affect the text, so converting the same book again with the same
+  options costs one pass over the EPUB to hash it, after which the 
+  text is mapped and written out whole.
+
+  Several processes may use the same cache at once. An entry is
+  written to a temporary file of the writer's own and renamed into
+  place when it is complete, so a reader sees all of an entry or none
+  of it; a reader that has opened an entry keeps it even if another
+  process removes it. When the cache grows past --cache-size, the 
+  entries that were used longest ago are removed: the time an entry
+  was last used is its modification time, which is updated whenever
+  it is served
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "klib_log.h"
+#include "epub2txt_hash.h"
+#include "epub2txt_zip.h"
+#include "epub2txt_cache.h"
+
+/*========================================================================
+  globals
+=========================================================================*/
+const char *cache_dir = NULL;
+
+long long cache_size = 1024LL * 1024 * 1024;
+
+// A temporary file older than this was left by a process that did not
+//  finish, and is removed along with the old entries
+#define CACHE_STALE_SECONDS (24 * 60 * 60)
+
+/*========================================================================
+  epub2txt_cache_key
+  The name of the cache entry for an EPUB of size bytes at data, 
+  converted with options, a string that describes the options that 
+  affect the text. The size is part of the name as well as the hash,
+  which makes a collision even less likely. The caller frees it
+=========================================================================*/
+char *epub2txt_cache_key (const BYTE *data, long long size, 
+    const char *options)
+  {
+  uint64_t seed = epub2txt_hash64 ((const BYTE *)options, strlen (options),
+    0);
+  uint64_t hash = epub2txt_hash64 (data, size, seed);
+  char *key = malloc (64);
+  snprintf (key, 64, "%016llx-%llx.txt", (unsigned long long)hash, size);
+  return key;
+  }
+
+/*========================================================================
+  epub2txt_cache_path
+  The path of the file name in the cache directory. The caller frees it
+=========================================================================*/
+static char *epub2txt_cache_path (const char *name)
+  {
+  char *path = malloc (strlen (cache_dir) + strlen (name) + 2);
+  sprintf (path, "%s/%s", cache_dir, name);
+  return path;
+  }
+
+/*========================================================================
+  epub2txt_cache_write_all
+  Writes len bytes to fd, however many calls that takes. Returns FALSE
+  if a write fails
+=========================================================================*/
+static BOOL epub2txt_cache_write_all (int fd, const char *data, 
+    long long len)
+  {
+  while (len > 0)
+    {
+    ssize_t n = write (fd, data, len > (1 << 30) ? (1 << 30) : len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FALSE;
+    data += n;
+    len -= n;
+    }
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_cache_serve
+  Writes the text of the entry key to stdout, if the cache has it, and
+  sets size to its length. Returns FALSE if it does not
+=========================================================================*/
+BOOL epub2txt_cache_serve (const char *key, long long *size)
+  {
+  KLIB_IN
+  char *path = epub2txt_cache_path (key);
+  int fd = open (path, O_RDONLY);
+  free (path);
+  struct stat sb;
+  if (fd < 0 || fstat (fd, &sb) != 0)
+    {
+    if (fd >= 0) close (fd);
+    KLIB_OUT
+    return FALSE;
+    }
+  // Mark the entry as used; if another process owns the cache, this
+  //  fails, and the entry is simply a little more likely to be removed
+  futimens (fd, NULL);
+  fflush (stdout);
+  *size = sb.st_size;
+  if (sb.st_size > 0)
+    {
+    const char *data = mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, 
+      fd, 0);
+    if (data == MAP_FAILED)
+      {
+      close (fd);
+      KLIB_OUT
+      return FALSE;
+      }
+    madvise ((void *)data, sb.st_size, MADV_SEQUENTIAL);
+    if (!epub2txt_cache_write_all (STDOUT_FILENO, data, sb.st_size))
+      klib_log_warning ("Can't write the text of a book: %s", 
+        strerror (errno));
+    munmap ((void *)data, sb.st_size);
+    }
+  close (fd);
+  KLIB_OUT
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_cache_begin
+  Starts an entry, creating the cache directory if need be. Returns 
+  NULL, with a warning, if it can't be written
+=========================================================================*/
+epub2txt_CacheEntry *epub2txt_cache_begin (const char *key)
+  {
+  KLIB_IN
+  static int serial = 0;
+  epub2txt_CacheEntry *entry = calloc (1, sizeof (epub2txt_CacheEntry));
+  entry->path = epub2txt_cache_path (key);
+  // Temporary names start with a dot, which no entry's name does
+  char temp[128];
+  snprintf (temp, sizeof (temp), ".%d.%d.%s", (int)getpid (), serial++, 
+    key);
+  entry->temp = epub2txt_cache_path (temp);
+  epub2txt_zip_make_dirs (entry->temp);
+  entry->fd = open (entry->temp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (entry->fd < 0)
+    {
+    klib_log_warning ("Can't write to the cache %s: %s", cache_dir, 
+      strerror (errno));
+    free (entry->path);
+    free (entry->temp);
+    free (entry);
+    entry = NULL;
+    }
+  KLIB_OUT
+  return entry;
+  }
+
+/*========================================================================
+  epub2txt_cache_write
+  Adds output text to an entry being written. If a write fails, the rest
+  are not tried, and the entry is not kept
+=========================================================================*/
+void epub2txt_cache_write (epub2txt_CacheEntry *entry, const char *data, 
+    int len)
+  {
+  if (entry->failed) return;
+  if (!epub2txt_cache_write_all (entry->fd, data, len))
+    entry->failed = TRUE;
+  }
+
+// An entry in the cache directory, for epub2txt_cache_evict
+typedef struct _epub2txt_CacheFile
+  {
+  char *name;
+  long long size;
+  // Modification time in nanoseconds, as entries may well be used
+  //  within a second of one another
+  long long mtime;
+  } epub2txt_CacheFile;
+
+/*========================================================================
+  epub2txt_cache_compare
+  Orders cache files from the one used longest ago
+=========================================================================*/
+static int epub2txt_cache_compare (const void *a, const void *b)
+  {
+  const epub2txt_CacheFile *f1 = a, *f2 = b;
+  return f1->mtime < f2->mtime ? -1 : f1->mtime > f2->mtime;
+  }
+
+/*========================================================================
+  epub2txt_cache_evict
+  Removes the entries that were used longest ago until the cache is
+  within cache_size, along with stale temporary files. An entry that
+  another process has already removed is no matter
+=========================================================================*/
+static void epub2txt_cache_evict (void)
+  {
+  KLIB_IN
+  DIR *d = opendir (cache_dir);
+  if (!d)
+    {
+    KLIB_OUT
+    return;
+    }
+  epub2txt_CacheFile *files = NULL;
+  int nfiles = 0, capacity = 0;
+  long long total = 0;
+  time_t now = time (NULL);
+  struct dirent *de;
+  while ((de = readdir (d)) != NULL)
+    {
+    if (strcmp (de->d_name, ".") == 0 || strcmp (de->d_name, "..") == 0) 
+      continue;
+    char *path = epub2txt_cache_path (de->d_name);
+    struct stat sb;
+    if (lstat (path, &sb) == 0 && S_ISREG (sb.st_mode))
+      {
+      if (de->d_name[0] == '.')
+        {
+        if (now - sb.st_mtime > CACHE_STALE_SECONDS) unlink (path);
+        }
+      else
+        {
+        if (nfiles == capacity)
+          {
+          capacity = capacity ? 2 * capacity : 256;
+          files = realloc (files, capacity * sizeof (epub2txt_CacheFile));
+          }
+        files[nfiles].name = strdup (de->d_name);
+        // What counts is the space the entry takes on disk, which for
+        //  a small one is much more than its length
+        files[nfiles].size = sb.st_blocks * 512LL;
+        files[nfiles].mtime = sb.st_mtim.tv_sec * 1000000000LL
+          + sb.st_mtim.tv_nsec;
+        total += files[nfiles].size;
+        nfiles++;
+        }
+      }
+    free (path);
+    }
+  closedir (d);
+  if (total > cache_size)
+    {
+    int i;
+    qsort (files, nfiles, sizeof (epub2txt_CacheFile), 
+      epub2txt_cache_compare);
+    for (i = 0; i < nfiles && total > cache_size; i++)
+      {
+      char *path = epub2txt_cache_path (files[i].name);
+      klib_log_debug ("Removing %s from the cache", path);
+      unlink (path);
+      total -= files[i].size;
+      free (path);
+      }
+    }
+  int i;
+  for (i = 0; i < nfiles; i++)
+    free (files[i].name);
+  free (files);
+  KLIB_OUT
+  }
+
+/*========================================================================
+  epub2txt_cache_end
+  Finishes an entry. If keep is set, and it was written in full, it is
+  put in the cache, replacing any entry another process made for the
+  same key in the meantime, which would have the same text. Otherwise
+  it is thrown away
+=========================================================================*/
+void epub2txt_cache_end (epub2txt_CacheEntry *entry, BOOL keep)
+  {
+  KLIB_IN
+  if (!entry)
+    {
+    KLIB_OUT
+    return;
+    }
+  if (close (entry->fd) != 0) entry->failed = TRUE;
+  if (keep && !entry->failed && rename (entry->temp, entry->path) == 0)
+    epub2txt_cache_evict ();
+  else
+    unlink (entry->temp);
+  free (entry->path);
+  free (entry->temp);
+  free (entry);
+  KLIB_OUT
+  }
+
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "klib_defs.h"
+
+// Global variable, set by --cache: the directory that converted books
+//  are kept in, or NULL if they are not
+extern const char *cache_dir;
+
+// Global variable, set by --cache-size: the most bytes the cache 
+//  holds before the books used longest ago are removed
+extern long long cache_size;
+
+/*========================================================================
+  epub2txt_CacheEntry
+  The text of a book that is being written into the cache. It goes to
+  a temporary file, which is only given the key as its name when it is
+  complete
+=========================================================================*/
+typedef struct _epub2txt_CacheEntry
+  {
+  char *path;
+  char *temp;
+  int fd;
+  // Set if a write fails, so that the entry is not kept
+  BOOL failed;
+  } epub2txt_CacheEntry;
+
+char *epub2txt_cache_key (const BYTE *data, long long size, 
+  const char *options);
+
+BOOL epub2txt_cache_serve (const char *key, long long *size);
+
+epub2txt_CacheEntry *epub2txt_cache_begin (const char *key);
+
+void epub2txt_cache_write (epub2txt_CacheEntry *entry, const char *data, 
+  int len);
+
+void epub2txt_cache_end (epub2txt_CacheEntry *entry, BOOL keep);
+
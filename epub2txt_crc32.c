@@ -0,0 +1,75 @@
+/*========================================================================
+  epub2txt
+  epub2txt_crc32.c
+  The CRC-32 of ZIP entries (the IEEE 802.3 polynomial, reflected).
+
+  The CRC is computed eight bytes at a time ("slicing by eight"), with
+  eight tables of 256 entries: table k gives the effect of a byte that
+  is followed by k more. The eight lookups of each step are
+  independent, so they overlap, where the one-table method has to wait
+  for each lookup before it can start the next.
+
+  The CRC32 instruction of SSE4.2 is no use here: it computes CRC-32C,
+  which has a different polynomial
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include "epub2txt_crc32.h"
+
+#define CRC32_POLY 0xedb88320U
+
+static uint32_t crc_table[8][256];
+static BOOL crc_table_made = FALSE;
+
+/*========================================================================
+  epub2txt_crc32_make_table
+  Builds the tables for taking the CRC eight bytes at a time: the first
+  is the usual table for one byte, and each of the others takes it a
+  byte further
+=========================================================================*/
+static void epub2txt_crc32_make_table (void)
+  {
+  int i, k;
+  for (i = 0; i < 256; i++)
+    {
+    uint32_t c = i;
+    for (k = 0; k < 8; k++)
+      c = c & 1 ? (c >> 1) ^ CRC32_POLY : c >> 1;
+    crc_table[0][i] = c;
+    }
+  for (i = 0; i < 256; i++)
+    for (k = 1; k < 8; k++)
+      crc_table[k][i] = (crc_table[k - 1][i] >> 8)
+        ^ crc_table[0][crc_table[k - 1][i] & 0xff];
+  crc_table_made = TRUE;
+  }
+
+/*========================================================================
+  epub2txt_crc32
+  Continues the CRC crc (zero to start with) over len more bytes
+=========================================================================*/
+uint32_t epub2txt_crc32 (uint32_t crc, const BYTE *data, size_t len)
+  {
+  if (!crc_table_made) epub2txt_crc32_make_table ();
+  crc = ~crc;
+  while (len >= 8)
+    {
+    uint32_t lo = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8)
+      | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+    uint32_t hi = (uint32_t)data[4] | ((uint32_t)data[5] << 8)
+      | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+    crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff]
+      ^ crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24]
+      ^ crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff]
+      ^ crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+    data += 8;
+    len -= 8;
+    }
+  while (len > 0)
+    {
+    crc = (crc >> 8) ^ crc_table[0][(crc ^ *data++) & 0xff];
+    len--;
+    }
+  return ~crc;
+  }
+
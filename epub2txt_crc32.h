@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "klib_defs.h"
+
+uint32_t epub2txt_crc32 (uint32_t crc, const BYTE *data, size_t len);
+
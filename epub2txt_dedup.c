@@ -0,0 +1,136 @@
+/*========================================================================
+  epub2txt
+  epub2txt_dedup.c
+  Spine documents that have been seen before. Books of a series, or 
+  from the same publisher, often have documents that are identical 
+  byte for byte -- the copyright page, "about the author", and so on.
+  The output of each small document that is scanned is kept, under a
+  hash of its contents, so that when a document with the same hash and
+  size turns up again in the same run, its output can be written 
+  instead of the document being scanned.
+
+  What is kept is bounded by DEDUP_STORE_MAX bytes of output; when it
+  is full, the documents that were kept first are dropped, as a repeat
+  is most likely in the books that were converted most recently
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "klib_log.h"
+#include "epub2txt_dedup.h"
+
+// Most bytes of output to keep
+#define DEDUP_STORE_MAX (8 * 1024 * 1024)
+
+// Hash buckets; a power of two
+#define DEDUP_BUCKETS 4096
+
+static epub2txt_DedupItem *buckets[DEDUP_BUCKETS];
+
+// Items in the order they were kept, for dropping the oldest
+static epub2txt_DedupItem *oldest = NULL;
+static epub2txt_DedupItem *newest = NULL;
+static long long store_bytes = 0;
+
+// The output of the document being scanned. If it grows larger than a
+//  document that would be kept, it is given up
+static char *record_text = NULL;
+static int record_len = 0;
+static BOOL record_failed = FALSE;
+
+/*========================================================================
+  epub2txt_dedup_find
+  Returns the output of a document with the given hash and size, or
+  NULL if none has been kept
+=========================================================================*/
+const epub2txt_DedupItem *epub2txt_dedup_find (uint64_t hash, 
+    long long size)
+  {
+  epub2txt_DedupItem *item = buckets[hash & (DEDUP_BUCKETS - 1)];
+  while (item && (item->hash != hash || item->size != size))
+    item = item->next_in_bucket;
+  return item;
+  }
+
+/*========================================================================
+  epub2txt_dedup_record_begin
+  Starts collecting the output of a document
+=========================================================================*/
+void epub2txt_dedup_record_begin (void)
+  {
+  if (!record_text) record_text = malloc (DEDUP_ITEM_MAX);
+  record_len = 0;
+  record_failed = FALSE;
+  }
+
+/*========================================================================
+  epub2txt_dedup_record
+  Adds output text to the item being recorded. An item that grows too
+  big to keep is not recorded
+=========================================================================*/
+void epub2txt_dedup_record (const char *s, int len)
+  {
+  if (record_failed || len == 0) return;
+  if (len > DEDUP_ITEM_MAX - record_len)
+    {
+    record_failed = TRUE;
+    return;
+    }
+  memcpy (record_text + record_len, s, len);
+  record_len += len;
+  }
+
+/*========================================================================
+  epub2txt_dedup_drop_oldest
+=========================================================================*/
+static void epub2txt_dedup_drop_oldest (void)
+  {
+  epub2txt_DedupItem *item = oldest;
+  epub2txt_DedupItem **p = &buckets[item->hash & (DEDUP_BUCKETS - 1)];
+  while (*p != item) p = &(*p)->next_in_bucket;
+  *p = item->next_in_bucket;
+  oldest = item->next_added;
+  if (!oldest) newest = NULL;
+  store_bytes -= item->len;
+  free (item->text);
+  free (item);
+  }
+
+/*========================================================================
+  epub2txt_dedup_record_end
+  Finishes collecting the output of a document, and keeps it if keep 
+  is set and all of it was collected
+=========================================================================*/
+void epub2txt_dedup_record_end (uint64_t hash, long long size, int flushes,
+    int paras, long long words, BOOL keep)
+  {
+  KLIB_IN
+  if (keep && !record_failed && !epub2txt_dedup_find (hash, size))
+    {
+    while (oldest && store_bytes + record_len > DEDUP_STORE_MAX)
+      epub2txt_dedup_drop_oldest ();
+    epub2txt_DedupItem *item = malloc (sizeof (epub2txt_DedupItem));
+    item->hash = hash;
+    item->size = size;
+    item->text = malloc (record_len ? record_len : 1);
+    if (record_len) memcpy (item->text, record_text, record_len);
+    item->len = record_len;
+    item->flushes = flushes;
+    item->paras = paras;
+    item->words = words;
+    epub2txt_DedupItem **bucket = &buckets[hash & (DEDUP_BUCKETS - 1)];
+    item->next_in_bucket = *bucket;
+    *bucket = item;
+    item->next_added = NULL;
+    if (newest) 
+      newest->next_added = item;
+    else
+      oldest = item;
+    newest = item;
+    store_bytes += record_len;
+    }
+  record_len = 0;
+  KLIB_OUT
+  }
+
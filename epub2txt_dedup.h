@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include "klib_defs.h"
+
+// Spine documents larger than this are always scanned, and are not
+//  looked for among the documents scanned before
+#define DEDUP_ITEM_MAX (256 * 1024)
+
+/*========================================================================
+  epub2txt_DedupItem
+  The output of a spine document that has been scanned, with what
+  scanning it did to the counters, so that it can be written again for
+  a document with the same contents instead of scanning that
+=========================================================================*/
+typedef struct _epub2txt_DedupItem
+  {
+  uint64_t hash;
+  long long size;
+  char *text;
+  int len;
+  // Paragraphs ended, and paragraphs and words written
+  int flushes;
+  int paras;
+  long long words;
+  struct _epub2txt_DedupItem *next_in_bucket;
+  struct _epub2txt_DedupItem *next_added;
+  } epub2txt_DedupItem;
+
+const epub2txt_DedupItem *epub2txt_dedup_find (uint64_t hash, 
+  long long size);
+
+void epub2txt_dedup_record_begin (void);
+
+void epub2txt_dedup_record (const char *s, int len);
+
+void epub2txt_dedup_record_end (uint64_t hash, long long size, int flushes,
+  int paras, long long words, BOOL keep);
+
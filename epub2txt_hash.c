@@ -0,0 +1,133 @@
+/*========================================================================
+  epub2txt
+  epub2txt_hash.c
+  A 64-bit hash of a block of bytes, for telling whether two books, or
+  two documents, have the same contents: the XXH64 algorithm. It is
+  not cryptographic, but any change in the data changes it, and it
+  runs at several gigabytes a second -- much faster than the CRC --
+  because it works on four independent 64-bit lanes of 32 bytes at a
+  time
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <string.h>
+#include "epub2txt_hash.h"
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x,r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/*========================================================================
+  epub2txt_hash_read64
+  Reads 8 bytes as a little-endian 64-bit word
+=========================================================================*/
+static inline uint64_t epub2txt_hash_read64 (const BYTE *p)
+  {
+  // The hash is defined on little-endian words; memcpy compiles to a
+  //  single load
+  uint64_t v;
+  memcpy (&v, p, sizeof (v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64 (v);
+#endif
+  return v;
+  }
+
+/*========================================================================
+  epub2txt_hash_read32
+  Reads 4 bytes as a little-endian 32-bit word
+=========================================================================*/
+static inline uint32_t epub2txt_hash_read32 (const BYTE *p)
+  {
+  uint32_t v;
+  memcpy (&v, p, sizeof (v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32 (v);
+#endif
+  return v;
+  }
+
+/*========================================================================
+  epub2txt_hash_round
+  Mixes a 64-bit word of input into one of the accumulators
+=========================================================================*/
+static inline uint64_t epub2txt_hash_round (uint64_t acc, uint64_t input)
+  {
+  acc += input * PRIME2;
+  acc = ROTL64 (acc, 31);
+  return acc * PRIME1;
+  }
+
+/*========================================================================
+  epub2txt_hash_merge
+  Folds one of the four accumulators into the hash of a long input
+=========================================================================*/
+static inline uint64_t epub2txt_hash_merge (uint64_t acc, uint64_t val)
+  {
+  acc ^= epub2txt_hash_round (0, val);
+  return acc * PRIME1 + PRIME4;
+  }
+
+/*========================================================================
+  epub2txt_hash64
+  The hash of len bytes of data. A different seed gives an unrelated
+  hash of the same data
+=========================================================================*/
+uint64_t epub2txt_hash64 (const BYTE *data, size_t len, uint64_t seed)
+  {
+  const BYTE *p = data, *end = data + len;
+  uint64_t h;
+  if (len >= 32)
+    {
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+    const BYTE *limit = end - 32;
+    do
+      {
+      v1 = epub2txt_hash_round (v1, epub2txt_hash_read64 (p));
+      v2 = epub2txt_hash_round (v2, epub2txt_hash_read64 (p + 8));
+      v3 = epub2txt_hash_round (v3, epub2txt_hash_read64 (p + 16));
+      v4 = epub2txt_hash_round (v4, epub2txt_hash_read64 (p + 24));
+      p += 32;
+      } while (p <= limit);
+    h = ROTL64 (v1, 1) + ROTL64 (v2, 7) + ROTL64 (v3, 12) + ROTL64 (v4, 18);
+    h = epub2txt_hash_merge (h, v1);
+    h = epub2txt_hash_merge (h, v2);
+    h = epub2txt_hash_merge (h, v3);
+    h = epub2txt_hash_merge (h, v4);
+    }
+  else
+    h = seed + PRIME5;
+  h += (uint64_t)len;
+
+  for (; p + 8 <= end; p += 8)
+    {
+    h ^= epub2txt_hash_round (0, epub2txt_hash_read64 (p));
+    h = ROTL64 (h, 27) * PRIME1 + PRIME4;
+    }
+  if (p + 4 <= end)
+    {
+    h ^= (uint64_t)epub2txt_hash_read32 (p) * PRIME1;
+    h = ROTL64 (h, 23) * PRIME2 + PRIME3;
+    p += 4;
+    }
+  for (; p < end; p++)
+    {
+    h ^= (*p) * PRIME5;
+    h = ROTL64 (h, 11) * PRIME1;
+    }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+  }
+
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "klib_defs.h"
+
+uint64_t epub2txt_hash64 (const BYTE *data, size_t len, uint64_t seed);
+
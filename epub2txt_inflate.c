@@ -0,0 +1,808 @@
+/*========================================================================
+  epub2txt
+  epub2txt_inflate.c
+  A DEFLATE (RFC 1951) decoder, for reading EPUB archive entries
+  without running unzip.
+
+  Decoding is table-driven: a code of up to INFLATE_LIT_BITS bits
+  (nearly all of them, in text) is decoded by a single lookup, and
+  where two short literal codes fit in the table's bits, one lookup
+  yields both. The bit buffer is 64 bits wide and is refilled eight
+  bytes at a time, which is enough for a whole length and distance
+  pair. Matches are copied eight bytes at a time, into a buffer that
+  holds the history window followed by the new output, so that copies
+  never have to wrap around
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdio.h>
+#include <string.h>
+#include "klib_log.h"
+#include "epub2txt_inflate.h"
+
+// Longest code, in bits, and the numbers of each kind of symbol
+#define INFLATE_MAX_BITS 15
+#define INFLATE_MAX_LCODES 286
+#define INFLATE_MAX_DCODES 30
+#define INFLATE_FIX_LCODES 288
+#define INFLATE_CODE_BITS 7
+
+/*========================================================================
+  Table entries
+  Each entry of a decoding table is 32 bits: the number of bits the
+  code takes (bits 0-4), what the entry is (bits 5-7), the number of
+  extra bits that follow the code (bits 8-12), and a value (bits 16-31)
+  -- a literal, two literals, a length or distance base, or for a
+  subtable, its offset in the table
+=========================================================================*/
+#define ENTRY_BAD 0
+#define ENTRY_LITERAL 1
+#define ENTRY_LITERAL2 2
+#define ENTRY_LENGTH 3
+#define ENTRY_END 4
+#define ENTRY_SUBTABLE 5
+#define ENTRY_SYMBOL 6
+
+#define ENTRY(type, len, extra, value) \
+  (((uint32_t)(value) << 16) | ((extra) << 8) | ((type) << 5) | (len))
+#define ENTRY_LEN(e) ((e) & 31)
+#define ENTRY_TYPE(e) (((e) >> 5) & 7)
+#define ENTRY_EXTRA(e) (((e) >> 8) & 31)
+#define ENTRY_VALUE(e) ((e) >> 16)
+
+// What the symbols of a code mean, when building its table
+typedef enum
+  {
+  CODE_LITLEN,
+  CODE_DIST,
+  CODE_PLAIN
+  } epub2txt_CodeKind;
+
+// Base values and extra bits of the length and distance symbols
+static const short length_base[29] =
+  {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+  };
+static const short length_extra[29] =
+  {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+  };
+static const unsigned short dist_base[30] =
+  {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+  513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+  };
+static const short dist_extra[30] =
+  {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7,
+  8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+  };
+
+/*========================================================================
+  epub2txt_inflate_load64
+  Reads 8 bytes of input as a little-endian 64-bit value
+=========================================================================*/
+static uint64_t epub2txt_inflate_load64 (const BYTE *p)
+  {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t v;
+  memcpy (&v, p, 8);
+  return v;
+#else
+  return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16)
+    | ((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32)
+    | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48)
+    | ((uint64_t)p[7] << 56);
+#endif
+  }
+
+/*========================================================================
+  epub2txt_inflate_fill
+  Reads another block from the file if the input buffer is empty.
+  Returns FALSE at the end of the data
+=========================================================================*/
+static BOOL epub2txt_inflate_fill (epub2txt_Inflate *s)
+  {
+  if (s->in_pos == s->in_len && !s->in_eof)
+    {
+    int n = s->in_left < INFLATE_INPUT_SIZE
+      ? (int)s->in_left : INFLATE_INPUT_SIZE;
+    s->in_len = n > 0 ? fread (s->in_buff, 1, n, s->in) : 0;
+    s->in_left -= s->in_len;
+    s->in_read += s->in_len;
+    s->in_pos = 0;
+    if (s->in_len == 0) s->in_eof = TRUE;
+    }
+  return s->in_pos < s->in_len;
+  }
+
+/*========================================================================
+  epub2txt_inflate_byte
+  The next byte of compressed data. At the end of the data, returns
+  zero and counts it in in_pad, so that decoding can run on to a point
+  where it checks for truncation
+=========================================================================*/
+static int epub2txt_inflate_byte (epub2txt_Inflate *s)
+  {
+  if (!epub2txt_inflate_fill (s))
+    {
+    s->in_pad++;
+    return 0;
+    }
+  return s->in_buff[s->in_pos++];
+  }
+
+/*========================================================================
+  epub2txt_inflate_refill
+  Fills the bit buffer to at least 56 bits. Where eight bytes of input
+  are to hand, they are loaded at once: the bits above nbits are then
+  the start of the bytes that follow, so loading them again later
+  does no harm
+=========================================================================*/
+static void epub2txt_inflate_refill (epub2txt_Inflate *s)
+  {
+  if (s->in_len - s->in_pos >= 8)
+    {
+    s->bits |= epub2txt_inflate_load64 (s->in_buff + s->in_pos) << s->nbits;
+    s->in_pos += (63 - s->nbits) >> 3;
+    s->nbits |= 56;
+    }
+  else
+    {
+    while (s->nbits <= 56)
+      {
+      s->bits |= (uint64_t)epub2txt_inflate_byte (s) << s->nbits;
+      s->nbits += 8;
+      }
+    }
+  }
+
+/*========================================================================
+  epub2txt_inflate_bits
+  Takes need bits from the bit buffer, refilling it first if it has too
+  few
+=========================================================================*/
+static int epub2txt_inflate_bits (epub2txt_Inflate *s, int need)
+  {
+  if (s->nbits < need) epub2txt_inflate_refill (s);
+  int ret = (int)(s->bits & ((1U << need) - 1));
+  s->bits >>= need;
+  s->nbits -= need;
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_inflate_truncated
+  Whether any of the zero bytes supplied after the end of the input
+  have been used. They are the last bytes into the bit buffer, so they
+  are its top in_pad * 8 bits
+=========================================================================*/
+static BOOL epub2txt_inflate_truncated (const epub2txt_Inflate *s)
+  {
+  return s->nbits < s->in_pad * 8;
+  }
+
+/*========================================================================
+  epub2txt_inflate_slide
+  Passes the output that has not been passed on to the sink, and moves
+  the last INFLATE_WINDOW_SIZE bytes to the start of the buffer, to be
+  the history for what follows
+=========================================================================*/
+static BOOL epub2txt_inflate_slide (epub2txt_Inflate *s)
+  {
+  int len = s->out_pos - s->out_flushed;
+  if (len > 0)
+    {
+    if (!s->sink (s->ctx, s->out + s->out_flushed, len)) return FALSE;
+    s->out_total += len;
+    }
+  if (s->out_pos > INFLATE_WINDOW_SIZE)
+    {
+    memmove (s->out, s->out + s->out_pos - INFLATE_WINDOW_SIZE,
+      INFLATE_WINDOW_SIZE);
+    s->out_pos = INFLATE_WINDOW_SIZE;
+    }
+  s->out_flushed = s->out_pos;
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_inflate_stored
+=========================================================================*/
+static int epub2txt_inflate_stored (epub2txt_Inflate *s)
+  {
+  // Stored blocks start on a byte boundary
+  epub2txt_inflate_bits (s, s->nbits & 7);
+  int len = epub2txt_inflate_bits (s, 16);
+  int nlen = epub2txt_inflate_bits (s, 16);
+  if (epub2txt_inflate_truncated (s)) return INFLATE_TRUNCATED;
+  if (len != (~nlen & 0xffff)) return INFLATE_BAD_BLOCK;
+
+  // Whole bytes that are already in the bit buffer come first
+  while (len > 0 && s->nbits >= 8)
+    {
+    if (s->in_pad * 8 >= s->nbits) return INFLATE_TRUNCATED;
+    s->out[s->out_pos++] = (BYTE)s->bits;
+    s->bits >>= 8;
+    s->nbits -= 8;
+    len--;
+    }
+  if (s->nbits == 0) s->bits = 0;
+
+  while (len > 0)
+    {
+    if (s->out_pos >= INFLATE_WINDOW_SIZE + INFLATE_OUTPUT_SIZE
+        && !epub2txt_inflate_slide (s))
+      return INFLATE_STOPPED;
+    if (!epub2txt_inflate_fill (s)) return INFLATE_TRUNCATED;
+    int n = s->in_len - s->in_pos;
+    int room = INFLATE_WINDOW_SIZE + INFLATE_OUTPUT_SIZE - s->out_pos;
+    if (n > len) n = len;
+    if (n > room) n = room;
+    memcpy (s->out + s->out_pos, s->in_buff + s->in_pos, n);
+    s->out_pos += n;
+    s->in_pos += n;
+    len -= n;
+    }
+  return INFLATE_OK;
+  }
+
+/*========================================================================
+  epub2txt_inflate_entry
+  The table entry for a symbol whose code is len bits long
+=========================================================================*/
+static uint32_t epub2txt_inflate_entry (epub2txt_CodeKind kind, int symbol,
+    int len)
+  {
+  if (kind == CODE_LITLEN)
+    {
+    if (symbol < 256)
+      return ENTRY (ENTRY_LITERAL, len, 0, symbol);
+    if (symbol == 256)
+      return ENTRY (ENTRY_END, len, 0, 0);
+    symbol -= 257;
+    if (symbol < 29)
+      return ENTRY (ENTRY_LENGTH, len, length_extra[symbol],
+        length_base[symbol]);
+    return ENTRY (ENTRY_BAD, len, 0, 0);
+    }
+  if (kind == CODE_DIST)
+    {
+    if (symbol < 30)
+      return ENTRY (ENTRY_SYMBOL, len, dist_extra[symbol],
+        dist_base[symbol]);
+    return ENTRY (ENTRY_BAD, len, 0, 0);
+    }
+  return ENTRY (ENTRY_SYMBOL, len, 0, symbol);
+  }
+
+/*========================================================================
+  epub2txt_inflate_build
+  Builds the decoding table of a canonical Huffman code from the code
+  lengths of its n symbols. Codes are read from the low bits of the bit
+  buffer, so each code fills the main table at its bit-reversed value,
+  and every entry above that whose low bits are the same. A code longer
+  than table_bits fills a subtable, found from its first table_bits
+  bits, that is indexed by the rest. Entries for bit patterns that are
+  not codes are left as ENTRY_BAD, which takes no bits.
+
+  Returns a negative number if there are too many codes of some length,
+  a positive number if the code is incomplete, and zero if it is
+  complete. For literal and length codes, entries whose code leaves
+  room in the table for a second literal code decode both at once
+=========================================================================*/
+static int epub2txt_inflate_build (uint32_t *table, const BYTE *lengths,
+    int n, int table_bits, epub2txt_CodeKind kind)
+  {
+  int count[INFLATE_MAX_BITS + 1];
+  int next[INFLATE_MAX_BITS + 1];
+  int len, symbol, i;
+  int size = 1 << table_bits;
+  int sub_bits = INFLATE_MAX_BITS - table_bits;
+
+  memset (count, 0, sizeof (count));
+  for (symbol = 0; symbol < n; symbol++)
+    count[lengths[symbol]]++;
+  for (i = 0; i < size; i++)
+    table[i] = ENTRY (ENTRY_BAD, 0, 0, 0);
+  if (count[0] == n) return 0;
+
+  int left = 1;
+  for (len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+    left <<= 1;
+    left -= count[len];
+    if (left < 0) return left;
+    }
+
+  int code = 0;
+  count[0] = 0;
+  for (len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+    code = (code + count[len - 1]) << 1;
+    next[len] = code;
+    }
+
+  int sub_next = size;
+  for (symbol = 0; symbol < n; symbol++)
+    {
+    len = lengths[symbol];
+    if (len == 0) continue;
+    int c = next[len]++;
+    int rev = 0;
+    for (i = 0; i < len; i++, c >>= 1)
+      rev = (rev << 1) | (c & 1);
+    uint32_t entry = epub2txt_inflate_entry (kind, symbol, len);
+    if (len <= table_bits)
+      {
+      for (i = rev; i < size; i += 1 << len)
+        table[i] = entry;
+      }
+    else
+      {
+      int prefix = rev & (size - 1);
+      if (ENTRY_TYPE (table[prefix]) != ENTRY_SUBTABLE)
+        {
+        table[prefix] = ENTRY (ENTRY_SUBTABLE, table_bits, sub_bits,
+          sub_next);
+        for (i = 0; i < (1 << sub_bits); i++)
+          table[sub_next + i] = ENTRY (ENTRY_BAD, 0, 0, 0);
+        sub_next += 1 << sub_bits;
+        }
+      uint32_t *sub = table + ENTRY_VALUE (table[prefix]);
+      for (i = rev >> table_bits; i < (1 << sub_bits);
+          i += 1 << (len - table_bits))
+        sub[i] = entry;
+      }
+    }
+
+  if (kind == CODE_LITLEN)
+    {
+    // The main table as it stands, for finding the second literals
+    uint32_t single[1 << INFLATE_LIT_BITS];
+    memcpy (single, table, size * sizeof (uint32_t));
+    for (i = 0; i < size; i++)
+      {
+      uint32_t e = single[i];
+      if (ENTRY_TYPE (e) != ENTRY_LITERAL) continue;
+      int len1 = ENTRY_LEN (e);
+      // The bits after the first code; the missing top bits don't
+      //  matter if the second code is short enough to fit
+      uint32_t e2 = single[i >> len1];
+      if (ENTRY_TYPE (e2) == ENTRY_LITERAL
+          && ENTRY_LEN (e2) <= table_bits - len1)
+        table[i] = ENTRY (ENTRY_LITERAL2, len1 + ENTRY_LEN (e2), 0,
+          ENTRY_VALUE (e) | (ENTRY_VALUE (e2) << 8));
+      }
+    }
+  return left;
+  }
+
+/*========================================================================
+  epub2txt_inflate_lookup
+  Decodes a symbol from the low bits of bits: the entry for them in
+  table, or in the subtable it points to if the code is longer than
+  table_bits
+=========================================================================*/
+static uint32_t epub2txt_inflate_lookup (const uint32_t *table,
+    int table_bits, uint64_t bits)
+  {
+  uint32_t e = table[bits & ((1 << table_bits) - 1)];
+  if (ENTRY_TYPE (e) == ENTRY_SUBTABLE)
+    e = table[ENTRY_VALUE (e)
+      + ((bits >> table_bits) & ((1 << ENTRY_EXTRA (e)) - 1))];
+  return e;
+  }
+
+/*========================================================================
+  epub2txt_inflate_codes
+  Decodes the literals and matches of a compressed block, using the
+  tables already built. This is where nearly all the time goes, so the
+  bit buffer and the input and output positions are kept in local
+  variables, and written back to the state only when the input has to
+  be refilled a byte at a time, or the output passed on
+=========================================================================*/
+static int epub2txt_inflate_codes (epub2txt_Inflate *s)
+  {
+  const uint32_t *lit = s->lit_table;
+  const uint32_t *dist = s->dist_table;
+  uint64_t bits = s->bits;
+  int nbits = s->nbits;
+  const BYTE *in = s->in_buff + s->in_pos;
+  const BYTE *in_end = s->in_buff + s->in_len;
+  BYTE *out = s->out + s->out_pos;
+  BYTE *out_limit = s->out + INFLATE_WINDOW_SIZE + INFLATE_OUTPUT_SIZE;
+  int pad_bits = s->in_pad * 8;
+  int ret = INFLATE_OK;
+
+  for (;;)
+    {
+    if (in_end - in >= 8)
+      {
+      bits |= epub2txt_inflate_load64 (in) << nbits;
+      in += (63 - nbits) >> 3;
+      nbits |= 56;
+      }
+    else
+      {
+      s->bits = bits;
+      s->nbits = nbits;
+      s->in_pos = in - s->in_buff;
+      epub2txt_inflate_refill (s);
+      bits = s->bits;
+      nbits = s->nbits;
+      in = s->in_buff + s->in_pos;
+      in_end = s->in_buff + s->in_len;
+      pad_bits = s->in_pad * 8;
+      }
+
+    uint32_t e = epub2txt_inflate_lookup (lit, INFLATE_LIT_BITS, bits);
+    int len = ENTRY_LEN (e);
+    bits >>= len;
+    nbits -= len;
+    if (nbits < pad_bits)
+      {
+      ret = INFLATE_TRUNCATED;
+      break;
+      }
+    int type = ENTRY_TYPE (e);
+    if (type == ENTRY_LITERAL2)
+      {
+      out[0] = (BYTE)ENTRY_VALUE (e);
+      out[1] = (BYTE)(ENTRY_VALUE (e) >> 8);
+      out += 2;
+      }
+    else if (type == ENTRY_LITERAL)
+      {
+      *out++ = (BYTE)ENTRY_VALUE (e);
+      }
+    else if (type == ENTRY_LENGTH)
+      {
+      // 56 bits is enough for the longest length code and its extra
+      //  bits, and the longest distance code and its extra bits
+      int extra = ENTRY_EXTRA (e);
+      int length = ENTRY_VALUE (e) + (int)(bits & ((1U << extra) - 1));
+      bits >>= extra;
+      nbits -= extra;
+      e = epub2txt_inflate_lookup (dist, INFLATE_DIST_BITS, bits);
+      if (ENTRY_TYPE (e) != ENTRY_SYMBOL)
+        {
+        ret = INFLATE_BAD_CODES;
+        break;
+        }
+      len = ENTRY_LEN (e);
+      bits >>= len;
+      nbits -= len;
+      extra = ENTRY_EXTRA (e);
+      int distance = ENTRY_VALUE (e) + (int)(bits & ((1U << extra) - 1));
+      bits >>= extra;
+      nbits -= extra;
+      if (nbits < pad_bits)
+        {
+        ret = INFLATE_TRUNCATED;
+        break;
+        }
+      if (distance > out - s->out)
+        {
+        ret = INFLATE_BAD_DATA;
+        break;
+        }
+      const BYTE *from = out - distance;
+      if (distance >= 8)
+        {
+        BYTE *end = out + length;
+        do
+          {
+          memcpy (out, from, 8);
+          out += 8;
+          from += 8;
+          } while (out < end);
+        out = end;
+        }
+      else if (distance == 1)
+        {
+        memset (out, out[-1], length);
+        out += length;
+        }
+      else
+        {
+        while (length--) *out++ = *from++;
+        }
+      }
+    else if (type == ENTRY_END)
+      break;
+    else
+      {
+      ret = INFLATE_BAD_CODES;
+      break;
+      }
+
+    if (out >= out_limit)
+      {
+      s->out_pos = out - s->out;
+      if (!epub2txt_inflate_slide (s))
+        {
+        ret = INFLATE_STOPPED;
+        break;
+        }
+      out = s->out + s->out_pos;
+      }
+    }
+
+  s->bits = bits;
+  s->nbits = nbits;
+  s->in_pos = in - s->in_buff;
+  s->out_pos = out - s->out;
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_inflate_fixed
+  Decodes a block compressed with the fixed Huffman codes of the deflate
+  format
+=========================================================================*/
+static int epub2txt_inflate_fixed (epub2txt_Inflate *s)
+  {
+  BYTE lengths[INFLATE_FIX_LCODES];
+  int symbol;
+  for (symbol = 0; symbol < 144; symbol++) lengths[symbol] = 8;
+  for (; symbol < 256; symbol++) lengths[symbol] = 9;
+  for (; symbol < 280; symbol++) lengths[symbol] = 7;
+  for (; symbol < INFLATE_FIX_LCODES; symbol++) lengths[symbol] = 8;
+  epub2txt_inflate_build (s->lit_table, lengths, INFLATE_FIX_LCODES,
+    INFLATE_LIT_BITS, CODE_LITLEN);
+  for (symbol = 0; symbol < INFLATE_MAX_DCODES; symbol++)
+    lengths[symbol] = 5;
+  epub2txt_inflate_build (s->dist_table, lengths, INFLATE_MAX_DCODES,
+    INFLATE_DIST_BITS, CODE_DIST);
+  return epub2txt_inflate_codes (s);
+  }
+
+/*========================================================================
+  epub2txt_inflate_bad_code
+  Whether a code that epub2txt_inflate_build returned built is unusable:
+  an incomplete code is allowed only if it has a single symbol
+=========================================================================*/
+static BOOL epub2txt_inflate_bad_code (int built, const BYTE *lengths,
+    int n)
+  {
+  if (built < 0) return TRUE;
+  if (built == 0) return FALSE;
+  int i, used = 0;
+  for (i = 0; i < n; i++)
+    if (lengths[i]) used++;
+  return used != 1;
+  }
+
+/*========================================================================
+  epub2txt_inflate_dynamic
+  A block whose codes are described at its start, by code lengths that
+  are themselves Huffman coded
+=========================================================================*/
+static int epub2txt_inflate_dynamic (epub2txt_Inflate *s)
+  {
+  static const BYTE order[19] =
+    {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+  BYTE lengths[INFLATE_MAX_LCODES + INFLATE_MAX_DCODES];
+  int index;
+
+  int nlen = epub2txt_inflate_bits (s, 5) + 257;
+  int ndist = epub2txt_inflate_bits (s, 5) + 1;
+  int ncode = epub2txt_inflate_bits (s, 4) + 4;
+  if (nlen > INFLATE_MAX_LCODES || ndist > INFLATE_MAX_DCODES)
+    return INFLATE_BAD_CODES;
+
+  for (index = 0; index < ncode; index++)
+    lengths[order[index]] = epub2txt_inflate_bits (s, 3);
+  for (; index < 19; index++)
+    lengths[order[index]] = 0;
+  if (epub2txt_inflate_truncated (s)) return INFLATE_TRUNCATED;
+
+  // The code length code is short lived, so its table goes where the
+  //  distance table will be
+  uint32_t *codes = s->dist_table;
+  if (epub2txt_inflate_build (codes, lengths, 19, INFLATE_CODE_BITS,
+      CODE_PLAIN) != 0)
+    return INFLATE_BAD_CODES;
+
+  index = 0;
+  while (index < nlen + ndist)
+    {
+    if (s->nbits < INFLATE_CODE_BITS + 7) epub2txt_inflate_refill (s);
+    uint32_t e = epub2txt_inflate_lookup (codes, INFLATE_CODE_BITS,
+      s->bits);
+    if (ENTRY_TYPE (e) != ENTRY_SYMBOL) return INFLATE_BAD_CODES;
+    s->bits >>= ENTRY_LEN (e);
+    s->nbits -= ENTRY_LEN (e);
+    int symbol = ENTRY_VALUE (e);
+    if (symbol < 16)
+      lengths[index++] = symbol;
+    else
+      {
+      int len = 0, repeat;
+      if (symbol == 16)
+        {
+        if (index == 0) return INFLATE_BAD_CODES;
+        len = lengths[index - 1];
+        repeat = 3 + epub2txt_inflate_bits (s, 2);
+        }
+      else if (symbol == 17)
+        repeat = 3 + epub2txt_inflate_bits (s, 3);
+      else
+        repeat = 11 + epub2txt_inflate_bits (s, 7);
+      if (index + repeat > nlen + ndist) return INFLATE_BAD_CODES;
+      while (repeat--) lengths[index++] = len;
+      }
+    if (epub2txt_inflate_truncated (s)) return INFLATE_TRUNCATED;
+    }
+
+  // There must be a code for the end of the block
+  if (lengths[256] == 0) return INFLATE_BAD_CODES;
+
+  if (epub2txt_inflate_bad_code (epub2txt_inflate_build (s->lit_table,
+        lengths, nlen, INFLATE_LIT_BITS, CODE_LITLEN), lengths, nlen)
+      || epub2txt_inflate_bad_code (epub2txt_inflate_build (s->dist_table,
+        lengths + nlen, ndist, INFLATE_DIST_BITS, CODE_DIST),
+        lengths + nlen, ndist))
+    return INFLATE_BAD_CODES;
+
+  return epub2txt_inflate_codes (s);
+  }
+
+/*========================================================================
+  epub2txt_inflate_input
+  Sets where compressed data is read from: at most in_size bytes from
+  the current position of in
+=========================================================================*/
+void epub2txt_inflate_input (epub2txt_Inflate *s, FILE *in, 
+    long long in_size)
+  {
+  s->in = in;
+  s->in_left = in_size;
+  s->in_read = 0;
+  s->in_pos = 0;
+  s->in_len = 0;
+  s->in_eof = FALSE;
+  s->in_pad = 0;
+  s->bits = 0;
+  s->nbits = 0;
+  }
+
+/*========================================================================
+  epub2txt_inflate_read
+  Reads up to len bytes of the input as they are, for what is not
+  compressed: stored data, and the headers between compressed streams.
+  Returns the number read, which is less than len only at the end of
+  the input
+=========================================================================*/
+int epub2txt_inflate_read (epub2txt_Inflate *s, BYTE *buff, int len)
+  {
+  int done = 0;
+  while (done < len)
+    {
+    if (!epub2txt_inflate_fill (s)) break;
+    int n = s->in_len - s->in_pos;
+    if (n > len - done) n = len - done;
+    memcpy (buff + done, s->in_buff + s->in_pos, n);
+    s->in_pos += n;
+    done += n;
+    }
+  return done;
+  }
+
+/*========================================================================
+  epub2txt_inflate_tell
+  The number of bytes of input used so far
+=========================================================================*/
+long long epub2txt_inflate_tell (const epub2txt_Inflate *s)
+  {
+  return s->in_read - (s->in_len - s->in_pos);
+  }
+
+/*========================================================================
+  epub2txt_inflate_give_back
+  Returns the whole bytes left in the bit buffer at the end of a
+  compressed stream to the input buffer, so that what follows the
+  stream can be read. They are the bytes just before in_pos, but they
+  may no longer be in the buffer if it has been refilled since they
+  were loaded, so they are put back from the bit buffer itself
+=========================================================================*/
+static void epub2txt_inflate_give_back (epub2txt_Inflate *s)
+  {
+  int n = s->nbits / 8 - s->in_pad;
+  if (n > 0)
+    {
+    uint64_t bits = s->bits >> (s->nbits & 7);
+    if (n > s->in_pos)
+      {
+      memmove (s->in_buff + n, s->in_buff + s->in_pos, s->in_len - s->in_pos);
+      s->in_len += n - s->in_pos;
+      s->in_pos = n;
+      }
+    int i;
+    for (i = 0; i < n; i++)
+      s->in_buff[s->in_pos - n + i] = (BYTE)(bits >> (8 * i));
+    s->in_pos -= n;
+    }
+  s->bits = 0;
+  s->nbits = 0;
+  s->in_pad = 0;
+  }
+
+/*========================================================================
+  epub2txt_inflate
+  Decompresses in_size bytes of raw DEFLATE data (no zlib or gzip
+  header) read from the current position of in, passing the output to
+  sink in blocks of up to INFLATE_OUTPUT_SIZE bytes. Returns INFLATE_OK
+  or one of the INFLATE_ errors
+=========================================================================*/
+int epub2txt_inflate (epub2txt_Inflate *s, FILE *in, long long in_size,
+    epub2txt_InflateSink sink, void *ctx)
+  {
+  epub2txt_inflate_input (s, in, in_size);
+  return epub2txt_inflate_next (s, sink, ctx);
+  }
+
+/*========================================================================
+  epub2txt_inflate_next
+  Decompresses one DEFLATE stream from the input set by 
+  epub2txt_inflate_input, which may hold more than one. Whatever
+  follows the stream is left to be read
+=========================================================================*/
+int epub2txt_inflate_next (epub2txt_Inflate *s, epub2txt_InflateSink sink, 
+    void *ctx)
+  {
+  KLIB_IN
+  s->out_pos = 0;
+  s->out_flushed = 0;
+  s->out_total = 0;
+  s->sink = sink;
+  s->ctx = ctx;
+
+  int ret = INFLATE_OK;
+  int last;
+  do
+    {
+    last = epub2txt_inflate_bits (s, 1);
+    int type = epub2txt_inflate_bits (s, 2);
+    if (epub2txt_inflate_truncated (s))
+      ret = INFLATE_TRUNCATED;
+    else if (type == 0)
+      ret = epub2txt_inflate_stored (s);
+    else if (type == 1)
+      ret = epub2txt_inflate_fixed (s);
+    else if (type == 2)
+      ret = epub2txt_inflate_dynamic (s);
+    else
+      ret = INFLATE_BAD_BLOCK;
+    } while (!last && ret == INFLATE_OK);
+
+  // Even if the data is damaged, what was decoded before the damage
+  //  is passed on
+  if (ret != INFLATE_STOPPED && !epub2txt_inflate_slide (s))
+    ret = INFLATE_STOPPED;
+  epub2txt_inflate_give_back (s);
+  KLIB_OUT
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_inflate_strerror
+  A description of a result of epub2txt_inflate, for messages
+=========================================================================*/
+const char *epub2txt_inflate_strerror (int result)
+  {
+  switch (result)
+    {
+    case INFLATE_OK: return "no error";
+    case INFLATE_TRUNCATED: return "compressed data is truncated";
+    case INFLATE_BAD_BLOCK: return "invalid block type or length";
+    case INFLATE_BAD_CODES: return "invalid Huffman codes";
+    case INFLATE_BAD_DATA: return "match distance is too far back";
+    case INFLATE_STOPPED: return "could not write the data";
+    }
+  return "unknown error";
+  }
+
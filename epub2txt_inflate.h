@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "klib_defs.h"
+
+// The DEFLATE history window: a match can refer back this far
+#define INFLATE_WINDOW_SIZE 32768
+
+// Inflated data is passed on in blocks of up to this size
+#define INFLATE_OUTPUT_SIZE 32768
+
+// Compressed data is read from the file in blocks of this size
+#define INFLATE_INPUT_SIZE 16384
+
+// Codes of up to this many bits are decoded with a single table
+//  lookup; longer ones need a second lookup, in a subtable
+#define INFLATE_LIT_BITS 11
+#define INFLATE_DIST_BITS 8
+
+// Sizes of the decoding tables: the main table, and a subtable for
+//  each long code in the worst case (see epub2txt_inflate_build)
+#define INFLATE_LIT_TABLE_SIZE ((1 << INFLATE_LIT_BITS) \
+  + 288 * (1 << (15 - INFLATE_LIT_BITS)))
+#define INFLATE_DIST_TABLE_SIZE ((1 << INFLATE_DIST_BITS) \
+  + 32 * (1 << (15 - INFLATE_DIST_BITS)))
+
+// Matches are copied eight bytes at a time, and may write this far
+//  past their end
+#define INFLATE_SLACK 16
+
+// Results of epub2txt_inflate
+#define INFLATE_OK 0
+#define INFLATE_TRUNCATED -1
+#define INFLATE_BAD_BLOCK -2
+#define INFLATE_BAD_CODES -3
+#define INFLATE_BAD_DATA -4
+#define INFLATE_STOPPED -5
+
+// Receives each block of inflated data. Returning FALSE abandons the
+//  rest of the stream
+typedef BOOL (*epub2txt_InflateSink) (void *ctx, const BYTE *data, int len);
+
+// Decoder state. It is large (mostly the window and the tables), so
+//  it is allocated once and reused for every entry of an archive
+typedef struct _epub2txt_Inflate
+  {
+  FILE *in;
+  long long in_left;
+  // Bytes read from in so far
+  long long in_read;
+  // Room is left for the bytes that epub2txt_inflate_next gives back
+  //  from the bit buffer
+  BYTE in_buff[INFLATE_INPUT_SIZE + 8];
+  int in_pos;
+  int in_len;
+  BOOL in_eof;
+  // Zero bytes supplied after the end of the input; if any of them
+  //  are used, the data was truncated
+  int in_pad;
+  uint64_t bits;
+  int nbits;
+  // The last INFLATE_WINDOW_SIZE bytes of output, followed by the
+  //  output that has not yet been passed on
+  BYTE out[INFLATE_WINDOW_SIZE + INFLATE_OUTPUT_SIZE + 258
+    + INFLATE_SLACK];
+  int out_pos;
+  int out_flushed;
+  long long out_total;
+  epub2txt_InflateSink sink;
+  void *ctx;
+  uint32_t lit_table[INFLATE_LIT_TABLE_SIZE];
+  uint32_t dist_table[INFLATE_DIST_TABLE_SIZE];
+  } epub2txt_Inflate;
+
+int epub2txt_inflate (epub2txt_Inflate *s, FILE *in, long long in_size,
+  epub2txt_InflateSink sink, void *ctx);
+
+void epub2txt_inflate_input (epub2txt_Inflate *s, FILE *in, 
+  long long in_size);
+
+int epub2txt_inflate_read (epub2txt_Inflate *s, BYTE *buff, int len);
+
+long long epub2txt_inflate_tell (const epub2txt_Inflate *s);
+
+int epub2txt_inflate_next (epub2txt_Inflate *s, epub2txt_InflateSink sink, 
+  void *ctx);
+
+const char *epub2txt_inflate_strerror (int result);
+
@@ -0,0 +1,159 @@
+/*========================================================================
+  epub2txt
+  epub2txt_jobs.c
+  Converts books in parallel for --jobs. Each book is converted by a
+  child process of its own, so none of the conversion's state has to
+  be shared; a child's --stats counters are sent back to be added to
+  the total through a pipe. The text of each book must go to a file
+  of its own (--output), as the children run in no particular order
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "klib_log.h"
+#include "epub2txt.h"
+#include "epub2txt_stats.h"
+#include "epub2txt_jobs.h"
+
+/*========================================================================
+  globals
+=========================================================================*/
+int max_jobs = 1;
+
+// A book being converted by a child process, and the read end of the
+//  pipe its counters come back through
+typedef struct _epub2txt_Job
+  {
+  pid_t pid;
+  int fd;
+  } epub2txt_Job;
+
+static epub2txt_Job *jobs = NULL;
+static int njobs = 0;
+
+// Set in a child process: where to send its counters
+static BOOL in_child = FALSE;
+static int stats_fd = -1;
+
+/*========================================================================
+  epub2txt_jobs_reap
+  Waits for a child process to finish, and adds its counters to the
+  total. A child writes them just before it exits, and they are much
+  smaller than a pipe holds, so it never waits for them to be read
+=========================================================================*/
+static void epub2txt_jobs_reap (void)
+  {
+  int status, i;
+  pid_t pid = waitpid (-1, &status, 0);
+  if (pid < 0)
+    {
+    // No children are left, although some were thought to be
+    njobs = 0;
+    return;
+    }
+  for (i = 0; i < njobs && jobs[i].pid != pid; i++)
+    ;
+  if (i == njobs) return;
+  // A child that found an entry that failed --verify says so in its
+  //  exit status
+  if (WIFEXITED (status) && WEXITSTATUS (status) != 0)
+    verify_failed = TRUE;
+  epub2txt_Stats stats;
+  if (read (jobs[i].fd, &stats, sizeof (stats)) == sizeof (stats))
+    epub2txt_stats_add (&stats);
+  close (jobs[i].fd);
+  jobs[i] = jobs[--njobs];
+  }
+
+/*========================================================================
+  epub2txt_jobs_start
+  Starts a book. Returns TRUE if the caller is to convert it: it is
+  the child process that has been started for it, or books are not
+  being converted in parallel. Returns FALSE to the parent. When all
+  the books have been started, the parent must call epub2txt_jobs_wait
+=========================================================================*/
+BOOL epub2txt_jobs_start (void)
+  {
+  if (max_jobs <= 1 || in_child) return TRUE;
+  if (!jobs) jobs = malloc (max_jobs * sizeof (epub2txt_Job));
+  while (njobs >= max_jobs)
+    epub2txt_jobs_reap ();
+  int p[2];
+  fflush (stdout);
+  fflush (stderr);
+  if (pipe (p) != 0)
+    {
+    klib_log_warning ("Can't start a job; converting in this process");
+    return TRUE;
+    }
+  pid_t pid = fork ();
+  if (pid < 0)
+    {
+    klib_log_warning ("Can't start a job; converting in this process");
+    close (p[0]);
+    close (p[1]);
+    return TRUE;
+    }
+  if (pid == 0)
+    {
+    int i;
+    for (i = 0; i < njobs; i++)
+      close (jobs[i].fd);
+    njobs = 0;
+    close (p[0]);
+    in_child = TRUE;
+    stats_fd = p[1];
+    // Whatever this book writes to stderr comes out in one piece, not
+    //  interleaved with the other books'
+    setvbuf (stderr, NULL, _IOFBF, 65536);
+    return TRUE;
+    }
+  close (p[1]);
+  jobs[njobs].pid = pid;
+  jobs[njobs].fd = p[0];
+  njobs++;
+  return FALSE;
+  }
+
+/*========================================================================
+  epub2txt_jobs_finish
+  Called when a book that epub2txt_jobs_start said to convert has
+  been. A child process reports any error, sends back its counters,
+  and exits, with status 1 if an entry failed --verify; otherwise,
+  nothing happens, and the error is left for the caller
+=========================================================================*/
+void epub2txt_jobs_finish (klib_Error **error)
+  {
+  if (!in_child) return;
+  if (*error)
+    {
+    klib_log_error ("%s", klib_error_cstr (*error));
+    klib_error_free (*error);
+    *error = NULL;
+    }
+  if (stats_enabled
+      && write (stats_fd, &book_stats, sizeof (book_stats))
+        != sizeof (book_stats))
+    klib_log_warning ("Can't send the counters of a job");
+  fflush (stdout);
+  fflush (stderr);
+  _exit (verify_failed ? 1 : 0);
+  }
+
+/*========================================================================
+  epub2txt_jobs_wait
+  Waits for all the books that have been started to finish
+=========================================================================*/
+void epub2txt_jobs_wait (void)
+  {
+  while (njobs > 0)
+    epub2txt_jobs_reap ();
+  free (jobs);
+  jobs = NULL;
+  }
+
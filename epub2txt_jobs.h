@@ -0,0 +1,15 @@
+#pragma once
+
+#include "klib_defs.h"
+#include "klib_error.h"
+
+// Global variable for the most books to convert at once, each in a
+//  process of its own (--jobs)
+extern int max_jobs;
+
+BOOL epub2txt_jobs_start (void);
+
+void epub2txt_jobs_finish (klib_Error **error);
+
+void epub2txt_jobs_wait (void);
+
@@ -0,0 +1,391 @@
+/*========================================================================
+  epub2txt
+  epub2txt_stats.c
+  Per-stage timing and throughput counters for the --stats option
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "klib_log.h"
+#include "epub2txt_stats.h"
+
+/*========================================================================
+  globals
+=========================================================================*/
+BOOL stats_enabled = FALSE;
+
+BOOL stats_json = FALSE;
+
+epub2txt_Stats book_stats;
+
+static epub2txt_Stats total_stats;
+
+static const char *stage_names[STAGE_MAX] =
+  {"unzip", "opf", "scan", "wrap", "output"};
+
+// Stages nest, so we keep a small stack. Time is charged to whichever
+//  stage is on top when the clock is next read
+#define STAGE_STACK_MAX 16
+static epub2txt_Stage stage_stack[STAGE_STACK_MAX];
+static int stage_depth = 0;
+static double last_wall = 0;
+static double last_cpu = 0;
+
+static char book_name[512];
+
+/*========================================================================
+  epub2txt_stats_read_clocks
+  CPU time includes children, in case a stage runs a separate 
+  process
+=========================================================================*/
+static void epub2txt_stats_read_clocks (double *wall, double *cpu)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  *wall = ts.tv_sec + ts.tv_nsec / 1e9;
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+  *cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+  struct rusage ru;
+  if (getrusage (RUSAGE_CHILDREN, &ru) == 0)
+    {
+    *cpu += ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    *cpu += ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    }
+  }
+
+/*========================================================================
+  epub2txt_stats_charge
+  Charge the time since the clocks were last read to the stage on the
+  top of the stack, if there is one
+=========================================================================*/
+static void epub2txt_stats_charge (void)
+  {
+  double wall, cpu;
+  epub2txt_stats_read_clocks (&wall, &cpu);
+  if (stage_depth > 0)
+    {
+    epub2txt_Stage stage = stage_stack[stage_depth - 1];
+    book_stats.wall[stage] += wall - last_wall;
+    book_stats.cpu[stage] += cpu - last_cpu;
+    }
+  last_wall = wall;
+  last_cpu = cpu;
+  }
+
+/*========================================================================
+  epub2txt_stats_enter
+=========================================================================*/
+void epub2txt_stats_enter (epub2txt_Stage stage)
+  {
+  if (!stats_enabled) return;
+  epub2txt_stats_charge ();
+  if (stage_depth < STAGE_STACK_MAX)
+    stage_stack[stage_depth] = stage;
+  stage_depth++;
+  // Memstat context zero is 'outside any stage'
+  klib_memstat_set_context (stage + 1);
+  }
+
+/*========================================================================
+  epub2txt_stats_leave
+=========================================================================*/
+void epub2txt_stats_leave (void)
+  {
+  if (!stats_enabled) return;
+  epub2txt_stats_charge ();
+  if (stage_depth > 0)
+    stage_depth--;
+  else
+    klib_log_warning ("Unbalanced epub2txt_stats_leave");
+  if (stage_depth > 0 && stage_depth <= STAGE_STACK_MAX)
+    klib_memstat_set_context (stage_stack[stage_depth - 1] + 1);
+  else
+    klib_memstat_set_context (0);
+  }
+
+/*========================================================================
+  epub2txt_stats_begin_book
+=========================================================================*/
+void epub2txt_stats_begin_book (const char *file)
+  {
+  if (!stats_enabled) return;
+  memset (&book_stats, 0, sizeof (book_stats));
+  book_stats.books = 1;
+  strncpy (book_name, file, sizeof (book_name) - 1);
+  book_name[sizeof (book_name) - 1] = 0;
+  stage_depth = 0;
+  klib_memstat_set_context (0);
+  klib_memstat_reset ();
+  epub2txt_stats_read_clocks (&last_wall, &last_cpu);
+  }
+
+/*========================================================================
+  epub2txt_stats_collect_rss
+=========================================================================*/
+static void epub2txt_stats_collect_rss (epub2txt_Stats *stats)
+  {
+  struct rusage ru;
+  if (getrusage (RUSAGE_SELF, &ru) == 0)
+    stats->peak_rss = ru.ru_maxrss;
+  if (getrusage (RUSAGE_CHILDREN, &ru) == 0)
+    stats->child_peak_rss = ru.ru_maxrss;
+  }
+
+/*========================================================================
+  epub2txt_stats_collect_memstat
+  Copy the allocation counts for the book into book_stats
+=========================================================================*/
+static void epub2txt_stats_collect_memstat (void)
+  {
+  int i;
+  const klib_MemStat *m = klib_memstat_get_total ();
+  book_stats.allocs = m->allocs;
+  book_stats.alloc_bytes = m->bytes;
+  book_stats.peak_bytes = m->peak;
+  for (i = 0; i < STAGE_MAX; i++)
+    {
+    m = klib_memstat_get_context (i + 1);
+    book_stats.stage_allocs[i] = m->allocs;
+    book_stats.stage_alloc_bytes[i] = m->bytes;
+    book_stats.stage_peak_bytes[i] = m->peak;
+    }
+  for (i = 0; i < klib_memstat_tag_count (); i++)
+    {
+    m = klib_memstat_get_tag (i);
+    book_stats.tag_allocs[i] = m->allocs;
+    book_stats.tag_alloc_bytes[i] = m->bytes;
+    book_stats.tag_peak_bytes[i] = m->peak;
+    }
+  }
+
+/*========================================================================
+  epub2txt_stats_max
+=========================================================================*/
+static long long epub2txt_stats_max (long long a, long long b)
+  {
+  return a > b ? a : b;
+  }
+
+/*========================================================================
+  epub2txt_stats_print_json_string
+=========================================================================*/
+static void epub2txt_stats_print_json_string (FILE *f, const char *s)
+  {
+  fputc ('"', f);
+  for (; *s; s++)
+    {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\')
+      fprintf (f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf (f, "\\u%04x", c);
+    else
+      fputc (c, f);
+    }
+  fputc ('"', f);
+  }
+
+/*========================================================================
+  epub2txt_stats_print
+=========================================================================*/
+static void epub2txt_stats_print (FILE *f, const char *name,
+    const epub2txt_Stats *stats)
+  {
+  int i;
+  double wall = 0, cpu = 0;
+  for (i = 0; i < STAGE_MAX; i++)
+    {
+    wall += stats->wall[i];
+    cpu += stats->cpu[i];
+    }
+  double scan_mbs = 0;
+  if (stats->wall[STAGE_SCAN] > 0)
+    scan_mbs = stats->scanned_bytes / stats->wall[STAGE_SCAN] / 1e6;
+
+  if (stats_json)
+    {
+    fprintf (f, "{\"type\":\"%s\",\"file\":", name ? "book" : "total");
+    if (name)
+      epub2txt_stats_print_json_string (f, name);
+    else
+      fprintf (f, "null");
+    fprintf (f, ",\"books\":%d,\"stages\":{", stats->books);
+    for (i = 0; i < STAGE_MAX; i++)
+      fprintf (f, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}", i ? "," : "",
+        stage_names[i], stats->wall[i], stats->cpu[i]);
+    fprintf (f, "},\"wall\":%.6f,\"cpu\":%.6f", wall, cpu);
+    fprintf (f, ",\"compressed_bytes\":%lld,\"uncompressed_bytes\":%lld"
+      ",\"scanned_bytes\":%lld,\"spine_items\":%lld"
+      ",\"corrupt_entries\":%lld,\"paragraphs\":%lld"
+      ",\"words\":%lld,\"output_bytes\":%lld,\"cache_hits\":%lld"
+      ",\"repeated_items\":%lld,\"repeated_bytes\":%lld"
+      ",\"unchanged_books\":%lld,\"removed_books\":%lld"
+      ",\"scan_mb_per_sec\":%.3f"
+      ",\"peak_rss_kb\":%lld,\"child_peak_rss_kb\":%lld",
+      stats->compressed_bytes, stats->uncompressed_bytes,
+      stats->scanned_bytes, stats->spine_items, stats->corrupt_entries,
+      stats->paragraphs,
+      stats->words, stats->output_bytes, stats->cache_hits, 
+      stats->repeated_items, stats->repeated_bytes, 
+      stats->unchanged_books, stats->removed_books, scan_mbs, 
+      stats->peak_rss,
+      stats->child_peak_rss);
+    if (klib_memstat_available ())
+      {
+      fprintf (f, ",\"memory\":{\"allocs\":%lld,\"bytes\":%lld"
+        ",\"peak_bytes\":%lld,\"stages\":{", stats->allocs, 
+        stats->alloc_bytes, stats->peak_bytes);
+      for (i = 0; i < STAGE_MAX; i++)
+        fprintf (f, "%s\"%s\":{\"allocs\":%lld,\"bytes\":%lld"
+          ",\"peak_bytes\":%lld}", i ? "," : "", stage_names[i], 
+          stats->stage_allocs[i], stats->stage_alloc_bytes[i], 
+          stats->stage_peak_bytes[i]);
+      fprintf (f, "},\"classes\":{");
+      for (i = 0; i < klib_memstat_tag_count (); i++)
+        {
+        fprintf (f, "%s", i ? "," : "");
+        epub2txt_stats_print_json_string (f, klib_memstat_tag_name (i));
+        fprintf (f, ":{\"allocs\":%lld,\"bytes\":%lld"
+          ",\"peak_bytes\":%lld}", stats->tag_allocs[i], 
+          stats->tag_alloc_bytes[i], stats->tag_peak_bytes[i]);
+        }
+      fprintf (f, "}}");
+      }
+    fprintf (f, "}\n");
+    }
+  else
+    {
+    if (name)
+      fprintf (f, "epub2txt stats: %s\n", name);
+    else
+      fprintf (f, "epub2txt stats: total for %d book(s)\n", stats->books);
+    fprintf (f, "  %-20s %12s %12s\n", "stage", "wall (s)", "cpu (s)");
+    for (i = 0; i < STAGE_MAX; i++)
+      fprintf (f, "  %-20s %12.6f %12.6f\n", stage_names[i],
+        stats->wall[i], stats->cpu[i]);
+    fprintf (f, "  %-20s %12.6f %12.6f\n", "total", wall, cpu);
+    fprintf (f, "  %-20s %12lld\n", "compressed bytes",
+      stats->compressed_bytes);
+    fprintf (f, "  %-20s %12lld\n", "extracted bytes",
+      stats->uncompressed_bytes);
+    fprintf (f, "  %-20s %12lld\n", "scanned bytes", stats->scanned_bytes);
+    fprintf (f, "  %-20s %12lld\n", "spine items", stats->spine_items);
+    fprintf (f, "  %-20s %12lld\n", "corrupt entries", 
+      stats->corrupt_entries);
+    fprintf (f, "  %-20s %12lld\n", "paragraphs", stats->paragraphs);
+    fprintf (f, "  %-20s %12lld\n", "words", stats->words);
+    fprintf (f, "  %-20s %12lld\n", "output bytes", stats->output_bytes);
+    fprintf (f, "  %-20s %12lld\n", "cache hits", stats->cache_hits);
+    fprintf (f, "  %-20s %12lld %11.1f%%\n", "repeated items", 
+      stats->repeated_items, stats->spine_items 
+        ? 100.0 * stats->repeated_items / stats->spine_items : 0.0);
+    fprintf (f, "  %-20s %12lld\n", "repeated bytes", 
+      stats->repeated_bytes);
+    if (!name)
+      {
+      fprintf (f, "  %-20s %12lld\n", "unchanged books", 
+        stats->unchanged_books);
+      fprintf (f, "  %-20s %12lld\n", "removed books", 
+        stats->removed_books);
+      }
+    fprintf (f, "  %-20s %12.3f\n", "scanner MB/s", scan_mbs);
+    fprintf (f, "  %-20s %12lld\n", "peak RSS (kB)", stats->peak_rss);
+    if (klib_memstat_available ())
+      {
+      fprintf (f, "  %-20s %12s %12s %12s\n", "allocations by stage", 
+        "count", "bytes", "peak bytes");
+      for (i = 0; i < STAGE_MAX; i++)
+        fprintf (f, "  %-20s %12lld %12lld %12lld\n", stage_names[i],
+          stats->stage_allocs[i], stats->stage_alloc_bytes[i], 
+          stats->stage_peak_bytes[i]);
+      fprintf (f, "  %-20s %12s %12s %12s\n", "allocations by class", 
+        "count", "bytes", "peak bytes");
+      for (i = 0; i < klib_memstat_tag_count (); i++)
+        fprintf (f, "  %-20s %12lld %12lld %12lld\n", 
+          klib_memstat_tag_name (i), stats->tag_allocs[i], 
+          stats->tag_alloc_bytes[i], stats->tag_peak_bytes[i]);
+      fprintf (f, "  %-20s %12lld %12lld %12lld\n", "total",
+        stats->allocs, stats->alloc_bytes, stats->peak_bytes);
+      }
+    }
+  }
+
+/*========================================================================
+  epub2txt_stats_end_book
+=========================================================================*/
+void epub2txt_stats_end_book (void)
+  {
+  if (!stats_enabled) return;
+  // Anything still on the stack (after an error, for example) is
+  //  charged up to this point
+  epub2txt_stats_charge ();
+  stage_depth = 0;
+  klib_memstat_set_context (0);
+  epub2txt_stats_collect_memstat ();
+  epub2txt_stats_collect_rss (&book_stats);
+  epub2txt_stats_print (stderr, book_name, &book_stats);
+  epub2txt_stats_add (&book_stats);
+  }
+
+/*========================================================================
+  epub2txt_stats_add
+  Adds the counters of a book to the total; this is also how the 
+  counters of a book converted by another process are collected
+=========================================================================*/
+void epub2txt_stats_add (const epub2txt_Stats *stats)
+  {
+  if (!stats_enabled) return;
+  int i;
+  total_stats.books += stats->books;
+  for (i = 0; i < STAGE_MAX; i++)
+    {
+    total_stats.wall[i] += stats->wall[i];
+    total_stats.cpu[i] += stats->cpu[i];
+    }
+  total_stats.compressed_bytes += stats->compressed_bytes;
+  total_stats.uncompressed_bytes += stats->uncompressed_bytes;
+  total_stats.scanned_bytes += stats->scanned_bytes;
+  total_stats.spine_items += stats->spine_items;
+  total_stats.corrupt_entries += stats->corrupt_entries;
+  total_stats.paragraphs += stats->paragraphs;
+  total_stats.words += stats->words;
+  total_stats.output_bytes += stats->output_bytes;
+  total_stats.cache_hits += stats->cache_hits;
+  total_stats.repeated_items += stats->repeated_items;
+  total_stats.repeated_bytes += stats->repeated_bytes;
+  total_stats.unchanged_books += stats->unchanged_books;
+  total_stats.removed_books += stats->removed_books;
+  total_stats.allocs += stats->allocs;
+  total_stats.alloc_bytes += stats->alloc_bytes;
+  total_stats.peak_bytes = epub2txt_stats_max (total_stats.peak_bytes, 
+    stats->peak_bytes);
+  for (i = 0; i < STAGE_MAX; i++)
+    {
+    total_stats.stage_allocs[i] += stats->stage_allocs[i];
+    total_stats.stage_alloc_bytes[i] += stats->stage_alloc_bytes[i];
+    total_stats.stage_peak_bytes[i] = epub2txt_stats_max 
+      (total_stats.stage_peak_bytes[i], stats->stage_peak_bytes[i]);
+    }
+  for (i = 0; i < KLIB_MEMSTAT_TAGS_MAX; i++)
+    {
+    total_stats.tag_allocs[i] += stats->tag_allocs[i];
+    total_stats.tag_alloc_bytes[i] += stats->tag_alloc_bytes[i];
+    total_stats.tag_peak_bytes[i] = epub2txt_stats_max 
+      (total_stats.tag_peak_bytes[i], stats->tag_peak_bytes[i]);
+    }
+  }
+
+/*========================================================================
+  epub2txt_stats_report_total
+=========================================================================*/
+void epub2txt_stats_report_total (void)
+  {
+  if (!stats_enabled) return;
+  epub2txt_stats_collect_rss (&total_stats);
+  epub2txt_stats_print (stderr, NULL, &total_stats);
+  }
+
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdio.h>
+#include "klib_defs.h"
+#include "klib_memstat.h"
+
+// Conversion stages that are timed separately by --stats. Stages nest
+//  (scanning calls the wrapper, which calls the output code), and
+//  each stage is charged only for the time it spends itself, so the
+//  per-stage figures add up to the total
+typedef enum
+  {
+  STAGE_UNZIP = 0,
+  STAGE_OPF = 1,
+  STAGE_SCAN = 2,
+  STAGE_WRAP = 3,
+  STAGE_OUTPUT = 4,
+  STAGE_MAX = 5
+  } epub2txt_Stage;
+
+typedef struct _epub2txt_Stats
+  {
+  int books;
+  double wall[STAGE_MAX];
+  double cpu[STAGE_MAX];
+  long long compressed_bytes;
+  long long uncompressed_bytes;
+  long long scanned_bytes;
+  long long spine_items;
+  // Entries that were damaged, or failed --verify
+  long long corrupt_entries;
+  long long paragraphs;
+  long long words;
+  long long output_bytes;
+  // Books whose text was found in the --cache, rather than converted
+  long long cache_hits;
+  // Spine items that had been scanned before, in this book or another,
+  //  whose output was reused, and their size
+  long long repeated_items;
+  long long repeated_bytes;
+  // With --sync, books that were up to date, and so not converted, and
+  //  books gone from the tree whose text was removed
+  long long unchanged_books;
+  long long removed_books;
+  // Peak resident set sizes in kB, of this process and of the largest
+  //  child process. These are high-water marks for the whole run so 
+  //  far, not just for this book
+  long long peak_rss;
+  long long child_peak_rss;
+  // Allocation counts are only collected when klib is built with
+  //  KLIB_MEMSTATS. Peaks are of all tracked memory that is live
+  //  while the stage is running, or while the book is being converted
+  long long allocs;
+  long long alloc_bytes;
+  long long peak_bytes;
+  long long stage_allocs[STAGE_MAX];
+  long long stage_alloc_bytes[STAGE_MAX];
+  long long stage_peak_bytes[STAGE_MAX];
+  long long tag_allocs[KLIB_MEMSTAT_TAGS_MAX];
+  long long tag_alloc_bytes[KLIB_MEMSTAT_TAGS_MAX];
+  long long tag_peak_bytes[KLIB_MEMSTAT_TAGS_MAX];
+  } epub2txt_Stats;
+
+// Global variable, set by the --stats option. All the stats functions
+//  return immediately if it is FALSE
+extern BOOL stats_enabled;
+
+// Global variable to select JSON output of statistics
+extern BOOL stats_json;
+
+// Counters for the book currently being converted
+extern epub2txt_Stats book_stats;
+
+void epub2txt_stats_begin_book (const char *file);
+
+void epub2txt_stats_end_book (void);
+
+void epub2txt_stats_add (const epub2txt_Stats *stats);
+
+void epub2txt_stats_enter (epub2txt_Stage stage);
+
+void epub2txt_stats_leave (void);
+
+void epub2txt_stats_report_total (void);
+
@@ -0,0 +1,505 @@
+/*========================================================================
+  epub2txt
+  epub2txt_sync.c
+  Keeps output_dir a mirror of a tree of EPUBs (--sync), converting
+  only the books that are new or have changed since the last time, and
+  removing the text of books that have gone.
+
+  What the mirror was made from is kept in a manifest in output_dir:
+  the options the text was converted with, and the path, size,
+  modification time and hash of each book. A book whose size and time
+  are the same as in the manifest is taken to be unchanged without
+  being read, so a run over a tree that has hardly changed costs a
+  stat of each book and its text. A book whose time has changed is
+  hashed, and only converted if its contents have changed too. If the
+  options are not those the mirror was made with, every book is
+  converted
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "klib_log.h"
+#include "epub2txt.h"
+#include "epub2txt_stats.h"
+#include "epub2txt_jobs.h"
+#include "epub2txt_hash.h"
+#include "epub2txt_zip.h"
+#include "epub2txt_sync.h"
+
+/*========================================================================
+  globals
+=========================================================================*/
+const char *sync_source = NULL;
+
+// The manifest's name in output_dir, and its first line, which changes
+//  if its format does
+#define SYNC_MANIFEST ".epub2txt-sync"
+#define SYNC_HEADER "epub2txt-sync 1"
+
+/*========================================================================
+  epub2txt_SyncBook
+  A book in the tree, or in the manifest
+=========================================================================*/
+typedef struct _epub2txt_SyncBook
+  {
+  // Relative to sync_source
+  char *path;
+  long long size;
+  // Modification time in nanoseconds, as a book may well be replaced
+  //  within a second of being synced
+  long long mtime;
+  uint64_t hash;
+  // For a book in the tree, set if it has been converted; for a book in
+  //  the manifest, set if it is still in the tree
+  BOOL flag;
+  } epub2txt_SyncBook;
+
+typedef struct _epub2txt_SyncList
+  {
+  epub2txt_SyncBook *books;
+  long long n;
+  long long capacity;
+  } epub2txt_SyncList;
+
+/*========================================================================
+  epub2txt_sync_add
+  Adds a book to the end of list, and returns it, with only its path set
+=========================================================================*/
+static epub2txt_SyncBook *epub2txt_sync_add (epub2txt_SyncList *list,
+    const char *path)
+  {
+  if (list->n == list->capacity)
+    {
+    list->capacity = list->capacity ? 2 * list->capacity : 256;
+    list->books = realloc (list->books,
+      list->capacity * sizeof (epub2txt_SyncBook));
+    }
+  epub2txt_SyncBook *book = &list->books[list->n++];
+  memset (book, 0, sizeof (epub2txt_SyncBook));
+  book->path = strdup (path);
+  return book;
+  }
+
+/*========================================================================
+  epub2txt_sync_free
+  Frees the books of list
+=========================================================================*/
+static void epub2txt_sync_free (epub2txt_SyncList *list)
+  {
+  long long i;
+  for (i = 0; i < list->n; i++)
+    free (list->books[i].path);
+  free (list->books);
+  }
+
+/*========================================================================
+  epub2txt_sync_compare
+  Orders books by path
+=========================================================================*/
+static int epub2txt_sync_compare (const void *a, const void *b)
+  {
+  const epub2txt_SyncBook *b1 = a, *b2 = b;
+  return strcmp (b1->path, b2->path);
+  }
+
+/*========================================================================
+  epub2txt_sync_sort
+  Sorts list by path, for epub2txt_sync_find
+=========================================================================*/
+static void epub2txt_sync_sort (epub2txt_SyncList *list)
+  {
+  if (list->n > 0)
+    qsort (list->books, list->n, sizeof (epub2txt_SyncBook),
+      epub2txt_sync_compare);
+  }
+
+/*========================================================================
+  epub2txt_sync_find
+  The book in the sorted list with the given path, or NULL if there
+  isn't one
+=========================================================================*/
+static epub2txt_SyncBook *epub2txt_sync_find (const epub2txt_SyncList *list,
+    const char *path)
+  {
+  epub2txt_SyncBook key;
+  key.path = (char *)path;
+  if (list->n == 0) return NULL;
+  return bsearch (&key, list->books, list->n, sizeof (epub2txt_SyncBook),
+    epub2txt_sync_compare);
+  }
+
+/*========================================================================
+  epub2txt_sync_read_manifest
+  Reads the books in the manifest into list. Returns TRUE if the
+  mirror was made with options; a manifest that is missing, or can't
+  be read, is taken to be for other options, so that every book is
+  converted
+=========================================================================*/
+static BOOL epub2txt_sync_read_manifest (const char *path,
+    const char *options, epub2txt_SyncList *list)
+  {
+  KLIB_IN
+  FILE *f = fopen (path, "r");
+  if (!f)
+    {
+    if (errno != ENOENT)
+      klib_log_warning ("Can't read %s: %s", path, strerror (errno));
+    KLIB_OUT
+    return FALSE;
+    }
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  int n = 0;
+  BOOL same = FALSE;
+  while ((len = getline (&line, &line_size, f)) > 0)
+    {
+    if (line[len - 1] == '\n') line[--len] = 0;
+    n++;
+    if (n == 1)
+      {
+      if (strcmp (line, SYNC_HEADER) != 0)
+        {
+        klib_log_warning ("%s is not a manifest that can be read", path);
+        break;
+        }
+      continue;
+      }
+    if (n == 2)
+      {
+      same = strcmp (line, options) == 0;
+      continue;
+      }
+    unsigned long long hash;
+    long long size, mtime;
+    int name = 0;
+    if (sscanf (line, "%llx %lld %lld %n", &hash, &size, &mtime, &name) < 3
+        || name == 0 || line[name] == 0)
+      {
+      klib_log_warning ("%s: line %d is damaged", path, n);
+      continue;
+      }
+    epub2txt_SyncBook *book = epub2txt_sync_add (list, line + name);
+    book->size = size;
+    book->mtime = mtime;
+    book->hash = hash;
+    }
+  free (line);
+  fclose (f);
+  epub2txt_sync_sort (list);
+  KLIB_OUT
+  return same;
+  }
+
+/*========================================================================
+  epub2txt_sync_write_manifest
+  Writes the books in list that are to be kept into the manifest. It
+  is written to a temporary file that replaces the manifest when it
+  is complete, so that a sync that is stopped part of the way through
+  leaves the old one
+=========================================================================*/
+static void epub2txt_sync_write_manifest (const char *path,
+    const char *options, const epub2txt_SyncList *list, const BOOL *keep,
+    klib_Error **error)
+  {
+  KLIB_IN
+  char *temp = malloc (strlen (path) + 32);
+  sprintf (temp, "%s.%d", path, (int)getpid ());
+  FILE *f = fopen (temp, "w");
+  if (f)
+    {
+    long long i;
+    fprintf (f, "%s\n%s\n", SYNC_HEADER, options);
+    for (i = 0; i < list->n; i++)
+      {
+      const epub2txt_SyncBook *book = &list->books[i];
+      if (keep[i])
+        fprintf (f, "%016llx %lld %lld %s\n",
+          (unsigned long long)book->hash, book->size, book->mtime,
+          book->path);
+      }
+    if (fclose (f) != 0 || rename (temp, path) != 0)
+      {
+      *error = klib_error_new (errno, "Can't write %s: %s", path,
+        strerror (errno));
+      unlink (temp);
+      }
+    }
+  else
+    *error = klib_error_new (errno, "Can't write %s: %s", temp,
+      strerror (errno));
+  free (temp);
+  KLIB_OUT
+  }
+
+/*========================================================================
+  epub2txt_sync_walk
+  Adds the EPUBs in the directory dir of the tree, and in the
+  directories under it, to list. The directory that the mirror is in
+  is passed over, in case it is in the tree; so are links to
+  directories, which might make a loop
+=========================================================================*/
+static void epub2txt_sync_walk (const char *dir, epub2txt_SyncList *list,
+    const struct stat *output_sb)
+  {
+  KLIB_IN
+  char *full = malloc (strlen (sync_source) + strlen (dir) + 2);
+  sprintf (full, "%s%s%s", sync_source, *dir ? "/" : "", dir);
+  DIR *d = opendir (full);
+  if (!d)
+    {
+    klib_log_warning ("Can't read %s: %s", full, strerror (errno));
+    free (full);
+    KLIB_OUT
+    return;
+    }
+  struct dirent *de;
+  while ((de = readdir (d)) != NULL)
+    {
+    if (strcmp (de->d_name, ".") == 0 || strcmp (de->d_name, "..") == 0)
+      continue;
+    char *path = malloc (strlen (dir) + strlen (de->d_name) + 2);
+    sprintf (path, "%s%s%s", dir, *dir ? "/" : "", de->d_name);
+    char *file = malloc (strlen (full) + strlen (de->d_name) + 2);
+    sprintf (file, "%s/%s", full, de->d_name);
+    struct stat sb;
+    if (lstat (file, &sb) == 0 && S_ISDIR (sb.st_mode))
+      {
+      if (sb.st_dev != output_sb->st_dev || sb.st_ino != output_sb->st_ino)
+        epub2txt_sync_walk (path, list, output_sb);
+      }
+    else
+      {
+      const char *dot = strrchr (de->d_name, '.');
+      if (dot && strcasecmp (dot, ".epub") == 0 && stat (file, &sb) == 0
+          && S_ISREG (sb.st_mode))
+        {
+        // The manifest has a line for each book
+        if (strchr (path, '\n'))
+          klib_log_warning ("%s: not synced, as its name has a newline "
+            "in it", file);
+        else
+          {
+          epub2txt_SyncBook *book = epub2txt_sync_add (list, path);
+          book->size = sb.st_size;
+          book->mtime = (long long)sb.st_mtim.tv_sec * 1000000000
+            + sb.st_mtim.tv_nsec;
+          }
+        }
+      }
+    free (file);
+    free (path);
+    }
+  closedir (d);
+  free (full);
+  KLIB_OUT
+  }
+
+/*========================================================================
+  epub2txt_sync_hash
+  Hashes the contents of a file. Returns FALSE if it can't be read
+=========================================================================*/
+static BOOL epub2txt_sync_hash (const char *file, uint64_t *hash)
+  {
+  KLIB_IN
+  BOOL ret = FALSE;
+  int fd = open (file, O_RDONLY);
+  struct stat sb;
+  if (fd >= 0 && fstat (fd, &sb) == 0)
+    {
+    void *image = sb.st_size > 0
+      ? mmap (NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0) : NULL;
+    if (image != MAP_FAILED)
+      {
+      if (image) madvise (image, sb.st_size, MADV_SEQUENTIAL);
+      *hash = epub2txt_hash64 (image, sb.st_size, 0);
+      if (image) munmap (image, sb.st_size);
+      ret = TRUE;
+      }
+    }
+  if (fd >= 0) close (fd);
+  KLIB_OUT
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_sync_text
+  The file that the text of the book at path in the tree goes to. The
+  caller frees it
+=========================================================================*/
+static klib_String *epub2txt_sync_text (const char *path)
+  {
+  klib_String *file = klib_string_new_printf ("%s/%s", sync_source, path);
+  klib_String *text = epub2txt_output_path (klib_string_cstr (file), NULL);
+  klib_string_free (file);
+  return text;
+  }
+
+/*========================================================================
+  epub2txt_sync_exists
+  Returns TRUE if file is there, and is a regular file
+=========================================================================*/
+static BOOL epub2txt_sync_exists (const klib_String *file)
+  {
+  struct stat sb;
+  return stat (klib_string_cstr (file), &sb) == 0 && S_ISREG (sb.st_mode);
+  }
+
+/*========================================================================
+  epub2txt_sync_remove
+  Removes the text of a book that has gone from the tree, and the
+  directories that held it, if that leaves them empty
+=========================================================================*/
+static void epub2txt_sync_remove (const char *path)
+  {
+  KLIB_IN
+  klib_String *text = epub2txt_sync_text (path);
+  char *s = strdup (klib_string_cstr (text));
+  if (unlink (s) != 0 && errno != ENOENT)
+    klib_log_warning ("Can't remove %s: %s", s, strerror (errno));
+  int root_len = strlen (output_dir);
+  char *slash;
+  while ((slash = strrchr (s, '/')) != NULL && slash - s > root_len)
+    {
+    *slash = 0;
+    if (rmdir (s) != 0) break;
+    }
+  free (s);
+  klib_string_free (text);
+  KLIB_OUT
+  }
+
+/*========================================================================
+  epub2txt_sync
+  Brings the mirror in output_dir up to date with the tree
+  sync_source. Books are converted with --jobs as they would be if
+  they had been named on the command line; one that can't be
+  converted is reported, and left out of the manifest, so that it is
+  tried again next time
+=========================================================================*/
+void epub2txt_sync (BOOL ascii, int width, BOOL notrim, klib_Error **error)
+  {
+  KLIB_IN
+  struct stat sb, output_sb;
+  if (stat (sync_source, &sb) != 0 || !S_ISDIR (sb.st_mode))
+    {
+    *error = klib_error_new (ENOTDIR, "Not a directory: %s", sync_source);
+    KLIB_OUT
+    return;
+    }
+  klib_String *manifest = klib_string_new_printf ("%s/%s", output_dir,
+    SYNC_MANIFEST);
+  epub2txt_zip_make_dirs (klib_string_cstr (manifest));
+  if (stat (output_dir, &output_sb) != 0 || !S_ISDIR (output_sb.st_mode))
+    {
+    *error = klib_error_new (ENOTDIR, "Can't write to %s", output_dir);
+    klib_string_free (manifest);
+    KLIB_OUT
+    return;
+    }
+  klib_String *options = epub2txt_options (ascii, width, notrim);
+  if (count_mode) klib_string_append (options, " count");
+  epub2txt_SyncList old, tree;
+  memset (&old, 0, sizeof (old));
+  memset (&tree, 0, sizeof (tree));
+  BOOL same = epub2txt_sync_read_manifest (klib_string_cstr (manifest),
+    klib_string_cstr (options), &old);
+  if (!same && old.n > 0)
+    klib_log_info ("%s was made with other options; converting every "
+      "book", output_dir);
+  epub2txt_sync_walk ("", &tree, &output_sb);
+  epub2txt_sync_sort (&tree);
+
+  epub2txt_Stats counts;
+  memset (&counts, 0, sizeof (counts));
+  long long i;
+  // Books that have gone are removed first, in case a new book's text
+  //  has the same name as one of theirs
+  for (i = 0; i < tree.n; i++)
+    {
+    epub2txt_SyncBook *was = epub2txt_sync_find (&old, tree.books[i].path);
+    if (was) was->flag = TRUE;
+    }
+  for (i = 0; i < old.n; i++)
+    {
+    if (old.books[i].flag) continue;
+    klib_log_info ("%s: removed", old.books[i].path);
+    epub2txt_sync_remove (old.books[i].path);
+    counts.removed_books++;
+    }
+
+  for (i = 0; i < tree.n; i++)
+    {
+    epub2txt_SyncBook *book = &tree.books[i];
+    const epub2txt_SyncBook *was = same
+      ? epub2txt_sync_find (&old, book->path) : NULL;
+    klib_String *text = epub2txt_sync_text (book->path);
+    klib_String *file = klib_string_new_printf ("%s/%s", sync_source,
+      book->path);
+    BOOL hashed = FALSE;
+    if (was && was->size == book->size && was->mtime != book->mtime)
+      hashed = epub2txt_sync_hash (klib_string_cstr (file), &book->hash);
+    if (was && was->size == book->size
+        && (was->mtime == book->mtime || (hashed && was->hash == book->hash))
+        && epub2txt_sync_exists (text))
+      {
+      if (!hashed) book->hash = was->hash;
+      counts.unchanged_books++;
+      }
+    else
+      {
+      if (!hashed && !epub2txt_sync_hash (klib_string_cstr (file),
+          &book->hash))
+        klib_log_warning ("Can't read %s: %s", klib_string_cstr (file),
+          strerror (errno));
+      klib_log_info ("%s: converting", book->path);
+      book->flag = TRUE;
+      klib_Error *book_error = NULL;
+      epub2txt_do_file (klib_string_cstr (file), ascii, width, notrim,
+        &book_error);
+      if (book_error)
+        {
+        klib_log_error ("%s", klib_error_cstr (book_error));
+        klib_error_free (book_error);
+        }
+      klib_object_census_poll (stderr);
+      }
+    klib_string_free (file);
+    klib_string_free (text);
+    }
+  epub2txt_jobs_wait ();
+
+  // A book that was converted is only kept in the manifest if its text
+  //  was written; one that failed has had its text removed
+  BOOL *keep = malloc ((tree.n + 1) * sizeof (BOOL));
+  for (i = 0; i < tree.n; i++)
+    {
+    keep[i] = TRUE;
+    if (tree.books[i].flag)
+      {
+      klib_String *text = epub2txt_sync_text (tree.books[i].path);
+      keep[i] = epub2txt_sync_exists (text);
+      klib_string_free (text);
+      }
+    }
+  epub2txt_sync_write_manifest (klib_string_cstr (manifest),
+    klib_string_cstr (options), &tree, keep, error);
+  epub2txt_stats_add (&counts);
+  free (keep);
+  epub2txt_sync_free (&tree);
+  epub2txt_sync_free (&old);
+  klib_string_free (options);
+  klib_string_free (manifest);
+  KLIB_OUT
+  }
+
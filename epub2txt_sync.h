@@ -0,0 +1,11 @@
+#pragma once
+
+#include "klib_defs.h"
+#include "klib_error.h"
+
+// Global variable, set by --sync: the root of the tree of EPUBs that
+//  output_dir is kept a mirror of, or NULL if there isn't one
+extern const char *sync_source;
+
+void epub2txt_sync (BOOL ascii, int width, BOOL notrim, klib_Error **error);
+
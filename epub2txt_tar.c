@@ -0,0 +1,273 @@
+/*========================================================================
+  epub2txt
+  epub2txt_tar.c
+  Reads a tar archive that is held in memory, such as a bundle of
+  EPUBs. Files in a tar archive are stored whole, one after another,
+  so once the headers have been read, each file can be used where it
+  is. POSIX (ustar and pax) and GNU archives are read; only regular
+  files are listed
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "klib_log.h"
+#include "epub2txt_tar.h"
+
+// Archives are made of blocks of this size; each file has a header
+//  block, and its data is padded to a whole number of blocks
+#define TAR_BLOCK 512
+
+// Header fields
+#define TAR_NAME 0
+#define TAR_NAME_SIZE 100
+#define TAR_SIZE 124
+#define TAR_SIZE_SIZE 12
+#define TAR_CHECKSUM 148
+#define TAR_CHECKSUM_SIZE 8
+#define TAR_TYPE 156
+#define TAR_MAGIC 257
+#define TAR_PREFIX 345
+#define TAR_PREFIX_SIZE 155
+
+/*========================================================================
+  epub2txt_tar_number
+  Reads a number field, which is octal, or, in GNU archives, big-endian
+  binary if the top bit of its first byte is set. Returns -1 if it is
+  not valid
+=========================================================================*/
+static long long epub2txt_tar_number (const BYTE *p, int len)
+  {
+  long long n = 0;
+  int i = 0;
+  if (p[0] & 0x80)
+    {
+    if (len > 8 && (p[0] & 0x7f) != 0) return -1;
+    for (i = 1; i < len; i++)
+      {
+      if (n > (0x7fffffffffffffffLL >> 8)) return -1;
+      n = (n << 8) | p[i];
+      }
+    return n;
+    }
+  while (i < len && p[i] == ' ') i++;
+  for (; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+    {
+    if (n > (0x7fffffffffffffffLL >> 3)) return -1;
+    n = (n << 3) | (p[i] - '0');
+    }
+  if (i < len && p[i] != ' ' && p[i] != 0) return -1;
+  return n;
+  }
+
+/*========================================================================
+  epub2txt_tar_checksum_ok
+  The checksum is the sum of the bytes of the header, with the
+  checksum field itself taken as spaces
+=========================================================================*/
+static BOOL epub2txt_tar_checksum_ok (const BYTE *h)
+  {
+  long long sum = 0;
+  int i;
+  for (i = 0; i < TAR_BLOCK; i++)
+    sum += (i >= TAR_CHECKSUM && i < TAR_CHECKSUM + TAR_CHECKSUM_SIZE)
+      ? ' ' : h[i];
+  return epub2txt_tar_number (h + TAR_CHECKSUM, TAR_CHECKSUM_SIZE) == sum;
+  }
+
+/*========================================================================
+  epub2txt_tar_is
+  Whether data starts with a tar header
+=========================================================================*/
+BOOL epub2txt_tar_is (const BYTE *data, long long size)
+  {
+  return size >= TAR_BLOCK && epub2txt_tar_checksum_ok (data);
+  }
+
+/*========================================================================
+  epub2txt_tar_field
+  A string field of the header, which need not have a terminating
+  zero if it is full
+=========================================================================*/
+static char *epub2txt_tar_field (const BYTE *p, int len)
+  {
+  int n = 0;
+  while (n < len && p[n]) n++;
+  char *s = malloc (n + 1);
+  memcpy (s, p, n);
+  s[n] = 0;
+  return s;
+  }
+
+/*========================================================================
+  epub2txt_tar_pax_path
+  The path record of a pax extended header, which is a series of
+  records of the form "length keyword=value\n", or NULL if it has none
+=========================================================================*/
+static char *epub2txt_tar_pax_path (const BYTE *p, long long size)
+  {
+  char *ret = NULL;
+  long long pos = 0;
+  while (pos < size)
+    {
+    long long len = 0, i = pos;
+    while (i < size && p[i] >= '0' && p[i] <= '9' && len < size)
+      len = len * 10 + (p[i++] - '0');
+    if (i >= size || p[i] != ' ' || len <= i - pos + 1 || len > size - pos)
+      break;
+    const BYTE *rec = p + i + 1;
+    long long rec_len = len - (i + 1 - pos) - 1;
+    if (rec_len >= 5 && memcmp (rec, "path=", 5) == 0)
+      {
+      free (ret);
+      ret = epub2txt_tar_field (rec + 5, rec_len - 5);
+      }
+    pos += len;
+    }
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_tar_compare
+  Orders entries by name, and entries with the same name by their
+  position in the archive, for the sorted index
+=========================================================================*/
+static int epub2txt_tar_compare (const void *a, const void *b)
+  {
+  const epub2txt_TarEntry *e1 = a, *e2 = b;
+  int c = strcmp (e1->name, e2->name);
+  if (c != 0) return c;
+  return e1->offset < e2->offset ? -1 : e1->offset > e2->offset;
+  }
+
+/*========================================================================
+  epub2txt_tar_open_memory
+  Reads the headers of a tar archive held in memory. The caller keeps
+  the data until the archive is closed. An archive that is damaged or
+  cut short is read as far as it can be. name is only for messages
+=========================================================================*/
+epub2txt_Tar *epub2txt_tar_open_memory (const BYTE *data, long long size,
+    const char *name, klib_Error **error)
+  {
+  KLIB_IN
+  if (!epub2txt_tar_is (data, size))
+    {
+    *error = klib_error_new (EINVAL, "%s: not a tar archive", name);
+    KLIB_OUT
+    return NULL;
+    }
+  epub2txt_Tar *tar = calloc (1, sizeof (epub2txt_Tar));
+  tar->file = strdup (name);
+  tar->image = data;
+  tar->image_size = size;
+  long long capacity = 0, pos = 0;
+  // A name from a GNU long name or pax header, for the next file
+  char *next_name = NULL;
+  while (size - pos >= TAR_BLOCK)
+    {
+    const BYTE *h = data + pos;
+    if (h[0] == 0) break;
+    long long len = epub2txt_tar_number (h + TAR_SIZE, TAR_SIZE_SIZE);
+    if (!epub2txt_tar_checksum_ok (h) || len < 0
+        || len > size - pos - TAR_BLOCK)
+      {
+      klib_log_warning ("%s: damaged or truncated at offset %lld", name,
+        pos);
+      break;
+      }
+    const BYTE *p = h + TAR_BLOCK;
+    switch (h[TAR_TYPE])
+      {
+      case 'L':
+        free (next_name);
+        next_name = epub2txt_tar_field (p, len);
+        break;
+      case 'x':
+        {
+        char *path = epub2txt_tar_pax_path (p, len);
+        if (path)
+          {
+          free (next_name);
+          next_name = path;
+          }
+        }
+        break;
+      case '0': case 0: case '7':
+        if (tar->nentries == capacity)
+          {
+          capacity = capacity ? 2 * capacity : 64;
+          tar->entries = realloc (tar->entries,
+            capacity * sizeof (epub2txt_TarEntry));
+          }
+        epub2txt_TarEntry *e = &tar->entries[tar->nentries++];
+        if (next_name)
+          e->name = next_name;
+        else if (memcmp (h + TAR_MAGIC, "ustar", 5) == 0 && h[TAR_PREFIX])
+          {
+          char *prefix = epub2txt_tar_field (h + TAR_PREFIX, TAR_PREFIX_SIZE);
+          char *base = epub2txt_tar_field (h + TAR_NAME, TAR_NAME_SIZE);
+          e->name = malloc (strlen (prefix) + strlen (base) + 2);
+          sprintf (e->name, "%s/%s", prefix, base);
+          free (prefix);
+          free (base);
+          }
+        else
+          e->name = epub2txt_tar_field (h + TAR_NAME, TAR_NAME_SIZE);
+        next_name = NULL;
+        e->offset = pos + TAR_BLOCK;
+        e->size = len;
+        break;
+      default:
+        // Directories, links and so on, and global pax headers
+        free (next_name);
+        next_name = NULL;
+      }
+    pos += TAR_BLOCK + (len + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+  free (next_name);
+  if (tar->nentries > 0)
+    qsort (tar->entries, tar->nentries, sizeof (epub2txt_TarEntry),
+      epub2txt_tar_compare);
+  KLIB_OUT
+  return tar;
+  }
+
+/*========================================================================
+  epub2txt_tar_find
+  Returns the file with the given name, or NULL if there isn't one. If
+  the archive has more than one, it is the last, as tar would extract
+=========================================================================*/
+const epub2txt_TarEntry *epub2txt_tar_find (const epub2txt_Tar *tar,
+    const char *name)
+  {
+  long long lo = 0, hi = tar->nentries;
+  while (lo < hi)
+    {
+    long long mid = lo + (hi - lo) / 2;
+    if (strcmp (tar->entries[mid].name, name) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  if (lo > 0 && strcmp (tar->entries[lo - 1].name, name) == 0)
+    return &tar->entries[lo - 1];
+  return NULL;
+  }
+
+/*========================================================================
+  epub2txt_tar_close
+  Frees the archive and its index
+=========================================================================*/
+void epub2txt_tar_close (epub2txt_Tar *tar)
+  {
+  if (!tar) return;
+  long long i;
+  for (i = 0; i < tar->nentries; i++)
+    free (tar->entries[i].name);
+  free (tar->entries);
+  free (tar->file);
+  free (tar);
+  }
+
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "klib_defs.h"
+#include "klib_error.h"
+
+/*========================================================================
+  epub2txt_TarEntry
+  A regular file in a tar archive
+=========================================================================*/
+typedef struct _epub2txt_TarEntry
+  {
+  char *name;
+  // Where the file's data starts in the archive
+  long long offset;
+  long long size;
+  } epub2txt_TarEntry;
+
+/*========================================================================
+  epub2txt_Tar
+  A tar archive held in memory. Its files are stored whole, so they
+  are used where they are. Entries are sorted by name
+=========================================================================*/
+typedef struct _epub2txt_Tar
+  {
+  char *file;
+  const BYTE *image;
+  long long image_size;
+  epub2txt_TarEntry *entries;
+  long long nentries;
+  } epub2txt_Tar;
+
+BOOL epub2txt_tar_is (const BYTE *data, long long size);
+
+epub2txt_Tar *epub2txt_tar_open_memory (const BYTE *data, long long size,
+  const char *name, klib_Error **error);
+
+const epub2txt_TarEntry *epub2txt_tar_find (const epub2txt_Tar *tar,
+  const char *name);
+
+void epub2txt_tar_close (epub2txt_Tar *tar);
+
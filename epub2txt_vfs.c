@@ -0,0 +1,385 @@
+/*========================================================================
+  epub2txt
+  epub2txt_vfs.c
+  Reads the entries of an EPUB by name, whether it is an archive on
+  disk, an archive in memory, an archive arriving on a stream, or a
+  directory that it has been unpacked into. Data is handed to the
+  reader a block at a time, and nothing is written to disk, except
+  the entries of a stream, which have to be spooled as they go past.
+  Where the data of an entry is already in memory -- a file of a
+  directory, which is mapped, or a stored entry of an archive in
+  memory, or any file of a tar archive in memory -- it can be used 
+  where it is, without being copied
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "klib_log.h"
+#include "klib_string.h"
+#include "epub2txt_vfs.h"
+
+/*========================================================================
+  epub2txt_vfs_new
+=========================================================================*/
+static epub2txt_Vfs *epub2txt_vfs_new (int type, const char *name)
+  {
+  epub2txt_Vfs *vfs = calloc (1, sizeof (epub2txt_Vfs));
+  vfs->type = type;
+  vfs->name = strdup (name);
+  return vfs;
+  }
+
+/*========================================================================
+  epub2txt_vfs_open
+  Opens an EPUB: source is "-" for an archive on stdin, which is read
+  as a stream and spooled into the directory spool; or a directory; or
+  else an archive
+=========================================================================*/
+epub2txt_Vfs *epub2txt_vfs_open (const char *source, const char *spool,
+    klib_Error **error)
+  {
+  KLIB_IN
+  epub2txt_Vfs *vfs = NULL;
+  struct stat sb;
+  if (strcmp (source, "-") == 0)
+    {
+    vfs = epub2txt_vfs_new (VFS_STREAM, source);
+    vfs->zip = epub2txt_zip_open_stream (stdin, source, spool);
+    }
+  else if (stat (source, &sb) == 0 && S_ISDIR (sb.st_mode))
+    {
+    vfs = epub2txt_vfs_new (VFS_DIRECTORY, source);
+    vfs->dir = strdup (source);
+    }
+  else
+    {
+    epub2txt_Zip *zip = epub2txt_zip_open (source, error);
+    if (zip)
+      {
+      vfs = epub2txt_vfs_new (VFS_ARCHIVE, source);
+      vfs->zip = zip;
+      }
+    }
+  KLIB_OUT
+  return vfs;
+  }
+
+/*========================================================================
+  epub2txt_vfs_open_memory
+  Opens an EPUB archive that is held in memory. The caller keeps the
+  data until the EPUB is closed. name is only for messages
+=========================================================================*/
+epub2txt_Vfs *epub2txt_vfs_open_memory (const BYTE *data, long long size,
+    const char *name, klib_Error **error)
+  {
+  KLIB_IN
+  epub2txt_Vfs *vfs = NULL;
+  epub2txt_Zip *zip = epub2txt_zip_open_memory (data, size, name, error);
+  if (zip)
+    {
+    vfs = epub2txt_vfs_new (VFS_MEMORY, name);
+    vfs->zip = zip;
+    }
+  KLIB_OUT
+  return vfs;
+  }
+
+/*========================================================================
+  epub2txt_vfs_open_mapped
+  Maps a file into memory and opens it as an archive in memory: a tar
+  archive, if it looks like one, or else a ZIP archive. This is how a
+  bundle of EPUBs is read, as the ones that are stored in it can then
+  be opened where they are
+=========================================================================*/
+epub2txt_Vfs *epub2txt_vfs_open_mapped (const char *file, 
+    klib_Error **error)
+  {
+  KLIB_IN
+  epub2txt_Vfs *vfs = NULL;
+  void *image = MAP_FAILED;
+  struct stat sb;
+  errno = 0;
+  int fd = open (file, O_RDONLY);
+  if (fd >= 0 && fstat (fd, &sb) == 0 && sb.st_size > 0)
+    image = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (fd >= 0) close (fd);
+  if (image == MAP_FAILED)
+    {
+    *error = klib_error_new (errno ? errno : EINVAL, "Can't read %s", file);
+    KLIB_OUT
+    return NULL;
+    }
+  if (epub2txt_tar_is (image, sb.st_size))
+    {
+    epub2txt_Tar *tar = epub2txt_tar_open_memory (image, sb.st_size, file, 
+      error);
+    if (tar)
+      {
+      vfs = epub2txt_vfs_new (VFS_TAR, file);
+      vfs->tar = tar;
+      }
+    }
+  else
+    vfs = epub2txt_vfs_open_memory (image, sb.st_size, file, error);
+  if (vfs)
+    {
+    vfs->image = image;
+    vfs->image_size = sb.st_size;
+    }
+  else
+    munmap (image, sb.st_size);
+  KLIB_OUT
+  return vfs;
+  }
+
+/*========================================================================
+  epub2txt_vfs_memory
+  How much memory epub2txt_vfs_load will take
+=========================================================================*/
+long long epub2txt_vfs_memory (const epub2txt_Vfs *vfs)
+  {
+  return vfs->zip ? epub2txt_zip_memory (vfs->zip) : 0;
+  }
+
+/*========================================================================
+  epub2txt_vfs_load
+  Reads the directory of an archive. A directory on disk has nothing
+  to read: its files are looked for as they are wanted
+=========================================================================*/
+void epub2txt_vfs_load (epub2txt_Vfs *vfs, klib_Error **error)
+  {
+  if (vfs->zip) epub2txt_zip_read_directory (vfs->zip, error);
+  }
+
+/*========================================================================
+  epub2txt_vfs_count
+  The number of entries of an archive, in name order, which
+  epub2txt_vfs_entry lists; directories and streams are not listed
+=========================================================================*/
+long long epub2txt_vfs_count (const epub2txt_Vfs *vfs)
+  {
+  if (vfs->tar) return vfs->tar->nentries;
+  if (vfs->zip && !vfs->zip->stream) return vfs->zip->nentries;
+  return 0;
+  }
+
+/*========================================================================
+  epub2txt_vfs_entry
+  The name of the i'th entry of an archive, counting from 0 in name order
+=========================================================================*/
+const char *epub2txt_vfs_entry (const epub2txt_Vfs *vfs, long long i)
+  {
+  return vfs->tar ? vfs->tar->entries[i].name : vfs->zip->entries[i].name;
+  }
+
+/*========================================================================
+  epub2txt_vfs_want
+  Says that the named entry will be read, so that a stream keeps it
+  when it goes past
+=========================================================================*/
+void epub2txt_vfs_want (epub2txt_Vfs *vfs, const char *name)
+  {
+  if (vfs->zip) epub2txt_zip_want (vfs->zip, name);
+  }
+
+/*========================================================================
+  epub2txt_vfs_map_file
+  Maps a file into memory. A file of no bytes has no mapping, but is
+  still there. Returns NULL if the file can't be read
+=========================================================================*/
+static const BYTE *epub2txt_vfs_map_file (const char *path,
+    long long *size)
+  {
+  static const BYTE empty[1];
+  const BYTE *ret = NULL;
+  struct stat sb;
+  int fd = open (path, O_RDONLY);
+  if (fd >= 0 && fstat (fd, &sb) == 0 && S_ISREG (sb.st_mode))
+    {
+    if (sb.st_size == 0)
+      ret = empty;
+    else
+      {
+      void *p = mmap (NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) ret = p;
+      }
+    if (ret) *size = sb.st_size;
+    }
+  if (fd >= 0) close (fd);
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_vfs_map
+  Where the named entry's data is, if it can be used without being
+  copied; or else NULL, and it has to be read with epub2txt_vfs_read.
+  The files of a directory can always be mapped, so if one can't, it
+  is missing. An entry of a stream is mapped once it has been
+  extracted into the spool. Returns NULL, and sets error, only if
+  extracting it fails. The data must be given back with
+  epub2txt_vfs_unmap
+=========================================================================*/
+const BYTE *epub2txt_vfs_map (epub2txt_Vfs *vfs, const char *name,
+    long long *size, klib_Error **error)
+  {
+  KLIB_IN
+  const BYTE *ret = NULL;
+  klib_String *path = NULL;
+  switch (vfs->type)
+    {
+    case VFS_DIRECTORY:
+      path = klib_string_new_printf ("%s/%s", vfs->dir, name);
+      ret = epub2txt_vfs_map_file (klib_string_cstr (path), size);
+      if (ret) vfs->read_bytes += *size;
+      break;
+    case VFS_STREAM:
+      path = klib_string_new_printf ("%s/%s", vfs->zip->spool, name);
+      if (epub2txt_zip_extract (vfs->zip, name, klib_string_cstr (path),
+          error))
+        ret = epub2txt_vfs_map_file (klib_string_cstr (path), size);
+      break;
+    case VFS_TAR:
+      {
+      const epub2txt_TarEntry *e = epub2txt_tar_find (vfs->tar, name);
+      if (e)
+        {
+        ret = vfs->tar->image + e->offset;
+        *size = e->size;
+        vfs->read_bytes += e->size;
+        }
+      }
+      break;
+    default:
+      ret = epub2txt_zip_map (vfs->zip, name, size);
+    }
+  if (path) klib_string_free (path);
+  KLIB_OUT
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_vfs_size
+  The size of the named entry's data, if it has to be read rather than
+  mapped and the archive says what it is, or else -1. It need not be 
+  right if the archive is damaged
+=========================================================================*/
+long long epub2txt_vfs_size (const epub2txt_Vfs *vfs, const char *name)
+  {
+  if (vfs->type != VFS_ARCHIVE && vfs->type != VFS_MEMORY) return -1;
+  const epub2txt_ZipEntry *e = epub2txt_zip_find (vfs->zip, name);
+  return e ? e->size : -1;
+  }
+
+/*========================================================================
+  epub2txt_vfs_unmap
+=========================================================================*/
+void epub2txt_vfs_unmap (const epub2txt_Vfs *vfs, const BYTE *data,
+    long long size)
+  {
+  // Archives in memory are not mapped; their data is only pointed to
+  if (data && size > 0
+      && (vfs->type == VFS_DIRECTORY || vfs->type == VFS_STREAM))
+    munmap ((void *)data, size);
+  }
+
+/*========================================================================
+  epub2txt_vfs_read
+  Passes the named entry's data to sink a block at a time. If sink
+  returns FALSE, the rest is not read. Returns FALSE if there is no
+  such entry, or it can't be read; error is set only for a failure
+  that is not just to do with this entry
+=========================================================================*/
+BOOL epub2txt_vfs_read (epub2txt_Vfs *vfs, const char *name,
+    epub2txt_InflateSink sink, void *ctx, klib_Error **error)
+  {
+  KLIB_IN
+  if (vfs->type == VFS_ARCHIVE || vfs->type == VFS_MEMORY)
+    {
+    BOOL ret = epub2txt_zip_read (vfs->zip, name, sink, ctx, error);
+    KLIB_OUT
+    return ret;
+    }
+  // A file is mapped, or found in memory, and passed on in pieces, as
+  //  a block's length is an int
+  long long size = 0;
+  const BYTE *data = epub2txt_vfs_map (vfs, name, &size, error);
+  if (data)
+    {
+    long long pos = 0;
+    while (pos < size)
+      {
+      int n = size - pos < (1 << 30) ? (int)(size - pos) : (1 << 30);
+      if (!sink (ctx, data + pos, n)) break;
+      pos += n;
+      }
+    epub2txt_vfs_unmap (vfs, data, size);
+    }
+  KLIB_OUT
+  return data != NULL;
+  }
+
+/*========================================================================
+  epub2txt_vfs_source_bytes
+  The size of the EPUB: of the archive, or as much of a stream as has
+  been read, or of the files of a directory that have been read. For
+  a bundle, it is the size of the bundle
+=========================================================================*/
+long long epub2txt_vfs_source_bytes (const epub2txt_Vfs *vfs)
+  {
+  struct stat sb;
+  switch (vfs->type)
+    {
+    case VFS_DIRECTORY:
+      return vfs->read_bytes;
+    case VFS_STREAM:
+      return epub2txt_zip_stream_read (vfs->zip);
+    case VFS_MEMORY:
+      return vfs->zip->image_size;
+    case VFS_TAR:
+      return vfs->tar->image_size;
+    }
+  return stat (vfs->name, &sb) == 0 ? sb.st_size : 0;
+  }
+
+/*========================================================================
+  epub2txt_vfs_extracted_bytes
+  The total size of the entries read so far, for --stats
+=========================================================================*/
+long long epub2txt_vfs_extracted_bytes (const epub2txt_Vfs *vfs)
+  {
+  return vfs->zip ? vfs->zip->extracted_bytes : vfs->read_bytes;
+  }
+
+/*========================================================================
+  epub2txt_vfs_corrupt_entries
+  The number of entries found to be damaged so far, which only --verify
+  looks for
+=========================================================================*/
+int epub2txt_vfs_corrupt_entries (const epub2txt_Vfs *vfs)
+  {
+  return vfs->zip ? vfs->zip->corrupt_entries : 0;
+  }
+
+/*========================================================================
+  epub2txt_vfs_close
+  Closes the archive or directory, and frees vfs
+=========================================================================*/
+void epub2txt_vfs_close (epub2txt_Vfs *vfs)
+  {
+  if (!vfs) return;
+  epub2txt_zip_close (vfs->zip);
+  epub2txt_tar_close (vfs->tar);
+  if (vfs->image) munmap ((void *)vfs->image, vfs->image_size);
+  free (vfs->dir);
+  free (vfs->name);
+  free (vfs);
+  }
+
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "klib_defs.h"
+#include "klib_error.h"
+#include "epub2txt_inflate.h"
+#include "epub2txt_zip.h"
+#include "epub2txt_tar.h"
+
+// Where the entries of an EPUB come from
+#define VFS_ARCHIVE 0
+#define VFS_DIRECTORY 1
+#define VFS_MEMORY 2
+#define VFS_STREAM 3
+#define VFS_TAR 4
+
+/*========================================================================
+  epub2txt_Vfs
+  An EPUB whose entries can be read by name, whatever holds them: an
+  archive in a file or in memory, an archive arriving on a stream, or
+  a directory that an EPUB has been unpacked into. A bundle of EPUBs,
+  which may be a tar archive as well as a ZIP archive, is read in the
+  same way
+=========================================================================*/
+typedef struct _epub2txt_Vfs
+  {
+  int type;
+  char *name;
+  // The archive, unless the EPUB is a directory or a tar archive
+  epub2txt_Zip *zip;
+  epub2txt_Tar *tar;
+  // A file that was mapped to be opened as an archive in memory, 
+  //  which is unmapped when it is closed
+  const BYTE *image;
+  long long image_size;
+  // The directory, if it is one
+  char *dir;
+  // Total size of the files read from a directory, or a tar archive,
+  //  so far
+  long long read_bytes;
+  } epub2txt_Vfs;
+
+epub2txt_Vfs *epub2txt_vfs_open (const char *source, const char *spool,
+  klib_Error **error);
+
+epub2txt_Vfs *epub2txt_vfs_open_memory (const BYTE *data, long long size,
+  const char *name, klib_Error **error);
+
+epub2txt_Vfs *epub2txt_vfs_open_mapped (const char *file, 
+  klib_Error **error);
+
+long long epub2txt_vfs_memory (const epub2txt_Vfs *vfs);
+
+void epub2txt_vfs_load (epub2txt_Vfs *vfs, klib_Error **error);
+
+long long epub2txt_vfs_count (const epub2txt_Vfs *vfs);
+
+const char *epub2txt_vfs_entry (const epub2txt_Vfs *vfs, long long i);
+
+void epub2txt_vfs_want (epub2txt_Vfs *vfs, const char *name);
+
+BOOL epub2txt_vfs_read (epub2txt_Vfs *vfs, const char *name,
+  epub2txt_InflateSink sink, void *ctx, klib_Error **error);
+
+const BYTE *epub2txt_vfs_map (epub2txt_Vfs *vfs, const char *name,
+  long long *size, klib_Error **error);
+
+long long epub2txt_vfs_size (const epub2txt_Vfs *vfs, const char *name);
+
+void epub2txt_vfs_unmap (const epub2txt_Vfs *vfs, const BYTE *data,
+  long long size);
+
+long long epub2txt_vfs_source_bytes (const epub2txt_Vfs *vfs);
+
+long long epub2txt_vfs_extracted_bytes (const epub2txt_Vfs *vfs);
+
+int epub2txt_vfs_corrupt_entries (const epub2txt_Vfs *vfs);
+
+void epub2txt_vfs_close (epub2txt_Vfs *vfs);
+
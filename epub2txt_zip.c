@@ -0,0 +1,1133 @@
+/*========================================================================
+  epub2txt
+  epub2txt_zip.c
+  Reads entries from a ZIP archive, so that only the parts of an EPUB
+  that are converted are ever decompressed. ZIP64 archives, which may
+  be larger than 4 GB and have more than 65,535 entries, are read as
+  well; sizes and offsets are 64 bits throughout.
+
+  An archive that can't be seeked in, such as one arriving on a pipe,
+  is read as a stream instead: its local headers are read in order,
+  without the central directory, and the entries that are wanted are
+  extracted as they go past. Until the caller says which entries it
+  wants, it might want any of them, so all of them are extracted,
+  except for images, fonts and other media, which are never converted
+  Distributed under the terms of the GPV, version 2.0
+=========================================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "klib_log.h"
+#include "klib_error.h"
+#include "klib_string.h"
+#include "epub2txt_crc32.h"
+#include "epub2txt_zip.h"
+
+// Record signatures and sizes
+#define ZIP_EOCD_SIG 0x06054b50
+#define ZIP_EOCD_SIZE 22
+#define ZIP_CENTRAL_SIG 0x02014b50
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIG 0x04034b50
+#define ZIP_LOCAL_SIZE 30
+#define ZIP64_EOCD_SIG 0x06064b50
+#define ZIP64_EOCD_SIZE 56
+#define ZIP64_LOCATOR_SIG 0x07064b50
+#define ZIP64_LOCATOR_SIZE 20
+#define ZIP_DESCRIPTOR_SIG 0x08074b50
+
+// The extra field of an entry that holds its 64-bit sizes and offset
+#define ZIP64_EXTRA_ID 0x0001
+
+// A 32-bit field with this value is in the ZIP64 extra field instead
+#define ZIP64_IN_EXTRA 0xffffffffUL
+
+// The end of central directory record is followed by a comment of at
+//  most this many bytes
+#define ZIP_COMMENT_MAX 65535
+
+// Entries with this flag set are encrypted
+#define ZIP_FLAG_ENCRYPTED 0x0001
+
+// Entries with this flag set have their CRC and sizes in a data 
+//  descriptor after the data, not in the local header
+#define ZIP_FLAG_DESCRIPTOR 0x0008
+
+// States of the entries of a stream that are named in its table
+#define ZIP_STREAM_WANTED 1
+#define ZIP_STREAM_EXTRACTED 2
+#define ZIP_STREAM_SKIPPED 3
+
+/*========================================================================
+  epub2txt_zip_get16
+  Reads a little-endian 16-bit value from the archive's data
+=========================================================================*/
+static unsigned int epub2txt_zip_get16 (const BYTE *p)
+  {
+  return p[0] | (p[1] << 8);
+  }
+
+/*========================================================================
+  epub2txt_zip_get32
+  Reads a little-endian 32-bit value from the archive's data
+=========================================================================*/
+static unsigned long epub2txt_zip_get32 (const BYTE *p)
+  {
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8)
+    | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+  }
+
+/*========================================================================
+  epub2txt_zip_get64
+  Reads a little-endian 64-bit value, as found in ZIP64 records
+=========================================================================*/
+static unsigned long long epub2txt_zip_get64 (const BYTE *p)
+  {
+  return epub2txt_zip_get32 (p) 
+    | ((unsigned long long)epub2txt_zip_get32 (p + 4) << 32);
+  }
+
+/*========================================================================
+  epub2txt_zip_find_zip64
+  Looks for the ZIP64 end of central directory locator, just before
+  the end of central directory record at eocd, and the ZIP64 record
+  that it points to. Returns the position of the ZIP64 record, which
+  is read into rec, or -1 if there isn't one. The locator's offset
+  does not allow for anything prepended to the archive, but the
+  record is nearly always just before the locator, so it is looked
+  for there too
+=========================================================================*/
+static long long epub2txt_zip_find_zip64 (FILE *f, long long eocd, 
+    BYTE *rec)
+  {
+  BYTE loc[ZIP64_LOCATOR_SIZE];
+  if (eocd < ZIP64_LOCATOR_SIZE + ZIP64_EOCD_SIZE
+      || fseeko (f, eocd - ZIP64_LOCATOR_SIZE, SEEK_SET) != 0
+      || fread (loc, 1, ZIP64_LOCATOR_SIZE, f) != ZIP64_LOCATOR_SIZE
+      || epub2txt_zip_get32 (loc) != ZIP64_LOCATOR_SIG)
+    return -1;
+  long long tries[2];
+  tries[0] = (long long)epub2txt_zip_get64 (loc + 8);
+  tries[1] = eocd - ZIP64_LOCATOR_SIZE - ZIP64_EOCD_SIZE;
+  int i;
+  for (i = 0; i < 2; i++)
+    if (tries[i] >= 0 
+        && tries[i] <= eocd - ZIP64_LOCATOR_SIZE - ZIP64_EOCD_SIZE
+        && fseeko (f, tries[i], SEEK_SET) == 0
+        && fread (rec, 1, ZIP64_EOCD_SIZE, f) == ZIP64_EOCD_SIZE
+        && epub2txt_zip_get32 (rec) == ZIP64_EOCD_SIG)
+      return tries[i];
+  return -1;
+  }
+
+/*========================================================================
+  epub2txt_zip_open_fp
+  Finds the central directory of the archive in f, which the archive
+  takes over; f is closed if it is not an archive. file is only for
+  messages
+=========================================================================*/
+static epub2txt_Zip *epub2txt_zip_open_fp (FILE *f, const char *file,
+    klib_Error **error)
+  {
+  KLIB_IN
+  // The end of central directory record is at the end of the file,
+  //  unless the archive has a comment
+  long long file_size = -1;
+  if (fseeko (f, 0, SEEK_END) == 0) file_size = ftello (f);
+  long long tail_size = ZIP_EOCD_SIZE + ZIP_COMMENT_MAX;
+  if (file_size >= 0 && tail_size > file_size) tail_size = file_size;
+  BYTE *tail = malloc (tail_size > 0 ? tail_size : 1);
+  long long eocd = -1;
+  if (file_size >= ZIP_EOCD_SIZE
+      && fseeko (f, file_size - tail_size, SEEK_SET) == 0
+      && fread (tail, 1, tail_size, f) == tail_size)
+    {
+    long long i;
+    for (i = tail_size - ZIP_EOCD_SIZE; i >= 0 && eocd < 0; i--)
+      if (epub2txt_zip_get32 (tail + i) == ZIP_EOCD_SIG)
+        eocd = i;
+    }
+
+  epub2txt_Zip *zip = NULL;
+  if (eocd < 0)
+    {
+    *error = klib_error_new (EINVAL, "%s: not a ZIP archive", file);
+    }
+  else
+    {
+    const BYTE *p = tail + eocd;
+    zip = calloc (1, sizeof (epub2txt_Zip));
+    zip->file = strdup (file);
+    zip->f = f;
+    zip->nentries = epub2txt_zip_get16 (p + 10);
+    zip->dir_size = epub2txt_zip_get32 (p + 12);
+    zip->dir_offset = epub2txt_zip_get32 (p + 16);
+    eocd += file_size - tail_size;
+
+    // In a ZIP64 archive, the directory is followed by the ZIP64 
+    //  record, whose fields replace those of the ordinary one
+    BYTE rec[ZIP64_EOCD_SIZE];
+    long long dir_end = epub2txt_zip_find_zip64 (f, eocd, rec);
+    if (dir_end >= 0)
+      {
+      zip->nentries = (long long)epub2txt_zip_get64 (rec + 32);
+      zip->dir_size = (long long)epub2txt_zip_get64 (rec + 40);
+      zip->dir_offset = (long long)epub2txt_zip_get64 (rec + 48);
+      }
+    else
+      dir_end = eocd;
+    if (zip->nentries < 0 || zip->dir_size < 0 || zip->dir_offset < 0
+        || zip->dir_size > dir_end 
+        || zip->dir_offset > dir_end - zip->dir_size)
+      zip->prefix = -1;
+    else
+      zip->prefix = dir_end - zip->dir_size - zip->dir_offset;
+    if (zip->prefix < 0)
+      {
+      *error = klib_error_new (EINVAL,
+        "%s: the ZIP central directory is damaged", file);
+      epub2txt_zip_close (zip);
+      zip = NULL;
+      f = NULL;
+      }
+    }
+  if (!zip && f) fclose (f);
+  free (tail);
+  KLIB_OUT
+  return zip;
+  }
+
+/*========================================================================
+  epub2txt_zip_open
+  Opens an archive and finds its central directory, which is not read
+  until epub2txt_zip_read_directory is called, so that the caller can
+  first check how much memory it will take
+=========================================================================*/
+epub2txt_Zip *epub2txt_zip_open (const char *file, klib_Error **error)
+  {
+  KLIB_IN
+  FILE *f = fopen (file, "rb");
+  if (!f)
+    {
+    *error = klib_error_new (errno, "Can't open %s: %s", file,
+      strerror (errno));
+    KLIB_OUT
+    return NULL;
+    }
+  epub2txt_Zip *zip = epub2txt_zip_open_fp (f, file, error);
+  KLIB_OUT
+  return zip;
+  }
+
+/*========================================================================
+  epub2txt_zip_open_memory
+  Opens an archive that is held in memory, as epub2txt_zip_open does
+  one in a file. The caller keeps the data until the archive is
+  closed: stored entries are passed on from where they are, rather
+  than copied. name is only for messages
+=========================================================================*/
+epub2txt_Zip *epub2txt_zip_open_memory (const BYTE *data, long long size,
+    const char *name, klib_Error **error)
+  {
+  KLIB_IN
+  FILE *f = size > 0 ? fmemopen ((void *)data, size, "rb") : NULL;
+  epub2txt_Zip *zip = NULL;
+  if (!f)
+    *error = klib_error_new (EINVAL, "%s: not a ZIP archive", name);
+  else
+    zip = epub2txt_zip_open_fp (f, name, error);
+  if (zip)
+    {
+    zip->image = data;
+    zip->image_size = size;
+    }
+  KLIB_OUT
+  return zip;
+  }
+
+/*========================================================================
+  epub2txt_zip_open_stream
+  Prepares to read an archive from a stream, such as a pipe, that 
+  can't be seeked in. Entries are extracted into the directory spool,
+  under their own names. name is only for messages
+=========================================================================*/
+epub2txt_Zip *epub2txt_zip_open_stream (FILE *f, const char *name, 
+    const char *spool)
+  {
+  epub2txt_Zip *zip = calloc (1, sizeof (epub2txt_Zip));
+  zip->file = strdup (name);
+  zip->f = f;
+  zip->stream = TRUE;
+  zip->stream_keep_all = TRUE;
+  zip->spool = strdup (spool);
+  epub2txt_inflate_input (&zip->inflate, f, LLONG_MAX);
+  return zip;
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_read
+  The number of bytes of a stream read so far
+=========================================================================*/
+long long epub2txt_zip_stream_read (const epub2txt_Zip *zip)
+  {
+  return epub2txt_inflate_tell (&zip->inflate);
+  }
+
+/*========================================================================
+  epub2txt_zip_capacity
+  The most entries the directory can hold, whatever its end record
+  claims: each takes at least ZIP_CENTRAL_SIZE bytes
+=========================================================================*/
+static long long epub2txt_zip_capacity (const epub2txt_Zip *zip)
+  {
+  long long max = zip->dir_size / ZIP_CENTRAL_SIZE;
+  return zip->nentries < max ? zip->nentries : max;
+  }
+
+/*========================================================================
+  epub2txt_zip_memory
+  The memory the archive will use once its directory has been read:
+  the entries, their names and the decompressor
+=========================================================================*/
+long long epub2txt_zip_memory (const epub2txt_Zip *zip)
+  {
+  if (zip->stream) return sizeof (epub2txt_Zip);
+  long long n = epub2txt_zip_capacity (zip);
+  return sizeof (epub2txt_Zip) + zip->dir_size + n
+    + n * (long long)sizeof (epub2txt_ZipEntry);
+  }
+
+/*========================================================================
+  epub2txt_zip_compare
+  Orders entries by name, and entries with the same name by their
+  position in the archive, for the sorted index
+=========================================================================*/
+static int epub2txt_zip_compare (const void *a, const void *b)
+  {
+  const epub2txt_ZipEntry *ea = a;
+  const epub2txt_ZipEntry *eb = b;
+  int ret = strcmp (ea->name, eb->name);
+  if (ret != 0) return ret;
+  // If a name is repeated, the entry furthest into the archive is
+  //  found, which is the one unzip would have left on disk
+  return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+  }
+
+/*========================================================================
+  epub2txt_zip_read_zip64
+  Replaces the sizes and offset of an entry that are too big for their
+  32-bit fields with those in its ZIP64 extra field. The field holds
+  only the values that are needed, in this order. Returns TRUE if
+  there is such a field
+=========================================================================*/
+static BOOL epub2txt_zip_read_zip64 (epub2txt_ZipEntry *e, 
+    const BYTE *extra, int extra_len)
+  {
+  int pos = 0;
+  while (pos + 4 <= extra_len)
+    {
+    int id = epub2txt_zip_get16 (extra + pos);
+    int len = epub2txt_zip_get16 (extra + pos + 2);
+    const BYTE *p = extra + pos + 4;
+    if (pos + 4 + len > extra_len) break;
+    if (id == ZIP64_EXTRA_ID)
+      {
+      long long *fields[3];
+      int i, n = 0;
+      fields[0] = &e->size;
+      fields[1] = &e->compressed_size;
+      fields[2] = &e->offset;
+      for (i = 0; i < 3; i++)
+        {
+        if (*fields[i] != ZIP64_IN_EXTRA) continue;
+        if (n + 8 > len) break;
+        *fields[i] = (long long)epub2txt_zip_get64 (p + n);
+        n += 8;
+        }
+      return TRUE;
+      }
+    pos += 4 + len;
+    }
+  return FALSE;
+  }
+
+/*========================================================================
+  epub2txt_zip_read_directory
+  Reads the central directory into an array of entries, sorted by name
+=========================================================================*/
+void epub2txt_zip_read_directory (epub2txt_Zip *zip, klib_Error **error)
+  {
+  KLIB_IN
+  if (zip->stream)
+    {
+    KLIB_OUT
+    return;
+    }
+  BYTE *dir = malloc (zip->dir_size + 1);
+  if (!dir || fseeko (zip->f, zip->prefix + zip->dir_offset, SEEK_SET) != 0
+      || fread (dir, 1, zip->dir_size, zip->f) != zip->dir_size)
+    {
+    *error = klib_error_new (EINVAL,
+      "%s: can't read the ZIP central directory", zip->file);
+    free (dir);
+    KLIB_OUT
+    return;
+    }
+
+  // Names go in a pool of their own, each with a terminating zero;
+  //  together they are smaller than the directory
+  long long capacity = epub2txt_zip_capacity (zip);
+  zip->entries = malloc ((capacity + 1) * sizeof (epub2txt_ZipEntry));
+  zip->names = malloc (zip->dir_size + capacity + 1);
+  long long pos = 0, n = 0, names_len = 0;
+  while (n < capacity && pos + ZIP_CENTRAL_SIZE <= zip->dir_size)
+    {
+    const BYTE *p = dir + pos;
+    if (epub2txt_zip_get32 (p) != ZIP_CENTRAL_SIG) break;
+    int name_len = epub2txt_zip_get16 (p + 28);
+    long long len = ZIP_CENTRAL_SIZE + name_len
+      + epub2txt_zip_get16 (p + 30) + epub2txt_zip_get16 (p + 32);
+    if (pos + len > zip->dir_size) break;
+    epub2txt_ZipEntry *e = &zip->entries[n++];
+    e->flags = epub2txt_zip_get16 (p + 8);
+    e->method = epub2txt_zip_get16 (p + 10);
+    e->crc = epub2txt_zip_get32 (p + 16);
+    e->compressed_size = epub2txt_zip_get32 (p + 20);
+    e->size = epub2txt_zip_get32 (p + 24);
+    e->offset = epub2txt_zip_get32 (p + 42);
+    epub2txt_zip_read_zip64 (e, p + ZIP_CENTRAL_SIZE + name_len, 
+      epub2txt_zip_get16 (p + 30));
+    char *name = zip->names + names_len;
+    memcpy (name, p + ZIP_CENTRAL_SIZE, name_len);
+    name[name_len] = 0;
+    e->name = name;
+    names_len += name_len + 1;
+    pos += len;
+    }
+  if (n < zip->nentries)
+    klib_log_warning ("%s: ZIP central directory has %lld of %lld entries",
+      zip->file, n, zip->nentries);
+  zip->nentries = n;
+  qsort (zip->entries, n, sizeof (epub2txt_ZipEntry), epub2txt_zip_compare);
+  free (dir);
+  KLIB_OUT
+  }
+
+/*========================================================================
+  epub2txt_zip_find
+  Returns the entry with the given name, or NULL if there isn't one
+=========================================================================*/
+const epub2txt_ZipEntry *epub2txt_zip_find (const epub2txt_Zip *zip,
+    const char *name)
+  {
+  long long lo = 0, hi = zip->nentries;
+  // The last entry whose name is not greater than name
+  while (lo < hi)
+    {
+    long long mid = lo + (hi - lo) / 2;
+    if (strcmp (zip->entries[mid].name, name) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  if (lo > 0 && strcmp (zip->entries[lo - 1].name, name) == 0)
+    return &zip->entries[lo - 1];
+  return NULL;
+  }
+
+/*========================================================================
+  epub2txt_zip_make_dirs
+  Creates the directories that a file's path needs
+=========================================================================*/
+void epub2txt_zip_make_dirs (const char *path)
+  {
+  char *s = strdup (path);
+  char *slash;
+  for (slash = strchr (s + 1, '/'); slash; slash = strchr (slash + 1, '/'))
+    {
+    *slash = 0;
+    mkdir (s, 0755);
+    *slash = '/';
+    }
+  free (s);
+  }
+
+// Where an entry's data goes: into the file f, if it is being 
+//  extracted, or else to a reader's sink. Neither is set if the data
+//  is only being read past
+typedef struct _epub2txt_ZipOutput
+  {
+  FILE *f;
+  const char *dest;
+  epub2txt_InflateSink sink;
+  void *ctx;
+  BOOL verify;
+  uint32_t crc;
+  long long size;
+  } epub2txt_ZipOutput;
+
+/*========================================================================
+  epub2txt_zip_write
+  The sink for an entry's data as it is extracted: checks its CRC if
+  asked to, counts it, and passes it on to wherever it goes
+=========================================================================*/
+static BOOL epub2txt_zip_write (void *ctx, const BYTE *data, int len)
+  {
+  epub2txt_ZipOutput *out = ctx;
+  if (out->verify) out->crc = epub2txt_crc32 (out->crc, data, len);
+  out->size += len;
+  if (out->f) return fwrite (data, 1, len, out->f) == len;
+  if (out->sink) return out->sink (out->ctx, data, len);
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_zip_create
+  Opens the file that an entry is to be extracted to, creating any
+  directories it needs
+=========================================================================*/
+static BOOL epub2txt_zip_create (epub2txt_Zip *zip, const char *dest,
+    epub2txt_ZipOutput *out, klib_Error **error)
+  {
+  epub2txt_zip_make_dirs (dest);
+  out->f = fopen (dest, "wb");
+  out->dest = dest;
+  out->verify = zip->verify;
+  out->crc = 0;
+  out->size = 0;
+  if (!out->f)
+    *error = klib_error_new (errno, "Can't write %s: %s", dest,
+      strerror (errno));
+  return out->f != NULL;
+  }
+
+/*========================================================================
+  epub2txt_zip_copy
+  Copies len bytes of the input as they are, for a stored entry, 
+  through the decompressor's input buffer
+=========================================================================*/
+static int epub2txt_zip_copy (epub2txt_Zip *zip, long long len, 
+    epub2txt_ZipOutput *out)
+  {
+  BYTE buff[INFLATE_INPUT_SIZE];
+  while (len > 0)
+    {
+    int n = len < INFLATE_INPUT_SIZE ? (int)len : INFLATE_INPUT_SIZE;
+    if (epub2txt_inflate_read (&zip->inflate, buff, n) != n) 
+      return INFLATE_TRUNCATED;
+    if (!epub2txt_zip_write (out, buff, n)) return INFLATE_STOPPED;
+    len -= n;
+    }
+  return INFLATE_OK;
+  }
+
+/*========================================================================
+  epub2txt_zip_image_data
+  Where the len bytes at the current position of an archive in memory
+  are, or NULL if the archive does not hold them all
+=========================================================================*/
+static const BYTE *epub2txt_zip_image_data (epub2txt_Zip *zip, long long len)
+  {
+  long long pos = ftello (zip->f);
+  if (pos < 0 || pos > zip->image_size || len > zip->image_size - pos)
+    return NULL;
+  return zip->image + pos;
+  }
+
+/*========================================================================
+  epub2txt_zip_copy_image
+  Passes on a stored entry of an archive in memory from where it is. 
+  It goes in pieces, as a block's length is an int
+=========================================================================*/
+static int epub2txt_zip_copy_image (epub2txt_Zip *zip, long long len, 
+    epub2txt_ZipOutput *out)
+  {
+  const BYTE *p = epub2txt_zip_image_data (zip, len);
+  if (!p) return INFLATE_TRUNCATED;
+  while (len > 0)
+    {
+    int n = len < (1 << 30) ? (int)len : (1 << 30);
+    if (!epub2txt_zip_write (out, p, n)) return INFLATE_STOPPED;
+    p += n;
+    len -= n;
+    }
+  return INFLATE_OK;
+  }
+
+/*========================================================================
+  epub2txt_zip_decode
+  Extracts an entry's data from the current position of the input
+=========================================================================*/
+static int epub2txt_zip_decode (epub2txt_Zip *zip, const epub2txt_ZipEntry *e,
+    epub2txt_ZipOutput *out)
+  {
+  if (e->method == ZIP_METHOD_STORED && zip->image)
+    return epub2txt_zip_copy_image (zip, e->compressed_size, out);
+  if (e->method == ZIP_METHOD_STORED)
+    return epub2txt_zip_copy (zip, e->compressed_size, out);
+  return epub2txt_inflate_next (&zip->inflate, epub2txt_zip_write, out);
+  }
+
+/*========================================================================
+  epub2txt_zip_finish
+  Closes the file an entry was extracted to, if it was, and reports 
+  anything wrong with it. Damaged data is logged and counted in 
+  corrupt_entries. Data that decompresses without error can still be
+  wrong; if verify is set, it is checked against the entry's CRC and
+  size. A reader that stopped early has not seen all the data, so
+  there is nothing to check
+=========================================================================*/
+static void epub2txt_zip_finish (epub2txt_Zip *zip, const epub2txt_ZipEntry *e,
+    epub2txt_ZipOutput *out, int ret, klib_Error **error)
+  {
+  zip->extracted_bytes += out->size;
+  if (out->f && fclose (out->f) != 0) ret = INFLATE_STOPPED;
+  if (ret == INFLATE_STOPPED)
+    {
+    if (out->f) *error = klib_error_new (EIO, "Can't write %s", out->dest);
+    }
+  else if (ret != INFLATE_OK)
+    {
+    klib_log_warning ("%s: %s: %s", zip->file, e->name,
+      epub2txt_inflate_strerror (ret));
+    zip->corrupt_entries++;
+    }
+  else if (zip->verify && out->size != e->size)
+    {
+    klib_log_warning ("%s: %s: size is %lld, not %lld", zip->file, e->name,
+      out->size, e->size);
+    zip->corrupt_entries++;
+    }
+  else if (zip->verify && out->crc != e->crc)
+    {
+    klib_log_warning ("%s: %s: CRC is %08lx, not %08lx", zip->file, e->name,
+      (unsigned long)out->crc, e->crc);
+    zip->corrupt_entries++;
+    }
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_hash
+  The FNV-1a hash of an entry name
+=========================================================================*/
+static unsigned long epub2txt_zip_stream_hash (const char *name)
+  {
+  unsigned long h = 2166136261UL;
+  for (; *name; name++)
+    h = ((h ^ (BYTE)*name) * 16777619UL) & 0xffffffffUL;
+  return h;
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_name
+  Finds a name in the table of a stream's wanted and extracted entries,
+  adding it, with a state of zero, if add is set. The table is an open
+  hash table, which is doubled in size when it is half full. Returns
+  NULL if the name is not there and add is not set
+=========================================================================*/
+static epub2txt_ZipName *epub2txt_zip_stream_name (epub2txt_Zip *zip, 
+    const char *name, BOOL add)
+  {
+  if (add && (zip->stream_count + 1) * 2 > zip->stream_capacity)
+    {
+    long long old_capacity = zip->stream_capacity, i;
+    epub2txt_ZipName *old = zip->stream_names;
+    zip->stream_capacity = old_capacity ? old_capacity * 2 : 64;
+    zip->stream_names = calloc (zip->stream_capacity, 
+      sizeof (epub2txt_ZipName));
+    for (i = 0; i < old_capacity; i++)
+      {
+      if (!old[i].name) continue;
+      long long j = epub2txt_zip_stream_hash (old[i].name) 
+        & (zip->stream_capacity - 1);
+      while (zip->stream_names[j].name) 
+        j = (j + 1) & (zip->stream_capacity - 1);
+      zip->stream_names[j] = old[i];
+      }
+    free (old);
+    }
+  if (zip->stream_capacity == 0) return NULL;
+  long long j = epub2txt_zip_stream_hash (name) & (zip->stream_capacity - 1);
+  while (zip->stream_names[j].name)
+    {
+    if (strcmp (zip->stream_names[j].name, name) == 0) 
+      return &zip->stream_names[j];
+    j = (j + 1) & (zip->stream_capacity - 1);
+    }
+  if (!add) return NULL;
+  zip->stream_names[j].name = strdup (name);
+  zip->stream_names[j].state = 0;
+  zip->stream_count++;
+  return &zip->stream_names[j];
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_media
+  Whether an entry's name shows it to be an image, font or other media
+  file, which is not extracted from a stream even before the caller
+  has said what it wants
+=========================================================================*/
+static BOOL epub2txt_zip_stream_media (const char *name)
+  {
+  static const char *exts[] = {".jpg", ".jpeg", ".png", ".gif", ".webp",
+    ".bmp", ".tif", ".tiff", ".ttf", ".otf", ".woff", ".woff2", ".mp3", 
+    ".mp4", ".m4a", ".m4v", ".ogg", ".webm", ".wav", ".css", ".js", NULL};
+  const char *dot = strrchr (name, '.');
+  int i;
+  if (!dot) return FALSE;
+  for (i = 0; exts[i]; i++)
+    if (strcasecmp (dot, exts[i]) == 0) return TRUE;
+  return FALSE;
+  }
+
+/*========================================================================
+  epub2txt_zip_name_outside
+  Whether an entry's name would take it outside the directory it is
+  extracted into: it is absolute, or goes up a level. Nothing 
+  converted has such a name, as hrefs are resolved within the archive
+=========================================================================*/
+BOOL epub2txt_zip_name_outside (const char *name)
+  {
+  const char *p;
+  if (name[0] == '/') return TRUE;
+  for (p = name; (p = strstr (p, "..")) != NULL; p += 2)
+    if ((p == name || p[-1] == '/') && (p[2] == 0 || p[2] == '/'))
+      return TRUE;
+  return FALSE;
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_skip
+  Reads past len bytes of a stream
+=========================================================================*/
+static BOOL epub2txt_zip_stream_skip (epub2txt_Zip *zip, long long len)
+  {
+  epub2txt_ZipOutput discard;
+  memset (&discard, 0, sizeof (discard));
+  return epub2txt_zip_copy (zip, len, &discard) == INFLATE_OK;
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_descriptor
+  Reads the data descriptor that follows an entry whose CRC and sizes
+  were not known when its local header was written. The descriptor
+  may or may not start with a signature, and its sizes are 64 bits if
+  the entry has a ZIP64 extra field
+=========================================================================*/
+static BOOL epub2txt_zip_stream_descriptor (epub2txt_Zip *zip, 
+    epub2txt_ZipEntry *e, BOOL zip64)
+  {
+  BYTE d[24];
+  int len = zip64 ? 20 : 12;
+  if (epub2txt_inflate_read (&zip->inflate, d, 4) != 4) return FALSE;
+  int have = 4;
+  if (epub2txt_zip_get32 (d) == ZIP_DESCRIPTOR_SIG) have = 0;
+  if (epub2txt_inflate_read (&zip->inflate, d + have, len - have) 
+      != len - have)
+    return FALSE;
+  e->crc = epub2txt_zip_get32 (d);
+  if (zip64)
+    {
+    e->compressed_size = (long long)epub2txt_zip_get64 (d + 4);
+    e->size = (long long)epub2txt_zip_get64 (d + 12);
+    }
+  else
+    {
+    e->compressed_size = epub2txt_zip_get32 (d + 4);
+    e->size = epub2txt_zip_get32 (d + 8);
+    }
+  return TRUE;
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_stored
+  Reads a stored entry whose size is only given in the data descriptor
+  after it. Nothing else shows where the data ends, so the descriptor
+  is looked for: the last few bytes read are held back until they are
+  known not to be a descriptor that agrees with the data before it
+=========================================================================*/
+static int epub2txt_zip_stream_stored (epub2txt_Zip *zip, 
+    epub2txt_ZipEntry *e, BOOL zip64, epub2txt_ZipOutput *out)
+  {
+  int lag_size = zip64 ? 24 : 16;
+  BYTE lag[24];
+  int lag_len = 0;
+  long long len = 0;
+  uint32_t crc = 0;
+  for (;;)
+    {
+    if (lag_len == lag_size)
+      {
+      const BYTE *p = lag;
+      if (epub2txt_zip_get32 (p) == ZIP_DESCRIPTOR_SIG
+          && epub2txt_zip_get32 (p + 4) == crc
+          && (zip64 ? (long long)epub2txt_zip_get64 (p + 8) 
+              : (long long)epub2txt_zip_get32 (p + 8)) == len)
+        {
+        e->crc = crc;
+        e->compressed_size = e->size = len;
+        return INFLATE_OK;
+        }
+      if (!epub2txt_zip_write (out, lag, 1)) return INFLATE_STOPPED;
+      crc = epub2txt_crc32 (crc, lag, 1);
+      len++;
+      memmove (lag, lag + 1, --lag_len);
+      }
+    if (epub2txt_inflate_read (&zip->inflate, lag + lag_len, 1) != 1)
+      return INFLATE_TRUNCATED;
+    lag_len++;
+    }
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_next
+  Reads the next entry of a stream, extracting it into the spool
+  directory if it is wanted. Returns FALSE at the end of the entries,
+  which is where the central directory starts, or if the stream can't
+  be followed any further
+=========================================================================*/
+static BOOL epub2txt_zip_stream_next (epub2txt_Zip *zip, klib_Error **error)
+  {
+  KLIB_IN
+  epub2txt_Inflate *s = &zip->inflate;
+  BYTE local[ZIP_LOCAL_SIZE];
+  long long offset = epub2txt_inflate_tell (s);
+  int n = epub2txt_inflate_read (s, local, ZIP_LOCAL_SIZE);
+  if (n < 4 || epub2txt_zip_get32 (local) != ZIP_LOCAL_SIG)
+    {
+    zip->stream_done = TRUE;
+    KLIB_OUT
+    return FALSE;
+    }
+
+  epub2txt_ZipEntry e;
+  int name_len = epub2txt_zip_get16 (local + 26);
+  int extra_len = epub2txt_zip_get16 (local + 28);
+  char *name = malloc (name_len + 1);
+  BYTE *extra = malloc (extra_len + 1);
+  BOOL ok = n == ZIP_LOCAL_SIZE
+    && epub2txt_inflate_read (s, (BYTE *)name, name_len) == name_len
+    && epub2txt_inflate_read (s, extra, extra_len) == extra_len;
+  name[name_len] = 0;
+  e.name = name;
+  e.flags = epub2txt_zip_get16 (local + 6);
+  e.method = epub2txt_zip_get16 (local + 8);
+  e.crc = epub2txt_zip_get32 (local + 14);
+  e.compressed_size = epub2txt_zip_get32 (local + 18);
+  e.size = epub2txt_zip_get32 (local + 22);
+  e.offset = offset;
+  BOOL zip64 = epub2txt_zip_read_zip64 (&e, extra, extra_len);
+  BOOL descriptor = (e.flags & ZIP_FLAG_DESCRIPTOR) != 0;
+  BOOL supported = !(e.flags & ZIP_FLAG_ENCRYPTED)
+    && (e.method == ZIP_METHOD_STORED || e.method == ZIP_METHOD_DEFLATED);
+
+  epub2txt_ZipName *wanted = epub2txt_zip_stream_name (zip, name, FALSE);
+  BOOL keep;
+  if (zip->stream_keep_all)
+    {
+    keep = !epub2txt_zip_stream_media (name);
+    // If it turns out to be wanted after all, it can be reported
+    if (!keep && ok)
+      epub2txt_zip_stream_name (zip, name, TRUE)->state = ZIP_STREAM_SKIPPED;
+    }
+  else
+    keep = wanted && wanted->state == ZIP_STREAM_WANTED;
+  // A directory entry, as zip -r writes, is only read past; the
+  //  directories that files need are created along with them
+  if (epub2txt_zip_name_outside (name)
+      || (name_len > 0 && name[name_len - 1] == '/'))
+    keep = FALSE;
+  if (!ok)
+    klib_log_warning ("%s: %s: bad local header", zip->file, name);
+  else if (!supported)
+    {
+    if (keep)
+      klib_log_warning ("%s: %s: unsupported compression method %d%s",
+        zip->file, name, e.method,
+        e.flags & ZIP_FLAG_ENCRYPTED ? " (encrypted)" : "");
+    long long len = e.compressed_size;
+    ok = epub2txt_zip_stream_skip (zip, len) && (!descriptor 
+      || (epub2txt_zip_stream_descriptor (zip, &e, zip64) 
+          && e.compressed_size == len));
+    if (!ok)
+      klib_log_warning ("%s: %s: lost track of the stream", zip->file, 
+        name);
+    }
+  else if (!keep && !descriptor)
+    ok = epub2txt_zip_stream_skip (zip, e.compressed_size);
+  else
+    {
+    klib_String *dest = klib_string_new_printf ("%s/%s", zip->spool, name);
+    epub2txt_ZipOutput out;
+    memset (&out, 0, sizeof (out));
+    if (!keep || epub2txt_zip_create (zip, klib_string_cstr (dest), &out, 
+        error))
+      {
+      // Where the sizes are only in the descriptor, the local header
+      //  has zeros. Compressed data shows where it ends, and then the
+      //  descriptor must agree with what was read; stored data has to
+      //  be searched for the descriptor
+      long long start = epub2txt_inflate_tell (s);
+      int ret;
+      if (descriptor && e.method == ZIP_METHOD_STORED 
+          && e.compressed_size == 0)
+        {
+        ret = epub2txt_zip_stream_stored (zip, &e, zip64, &out);
+        ok = ret == INFLATE_OK;
+        }
+      else
+        {
+        ret = epub2txt_zip_decode (zip, &e, &out);
+        long long used = epub2txt_inflate_tell (s) - start;
+        if (descriptor)
+          ok = epub2txt_zip_stream_descriptor (zip, &e, zip64)
+            && e.compressed_size == used;
+        else
+          ok = used <= e.compressed_size
+            && epub2txt_zip_stream_skip (zip, e.compressed_size - used);
+        }
+      if (keep)
+        {
+        epub2txt_zip_finish (zip, &e, &out, ret, error);
+        wanted = epub2txt_zip_stream_name (zip, name, TRUE);
+        wanted->state = ZIP_STREAM_EXTRACTED;
+        }
+      if (!ok)
+        klib_log_warning ("%s: %s: lost track of the stream", zip->file, 
+          name);
+      }
+    klib_string_free (dest);
+    }
+  if (!ok || *error) zip->stream_done = TRUE;
+  free (name);
+  free (extra);
+  KLIB_OUT
+  return !zip->stream_done;
+  }
+
+/*========================================================================
+  epub2txt_zip_want
+  Marks an entry of a stream as wanted. Once any entry has been marked,
+  the only entries that are extracted are the wanted ones
+=========================================================================*/
+void epub2txt_zip_want (epub2txt_Zip *zip, const char *name)
+  {
+  if (!zip->stream) return;
+  zip->stream_keep_all = FALSE;
+  epub2txt_ZipName *n = epub2txt_zip_stream_name (zip, name, TRUE);
+  if (n->state == 0) n->state = ZIP_STREAM_WANTED;
+  }
+
+/*========================================================================
+  epub2txt_zip_extract_stream
+  Reads on through a stream until the named entry has been extracted,
+  unless it already has been
+=========================================================================*/
+static BOOL epub2txt_zip_extract_stream (epub2txt_Zip *zip, 
+    const char *name, klib_Error **error)
+  {
+  KLIB_IN
+  epub2txt_ZipName *n = epub2txt_zip_stream_name (zip, name, TRUE);
+  if (n->state == ZIP_STREAM_SKIPPED)
+    {
+    klib_log_warning ("%s: %s was passed over in the stream, before it was "
+      "known to be needed", zip->file, name);
+    KLIB_OUT
+    return FALSE;
+    }
+  if (n->state == 0) n->state = ZIP_STREAM_WANTED;
+  while (n->state == ZIP_STREAM_WANTED
+      && epub2txt_zip_stream_next (zip, error))
+    n = epub2txt_zip_stream_name (zip, name, FALSE);
+  n = epub2txt_zip_stream_name (zip, name, FALSE);
+  BOOL ret = n->state == ZIP_STREAM_EXTRACTED;
+  if (!ret && *error == NULL)
+    klib_log_debug ("%s: no entry %s", zip->file, name);
+  KLIB_OUT
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_zip_locate
+  Finds the named entry, and moves to the start of its data. Returns
+  NULL if there is no such entry, or it can't be extracted
+=========================================================================*/
+static const epub2txt_ZipEntry *epub2txt_zip_locate (epub2txt_Zip *zip,
+    const char *name)
+  {
+  const epub2txt_ZipEntry *e = epub2txt_zip_find (zip, name);
+  if (!e)
+    {
+    klib_log_debug ("%s: no entry %s", zip->file, name);
+    return NULL;
+    }
+  if (e->flags & ZIP_FLAG_ENCRYPTED
+      || (e->method != ZIP_METHOD_STORED && e->method != ZIP_METHOD_DEFLATED))
+    {
+    klib_log_warning ("%s: %s: unsupported compression method %d%s",
+      zip->file, name, e->method,
+      e->flags & ZIP_FLAG_ENCRYPTED ? " (encrypted)" : "");
+    return NULL;
+    }
+
+  // The local header repeats the name, and may have a different extra
+  //  field; the data follows them
+  BYTE local[ZIP_LOCAL_SIZE];
+  if (fseeko (zip->f, zip->prefix + e->offset, SEEK_SET) != 0
+      || fread (local, 1, ZIP_LOCAL_SIZE, zip->f) != ZIP_LOCAL_SIZE
+      || epub2txt_zip_get32 (local) != ZIP_LOCAL_SIG
+      || fseeko (zip->f, zip->prefix + e->offset + ZIP_LOCAL_SIZE
+           + epub2txt_zip_get16 (local + 26)
+           + epub2txt_zip_get16 (local + 28), SEEK_SET) != 0)
+    {
+    klib_log_warning ("%s: %s: bad local header", zip->file, name);
+    return NULL;
+    }
+  return e;
+  }
+
+/*========================================================================
+  epub2txt_zip_extract
+  Decompresses the named entry into the file dest. Returns FALSE, 
+  without setting error, if there is no such entry, or if it can't be 
+  extracted; damaged data is reported by epub2txt_zip_finish, and 
+  whatever could be recovered is written, as unzip would. The entries
+  of a stream are extracted into its spool directory, so dest must be
+  the entry's name in that directory
+=========================================================================*/
+BOOL epub2txt_zip_extract (epub2txt_Zip *zip, const char *name,
+    const char *dest, klib_Error **error)
+  {
+  KLIB_IN
+  if (zip->stream)
+    {
+    BOOL ret = epub2txt_zip_extract_stream (zip, name, error);
+    KLIB_OUT
+    return ret;
+    }
+  const epub2txt_ZipEntry *e = epub2txt_zip_locate (zip, name);
+  epub2txt_ZipOutput out;
+  if (e && epub2txt_zip_create (zip, dest, &out, error))
+    {
+    epub2txt_inflate_input (&zip->inflate, zip->f, e->compressed_size);
+    int ret = epub2txt_zip_decode (zip, e, &out);
+    epub2txt_zip_finish (zip, e, &out, ret, error);
+    }
+  KLIB_OUT
+  return e != NULL && *error == NULL;
+  }
+
+/*========================================================================
+  epub2txt_zip_read
+  Decompresses the named entry, passing its data to sink a block at a
+  time, so that nothing need be written to disk. Returns FALSE as
+  epub2txt_zip_extract does. If sink returns FALSE, the rest of the
+  entry is not read. The entries of a stream can only be extracted
+=========================================================================*/
+BOOL epub2txt_zip_read (epub2txt_Zip *zip, const char *name,
+    epub2txt_InflateSink sink, void *ctx, klib_Error **error)
+  {
+  KLIB_IN
+  const epub2txt_ZipEntry *e = zip->stream 
+    ? NULL : epub2txt_zip_locate (zip, name);
+  if (e)
+    {
+    epub2txt_ZipOutput out;
+    memset (&out, 0, sizeof (out));
+    out.sink = sink;
+    out.ctx = ctx;
+    out.verify = zip->verify;
+    epub2txt_inflate_input (&zip->inflate, zip->f, e->compressed_size);
+    int ret = epub2txt_zip_decode (zip, e, &out);
+    epub2txt_zip_finish (zip, e, &out, ret, error);
+    }
+  KLIB_OUT
+  return e != NULL && *error == NULL;
+  }
+
+/*========================================================================
+  epub2txt_zip_map
+  Where the named entry's data is, if the archive is in memory and the
+  entry is stored, so that it can be used without being copied; or 
+  else NULL, and the entry has to be read. The entry is checked and
+  counted as it would be if it were read
+=========================================================================*/
+const BYTE *epub2txt_zip_map (epub2txt_Zip *zip, const char *name, 
+    long long *size)
+  {
+  KLIB_IN
+  const epub2txt_ZipEntry *e = zip->image ? epub2txt_zip_find (zip, name) 
+    : NULL;
+  const BYTE *ret = NULL;
+  if (e && e->method == ZIP_METHOD_STORED && epub2txt_zip_locate (zip, name))
+    ret = epub2txt_zip_image_data (zip, e->compressed_size);
+  if (ret)
+    {
+    epub2txt_ZipOutput out;
+    memset (&out, 0, sizeof (out));
+    out.verify = zip->verify;
+    klib_Error *error = NULL;
+    epub2txt_zip_finish (zip, e, &out, 
+      epub2txt_zip_copy_image (zip, e->compressed_size, &out), &error);
+    *size = e->compressed_size;
+    }
+  KLIB_OUT
+  return ret;
+  }
+
+/*========================================================================
+  epub2txt_zip_stream_clean
+  Removes the entries that were extracted into a stream's spool 
+  directory, and then its directories, as they are left empty
+=========================================================================*/
+static void epub2txt_zip_stream_clean (epub2txt_Zip *zip)
+  {
+  long long i;
+  int spool_len = strlen (zip->spool);
+  for (i = 0; i < zip->stream_capacity; i++)
+    {
+    const epub2txt_ZipName *n = &zip->stream_names[i];
+    if (!n->name || n->state != ZIP_STREAM_EXTRACTED) continue;
+    klib_String *path = klib_string_new_printf ("%s/%s", zip->spool, 
+      n->name);
+    char *s = strdup (klib_string_cstr (path));
+    remove (s);
+    char *slash;
+    while ((slash = strrchr (s, '/')) != NULL && slash - s > spool_len)
+      {
+      *slash = 0;
+      rmdir (s);
+      }
+    free (s);
+    klib_string_free (path);
+    }
+  rmdir (zip->spool);
+  }
+
+/*========================================================================
+  epub2txt_zip_close
+  Closes the archive, and frees the archive and its index
+=========================================================================*/
+void epub2txt_zip_close (epub2txt_Zip *zip)
+  {
+  if (!zip) return;
+  if (zip->f && !zip->stream) fclose (zip->f);
+  if (zip->stream) epub2txt_zip_stream_clean (zip);
+  long long i;
+  for (i = 0; i < zip->stream_capacity; i++)
+    free (zip->stream_names[i].name);
+  free (zip->stream_names);
+  free (zip->spool);
+  free (zip->entries);
+  free (zip->names);
+  free (zip->file);
+  free (zip);
+  }
+
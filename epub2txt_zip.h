@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdio.h>
+#include "klib_defs.h"
+#include "klib_error.h"
+#include "epub2txt_inflate.h"
+
+// Compression methods that can be extracted
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+
+/*========================================================================
+  epub2txt_ZipEntry
+  An entry of the archive's central directory
+=========================================================================*/
+typedef struct _epub2txt_ZipEntry
+  {
+  const char *name;
+  int method;
+  int flags;
+  unsigned long crc;
+  long long compressed_size;
+  long long size;
+  // Offset of the entry's local header
+  long long offset;
+  } epub2txt_ZipEntry;
+
+// An entry of a stream that is wanted, or has been extracted
+typedef struct _epub2txt_ZipName
+  {
+  char *name;
+  int state;
+  } epub2txt_ZipName;
+
+/*========================================================================
+  epub2txt_Zip
+  An open archive. Entries are sorted by name, so they can be found
+  without reading the whole directory again for each one
+=========================================================================*/
+typedef struct _epub2txt_Zip
+  {
+  char *file;
+  FILE *f;
+  // Where the central directory is, and how many entries it claims
+  long long dir_offset;
+  long long dir_size;
+  long long nentries;
+  // Bytes of anything prepended to the archive, such as a
+  //  self-extractor, which the offsets in the directory do not include
+  long long prefix;
+  epub2txt_ZipEntry *entries;
+  char *names;
+  // The archive, if it is held in memory (see epub2txt_zip_open_memory)
+  const BYTE *image;
+  long long image_size;
+  // Total size of the entries extracted so far
+  long long extracted_bytes;
+  // Set to check the CRC and size of each entry that is extracted
+  //  against the directory
+  BOOL verify;
+  // Entries found to be damaged so far
+  int corrupt_entries;
+  // Set for an archive that is read as a stream (see 
+  //  epub2txt_zip_open_stream), which has no directory of entries.
+  //  Instead, there is a hash table of the names of the entries that 
+  //  are wanted or have already been extracted into spool
+  BOOL stream;
+  BOOL stream_keep_all;
+  BOOL stream_done;
+  char *spool;
+  epub2txt_ZipName *stream_names;
+  long long stream_capacity;
+  long long stream_count;
+  epub2txt_Inflate inflate;
+  } epub2txt_Zip;
+
+epub2txt_Zip *epub2txt_zip_open (const char *file, klib_Error **error);
+
+epub2txt_Zip *epub2txt_zip_open_memory (const BYTE *data, long long size,
+  const char *name, klib_Error **error);
+
+epub2txt_Zip *epub2txt_zip_open_stream (FILE *f, const char *name, 
+  const char *spool);
+
+long long epub2txt_zip_stream_read (const epub2txt_Zip *zip);
+
+long long epub2txt_zip_memory (const epub2txt_Zip *zip);
+
+void epub2txt_zip_read_directory (epub2txt_Zip *zip, klib_Error **error);
+
+const epub2txt_ZipEntry *epub2txt_zip_find (const epub2txt_Zip *zip,
+  const char *name);
+
+BOOL epub2txt_zip_name_outside (const char *name);
+
+void epub2txt_zip_make_dirs (const char *path);
+
+void epub2txt_zip_want (epub2txt_Zip *zip, const char *name);
+
+BOOL epub2txt_zip_extract (epub2txt_Zip *zip, const char *name,
+  const char *dest, klib_Error **error);
+
+BOOL epub2txt_zip_read (epub2txt_Zip *zip, const char *name,
+  epub2txt_InflateSink sink, void *ctx, klib_Error **error);
+
+const BYTE *epub2txt_zip_map (epub2txt_Zip *zip, const char *name, 
+  long long *size);
+
+void epub2txt_zip_close (epub2txt_Zip *zip);
+
@@ -13,6 +13,7 @@ klib_buffer.c
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "klib_log.h"
+#include "klib_memstat.h"
 #include "klib_buffer.h"
 #include "klib_error.h"
 
@@ -33,8 +34,9 @@ typedef struct _klib_Buffer_priv
   {
   BYTE *data;
   // Note that a zero-length buffer is legitimate. The presence of some
-  //  data is signalled by 'data' being non-null
-  int len;
+  //  data is signalled by 'data' being non-null. The length is 64 bits,
+  //  so that a buffer can hold more than 2 GB
+  long long len;
   } klib_Buffer_priv;
 
 
@@ -47,26 +49,28 @@ void klib_buffer_init (klib_Object *_self)
   klib_object_init (_self);
   _self->dispose = klib_buffer_dispose;
   klib_Buffer *self = (klib_Buffer*)_self;
-  self->priv = (klib_Buffer_priv *)malloc (sizeof (klib_Buffer_priv));
+  self->priv = (klib_Buffer_priv *)klib_malloc 
+    (sizeof (klib_Buffer_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_Buffer_priv));
   self->priv->len = 0;
-  self->priv->data = malloc(0);
+  self->priv->data = klib_malloc (0, _self->class_name);
   KLIB_OUT
   }
 
 /*===========================================================================
 klib_buffer_set
 ============================================================================*/
-void klib_buffer_set (klib_Buffer *self, int len, const void *data)
+void klib_buffer_set (klib_Buffer *self, long long len, const void *data)
   {
   KLIB_IN
+  const char *tag = self->base.class_name;
   if (self->priv->data)
-    free (self->priv->data);
+    klib_free (self->priv->data, tag);
   if (data == NULL) 
     self->priv->data = NULL;
   else
     {
-    self->priv->data = malloc (len); 
+    self->priv->data = klib_malloc (len, tag); 
     self->priv->len = len;
     memcpy (self->priv->data, data, len);
     }
@@ -86,7 +90,7 @@ void klib_buffer_clear (klib_Buffer *self)
 /*===========================================================================
 klib_buffer_new
 ============================================================================*/
-klib_Buffer *klib_buffer_new (int len, const void *data)
+klib_Buffer *klib_buffer_new (long long len, const void *data)
   {
   KLIB_IN
   klib_Buffer *self = (klib_Buffer *)klib_object_new(&klib_spec_buffer); 
@@ -121,8 +125,8 @@ void klib_buffer_dispose (klib_Object *_self)
       {
       self->priv->len = 0;
       if (self->priv->data)
-        free (self->priv->data);
-      free (self->priv);
+        klib_free (self->priv->data, _self->class_name);
+      klib_free (self->priv, _self->class_name);
       }
     }
   klib_object_dispose ((klib_Object *)self);
@@ -173,11 +177,15 @@ klib_Buffer *klib_buffer_read_stream (FILE *stream,
   struct stat sb;
   if (fstat (fileno (stream), &sb) == 0)
     {
-    void *buff = malloc (sb.st_size);
-    read (fileno (stream), buff, sb.st_size);
+    // Read straight into the buffer's own storage, rather than into
+    //  a copy, so a large file only needs its own size in memory
     ret = klib_buffer_new_empty ();
+    const char *tag = ret->base.class_name;
+    klib_free (ret->priv->data, tag);
+    ret->priv->data = klib_malloc (sb.st_size, tag);
+    ret->priv->len = read (fileno (stream), ret->priv->data, sb.st_size);
+    if (ret->priv->len < 0) ret->priv->len = 0;
     // Convert to UTF-8 here
-    klib_buffer_set (ret, sb.st_size, buff);
     }
   KLIB_OUT
   return ret; 
@@ -191,7 +199,8 @@ BOOL klib_buffer_append_byte (klib_Buffer *self, BYTE c)
   KLIB_IN
   BOOL ret = FALSE;
 
-  self->priv->data = realloc (self->priv->data, self->priv->len + 1);
+  self->priv->data = klib_realloc (self->priv->data, self->priv->len + 1, 
+    self->base.class_name);
   if (self->priv->data)
     {
     self->priv->data[self->priv->len] = c;  
@@ -207,15 +216,16 @@ BOOL klib_buffer_append_byte (klib_Buffer *self, BYTE c)
 /*===========================================================================
 klib_buffer_append
 ============================================================================*/
-BOOL klib_buffer_append (klib_Buffer *self, int len, BYTE *c)
+BOOL klib_buffer_append (klib_Buffer *self, long long len, BYTE *c)
   {
   KLIB_IN
   BOOL ret = FALSE;
 
-  self->priv->data = realloc (self->priv->data, self->priv->len + len);
+  self->priv->data = klib_realloc (self->priv->data, self->priv->len + len,
+    self->base.class_name);
   if (self->priv->data)
     {
-    memcpy (self->priv->data + len, c, len);
+    memcpy (self->priv->data + self->priv->len, c, len);
     self->priv->len += len;
     ret = TRUE;
     }
@@ -228,7 +238,7 @@ BOOL klib_buffer_append (klib_Buffer *self, int len, BYTE *c)
 /*===========================================================================
 klib_buffer_ends_with
 ============================================================================*/
-BOOL klib_buffer_ends_with (klib_Buffer *self, int len, BYTE *c)
+BOOL klib_buffer_ends_with (klib_Buffer *self, long long len, BYTE *c)
   {
   KLIB_IN
   BOOL ret = FALSE;
@@ -242,7 +252,7 @@ BOOL klib_buffer_ends_with (klib_Buffer *self, int len, BYTE *c)
 /*===========================================================================
 klib_buffer_get_length
 ============================================================================*/
-int klib_buffer_get_length (const klib_Buffer *self)
+long long klib_buffer_get_length (const klib_Buffer *self)
   {
   return self->priv->len;
   }
@@ -335,6 +335,34 @@ Boolean isLegalUTF8Sequence(const UTF8 *source, const UTF8 *sourceEnd) {
 
 /* --------------------------------------------------------------------- */
 
+/*
+ * Exported function to return the number of bytes at the start of the
+ * source that ConvertUTF8toUTF32 would convert, before it stops at an
+ * illegal or incomplete sequence. Callers that can work on the UTF-8
+ * directly use this to get the same text that conversion would give.
+ */
+int LegalUTF8PrefixLength(const UTF8 *source, const UTF8 *sourceEnd) {
+    const UTF8 *start = source;
+    while (source < sourceEnd) {
+    unsigned short extraBytesToRead;
+    if (*source < 0x80) { /* ASCII is always legal */
+        source++;
+        continue;
+    }
+    extraBytesToRead = trailingBytesForUTF8[*source];
+    if (source + extraBytesToRead >= sourceEnd) {
+        break;
+    }
+    if (! isLegalUTF8(source, extraBytesToRead+1)) {
+        break;
+    }
+    source += extraBytesToRead+1;
+    }
+    return (int)(source - start);
+}
+
+/* --------------------------------------------------------------------- */
+
 ConversionResult ConvertUTF8toUTF16 (
     const UTF8** sourceStart, const UTF8* sourceEnd, 
     UTF16** targetStart, UTF16* targetEnd, ConversionFlags flags) {
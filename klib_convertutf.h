@@ -144,6 +144,8 @@ ConversionResult ConvertUTF32toUTF16 (
 
 Boolean isLegalUTF8Sequence(const UTF8 *source, const UTF8 *sourceEnd);
 
+int LegalUTF8PrefixLength(const UTF8 *source, const UTF8 *sourceEnd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -11,6 +11,7 @@ klib_error.c
 #include <string.h>
 #include "klib_string.h"
 #include "klib_error.h"
+#include "klib_memstat.h"
 
 /*===========================================================================
 private data
@@ -49,7 +50,8 @@ void klib_error_init (klib_Object *_self)
   _self->dispose = klib_error_dispose;
   _self->to_string = klib_error_to_string;
   klib_Error *self = (klib_Error *)_self;
-  self->priv = (klib_Error_priv *)malloc (sizeof (klib_Error_priv));
+  self->priv = (klib_Error_priv *)klib_malloc 
+    (sizeof (klib_Error_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_Error_priv));
   }
 
@@ -78,7 +80,7 @@ void klib_error_dispose (klib_Object *_self)
     self->disposing = TRUE;
     if (self->priv->str) 
         free (self->priv->str);
-    free (self->priv);
+    klib_free (self->priv, _self->class_name);
     }
   klib_object_dispose (_self);
   }
@@ -15,6 +15,7 @@ klib_getopt.c
 #include <sys/stat.h>
 #include "klib_defs.h"
 #include "klib_log.h"
+#include "klib_memstat.h"
 #include "klib_getopt.h"
 #include "klib_getoptspec.h"
 #include "klib_error.h"
@@ -63,7 +64,8 @@ void klib_getopt_init (klib_Object *_self)
   klib_object_init (_self);
   _self->dispose = klib_getopt_dispose;
   klib_GetOpt *self = (klib_GetOpt *)_self;
-  self->priv = (klib_GetOpt_priv *)malloc (sizeof (klib_GetOpt_priv));
+  self->priv = (klib_GetOpt_priv *)klib_malloc 
+    (sizeof (klib_GetOpt_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_GetOpt_priv));
   self->priv->specs = klib_list_new ();
   self->priv->argv = klib_list_new ();
@@ -91,7 +93,7 @@ void klib_getopt_dispose (klib_Object *_self)
         }
       klib_list_free (self->priv->specs);
       klib_list_free (self->priv->argv);
-      free (self->priv);
+      klib_free (self->priv, _self->class_name);
       }
     }
   klib_object_dispose ((klib_Object *)self);
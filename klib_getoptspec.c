@@ -15,6 +15,7 @@ klib_getoptspec.c
 #include <sys/stat.h>
 #include "klib_defs.h"
 #include "klib_log.h"
+#include "klib_memstat.h"
 #include "klib_getoptspec.h"
 #include "klib_error.h"
 #include "klib_string.h"
@@ -71,7 +72,8 @@ void klib_getoptspec_init (klib_Object *_self)
   klib_object_init (_self);
   _self->dispose = klib_getoptspec_dispose;
   klib_GetOptSpec *self = (klib_GetOptSpec *)_self;
-  self->priv = (klib_GetOptSpec_priv *)malloc (sizeof (klib_GetOptSpec_priv));
+  self->priv = (klib_GetOptSpec_priv *)klib_malloc 
+    (sizeof (klib_GetOptSpec_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_GetOptSpec_priv));
   KLIB_OUT
   }
@@ -98,7 +100,7 @@ void klib_getoptspec_dispose (klib_Object *_self)
       if (self->priv->name) free (self->priv->name);
       if (self->priv->longopt) free (self->priv->longopt);
       if (self->priv->arg) free (self->priv->arg);
-      free (self->priv);
+      klib_free (self->priv, _self->class_name);
       }
     }
   klib_object_dispose ((klib_Object *)self);
@@ -15,6 +15,7 @@ klib_list.c
 #include <sys/stat.h>
 #include "klib_defs.h"
 #include "klib_log.h"
+#include "klib_memstat.h"
 #include "klib_list.h"
 #include "klib_error.h"
 #include "klib_string.h"
@@ -33,9 +34,17 @@ static klib_Spec klib_spec_list =
   .class_name = "klib_List"
   };
 
+// Note that 'tail' is the first entry, and 'head' the last. We keep
+//  the head and the length, so that appending and counting are not
+//  O(n), and the position of the last entry found by index, so that 
+//  a loop over klib_list_get (list, i) is not O(n^2)
 typedef struct _klib_List_priv
   {
   klib_ListEntry *tail;
+  klib_ListEntry *head;
+  int length;
+  klib_ListEntry *cursor;
+  int cursor_index;
   } klib_List_priv;
 
 
@@ -60,7 +69,8 @@ void klib_list_init (klib_Object *_self)
   klib_object_init (_self);
   _self->dispose = klib_list_dispose;
   klib_List *self = (klib_List *)_self;
-  self->priv = (klib_List_priv *)malloc (sizeof (klib_List_priv));
+  self->priv = (klib_List_priv *)klib_malloc 
+    (sizeof (klib_List_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_List_priv));
   KLIB_OUT
   }
@@ -78,7 +88,7 @@ void klib_list_dispose (klib_Object *_self)
     if (self->priv) 
       {
       klib_list_clear (self);
-      free (self->priv);
+      klib_free (self->priv, _self->class_name);
       }
     }
   klib_object_dispose (_self);
@@ -95,6 +105,35 @@ void klib_list_free (klib_List *self)
   KLIB_OUT
   }
 
+/*===========================================================================
+klib_list_find_entry
+Returns the n'th entry, or NULL. Searching starts from the cursor if the
+entry is at or after it
+============================================================================*/
+static klib_ListEntry *klib_list_find_entry (klib_List *self, int n)
+  {
+  klib_List_priv *priv = self->priv;
+  if (n < 0 || n >= priv->length) return NULL;
+  klib_ListEntry *p = priv->tail;
+  int count = 0;
+  if (priv->cursor && priv->cursor_index <= n)
+    {
+    p = priv->cursor;
+    count = priv->cursor_index;
+    }
+  while (p && count < n)
+    {
+    p = p->next;
+    count++;
+    }
+  if (p)
+    {
+    priv->cursor = p;
+    priv->cursor_index = n;
+    }
+  return p;
+  }
+
 /*===========================================================================
 klib_list_get
 ============================================================================*/
@@ -102,21 +141,9 @@ klib_Object *klib_list_get (klib_List *self, int n)
   {
   KLIB_IN
   void *ret = NULL;
-  int count = 0;
-  klib_ListEntry *p = self->priv->tail;
+  klib_ListEntry *p = klib_list_find_entry (self, n);
   if (p)
-    {
-    do
-      {
-      if (n == count)
-        ret = p->data;
-      else
-        {
-        p = p->next;
-        count++;
-        }
-      } while (p && !ret);
-    }
+    ret = p->data;
 
   if (ret == NULL)
     klib_log_warning ("List index %d out of bounds in list_get()", n);
@@ -132,23 +159,11 @@ void klib_list_set (klib_List *self, int n, klib_Object *o, BOOL reref)
   {
   KLIB_IN
   void *ret = NULL;
-  int count = 0;
-  klib_ListEntry *p = self->priv->tail;
+  klib_ListEntry *p = klib_list_find_entry (self, n);
   if (p)
     {
-    do
-      {
-      if (n == count)
-        {
-        ret = p->data;
-        p->data = o;
-        }
-      else
-        {
-        p = p->next;
-        count++;
-        }
-      } while (p && !ret);
+    ret = p->data;
+    p->data = o;
     }
 
   if (ret == NULL)
@@ -171,16 +186,7 @@ klib_list_get_head
 klib_ListEntry *klib_list_get_head (klib_List *self)
   {
   KLIB_IN
-  klib_ListEntry *ret = NULL;
-  if (self->priv->tail)
-    {
-    ret = self->priv->tail;
-    while (ret->next)
-      {
-      ret = ret->next;
-      } 
-    }
-
+  klib_ListEntry *ret = self->priv->head;
   KLIB_OUT
   return ret;
   }
@@ -191,17 +197,7 @@ klib_list_get_length
 int klib_list_length (const klib_List *self)
   {
   KLIB_IN
-  int n = 0;
-  klib_ListEntry *p = self->priv->tail;
-  if (p)
-    {
-    do
-      {
-      p = p->next;
-      n++;
-      } while (p);
-    }
-
+  int n = self->priv->length;
   KLIB_OUT
   return n;
   }
@@ -220,11 +216,13 @@ void klib_list_append (klib_List *self, klib_Object *item)
   this_entry->next = NULL;
   klib_object_add_ref (this_entry->data);
 
-  klib_ListEntry *head = klib_list_get_head (self);
+  klib_ListEntry *head = self->priv->head;
   if (head == NULL)
     self->priv->tail = this_entry;
   else 
     head->next = this_entry; 
+  self->priv->head = this_entry;
+  self->priv->length++;
 
   KLIB_OUT
   }
@@ -252,60 +250,86 @@ void klib_list_clear (klib_List *self)
 
   KLIB_OUT
   self->priv->tail = NULL;
+  self->priv->head = NULL;
+  self->priv->length = 0;
+  self->priv->cursor = NULL;
   }
 
 /*===========================================================================
 klib_list_sort
-Trivial exchange sort. OK for small lists
+Stable merge sort of the entries' data pointers, which are then written
+back in order. The list structure itself is not changed
 ============================================================================*/
 void klib_list_sort (klib_List *self, klib_ListComparator comp)
   {
-  int i, j, l = klib_list_length (self);
-  for (i = 0; i < l; i++)
+  KLIB_IN
+  int l = self->priv->length;
+  if (l > 1)
     {
-    for (j = 0; j < l - 1; j++)
+    klib_Object **a = malloc (l * sizeof (klib_Object *));
+    klib_Object **b = malloc (l * sizeof (klib_Object *));
+    if (a && b)
       {
-      klib_Object *o1 = klib_list_get (self, j); 
-      klib_Object *o2 = klib_list_get (self, j+ 1); 
-      if (comp (o1, o2) > 0)
+      klib_ListEntry *p;
+      int i = 0, width;
+      for (p = self->priv->tail; p; p = p->next)
+        a[i++] = p->data;
+      for (width = 1; width < l; width *= 2)
         {
-        // Swap
-        klib_Object *temp = o1;
-        klib_list_set (self, j, o2, FALSE);
-        klib_list_set (self, j + 1, temp, FALSE);
+        int lo;
+        for (lo = 0; lo < l; lo += 2 * width)
+          {
+          int mid = lo + width < l ? lo + width : l;
+          int hi = lo + 2 * width < l ? lo + 2 * width : l;
+          int x = lo, y = mid, k = lo;
+          // Take from the left run on ties, to keep the sort stable
+          while (x < mid && y < hi)
+            b[k++] = comp (a[x], a[y]) > 0 ? a[y++] : a[x++];
+          while (x < mid) b[k++] = a[x++];
+          while (y < hi) b[k++] = a[y++];
+          }
+        klib_Object **temp = a;
+        a = b;
+        b = temp;
         }
+      i = 0;
+      for (p = self->priv->tail; p; p = p->next)
+        p->data = a[i++];
       }
+    free (a);
+    free (b);
     }
+  KLIB_OUT
   }
 
 /*===========================================================================
 klib_list_remove
-Removes the object and unrefs it
+Removes every occurrence of the object, and unrefs it once for each
 ============================================================================*/
 void klib_list_remove (klib_List *self, klib_Object *o)
   {
   KLIB_IN
-  klib_ListEntry *p = self->priv->tail;
-  if (p)
+  klib_List_priv *priv = self->priv;
+  klib_ListEntry **link = &priv->tail;
+  klib_ListEntry *last = NULL;
+  while (*link)
     {
+    klib_ListEntry *p = *link;
     if (p->data == o)
       {
-      self->priv->tail = self->priv->tail->next;
+      *link = p->next;
       klib_object_unref (o);
-      free (self->priv->tail);
+      free (p);
+      priv->length--;
       }
-    }
-  do
-    {
-    klib_ListEntry *pnext = p->next;
-    if (pnext->data == o)
+    else
       {
-      klib_object_unref (o);
-      free (pnext);
-      p->next = pnext->next;
-      } 
-    p = p->next;      
-    } while (p != NULL);
+      last = p;
+      link = &p->next;
+      }
+    }
+  priv->head = last;
+  priv->cursor = NULL;
 
   KLIB_OUT
   }
@@ -8,6 +8,7 @@ klib_log.c
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "klib_log.h"
 #include "klib_string.h"
 
@@ -36,11 +37,13 @@ klib_log_v
 void klib_log_v (int level, const char *fmt, va_list ap)
   {
   if (level > klib_log_level) return;
-  const char *s = klib_string_format_args (fmt, ap); 
+  char *s = klib_string_format_args (fmt, ap); 
+  if (!s) return;
   if (klib_log_handler)
     klib_log_handler (level, s);
   else
     fprintf (stderr, "%s\n", s);
+  free (s);
   }
 
 
@@ -8,8 +8,16 @@
 #define KLIB_LOG_DEBUG 3
 #define KLIB_LOG_TRACE 4 
 
+// In a KLIB_PROFILE build, function entry and exit are timed rather
+//  than logged -- see klib_profile.h
+#ifdef KLIB_PROFILE
+#include "klib_profile.h"
+#define KLIB_IN klib_profile_enter (__PRETTY_FUNCTION__);
+#define KLIB_OUT klib_profile_leave (__PRETTY_FUNCTION__);
+#else
 #define KLIB_IN klib_log_trace ("Entering %s", __PRETTY_FUNCTION__);
 #define KLIB_OUT klib_log_trace ("Leaving %s", __PRETTY_FUNCTION__);
+#endif
 
 typedef void (*KlibLogHandler)(int level, const char *message);
 
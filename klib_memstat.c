@@ -0,0 +1,256 @@
+/*===========================================================================
+klib
+klib_memstat.c
+(c)2000-2016 Kevin Boone
+============================================================================*/
+
+#include <string.h>
+#include <stdlib.h>
+#ifdef KLIB_MEMSTATS
+#include <malloc.h>
+#endif
+#include "klib_defs.h"
+#include "klib_memstat.h"
+
+/*===========================================================================
+private data
+============================================================================*/
+#define KLIB_MEMSTAT_TAG_LEN 32
+
+static char klib_memstat_tags[KLIB_MEMSTAT_TAGS_MAX][KLIB_MEMSTAT_TAG_LEN];
+static klib_MemStat klib_memstat_tag_stats[KLIB_MEMSTAT_TAGS_MAX];
+static int klib_memstat_ntags = 0;
+static klib_MemStat klib_memstat_context_stats[KLIB_MEMSTAT_CONTEXTS_MAX];
+static int klib_memstat_context = 0;
+static klib_MemStat klib_memstat_total;
+
+#ifdef KLIB_MEMSTATS
+
+/*===========================================================================
+klib_memstat_find_tag
+Tags that don't fit in the table are all counted against the last entry
+============================================================================*/
+static klib_MemStat *klib_memstat_find_tag (const char *tag)
+  {
+  int i;
+  if (!tag) tag = "(none)";
+  for (i = 0; i < klib_memstat_ntags; i++)
+    {
+    if (strcmp (klib_memstat_tags[i], tag) == 0)
+      return &klib_memstat_tag_stats[i];
+    }
+  if (klib_memstat_ntags == KLIB_MEMSTAT_TAGS_MAX)
+    return &klib_memstat_tag_stats[KLIB_MEMSTAT_TAGS_MAX - 1];
+  strncpy (klib_memstat_tags[i], tag, KLIB_MEMSTAT_TAG_LEN - 1);
+  klib_memstat_ntags++;
+  return &klib_memstat_tag_stats[i];
+  }
+
+/*===========================================================================
+klib_memstat_add
+============================================================================*/
+static void klib_memstat_add (klib_MemStat *stat, long long size)
+  {
+  stat->allocs++;
+  stat->bytes += size;
+  stat->live += size;
+  if (stat->live > stat->peak) stat->peak = stat->live;
+  }
+
+/*===========================================================================
+klib_memstat_remove
+============================================================================*/
+static void klib_memstat_remove (klib_MemStat *stat, long long size)
+  {
+  stat->frees++;
+  stat->live -= size;
+  }
+
+/*===========================================================================
+klib_memstat_count_alloc
+============================================================================*/
+static void klib_memstat_count_alloc (void *p, const char *tag)
+  {
+  if (!p) return;
+  long long size = malloc_usable_size (p);
+  klib_memstat_add (klib_memstat_find_tag (tag), size);
+  klib_memstat_add (&klib_memstat_total, size);
+  // The context's peak is the peak of _all_ live memory while that
+  //  context was current
+  klib_MemStat *c = &klib_memstat_context_stats[klib_memstat_context];
+  c->allocs++;
+  c->bytes += size;
+  if (klib_memstat_total.live > c->peak) c->peak = klib_memstat_total.live;
+  c->live = klib_memstat_total.live;
+  }
+
+/*===========================================================================
+klib_memstat_count_free
+============================================================================*/
+static void klib_memstat_count_free (void *p, const char *tag)
+  {
+  if (!p) return;
+  long long size = malloc_usable_size (p);
+  klib_memstat_remove (klib_memstat_find_tag (tag), size);
+  klib_memstat_remove (&klib_memstat_total, size);
+  klib_MemStat *c = &klib_memstat_context_stats[klib_memstat_context];
+  c->frees++;
+  c->live = klib_memstat_total.live;
+  }
+
+/*===========================================================================
+klib_memstat_malloc
+============================================================================*/
+void *klib_memstat_malloc (size_t size, const char *tag)
+  {
+  void *ret = malloc (size);
+  klib_memstat_count_alloc (ret, tag);
+  return ret;
+  }
+
+/*===========================================================================
+klib_memstat_calloc
+============================================================================*/
+void *klib_memstat_calloc (size_t count, size_t size, const char *tag)
+  {
+  void *ret = calloc (count, size);
+  klib_memstat_count_alloc (ret, tag);
+  return ret;
+  }
+
+/*===========================================================================
+klib_memstat_realloc
+A realloc is counted as a free followed by an allocation
+============================================================================*/
+void *klib_memstat_realloc (void *p, size_t size, const char *tag)
+  {
+  long long old_size = p ? malloc_usable_size (p) : 0;
+  void *ret = realloc (p, size);
+  if (ret || size == 0)
+    {
+    if (p)
+      {
+      klib_memstat_remove (klib_memstat_find_tag (tag), old_size);
+      klib_memstat_remove (&klib_memstat_total, old_size);
+      klib_memstat_context_stats[klib_memstat_context].frees++;
+      }
+    klib_memstat_count_alloc (ret, tag);
+    }
+  return ret;
+  }
+
+/*===========================================================================
+klib_memstat_free
+============================================================================*/
+void klib_memstat_free (void *p, const char *tag)
+  {
+  klib_memstat_count_free (p, tag);
+  free (p);
+  }
+
+/*===========================================================================
+klib_memstat_strdup
+============================================================================*/
+char *klib_memstat_strdup (const char *s, const char *tag)
+  {
+  char *ret = strdup (s);
+  klib_memstat_count_alloc (ret, tag);
+  return ret;
+  }
+
+#endif
+
+/*===========================================================================
+klib_memstat_available
+============================================================================*/
+BOOL klib_memstat_available (void)
+  {
+#ifdef KLIB_MEMSTATS
+  return TRUE;
+#else
+  return FALSE;
+#endif
+  }
+
+/*===========================================================================
+klib_memstat_set_context
+============================================================================*/
+void klib_memstat_set_context (int context)
+  {
+  if (context < 0 || context >= KLIB_MEMSTAT_CONTEXTS_MAX) context = 0;
+  klib_memstat_context = context;
+  klib_MemStat *c = &klib_memstat_context_stats[context];
+  if (klib_memstat_total.live > c->peak) c->peak = klib_memstat_total.live;
+  c->live = klib_memstat_total.live;
+  }
+
+/*===========================================================================
+klib_memstat_reset_one
+============================================================================*/
+static void klib_memstat_reset_one (klib_MemStat *stat, long long live)
+  {
+  stat->allocs = 0;
+  stat->frees = 0;
+  stat->bytes = 0;
+  stat->live = live;
+  stat->peak = live;
+  }
+
+/*===========================================================================
+klib_memstat_reset
+============================================================================*/
+void klib_memstat_reset (void)
+  {
+  int i;
+  for (i = 0; i < klib_memstat_ntags; i++)
+    klib_memstat_reset_one (&klib_memstat_tag_stats[i],
+      klib_memstat_tag_stats[i].live);
+  for (i = 0; i < KLIB_MEMSTAT_CONTEXTS_MAX; i++)
+    klib_memstat_reset_one (&klib_memstat_context_stats[i],
+      klib_memstat_total.live);
+  klib_memstat_reset_one (&klib_memstat_total, klib_memstat_total.live);
+  }
+
+/*===========================================================================
+klib_memstat_tag_count
+============================================================================*/
+int klib_memstat_tag_count (void)
+  {
+  return klib_memstat_ntags;
+  }
+
+/*===========================================================================
+klib_memstat_tag_name
+============================================================================*/
+const char *klib_memstat_tag_name (int tag)
+  {
+  if (tag < 0 || tag >= klib_memstat_ntags) return NULL;
+  return klib_memstat_tags[tag];
+  }
+
+/*===========================================================================
+klib_memstat_get_tag
+============================================================================*/
+const klib_MemStat *klib_memstat_get_tag (int tag)
+  {
+  if (tag < 0 || tag >= klib_memstat_ntags) return NULL;
+  return &klib_memstat_tag_stats[tag];
+  }
+
+/*===========================================================================
+klib_memstat_get_context
+============================================================================*/
+const klib_MemStat *klib_memstat_get_context (int context)
+  {
+  if (context < 0 || context >= KLIB_MEMSTAT_CONTEXTS_MAX) return NULL;
+  return &klib_memstat_context_stats[context];
+  }
+
+/*===========================================================================
+klib_memstat_get_total
+============================================================================*/
+const klib_MemStat *klib_memstat_get_total (void)
+  {
+  return &klib_memstat_total;
+  }
+
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+#include "klib_defs.h"
+
+/* Optional allocation accounting. When klib is built with
+KLIB_MEMSTATS defined, allocations made through the klib_malloc() family
+of macros are counted against a tag -- the class name of the klib object
+that owns the memory, or "sxmlc" for the XML parser. The application can
+also set an integer 'context' (for example, a processing stage), and
+allocations and peak live bytes are accumulated for that as well.
+Without KLIB_MEMSTATS the macros map straight onto the C library, and
+klib_memstat_available() returns FALSE. Sizes are taken from
+malloc_usable_size(), so no header is added to any block, and memory
+allocated in one place and freed in another remains safe. */
+
+#define KLIB_MEMSTAT_TAGS_MAX 32
+#define KLIB_MEMSTAT_CONTEXTS_MAX 16
+
+typedef struct _klib_MemStat
+  {
+  long long allocs;
+  long long frees;
+  long long bytes;
+  long long live;
+  long long peak;
+  } klib_MemStat;
+
+KLIB_BEGIN_DECLS
+
+#ifdef KLIB_MEMSTATS
+
+void *klib_memstat_malloc (size_t size, const char *tag);
+void *klib_memstat_calloc (size_t count, size_t size, const char *tag);
+void *klib_memstat_realloc (void *p, size_t size, const char *tag);
+void klib_memstat_free (void *p, const char *tag);
+char *klib_memstat_strdup (const char *s, const char *tag);
+
+#define klib_malloc(size, tag) klib_memstat_malloc ((size), (tag))
+#define klib_calloc(count, size, tag) \
+  klib_memstat_calloc ((count), (size), (tag))
+#define klib_realloc(p, size, tag) klib_memstat_realloc ((p), (size), (tag))
+#define klib_free(p, tag) klib_memstat_free ((p), (tag))
+#define klib_strdup(s, tag) klib_memstat_strdup ((s), (tag))
+
+#else
+
+// The tag is still evaluated, so that variables used only as tags
+//  don't produce warnings
+#define klib_malloc(size, tag) ((void)(tag), malloc (size))
+#define klib_calloc(count, size, tag) ((void)(tag), calloc ((count), (size)))
+#define klib_realloc(p, size, tag) ((void)(tag), realloc ((p), (size)))
+#define klib_free(p, tag) ((void)(tag), free (p))
+#define klib_strdup(s, tag) ((void)(tag), strdup (s))
+
+#endif
+
+/** Returns TRUE if klib was built with KLIB_MEMSTATS */
+BOOL klib_memstat_available (void);
+
+/** Sets the context against which subsequent allocations are counted,
+in the range 0 to KLIB_MEMSTAT_CONTEXTS_MAX - 1 */
+void klib_memstat_set_context (int context);
+
+/** Zeroes the allocation and byte counts for all tags and contexts, and
+sets all peaks to the current live value. Live counts are not changed */
+void klib_memstat_reset (void);
+
+/** Number of distinct tags seen so far */
+int klib_memstat_tag_count (void);
+
+const char *klib_memstat_tag_name (int tag);
+
+const klib_MemStat *klib_memstat_get_tag (int tag);
+
+const klib_MemStat *klib_memstat_get_context (int context);
+
+/** Counts for all tracked allocations together */
+const klib_MemStat *klib_memstat_get_total (void);
+
+KLIB_END_DECLS
+
@@ -11,13 +11,50 @@ klib_object.c
 #include <stdlib.h>
 #include <stdio.h>
 #include <wchar.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "klib_defs.h"
 #include "klib_log.h"
 #include "klib_object.h"
+#include "klib_memstat.h"
 #include "klib_string.h"
 
+/*===========================================================================
+private data
+============================================================================*/
+#define KLIB_CENSUS_CLASSES_MAX 32
+
+typedef struct _klib_CensusEntry
+  {
+  char class_name[CLASS_NAME_MAX];
+  long live;
+  long created;
+  } klib_CensusEntry;
+
+static BOOL klib_census_enabled = FALSE;
+static klib_CensusEntry klib_census[KLIB_CENSUS_CLASSES_MAX];
+static int klib_census_classes = 0;
+static volatile sig_atomic_t klib_census_dump_requested = 0;
+
+/*===========================================================================
+klib_census_find
+============================================================================*/
+static klib_CensusEntry *klib_census_find (const char *class_name)
+  {
+  int i;
+  for (i = 0; i < klib_census_classes; i++)
+    {
+    if (strcmp (klib_census[i].class_name, class_name) == 0)
+      return &klib_census[i];
+    }
+  if (klib_census_classes == KLIB_CENSUS_CLASSES_MAX) 
+    return NULL;
+  strncpy (klib_census[i].class_name, class_name, CLASS_NAME_MAX - 1);
+  klib_census_classes++;
+  return &klib_census[i];
+  }
+
 /*===========================================================================
 klib_object_to_string
 ============================================================================*/
@@ -53,7 +90,15 @@ klib_object_dispose
 void klib_object_dispose (klib_Object *self)
   {
   KLIB_IN
-  if (self) free (self);
+  if (self) 
+    {
+    if (self->census_counted)
+      {
+      klib_CensusEntry *e = klib_census_find (self->class_name);
+      if (e) e->live--;
+      }
+    klib_free (self, self->class_name);
+    }
   KLIB_OUT
   }
 
@@ -80,11 +125,21 @@ klib_object_new
 ============================================================================*/
 klib_Object *klib_object_new (const klib_Spec *spec)
   {
-  klib_Object *self = malloc (spec->obj_size);
+  klib_Object *self = klib_malloc (spec->obj_size, spec->class_name);
   memset (self, 0, spec->obj_size); 
   strncpy (self->class_name, spec->class_name, CLASS_NAME_MAX - 2);
   spec->init_fn (self); 
   self->ref_count++;
+  if (klib_census_enabled)
+    {
+    klib_CensusEntry *e = klib_census_find (self->class_name);
+    if (e)
+      {
+      e->live++;
+      e->created++;
+      self->census_counted = TRUE;
+      }
+    }
   return self;
   }
 
@@ -105,9 +160,69 @@ klib_object_get_ref_count
 int klib_object_get_ref_count (const klib_Object *self)
   {
   KLIB_IN
-  return self->ref_count;
   KLIB_OUT
+  return self->ref_count;
   }
 
+/*===========================================================================
+klib_object_census_enable
+============================================================================*/
+void klib_object_census_enable (BOOL enable)
+  {
+  klib_census_enabled = enable;
+  }
 
+/*===========================================================================
+klib_object_census_enabled
+============================================================================*/
+BOOL klib_object_census_enabled (void)
+  {
+  return klib_census_enabled;
+  }
+
+/*===========================================================================
+klib_object_census_live
+============================================================================*/
+long klib_object_census_live (void)
+  {
+  long ret = 0;
+  int i;
+  for (i = 0; i < klib_census_classes; i++)
+    ret += klib_census[i].live;
+  return ret;
+  }
+
+/*===========================================================================
+klib_object_census_dump
+============================================================================*/
+void klib_object_census_dump (FILE *f)
+  {
+  int i;
+  fprintf (f, "klib object census\n");
+  fprintf (f, "  %-30s %12s %12s\n", "class", "live", "created");
+  for (i = 0; i < klib_census_classes; i++)
+    fprintf (f, "  %-30s %12ld %12ld\n", klib_census[i].class_name,
+      klib_census[i].live, klib_census[i].created);
+  fprintf (f, "  %-30s %12ld\n", "total", klib_object_census_live ());
+  fflush (f);
+  }
+
+/*===========================================================================
+klib_object_census_request_dump
+============================================================================*/
+void klib_object_census_request_dump (void)
+  {
+  klib_census_dump_requested = 1;
+  }
+
+/*===========================================================================
+klib_object_census_poll
+============================================================================*/
+BOOL klib_object_census_poll (FILE *f)
+  {
+  if (!klib_census_dump_requested) return FALSE;
+  klib_census_dump_requested = 0;
+  klib_object_census_dump (f);
+  return TRUE;
+  }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdio.h>
 #include "klib_defs.h"
 
 struct _klib_String;
@@ -27,6 +28,8 @@ typedef struct _klib_Object
   int ref_count;
   klib_object_dispose_fn dispose;
   klib_object_tostring_fn to_string;
+  // Set if this object was counted by the census when it was created
+  BOOL census_counted;
   } klib_Object;
 
 
@@ -46,6 +49,29 @@ void klib_object_add_ref (klib_Object *self);
 
 int klib_object_get_ref_count (const klib_Object *self);
 
+/** Starts or stops counting live objects by class. The census costs a
+little time for each object created and disposed, so it is off by
+default. Objects created while it is off are not counted when they 
+are disposed */
+void klib_object_census_enable (BOOL enable);
+
+BOOL klib_object_census_enabled (void);
+
+/** Writes the number of live objects of each class, and the number
+created since the census was enabled */
+void klib_object_census_dump (FILE *f);
+
+/** Total number of live objects counted by the census */
+long klib_object_census_live (void);
+
+/** Asks for a dump at the next call to klib_object_census_poll(). This
+function is safe to call from a signal handler */
+void klib_object_census_request_dump (void);
+
+/** Writes a census dump if one has been requested. Returns TRUE if 
+a dump was written */
+BOOL klib_object_census_poll (FILE *f);
+
 KLIB_END_DECLS
 
 
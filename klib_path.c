@@ -17,6 +17,7 @@ klib_path.c
 #include <sys/stat.h>
 #include "klib_defs.h"
 #include "klib_log.h"
+#include "klib_memstat.h"
 #include "klib_string.h"
 #include "klib_path.h"
 #include "klib_error.h"
@@ -49,7 +50,8 @@ void klib_path_init (klib_Object *_self)
   klib_string_init (_self);
   _self->dispose = klib_path_dispose;
   klib_Path *self = (klib_Path *)_self;
-  self->priv = (klib_Path_priv *) malloc (sizeof (klib_Path_priv));
+  self->priv = (klib_Path_priv *)klib_malloc 
+    (sizeof (klib_Path_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_Path_priv));
   KLIB_OUT
   } 
@@ -196,7 +198,7 @@ void klib_path_dispose (klib_Object *_self)
     self->disposing = TRUE;
     if (self->priv) 
       {
-      free (self->priv);
+      klib_free (self->priv, _self->class_name);
       }
     }
   klib_string_dispose ((klib_Object *)self);
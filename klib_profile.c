@@ -0,0 +1,388 @@
+/*===========================================================================
+klib
+klib_profile.c
+(c)2000-2016 Kevin Boone
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "klib_defs.h"
+#include "klib_profile.h"
+
+#ifdef KLIB_PROFILE
+
+/*===========================================================================
+private data
+============================================================================*/
+#define KLIB_PROFILE_EVENTS 65536
+#define KLIB_PROFILE_DEPTH 256
+// Size of each thread's function table; must be a power of two
+#define KLIB_PROFILE_FUNCTIONS 1024
+
+typedef struct _klib_ProfileEvent
+  {
+  const char *function;
+  long long time;
+  BOOL leave;
+  } klib_ProfileEvent;
+
+typedef struct _klib_ProfileFunction
+  {
+  const char *name;
+  long long calls;
+  long long inclusive;
+  long long exclusive;
+  int active;
+  } klib_ProfileFunction;
+
+typedef struct _klib_ProfileFrame
+  {
+  klib_ProfileFunction *function;
+  long long start;
+  long long children;
+  } klib_ProfileFrame;
+
+typedef struct _klib_ProfileThread
+  {
+  int id;
+  int nevents;
+  klib_ProfileEvent events[KLIB_PROFILE_EVENTS];
+  int depth;
+  klib_ProfileFrame stack[KLIB_PROFILE_DEPTH];
+  int nfunctions;
+  klib_ProfileFunction functions[KLIB_PROFILE_FUNCTIONS];
+  struct _klib_ProfileThread *next;
+  } klib_ProfileThread;
+
+static __thread klib_ProfileThread *klib_profile_self = NULL;
+static klib_ProfileThread *klib_profile_threads = NULL;
+static int klib_profile_nthreads = 0;
+static volatile int klib_profile_lock = 0;
+static BOOL klib_profile_initialized = FALSE;
+static volatile BOOL klib_profile_done = FALSE;
+static BOOL klib_profile_trace = FALSE;
+static FILE *klib_profile_file = NULL;
+static long long klib_profile_t0 = 0;
+
+/*===========================================================================
+klib_profile_now
+============================================================================*/
+static inline long long klib_profile_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+/*===========================================================================
+klib_profile_open_trace
+============================================================================*/
+static void klib_profile_open_trace (void)
+  {
+  const char *name = getenv ("KLIB_PROFILE_FILE");
+  char default_name[64];
+  if (!name || !name[0])
+    {
+    snprintf (default_name, sizeof (default_name), "klib_profile.%d.json",
+      (int)getpid());
+    name = default_name;
+    }
+  klib_profile_file = fopen (name, "w");
+  if (!klib_profile_file)
+    {
+    fprintf (stderr, "klib_profile: can't write %s: %s\n", name,
+      strerror (errno));
+    return;
+    }
+  fprintf (klib_profile_file, "{\"traceEvents\":[\n");
+  }
+
+/*===========================================================================
+klib_profile_init
+Called with the lock held, the first time any thread records an event
+============================================================================*/
+static void klib_profile_init (void)
+  {
+  const char *mode = getenv ("KLIB_PROFILE");
+  klib_profile_trace = (mode && strcmp (mode, "trace") == 0);
+  klib_profile_t0 = klib_profile_now ();
+  if (klib_profile_trace)
+    klib_profile_open_trace ();
+  atexit (klib_profile_dump);
+  klib_profile_initialized = TRUE;
+  }
+
+/*===========================================================================
+klib_profile_register
+============================================================================*/
+static klib_ProfileThread *klib_profile_register (void)
+  {
+  klib_ProfileThread *self = calloc (1, sizeof (klib_ProfileThread));
+  if (!self) return NULL;
+  while (__sync_lock_test_and_set (&klib_profile_lock, 1))
+    ;
+  if (!klib_profile_initialized)
+    klib_profile_init ();
+  self->id = ++klib_profile_nthreads;
+  self->next = klib_profile_threads;
+  klib_profile_threads = self;
+  __sync_lock_release (&klib_profile_lock);
+  return self;
+  }
+
+/*===========================================================================
+klib_profile_find
+Functions are keyed on the address of their name, so the table probe is
+cheap; if the table is full, the event is dropped
+============================================================================*/
+static klib_ProfileFunction *klib_profile_find (klib_ProfileThread *self,
+    const char *name)
+  {
+  unsigned int h = (unsigned int)(((uintptr_t)name) >> 3)
+    & (KLIB_PROFILE_FUNCTIONS - 1);
+  int i;
+  for (i = 0; i < KLIB_PROFILE_FUNCTIONS; i++)
+    {
+    klib_ProfileFunction *f = &self->functions[h];
+    if (f->name == name) return f;
+    if (f->name == NULL)
+      {
+      if (self->nfunctions == KLIB_PROFILE_FUNCTIONS - 1) return NULL;
+      f->name = name;
+      self->nfunctions++;
+      return f;
+      }
+    h = (h + 1) & (KLIB_PROFILE_FUNCTIONS - 1);
+    }
+  return NULL;
+  }
+
+/*===========================================================================
+klib_profile_close
+Pop the top frame at the specified time
+============================================================================*/
+static void klib_profile_close (klib_ProfileThread *self, long long time)
+  {
+  klib_ProfileFrame *frame = &self->stack[--self->depth];
+  klib_ProfileFunction *f = frame->function;
+  long long inclusive = time - frame->start;
+  f->calls++;
+  f->exclusive += inclusive - frame->children;
+  // Only the outermost of a set of recursive calls counts towards
+  //  the inclusive time
+  if (--f->active == 0)
+    f->inclusive += inclusive;
+  if (self->depth > 0)
+    self->stack[self->depth - 1].children += inclusive;
+  if (klib_profile_trace && klib_profile_file)
+    fprintf (klib_profile_file,
+      "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+      "\"pid\":%d,\"tid\":%d},\n", f->name,
+      (frame->start - klib_profile_t0) / 1000.0, inclusive / 1000.0,
+      (int)getpid(), self->id);
+  }
+
+/*===========================================================================
+klib_profile_process
+Fold the buffered events into the call stack and function totals
+============================================================================*/
+static void klib_profile_process (klib_ProfileThread *self)
+  {
+  int i;
+  for (i = 0; i < self->nevents; i++)
+    {
+    klib_ProfileEvent *e = &self->events[i];
+    klib_ProfileFunction *f = klib_profile_find (self, e->function);
+    if (!f) continue;
+    if (!e->leave)
+      {
+      if (self->depth == KLIB_PROFILE_DEPTH) continue;
+      klib_ProfileFrame *frame = &self->stack[self->depth++];
+      frame->function = f;
+      frame->start = e->time;
+      frame->children = 0;
+      f->active++;
+      }
+    else
+      {
+      // Match the innermost open call of this function. Anything
+      //  opened above it returned without a KLIB_OUT. A KLIB_OUT with no
+      //  open call at all is ignored
+      int d = self->depth - 1;
+      while (d >= 0 && self->stack[d].function != f)
+        d--;
+      while (d >= 0 && self->depth > d)
+        klib_profile_close (self, e->time);
+      }
+    }
+  self->nevents = 0;
+  }
+
+/*===========================================================================
+klib_profile_record
+============================================================================*/
+static inline void klib_profile_record (const char *function, BOOL leave)
+  {
+  if (klib_profile_done) return;
+  klib_ProfileThread *self = klib_profile_self;
+  if (!self)
+    {
+    self = klib_profile_register ();
+    if (!self) return;
+    klib_profile_self = self;
+    }
+  if (self->nevents == KLIB_PROFILE_EVENTS)
+    klib_profile_process (self);
+  klib_ProfileEvent *e = &self->events[self->nevents++];
+  e->function = function;
+  e->leave = leave;
+  e->time = klib_profile_now ();
+  }
+
+/*===========================================================================
+klib_profile_enter
+============================================================================*/
+void klib_profile_enter (const char *function)
+  {
+  klib_profile_record (function, FALSE);
+  }
+
+/*===========================================================================
+klib_profile_leave
+============================================================================*/
+void klib_profile_leave (const char *function)
+  {
+  klib_profile_record (function, TRUE);
+  }
+
+/*===========================================================================
+klib_profile_compare
+Sort by exclusive time, largest first
+============================================================================*/
+static int klib_profile_compare (const void *a, const void *b)
+  {
+  const klib_ProfileFunction *fa = a;
+  const klib_ProfileFunction *fb = b;
+  if (fa->exclusive > fb->exclusive) return -1;
+  if (fa->exclusive < fb->exclusive) return 1;
+  return strcmp (fa->name, fb->name);
+  }
+
+/*===========================================================================
+klib_profile_write_table
+Totals for all threads are merged by function name
+============================================================================*/
+static void klib_profile_write_table (void)
+  {
+  int max = 0, n = 0, i, j;
+  klib_ProfileThread *t;
+  for (t = klib_profile_threads; t; t = t->next)
+    max += t->nfunctions;
+  klib_ProfileFunction *all = calloc (max + 1,
+    sizeof (klib_ProfileFunction));
+  if (!all) return;
+  for (t = klib_profile_threads; t; t = t->next)
+    {
+    for (i = 0; i < KLIB_PROFILE_FUNCTIONS; i++)
+      {
+      klib_ProfileFunction *f = &t->functions[i];
+      if (!f->name || f->calls == 0) continue;
+      for (j = 0; j < n && strcmp (all[j].name, f->name) != 0; j++)
+        ;
+      if (j == n) all[n++].name = f->name;
+      all[j].calls += f->calls;
+      all[j].inclusive += f->inclusive;
+      all[j].exclusive += f->exclusive;
+      }
+    }
+  qsort (all, n, sizeof (klib_ProfileFunction), klib_profile_compare);
+
+  long long total = 0;
+  for (i = 0; i < n; i++)
+    total += all[i].exclusive;
+
+  FILE *f = stderr;
+  const char *name = getenv ("KLIB_PROFILE_FILE");
+  if (name && name[0])
+    {
+    f = fopen (name, "w");
+    if (!f)
+      {
+      fprintf (stderr, "klib_profile: can't write %s: %s\n", name,
+        strerror (errno));
+      free (all);
+      return;
+      }
+    }
+  fprintf (f, "klib profile (%d thread%s)\n", klib_profile_nthreads,
+    klib_profile_nthreads == 1 ? "" : "s");
+  fprintf (f, "  %-36s %10s %12s %12s %6s\n", "function", "calls",
+    "incl ms", "excl ms", "excl%");
+  for (i = 0; i < n; i++)
+    {
+    fprintf (f, "  %-36s %10lld %12.3f %12.3f %6.1f\n", all[i].name,
+      all[i].calls, all[i].inclusive / 1e6, all[i].exclusive / 1e6,
+      total > 0 ? 100.0 * all[i].exclusive / total : 0.0);
+    }
+  fprintf (f, "  %-36s %10s %12s %12.3f\n", "total", "", "", total / 1e6);
+  if (f != stderr) fclose (f);
+  free (all);
+  }
+
+/*===========================================================================
+klib_profile_dump
+============================================================================*/
+void klib_profile_dump (void)
+  {
+  if (klib_profile_done || !klib_profile_initialized) return;
+  klib_profile_done = TRUE;
+  long long now = klib_profile_now ();
+  klib_ProfileThread *t;
+  for (t = klib_profile_threads; t; t = t->next)
+    {
+    klib_profile_process (t);
+    while (t->depth > 0)
+      klib_profile_close (t, now);
+    }
+  if (klib_profile_trace)
+    {
+    if (klib_profile_file)
+      {
+      fprintf (klib_profile_file,
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"%s\"}}\n]}\n", (int)getpid(),
+        program_invocation_short_name);
+      fclose (klib_profile_file);
+      klib_profile_file = NULL;
+      }
+    }
+  else
+    klib_profile_write_table ();
+  }
+
+#else
+
+/*===========================================================================
+Without KLIB_PROFILE, KLIB_IN and KLIB_OUT do not call these functions,
+but they are kept so that the profile can still be dumped explicitly
+============================================================================*/
+void klib_profile_enter (const char *function)
+  {
+  }
+
+void klib_profile_leave (const char *function)
+  {
+  }
+
+void klib_profile_dump (void)
+  {
+  }
+
+#endif
+
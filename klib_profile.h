@@ -0,0 +1,42 @@
+#pragma once
+
+#include "klib_defs.h"
+
+/* Optional function profiler. When klib is built with KLIB_PROFILE
+defined, the KLIB_IN and KLIB_OUT macros that bracket most functions
+record a timestamp into a per-thread event buffer, rather than writing
+a trace log message. When a buffer fills, its events are folded into
+per-function totals (or written out as trace events), so the cost of
+recording is just a clock read and a store.
+
+When the program exits, the profile is written according to the
+environment variable KLIB_PROFILE:
+
+  table (or unset) -- calls, inclusive and exclusive time per function
+  trace            -- Chrome trace-event JSON, for chrome://tracing or
+                      any compatible flame-graph viewer
+
+KLIB_PROFILE_FILE names the output file. The default is stderr for
+the table, and klib_profile.PID.json for a trace.
+
+Not every function has a KLIB_OUT on every return path, so a KLIB_OUT
+is matched against the innermost open call of the same function, and
+any calls opened above it are closed at the same time. A function that
+returns without KLIB_OUT is therefore charged until its caller returns.
+Recursive calls are counted in inclusive time only once. */
+
+KLIB_BEGIN_DECLS
+
+/** Record entry to the named function. The name must be a string
+constant, like __func__, because only the pointer is stored */
+void klib_profile_enter (const char *function);
+
+/** Record exit from the named function */
+void klib_profile_leave (const char *function);
+
+/** Write the profile now, rather than at exit. Events recorded after
+this call are not included in any later dump */
+void klib_profile_dump (void);
+
+KLIB_END_DECLS
+
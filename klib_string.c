@@ -15,6 +15,7 @@ klib_string.c
 #include <sys/stat.h>
 #include "klib_defs.h"
 #include "klib_log.h"
+#include "klib_memstat.h"
 #include "klib_string.h"
 #include "klib_error.h"
 #include "klib_buffer.h"
@@ -34,9 +35,13 @@ static klib_Spec klib_spec_string =
   .class_name = "klib_String"
   };
 
+// The length is kept, and the buffer grows geometrically, so that
+//  building a string by repeated appends is linear rather than quadratic
 typedef struct _klib_String_priv
   {
   char *str;
+  int length;
+  int capacity;
   } klib_String_priv;
 
 
@@ -49,7 +54,8 @@ void klib_string_init (klib_Object *_self)
   klib_object_init (_self);
   _self->dispose = klib_string_dispose;
   klib_String *self = (klib_String*)_self;
-  self->priv = (klib_String_priv *)malloc (sizeof (klib_String_priv));
+  self->priv = (klib_String_priv *)klib_malloc 
+    (sizeof (klib_String_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_String_priv));
   KLIB_OUT
   } 
@@ -93,12 +99,21 @@ klib_string_set
 void klib_string_set (klib_String *self, const char *s)
   {
   KLIB_IN
+  const char *tag = self->base.class_name;
   if (self->priv->str)
-    free (self->priv->str);
+    klib_free (self->priv->str, tag);
   if (s == NULL) 
+    {
     self->priv->str = NULL;
+    self->priv->length = 0;
+    self->priv->capacity = 0;
+    }
   else
-    self->priv->str = strdup (s);
+    {
+    self->priv->str = klib_strdup (s, tag);
+    self->priv->length = strlen (s);
+    self->priv->capacity = self->priv->length + 1;
+    }
   KLIB_OUT
   }
 
@@ -161,15 +176,19 @@ void klib_string_dispose (klib_Object *_self)
   {
   KLIB_IN
   klib_String *self = (klib_String *)_self;
-  if (!self) return;
+  if (!self)
+    {
+    KLIB_OUT
+    return;
+    }
   if (!self->disposing)
     {
     self->disposing = TRUE;
     if (self->priv) 
       {
       if (self->priv->str)
-        free (self->priv->str);
-      free (self->priv);
+        klib_free (self->priv->str, _self->class_name);
+      klib_free (self->priv, _self->class_name);
       }
     }
   klib_object_dispose ((klib_Object *)self);
@@ -293,15 +312,8 @@ int klib_string_length (const klib_String *self)
   {
   KLIB_IN
   int ret = 0;
-  if (self)
-    {
-    if (self->priv->str)
-      return strlen (self->priv->str);
-    else
-      return 0;
-    }
-  else
-    ret = 0;
+  if (self && self->priv->str)
+    ret = self->priv->length;
 
   KLIB_OUT
   return ret;
@@ -320,8 +332,8 @@ klib_String *klib_string_new_split_before (const char *s,
     ret = klib_string_new_substring (s, 0, p - s);
   else
     ret = klib_string_new (s);
-  return ret;
   KLIB_OUT
+  return ret;
   }
 
 /*===========================================================================
@@ -398,17 +410,30 @@ BOOL klib_string_append (klib_String *self, const char *s)
   {
   KLIB_IN
   BOOL ret = FALSE;
-  char *buff = malloc (strlen (self->priv->str) + strlen (s) + 1);
-  if (buff)
+  const char *tag = self->base.class_name;
+  klib_String_priv *priv = self->priv;
+  int len = strlen (s);
+  int needed = priv->length + len + 1;
+  if (needed > priv->capacity)
     {
-    strcpy (buff, self->priv->str);
-    strcat (buff, s);
-    klib_string_set (self, buff);
-    free (buff);
+    int capacity = priv->capacity * 2;
+    if (capacity < needed) capacity = needed;
+    if (capacity < 16) capacity = 16;
+    char *buff = klib_realloc (priv->str, capacity, tag);
+    if (buff)
+      {
+      // A null string is treated as empty
+      if (!priv->str) buff[0] = 0;
+      priv->str = buff;
+      priv->capacity = capacity;
+      }
+    }
+  if (needed <= priv->capacity)
+    {
+    memcpy (priv->str + priv->length, s, len + 1);
+    priv->length += len;
     ret = TRUE;
     }
-  else
-    ret = FALSE;
   KLIB_OUT
   return ret;
   }
@@ -428,8 +453,8 @@ klib_String *klib_string_new_split_after (const char *s,
       strlen (p) - strlen (pattern));
   else
     ret = klib_string_new_empty();
-  return ret;
   KLIB_OUT
+  return ret;
   }
 
 /*===========================================================================
@@ -651,13 +676,14 @@ klib_String *klib_string_new_from_buffer (const klib_Buffer *s,
   klib_String *self = klib_string_new_null();
 
   int len = klib_buffer_get_length (s);
-  self->priv->str = malloc (len + 1);
+  self->priv->str = klib_malloc (len + 1, self->base.class_name);
   memcpy (self->priv->str, klib_buffer_get_data (s), len);
   self->priv->str[len] = 0;
-
-  return self;
+  self->priv->length = strlen (self->priv->str);
+  self->priv->capacity = len + 1;
 
   KLIB_OUT
+  return self;
   }
 
 /*===========================================================================
@@ -17,6 +17,7 @@ klib_wstring.c
 #include <sys/stat.h>
 #include "klib_defs.h"
 #include "klib_log.h"
+#include "klib_memstat.h"
 #include "klib_wstring.h"
 #include "klib_error.h"
 #include "klib_wstring.h"
@@ -36,9 +37,13 @@ static klib_Spec klib_spec_wstring =
   .class_name = "klib_WString"
   };
 
+// As klib_String, the length is kept and the buffer grows 
+//  geometrically, so that repeated appends are linear
 typedef struct _klib_WString_priv
   {
   wchar_t *str;
+  int length;
+  int capacity;
   } klib_WString_priv;
 
 
@@ -73,10 +78,14 @@ klib_wstring_set
 void klib_wstring_set (klib_WString *self, const wchar_t *s)
   {
   KLIB_IN
-  if (self->priv->str) free (self->priv->str);
-  self->priv->str = malloc ((wcslen (s) + 1) * sizeof (wchar_t)); 
+  const char *tag = self->base.class_name;
+  int len = wcslen (s);
+  if (self->priv->str) klib_free (self->priv->str, tag);
+  self->priv->str = klib_malloc ((len + 1) * sizeof (wchar_t), tag); 
   // Include terminating null in copy
-  memcpy (self->priv->str, s, (wcslen(s) + 1) * sizeof (wchar_t));
+  memcpy (self->priv->str, s, (len + 1) * sizeof (wchar_t));
+  self->priv->length = len;
+  self->priv->capacity = len + 1;
   KLIB_OUT
   }
 
@@ -114,7 +123,7 @@ klib_WString *klib_wstring_read_stream (FILE *stream,
   struct stat sb;
   if (fstat (fileno (stream), &sb) == 0)
     {
-    char *buff = (char *)malloc (sb.st_size + 1);
+    char *buff = (char *)klib_malloc (sb.st_size + 1, "klib_WString");
     read (fileno (stream), buff, sb.st_size);
     buff[sb.st_size - 1] = 0;
     ret = klib_wstring_new_null ();
@@ -124,7 +133,8 @@ klib_WString *klib_wstring_read_stream (FILE *stream,
       klib_wstring_set (ret, (wchar_t*)buff);
     else
       {
-      wchar_t *buff2 = malloc ((sb.st_size + 1) * sizeof (wchar_t));
+      wchar_t *buff2 = klib_malloc ((sb.st_size + 1) * sizeof (wchar_t), 
+        "klib_WString");
       wchar_t *targetStart = buff2;
       memset (buff2, 0, (sb.st_size + 1) * sizeof (wchar_t));
       int utf16lenchars = (sb.st_size + 1);
@@ -136,9 +146,9 @@ klib_WString *klib_wstring_read_stream (FILE *stream,
         ConvertUTF8toUTF16 (&_buff, (UTF8*) buff + sb.st_size, 
          (UTF16 **) &targetStart, (UTF16 *) targetStart + utf16lenchars, 0);
       klib_wstring_set (ret, (wchar_t*)buff2);
-      free (buff2);
+      klib_free (buff2, "klib_WString");
       }
-    free (buff);
+    klib_free (buff, "klib_WString");
     }
   KLIB_OUT
   return ret; 
@@ -154,7 +164,8 @@ void klib_wstring_init (klib_Object *_self)
   klib_object_init (_self);
   _self->dispose = klib_wstring_dispose;
   klib_WString *self = (klib_WString *)_self;
-  self->priv = (klib_WString_priv *)malloc (sizeof (klib_WString_priv));
+  self->priv = (klib_WString_priv *)klib_malloc 
+    (sizeof (klib_WString_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_WString_priv));
   KLIB_OUT
   }
@@ -187,8 +198,8 @@ void klib_wstring_dispose (klib_Object *_self)
     if (self->priv) 
       {
       if (self->priv->str)
-         free (self->priv->str);
-      free (self->priv);
+         klib_free (self->priv->str, _self->class_name);
+      klib_free (self->priv, _self->class_name);
       }
     }
   klib_object_dispose (_self);
@@ -217,7 +228,7 @@ int klib_wstring_length (const klib_WString *self)
     if (self->priv) 
       {
       if (self->priv->str)
-         ret = wcslen (self->priv->str);
+         ret = self->priv->length;
       }
     }
   KLIB_OUT
@@ -353,6 +364,7 @@ klib_WString *klib_wstring_new_from_buffer (const klib_Buffer *s,
   klib_wstring_set (self, buff2);
   free (buff2);
 
+  KLIB_OUT
   return self;
 
   }
@@ -480,8 +492,8 @@ klib_WString *klib_wstring_new_split_before (const wchar_t *s,
     ret = klib_wstring_new_substring (s, 0, p - s);
   else
     ret = klib_wstring_new (s);
-  return ret;
   KLIB_OUT
+  return ret;
   }
 
 /*===========================================================================
@@ -498,8 +510,8 @@ klib_WString *klib_wstring_new_split_after (const wchar_t *s,
       wcslen (p) - wcslen (pattern));
   else
     ret = klib_wstring_new_empty();
-  return ret;
   KLIB_OUT
+  return ret;
   }
 
 /*===========================================================================
@@ -608,18 +620,31 @@ BOOL klib_wstring_append (klib_WString *self, const wchar_t *s)
   {
   KLIB_IN
   BOOL ret = FALSE;
-  wchar_t *buff = malloc 
-      ((wcslen (self->priv->str) + wcslen (s) + 1) * sizeof (wchar_t));
-  if (buff)
+  const char *tag = self->base.class_name;
+  klib_WString_priv *priv = self->priv;
+  int len = wcslen (s);
+  int needed = priv->length + len + 1;
+  if (needed > priv->capacity)
     {
-    wcscpy (buff, self->priv->str);
-    wcscat (buff, s);
-    klib_wstring_set (self, buff);
-    free (buff);
+    int capacity = priv->capacity * 2;
+    if (capacity < needed) capacity = needed;
+    if (capacity < 16) capacity = 16;
+    wchar_t *buff = klib_realloc (priv->str, capacity * sizeof (wchar_t), 
+      tag);
+    if (buff)
+      {
+      // A null string is treated as empty
+      if (!priv->str) buff[0] = 0;
+      priv->str = buff;
+      priv->capacity = capacity;
+      }
+    }
+  if (needed <= priv->capacity)
+    {
+    memcpy (priv->str + priv->length, s, (len + 1) * sizeof (wchar_t));
+    priv->length += len;
     ret = TRUE;
     }
-  else
-    ret = FALSE;
   KLIB_OUT
   return ret;
   }
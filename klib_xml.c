@@ -13,6 +13,7 @@ klib_xml.c
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "klib_log.h"
+#include "klib_memstat.h"
 #include "klib_xml.h"
 #include "klib_error.h"
 #include "klib_buffer.h"
@@ -47,7 +48,8 @@ void klib_xml_init (klib_Object *_self)
   klib_object_init (_self);
   _self->dispose = klib_xml_dispose;
   klib_Xml *self = (klib_Xml *)_self;
-  self->priv = (klib_Xml_priv *)malloc (sizeof (klib_Xml_priv));
+  self->priv = (klib_Xml_priv *)klib_malloc 
+    (sizeof (klib_Xml_priv), _self->class_name);
   memset (self->priv, 0, sizeof (klib_Xml_priv));
   XMLDoc_init (&self->priv->doc);
   KLIB_OUT
@@ -78,7 +80,7 @@ void klib_xml_dispose (klib_Object *_self)
     if (self->priv) 
       {
       XMLDoc_free (&self->priv->doc);
-      free (self->priv);
+      klib_free (self->priv, _self->class_name);
       }
     }
   klib_object_dispose (_self);
@@ -120,7 +122,10 @@ klib_Xml *klib_xml_read_file (const char *filename, struct _klib_Error **error)
         
       ret = (klib_Xml *)klib_object_new (&klib_spec_xml);
 
-      if (XMLDoc_parse_file_DOM (filename, &ret->priv->doc))
+      // A document with no root element is no use to any caller, and
+      //  XMLDoc_root() would index nodes[-1]
+      if (XMLDoc_parse_file_DOM (filename, &ret->priv->doc)
+          && ret->priv->doc.i_root >= 0)
         {
         }
       else
@@ -142,6 +147,34 @@ klib_Xml *klib_xml_read_file (const char *filename, struct _klib_Error **error)
   }
 
 
+/*===========================================================================
+klib_xml_read_stream
+============================================================================*/
+klib_Xml *klib_xml_read_stream (FILE *f, const char *name, 
+     struct _klib_Error **error)
+  {
+  KLIB_IN
+  klib_log_debug ("klib_xml_read_stream: Reading %s", name);
+  klib_Xml *ret = (klib_Xml *)klib_object_new (&klib_spec_xml);
+  // As for klib_xml_read_file, a document with no root element is an 
+  //  error
+  if (XMLDoc_parse_fp_DOM (f, name, &ret->priv->doc)
+      && ret->priv->doc.i_root >= 0)
+    {
+    }
+  else
+    {
+    *error = klib_error_new 
+      (KLIB_ERR_PARSE_XML, klib_error_strerror (KLIB_ERR_PARSE_XML), 
+        name);
+    klib_xml_free (ret);
+    ret = NULL;
+    }
+  KLIB_OUT
+  return ret;
+  }
+
+
 /*===========================================================================
 klib_xml_read_buffer
 // At present, we assume the buffer is full of utf-8 data
@@ -238,8 +271,8 @@ klib_String *klib_xml_unescape_string (const char *s)
     }
   else
     ret = klib_string_new_empty(); 
-  return ret; 
   KLIB_OUT
+  return ret;
   }
 
 
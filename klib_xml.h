@@ -2,6 +2,7 @@
 
 
 #include <stdarg.h>
+#include <stdio.h>
 #include "klib_defs.h"
 #include "klib_object.h"
 #include "sxmlc.h" 
@@ -28,6 +29,11 @@ void klib_xml_free (klib_Xml *self);
 /** Reads and parses a whole file */
 klib_Xml *klib_xml_read_file (const char *filename, struct _klib_Error **error);
 
+/** Reads and parses a whole file that is already open, from its start.
+The name is used for error messages. The file is not closed */
+klib_Xml *klib_xml_read_stream (FILE *f, const char *name, 
+     struct _klib_Error **error);
+
 /** Returns the root node of the current XML document, or null if the
 document is empty */
 XMLNode *klib_xml_get_root (klib_Xml *self);
@@ -9,12 +9,18 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
+#include <signal.h>
 #include "klib_log.h"
 #include "klib_path.h"
 #include "klib_list.h"
 #include "klib_getopt.h" 
 #include "klib_getoptspec.h" 
 #include "epub2txt.h" 
+#include "epub2txt_stats.h" 
+#include "epub2txt_jobs.h" 
+#include "epub2txt_cache.h" 
+#include "epub2txt_sync.h" 
 
 
 /*========================================================================
@@ -34,17 +40,48 @@ void show_long_usage (FILE *f, const char *argv0)
   {
   fprintf (f, "Usage: %s [options...] [expression]\n", argv0);
   fprintf (f, "  -a,--ascii                ASCII output\n");
+  fprintf (f, 
+   "  --cache {dir}             Keep converted books in {dir} for reuse\n");
+  fprintf (f, 
+   "  --cache-size {size}       Limit the cache to {size}; default 1G\n");
+  fprintf (f, 
+   "  --chapter {text}          Only chapters whose TOC label has {text}\n");
+  fprintf (f, 
+   "  --census                  Count live objects; dump on SIGUSR1 and exit\n");
+  fprintf (f, 
+   "  --count                   Count paragraphs, words and characters\n");
   fprintf (f, "  -d,--debug {level}        Set debug level (0-4)\n");
+  fprintf (f, 
+   "  -j,--jobs {count}         Convert up to {count} books at once\n");
   fprintf (f, "  --longhelp                Detailed usage\n");
+  fprintf (f, 
+   "  --max-memory {size}       Fail rather than use more than {size}\n");
   fprintf (f, "  -n,--notrim               Do not trim whitespace\n");
+  fprintf (f, 
+   "  -o,--output {dir}         Write each book's text to a file in {dir}\n");
   fprintf (f, 
    "  -p,--paras {count}        Write paragraph count every {count} paras\n");
+  fprintf (f, 
+   "  --preview {size}          Write only the first {size} bytes of text\n");
   fprintf (f, 
    "  -s,--start {para}         Start output from paragraph {para}\n");
+  fprintf (f, 
+   "  --spine {range}           Only spine items in {range}, e.g. 1,3-5\n");
+  fprintf (f, 
+   "  --sync {dir}              Update the --output mirror of EPUBs in {dir}\n");
+  fprintf (f, 
+   "  --stats                   Report timings and counts on stderr\n");
+  fprintf (f, 
+   "  --stats-json              As --stats, but in JSON format\n");
+  fprintf (f, 
+   "  --verify                  Check each extracted entry against its CRC\n");
   fprintf (f, "  -v,--version              Show version and configuration\n");
   fprintf (f, "  -w,--width {cols}         Format for cols columns\n");
   fprintf (f, "If no width is specified, lines will not be broken except\n");
   fprintf (f, "on paragraph boundaries\n");
+  fprintf (f, "A file named - is read from stdin, and a file may be a\n");
+  fprintf (f, "directory that an EPUB has been unpacked into; each EPUB\n");
+  fprintf (f, "in a .zip or .tar file is converted\n");
   }
 
 
@@ -58,6 +95,38 @@ void show_version (FILE *f, const char *argv0)
   }
 
 
+/*========================================================================
+  parse_size
+  Parses a size in bytes, with an optional suffix k, M or G. Returns -1
+  if it is not valid, or too big to hold
+=========================================================================*/
+static long long parse_size (const char *s)
+  {
+  char *end;
+  errno = 0;
+  long long n = strtoll (s, &end, 10);
+  if (end == s || n < 0 || errno == ERANGE) return -1;
+  long long multiplier = 1;
+  switch (*end)
+    {
+    case 'k': case 'K': multiplier = 1024LL; end++; break;
+    case 'm': case 'M': multiplier = 1024LL * 1024; end++; break;
+    case 'g': case 'G': multiplier = 1024LL * 1024 * 1024; end++; break;
+    }
+  if (*end != 0 || n > LLONG_MAX / multiplier) return -1;
+  return n * multiplier;
+  }
+
+
+/*=============================================================================
+  census_signal_handler 
+=============================================================================*/
+static void census_signal_handler (int sig)
+  {
+  klib_object_census_request_dump ();
+  }
+
+
 /*=============================================================================
   main()
 =============================================================================*/
@@ -75,6 +144,25 @@ int main (int argc, char **argv)
   klib_getopt_add_spec (getopt, "width", "width", 'w', KLIB_GETOPT_COMPARG);
   klib_getopt_add_spec (getopt, "debug", "debug", 'd', KLIB_GETOPT_COMPARG);
   klib_getopt_add_spec (getopt, "notrim", "notrim", 'n', KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "stats", "stats", 0, KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "census", "census", 0, KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "stats-json", "stats-json", 0, 
+    KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "max-memory", "max-memory", 0, 
+    KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "count", "count", 0, KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "spine", "spine", 0, KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "preview", "preview", 0, 
+    KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "chapter", "chapter", 0, 
+    KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "verify", "verify", 0, KLIB_GETOPT_NOARG);
+  klib_getopt_add_spec (getopt, "output", "output", 'o', KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "jobs", "jobs", 'j', KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "cache", "cache", 0, KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "cache-size", "cache-size", 0, 
+    KLIB_GETOPT_COMPARG);
+  klib_getopt_add_spec (getopt, "sync", "sync", 0, KLIB_GETOPT_COMPARG);
 
   klib_Error *error = NULL;
 
@@ -100,10 +188,101 @@ int main (int argc, char **argv)
       stopping_option = TRUE;
       }
 
+    const char *s_max_memory = klib_getopt_get_arg (getopt, "max-memory");
+    max_memory = 0;
+    if (s_max_memory && !stopping_option)
+      {
+      max_memory = parse_size (s_max_memory);
+      if (max_memory <= 0)
+        {
+        fprintf (stderr, "%s: invalid memory size: %s\n", argv0, 
+          s_max_memory);
+        stopping_option = TRUE;
+        }
+      }
+
+    spine_range = klib_getopt_get_arg (getopt, "spine");
+    if (spine_range && !stopping_option 
+        && !epub2txt_select_range (spine_range, 0, NULL))
+      {
+      fprintf (stderr, "%s: invalid spine range: %s\n", argv0, spine_range);
+      stopping_option = TRUE;
+      }
+    chapter_label = klib_getopt_get_arg (getopt, "chapter");
+    const char *s_preview = klib_getopt_get_arg (getopt, "preview");
+    preview_bytes = 0;
+    if (s_preview && !stopping_option)
+      {
+      preview_bytes = parse_size (s_preview);
+      if (preview_bytes <= 0)
+        {
+        fprintf (stderr, "%s: invalid preview size: %s\n", argv0, 
+          s_preview);
+        stopping_option = TRUE;
+        }
+      }
+
+    output_dir = klib_getopt_get_arg (getopt, "output");
+    const char *s_jobs = klib_getopt_get_arg (getopt, "jobs");
+    max_jobs = 1;
+    if (s_jobs && !stopping_option)
+      {
+      max_jobs = atoi (s_jobs);
+      if (max_jobs <= 0)
+        {
+        fprintf (stderr, "%s: invalid job count: %s\n", argv0, s_jobs);
+        stopping_option = TRUE;
+        }
+      else if (max_jobs > 1 && !output_dir)
+        {
+        fprintf (stderr, "%s: --jobs needs --output\n", argv0);
+        stopping_option = TRUE;
+        }
+      }
+
+    cache_dir = klib_getopt_get_arg (getopt, "cache");
+    const char *s_cache_size = klib_getopt_get_arg (getopt, "cache-size");
+    if (s_cache_size && !stopping_option)
+      {
+      cache_size = parse_size (s_cache_size);
+      if (cache_size <= 0)
+        {
+        fprintf (stderr, "%s: invalid cache size: %s\n", argv0, 
+          s_cache_size);
+        stopping_option = TRUE;
+        }
+      }
+
+    sync_source = klib_getopt_get_arg (getopt, "sync");
+    if (sync_source && !stopping_option)
+      {
+      if (!output_dir)
+        {
+        fprintf (stderr, "%s: --sync needs --output\n", argv0);
+        stopping_option = TRUE;
+        }
+      else if (klib_getopt_argc (getopt) > 0)
+        {
+        fprintf (stderr, "%s: --sync takes no files\n", argv0);
+        stopping_option = TRUE;
+        }
+      else
+        {
+        // The tree's name is the start of the name of each book in it,
+        //  so it is not to end with a slash
+        char *source = strdup (sync_source);
+        int len = strlen (source);
+        while (len > 1 && source[len - 1] == '/') source[--len] = 0;
+        sync_source = source;
+        }
+      }
+
     if (!stopping_option)
       {
       BOOL ascii = klib_getopt_arg_set (getopt, "ascii");
       BOOL notrim = klib_getopt_arg_set (getopt, "notrim");
+      count_mode = klib_getopt_arg_set (getopt, "count");
+      verify_mode = klib_getopt_arg_set (getopt, "verify");
       const char *s_width = klib_getopt_get_arg (getopt, "width");
       int width = 0;
       if (s_width)
@@ -116,6 +295,14 @@ int main (int argc, char **argv)
       start_para = 0;
       if (s_start)
         start_para = atoi (s_start); 
+      BOOL census = klib_getopt_arg_set (getopt, "census");
+      if (census)
+        {
+        klib_object_census_enable (TRUE);
+        signal (SIGUSR1, census_signal_handler);
+        }
+      stats_json = klib_getopt_arg_set (getopt, "stats-json");
+      stats_enabled = stats_json || klib_getopt_arg_set (getopt, "stats");
       const char *s_debug = klib_getopt_get_arg (getopt, "debug");
       if (s_debug)
         klib_log_set_level (atoi (s_debug)); 
@@ -128,12 +315,27 @@ int main (int argc, char **argv)
         klib_Error *error = NULL;
         klib_log_info ("Processing EPUB file %s", argv);
         epub2txt_do_file (argv, ascii, width, notrim, &error); 
+        if (error)
+          {
+          klib_log_error ("%s: %s\n", argv0, klib_error_cstr (error));
+          klib_error_free (error);
+          }
+        klib_object_census_poll (stderr);
+        }
+      if (sync_source)
+        {
+        klib_Error *error = NULL;
+        epub2txt_sync (ascii, width, notrim, &error);
         if (error)
           {
           klib_log_error ("%s: %s\n", argv0, klib_error_cstr (error));
           klib_error_free (error);
           }
         }
+      epub2txt_jobs_wait ();
+      epub2txt_stats_report_total ();
+      if (census)
+        klib_object_census_dump (stderr);
       }
     }
   else
@@ -143,6 +345,8 @@ int main (int argc, char **argv)
     klib_error_free (error);
     }
   klib_getopt_free (getopt);
-  return 0;
+  // Damage that --verify found is the one failure that is reported in
+  //  the exit status, so that it can be acted on unattended
+  return verify_failed ? 1 : 0;
   }
 
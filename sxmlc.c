@@ -851,7 +851,7 @@ int XML_parse_attribute(const SXML_CHAR* str, XMLAttribute* xmlattr)
 	}
 	
 	xmlattr->name = (SXML_CHAR*)__malloc((n0+1)*sizeof(SXML_CHAR));
-	xmlattr->value = (SXML_CHAR*)__malloc((sx_strlen(str) - n1 - remQ) * sizeof(SXML_CHAR));
+	xmlattr->value = (SXML_CHAR*)__malloc((sx_strlen(str) - n1 + 1) * sizeof(SXML_CHAR)); /* Room for the '\0' even if the value is only a quote */
 	xmlattr->active = true;
 	if (xmlattr->name != NULL && xmlattr->value != NULL) {
 		/* Copy name */
@@ -860,7 +860,7 @@ int XML_parse_attribute(const SXML_CHAR* str, XMLAttribute* xmlattr)
 		(void)str_unescape(xmlattr->name);
 		/* Copy value (p starts after the quote (if any) and stops at the end of 'str'
 		  (skipping the quote if any, hence the '*(p+remQ)') */
-		for (i = 0, p = str + n1 + remQ; *(p+remQ) != NULC; i++, p++)
+		for (i = 0, p = str + n1 + remQ; *p != NULC && *(p+remQ) != NULC; i++, p++)
 			xmlattr->value[i] = *p;
 		xmlattr->value[i] = NULC;
 		(void)html2str(str_unescape(xmlattr->value), NULL); /* Convert HTML escape sequences */
@@ -981,6 +981,9 @@ TagType XML_parse_1string(SXML_CHAR* str, XMLNode* xmlnode)
 		
 		xmlnode->n_attributes++;
 		xmlnode->attributes = pt;
+		/* So that 'XMLNode_free' is safe if the attribute can't be parsed */
+		pt[xmlnode->n_attributes - 1].name = NULL;
+		pt[xmlnode->n_attributes - 1].value = NULL;
 		while (*p != NULC && sx_isspace(*++p)) ; /* Skip spaces */
 		if (isquote(*p)) { /* Attribute value starts with a quote, look for next one, ignoring protected ones with '\' */
 			for (nn = p-str+1; str[nn] && str[nn] != *p; nn++) { // CHECK UNICODE "nn = p-str+1"
@@ -1036,6 +1039,7 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 		/* Get text for 'father' (i.e. what is before '<') */
 		while ((txt_end = sx_strchr(line, C2SX('<'))) == NULL) { /* '<' was not found, indicating a probable '>' inside text (should have been escaped with '&gt;' but we'll handle that ;) */
                         klib_log_trace ("Enter w2");
+			if (meos(in)) break; /* Nothing more to read: 'txt_end' is still NULL, reported below */
 			n0 = read_line_alloc(in, in_type, &line, &sz, n0, 0, C2SX('>'), true, C2SX('\n'), &ncr); /* Go on reading the file from current position until next '>' */
 			sd->line_num += ncr;
 			if (!n0) {
@@ -1106,7 +1110,9 @@ static int _parse_data_SAX(void* in, const DataSourceType in_type, const SAX_Cal
 			default: /* Add 'node' to 'father' children */
 				/* If the line looks like a comment (or CDATA) but is not properly finished, loop until we find the end. */
 				while (tag_type == TAG_PARTIAL) {
-					n0 = read_line_alloc(in, in_type, &line, &sz, n0, NULC, C2SX('>'), true, C2SX('\n'), &ncr); /* Go on reading the file from current position until next '>' */
+					/* At the end of the input, reading would give back the same line forever */
+					if (meos(in)) { n0 = 0; ncr = 0; }
+					else n0 = read_line_alloc(in, in_type, &line, &sz, n0, NULC, C2SX('>'), true, C2SX('\n'), &ncr); /* Go on reading the file from current position until next '>' */
 					sd->line_num += ncr;
 					if (n0 == 0) {
 						ret = false;
@@ -1328,7 +1334,6 @@ int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, v
 {
 	FILE* f;
 	int ret;
-	SAX_Data sd;
 	SXML_CHAR* fmode = 
 #ifndef SXMLC_UNICODE
 	C2SX("rt");
@@ -1350,8 +1355,6 @@ int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, v
 	//setvbuf(f, NULL, _IONBF, 0);
 	#endif
 
-	sd.name = (SXML_CHAR*)filename;
-	sd.user = user;
 #ifdef SXMLC_UNICODE
 	bom = freadBOM(f, NULL, NULL); /* Skip BOM, if any */
 	/* In Unicode, re-open the file in text-mode if there is no BOM (or UTF-8) as we assume that
@@ -1365,6 +1368,22 @@ int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, v
 	}
 #endif
 
+	ret = XMLDoc_parse_fp_SAX(f, filename, sax, user);
+	(void)fclose(f);
+
+	return ret;
+}
+
+int XMLDoc_parse_fp_SAX(FILE* f, const SXML_CHAR* name, const SAX_Callbacks* sax, void* user)
+{
+	int ret;
+	SAX_Data sd;
+
+	if (sax == NULL || f == NULL) return false;
+
+	sd.name = name;
+	sd.user = user;
+
 // Nasty kludge to skip a UTF-8 BOM without enabling the rest of the 
 // (broken) unicode support 
 int c1 = fgetc (f);
@@ -1376,10 +1395,9 @@ else
   fseek (f, 0, SEEK_SET);
 
 
-        klib_log_trace ("Calling SAX parser on file %s", filename);
+        klib_log_trace ("Calling SAX parser on file %s", name);
 	ret = _parse_data_SAX((void*)f, DATA_SOURCE_FILE, sax, &sd);
         klib_log_trace ("SAX parse done");
-	(void)fclose(f);
 
 	return ret;
 }
@@ -1434,6 +1452,22 @@ int XMLDoc_parse_file_DOM(const SXML_CHAR* filename, XMLDoc* doc)
 	return true;
 }
 
+int XMLDoc_parse_fp_DOM(FILE* f, const SXML_CHAR* name, XMLDoc* doc)
+{
+	DOM_through_SAX dom;
+	SAX_Callbacks sax;
+
+	if (doc == NULL || f == NULL || doc->init_value != XML_INIT_DONE) return false;
+
+	if (name != NULL) sx_strncpy(doc->filename, name, MAX_PATH);
+
+	dom.doc = doc;
+	dom.current = NULL;
+	SAX_Callbacks_init_DOM(&sax);
+
+	return XMLDoc_parse_fp_SAX(f, name, &sax, &dom) ? true : XMLDoc_free(doc);
+}
+
 int XMLDoc_parse_buffer_DOM(const SXML_CHAR* buffer, const SXML_CHAR* name, XMLDoc* doc)
 {
 	DOM_through_SAX dom;
@@ -545,6 +545,13 @@ int XMLDoc_parse_file_DOM(const SXML_CHAR* filename, XMLDoc* doc);
  */
 int XMLDoc_parse_buffer_DOM(const SXML_CHAR* buffer, const SXML_CHAR* name, XMLDoc* doc);
 
+/*
+ Create a new XML document from the start of the open file 'f', that can be given a name
+ 'name', and load it into 'doc'. 'f' is not closed.
+ Return 'false' in case of error (memory error, malformed document), 'true' otherwise.
+ */
+int XMLDoc_parse_fp_DOM(FILE* f, const SXML_CHAR* name, XMLDoc* doc);
+
 /*
  Parse an XML document from a given 'filename', calling SAX callbacks given in the 'sax' structure.
  'user' is a user-given pointer that will be given back to all callbacks.
@@ -552,6 +559,14 @@ int XMLDoc_parse_buffer_DOM(const SXML_CHAR* buffer, const SXML_CHAR* name, XMLD
  */
 int XMLDoc_parse_file_SAX(const SXML_CHAR* filename, const SAX_Callbacks* sax, void* user);
 
+/*
+ Parse an XML document from the start of the open file 'f', which can be given a name 'name',
+ calling SAX callbacks given in the 'sax' structure. 'f' is not closed.
+ 'user' is a user-given pointer that will be given back to all callbacks.
+ Return 'false' in case of error (memory error, malformed document), 'true' otherwise.
+ */
+int XMLDoc_parse_fp_SAX(FILE* f, const SXML_CHAR* name, const SAX_Callbacks* sax, void* user);
+
 /*
  Parse an XML document from a memory buffer 'buffer' that can be given a name 'name',
  calling SAX callbacks given in the 'sax' structure.
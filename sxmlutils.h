@@ -75,7 +75,16 @@ typedef char SXML_CHAR;
 
 //#define DBG_MEM
 
-#ifdef DBG_MEM
+#if defined(KLIB_MEMSTATS)
+/* Count sxmlc's allocations along with klib's */
+#include "klib_memstat.h"
+#define __malloc(sz) klib_memstat_malloc ((sz), "sxmlc")
+#define __calloc(count, sz) klib_memstat_calloc ((count), (sz), "sxmlc")
+#define __realloc(mem, sz) klib_memstat_realloc ((mem), (sz), "sxmlc")
+#define __free(mem) klib_memstat_free ((mem), "sxmlc")
+#undef __strdup
+#define __strdup(s) klib_memstat_strdup ((s), "sxmlc")
+#elif defined(DBG_MEM)
 void* __malloc(size_t sz);
 void* __calloc(size_t count, size_t sz);
 void* __realloc(void* mem, size_t sz);